@@ -0,0 +1,327 @@
+#include "jc.h"
+#include "utils.h"
+#include "makefile_am.h"
+#include "process.h"
+#include "stale.h"
+#include "affected.h"
+#include <limits.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// Libraries linked into libraries linked into a test are followed this deep
+#define MAX_LIBRARY_DEPTH 4
+
+// Add the output lines of a git command to the change set
+static int add_git_files(change_set *changes, char *const argv[]) {
+    process_options options = {0};
+    options.out = PROCESS_PIPE;
+    options.err = PROCESS_DISCARD;
+    options.capture = 1;
+    process_result result;
+    if (process_run(argv, &options, &result) != 0 || process_status(&result) != 0) {
+        process_result_free(&result);
+        return -1;
+    }
+    char *save = NULL;
+    for (char *line = result.output ? strtok_r(result.output, "\n", &save) : NULL; line;
+         line = strtok_r(NULL, "\n", &save)) {
+        changes->files = realloc(changes->files, (changes->count + 1) * sizeof(char *));
+        changes->files[changes->count++] = strdup(line);
+    }
+    process_result_free(&result);
+    return 0;
+}
+
+/**
+ * Find out which files changed
+ *
+ * With git, these are the files that differ from rev (HEAD if NULL) in
+ * the working tree, plus untracked ones. Without git, files modified
+ * after the reference file count as changed.
+ *
+ * @param reference Without git: a file written at the end of the last test run
+ * @param source Receives what the changes are relative to, for the user
+ * @return 0 on success, -1 if rev was given but git can't compare with it
+ */
+int change_set_load(change_set *changes, const char *rev, const char *reference, char *source, size_t size) {
+    memset(changes, 0, sizeof(*changes));
+    char *const diff[] = {"git", "diff", "--name-only", "--relative", (char *)(rev ? rev : "HEAD"), "--", NULL};
+    char *const untracked[] = {"git", "ls-files", "--others", "--exclude-standard", NULL};
+    if (add_git_files(changes, diff) == 0) {
+        add_git_files(changes, untracked);
+        changes->from_git = 1;
+        snprintf(source, size, "changed since %s", rev ? rev : "HEAD");
+        return 0;
+    }
+    change_set_free(changes);
+    if (rev) {
+        return -1;
+    }
+
+    struct stat st;
+    if (stat(reference, &st) == 0) {
+        changes->since = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        snprintf(source, size, "modified since the last test run");
+    } else {
+        changes->since = -1;
+        snprintf(source, size, "no previous test run to compare with");
+    }
+    return 0;
+}
+
+// Whether a project-relative path is among the changes
+int change_set_has(const change_set *changes, const char *path) {
+    if (changes->from_git) {
+        for (int i = 0; i < changes->count; i++) {
+            if (strcmp(changes->files[i], path) == 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    // A missing file can't be told apart from one that was never there
+    struct stat st;
+    return changes->since < 0 ||
+           (stat(path, &st) == 0 && (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec > changes->since);
+}
+
+void change_set_free(change_set *changes) {
+    am_free_words(changes->files, changes->count);
+    memset(changes, 0, sizeof(*changes));
+}
+
+// Add a project-relative path once; files outside the project are left out
+static void add_dep(char ***deps, int *count, const char *project, const char *base, const char *path) {
+    char relative[PATH_MAX];
+    size_t project_len = strlen(project);
+    if (path[0] == '/') {
+        if (strncmp(path, project, project_len) != 0 || path[project_len] != '/') {
+            return;
+        }
+        clean_path(path + project_len + 1, relative, sizeof(relative));
+    } else {
+        join_path(relative, sizeof(relative), base, path);
+    }
+    if (strncmp(relative, "../", 3) == 0) {
+        return;
+    }
+    for (int i = 0; i < *count; i++) {
+        if (strcmp((*deps)[i], relative) == 0) {
+            return;
+        }
+    }
+    *deps = realloc(*deps, (*count + 1) * sizeof(char *));
+    (*deps)[(*count)++] = strdup(relative);
+}
+
+static int is_compiled(const char *source) {
+    const char *dot = strrchr(source, '.');
+    return dot && (strcmp(dot, ".c") == 0 || strcmp(dot, ".cc") == 0 || strcmp(dot, ".cpp") == 0 ||
+                   strcmp(dot, ".cxx") == 0 || strcmp(dot, ".C") == 0 || strcmp(dot, ".S") == 0);
+}
+
+/**
+ * Add what one source of a target was compiled from, as its depfile says
+ *
+ * automake names the object "<canonical target>-<stem>.o" when the target
+ * has its own flags, and puts it next to the source with subdir-objects.
+ *
+ * @return 0 on success, -1 if no depfile was found
+ */
+static int add_source_deps(char ***deps, int *count, const char *project, const char *compile_dir,
+                           const char *canonical, int own_flags, const char *source) {
+    char stem[PATH_MAX];
+    snprintf(stem, sizeof(stem), "%s", source);
+    *strrchr(stem, '.') = '\0';
+    char *slash = strrchr(stem, '/');
+    const char *base = slash ? slash + 1 : stem;
+    char source_dir[PATH_MAX];
+    snprintf(source_dir, sizeof(source_dir), "%.*s", slash ? (int)(slash - stem) : 1, slash ? stem : ".");
+
+    const char *prefixes[] = {own_flags ? canonical : "", own_flags ? "" : canonical};
+    const char *dirs[] = {source_dir, "."};
+    for (int p = 0; p < 2; p++) {
+        for (int d = 0; d < 2; d++) {
+            char po_path[PATH_MAX * 3];
+            char deps_dir[PATH_MAX * 2];
+            join_path(deps_dir, sizeof(deps_dir), compile_dir, dirs[d]);
+            if (snprintf(po_path, sizeof(po_path), "%s/.deps/%s%s%s.Po", deps_dir, prefixes[p],
+                         *prefixes[p] ? "-" : "", base) >= (int)sizeof(po_path)) {
+                continue;
+            }
+            char **prerequisites;
+            int n = depfile_read(po_path, &prerequisites);
+            if (n < 0) {
+                continue;
+            }
+            for (int i = 0; i < n; i++) {
+                add_dep(deps, count, project, compile_dir, prerequisites[i]);
+            }
+            am_free_words(prerequisites, n);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Add the files a program or library is built from
+ *
+ * Its _SOURCES (the program name plus ".c" when there are none), what
+ * their depfiles list, and the same for the project libraries in its
+ * _LDADD or _LIBADD.
+ *
+ * @return 0 on success, -1 if a compiled source has no depfile
+ */
+static int add_target_deps(char ***deps, int *count, const char *project, const char *build_dir,
+                           const char *dir, const am_file *am, const char *target, int depth) {
+    char canonical[256];
+    char name[512];
+    am_canonical_name(target, canonical, sizeof(canonical));
+    char compile_dir[PATH_MAX];
+    join_path(compile_dir, sizeof(compile_dir), build_dir, dir);
+
+    snprintf(name, sizeof(name), "%s_SOURCES", canonical);
+    char **sources = NULL;
+    int source_count = am_expand_words(am, name, &sources, 0);
+    size_t target_len = strlen(target);
+    int is_library = (target_len > 2 && strcmp(target + target_len - 2, ".a") == 0) ||
+                     (target_len > 3 && strcmp(target + target_len - 3, ".la") == 0);
+    if (source_count == 0 && !am_get(am, name) && !is_library) {
+        snprintf(name, sizeof(name), "%s.c", target);
+        sources = malloc(sizeof(char *));
+        sources[source_count++] = strdup(name);
+    }
+
+    char cflags[512];
+    char cppflags[512];
+    snprintf(cflags, sizeof(cflags), "%s_CFLAGS", canonical);
+    snprintf(cppflags, sizeof(cppflags), "%s_CPPFLAGS", canonical);
+    int own_flags = am_get(am, cflags) || am_get(am, cppflags);
+
+    int result = 0;
+    for (int i = 0; i < source_count; i++) {
+        add_dep(deps, count, project, dir, sources[i]);
+        if (is_compiled(sources[i]) &&
+            add_source_deps(deps, count, project, compile_dir, canonical, own_flags, sources[i]) != 0) {
+            result = -1;
+        }
+    }
+    am_free_words(sources, source_count);
+
+    // Project libraries it links, written as "libx.a" or "$(top_builddir)/src/libx.a"
+    snprintf(name, sizeof(name), is_library ? "%s_LIBADD" : "%s_LDADD", canonical);
+    const char *value = am_get(am, name);
+    if (!value && !is_library) {
+        value = am_get(am, "LDADD");
+    }
+    char **words = NULL;
+    int word_count = value && depth < MAX_LIBRARY_DEPTH ? am_split_words(value, &words) : 0;
+    for (int i = 0; i < word_count; i++) {
+        const char *word = words[i];
+        size_t len = strlen(word);
+        if (!((len > 2 && strcmp(word + len - 2, ".a") == 0) || (len > 3 && strcmp(word + len - 3, ".la") == 0))) {
+            continue;
+        }
+        char library[PATH_MAX];
+        if (strncmp(word, "$(top_builddir)/", 16) == 0) {
+            clean_path(word + 16, library, sizeof(library));
+        } else if (strncmp(word, "$(builddir)/", 12) == 0) {
+            join_path(library, sizeof(library), dir, word + 12);
+        } else if (!strchr(word, '$')) {
+            join_path(library, sizeof(library), dir, word);
+        } else {
+            continue;
+        }
+        char *slash = strrchr(library, '/');
+        char library_dir[PATH_MAX];
+        snprintf(library_dir, sizeof(library_dir), "%.*s", slash ? (int)(slash - library) : 1, slash ? library : ".");
+        const char *library_name = slash ? slash + 1 : library;
+
+        am_file library_am;
+        char am_path[PATH_MAX + 16];
+        join_path(am_path, sizeof(am_path), library_dir, "Makefile.am");
+        if (am_parse(am_path, &library_am) != 0) {
+            continue;
+        }
+        if (add_target_deps(deps, count, project, build_dir, library_dir, &library_am, library_name, depth + 1) != 0) {
+            result = -1;
+        }
+        am_free(&library_am);
+    }
+    am_free_words(words, word_count);
+    return result;
+}
+
+/**
+ * List the project files a test depends on
+ *
+ * For a check program: its sources and libraries with everything their
+ * depfiles from the last build list. For a script: the script. Either
+ * way also the directory's Makefile.am, its check_DATA, dist_check_DATA
+ * and EXTRA_DIST, and configure.ac.
+ *
+ * @param build_dir Where the tests were built ("." in-tree)
+ * @param dir The Makefile.am directory that lists the test
+ * @param deps Receives a malloc'd array of project-relative paths
+ * @param count Receives the number of paths
+ * @return 0 on success, -1 if a compiled source has no depfile (the
+ *         files that could be found are still listed)
+ */
+int test_dependencies(const char *build_dir, const char *dir, const char *test, char ***deps, int *count) {
+    *deps = NULL;
+    *count = 0;
+    char project[PATH_MAX];
+    if (!getcwd(project, sizeof(project))) {
+        snprintf(project, sizeof(project), ".");
+    }
+
+    char am_path[PATH_MAX + 16];
+    join_path(am_path, sizeof(am_path), dir, "Makefile.am");
+    add_dep(deps, count, project, ".", am_path);
+    add_dep(deps, count, project, ".", "configure.ac");
+    am_file am;
+    if (am_parse(am_path, &am) != 0) {
+        return 0;
+    }
+
+    char **words = NULL;
+    int word_count = am_expand_words(&am, "check_DATA", &words, 0);
+    word_count = am_expand_words(&am, "dist_check_DATA", &words, word_count);
+    word_count = am_expand_words(&am, "EXTRA_DIST", &words, word_count);
+    for (int i = 0; i < word_count; i++) {
+        add_dep(deps, count, project, dir, words[i]);
+    }
+    am_free_words(words, word_count);
+
+    words = NULL;
+    word_count = am_expand_words(&am, "check_PROGRAMS", &words, 0);
+    int is_program = 0;
+    for (int i = 0; i < word_count; i++) {
+        is_program |= strcmp(words[i], test) == 0;
+    }
+    am_free_words(words, word_count);
+
+    int result = 0;
+    if (is_program) {
+        result = add_target_deps(deps, count, project, build_dir, dir, &am, test, 0);
+    } else {
+        add_dep(deps, count, project, dir, test);
+    }
+    am_free(&am);
+    return result;
+}
+
+// Whether a test depends on a changed file; tests without depfiles always do
+int test_affected(const change_set *changes, const char *build_dir, const char *dir, const char *test) {
+    char **deps;
+    int count;
+    int affected = test_dependencies(build_dir, dir, test, &deps, &count) != 0;
+    for (int i = 0; !affected && i < count; i++) {
+        affected = change_set_has(changes, deps[i]);
+    }
+    am_free_words(deps, count);
+    return affected;
+}
@@ -0,0 +1,21 @@
+#ifndef AFFECTED_H
+#define AFFECTED_H
+
+#include <stddef.h>
+
+// The files that changed, from git or by modification time
+typedef struct {
+    char **files;                // from git, relative to the project
+    int count;
+    int from_git;
+    long long since;             // otherwise: files modified after this (ns); -1 for everything
+} change_set;
+
+int change_set_load(change_set *changes, const char *rev, const char *reference, char *source, size_t size);
+int change_set_has(const change_set *changes, const char *path);
+void change_set_free(change_set *changes);
+
+int test_dependencies(const char *build_dir, const char *dir, const char *test, char ***deps, int *count);
+int test_affected(const change_set *changes, const char *build_dir, const char *dir, const char *test);
+
+#endif // AFFECTED_H
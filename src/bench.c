@@ -0,0 +1,508 @@
+#define _GNU_SOURCE
+
+#include "jc.h"
+#include "utils.h"
+#include "bench.h"
+#include "process.h"
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <time.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define BENCH_DIR ".jc/bench"
+
+// Two-sided significance level for reporting a change
+#define BENCH_ALPHA 0.05
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Linear interpolation between closest ranks of sorted samples
+static double percentile(const double *sorted, int count, double p) {
+    if (count == 1) {
+        return sorted[0];
+    }
+    double pos = p * (count - 1);
+    int lower = (int)pos;
+    if (lower >= count - 1) {
+        return sorted[count - 1];
+    }
+    return sorted[lower] + (pos - lower) * (sorted[lower + 1] - sorted[lower]);
+}
+
+void bench_compute(const double *samples, int count, bench_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->count = count;
+    if (count == 0) {
+        return;
+    }
+
+    double *sorted = malloc(count * sizeof(double));
+    memcpy(sorted, samples, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compare_doubles);
+
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += sorted[i];
+    }
+    stats->mean = sum / count;
+
+    double squares = 0;
+    for (int i = 0; i < count; i++) {
+        squares += (sorted[i] - stats->mean) * (sorted[i] - stats->mean);
+    }
+    stats->stddev = count > 1 ? sqrt(squares / (count - 1)) : 0;
+
+    stats->min = sorted[0];
+    stats->max = sorted[count - 1];
+    stats->median = percentile(sorted, count, 0.5);
+    stats->p95 = percentile(sorted, count, 0.95);
+    stats->p99 = percentile(sorted, count, 0.99);
+
+    // Tukey's fences
+    double q1 = percentile(sorted, count, 0.25);
+    double q3 = percentile(sorted, count, 0.75);
+    double iqr = q3 - q1;
+    for (int i = 0; i < count; i++) {
+        if (sorted[i] < q1 - 3 * iqr || sorted[i] > q3 + 3 * iqr) {
+            stats->severe_outliers++;
+        } else if (sorted[i] < q1 - 1.5 * iqr || sorted[i] > q3 + 1.5 * iqr) {
+            stats->mild_outliers++;
+        }
+    }
+    free(sorted);
+}
+
+typedef struct {
+    double value;
+    int group;
+} ranked_sample;
+
+static int compare_ranked(const void *a, const void *b) {
+    return compare_doubles(&((const ranked_sample *)a)->value, &((const ranked_sample *)b)->value);
+}
+
+/**
+ * Two-sided Mann-Whitney U test
+ *
+ * Uses the normal approximation with tie and continuity corrections,
+ * which is adequate from about 8 samples per side.
+ *
+ * @return The p-value that both series come from the same distribution
+ */
+double bench_mann_whitney(const double *a, int na, const double *b, int nb) {
+    int n = na + nb;
+    if (na == 0 || nb == 0) {
+        return 1.0;
+    }
+
+    ranked_sample *all = malloc(n * sizeof(ranked_sample));
+    for (int i = 0; i < na; i++) {
+        all[i].value = a[i];
+        all[i].group = 0;
+    }
+    for (int i = 0; i < nb; i++) {
+        all[na + i].value = b[i];
+        all[na + i].group = 1;
+    }
+    qsort(all, n, sizeof(ranked_sample), compare_ranked);
+
+    // Tied values share the average of their ranks
+    double rank_sum = 0;
+    double tie_term = 0;
+    for (int i = 0; i < n;) {
+        int j = i;
+        while (j < n && all[j].value == all[i].value) {
+            j++;
+        }
+        double rank = (i + 1 + j) / 2.0;
+        for (int k = i; k < j; k++) {
+            if (all[k].group == 0) {
+                rank_sum += rank;
+            }
+        }
+        double t = j - i;
+        tie_term += t * t * t - t;
+        i = j;
+    }
+    free(all);
+
+    double u = rank_sum - na * (na + 1) / 2.0;
+    double mean = na * (double)nb / 2.0;
+    double variance = na * (double)nb / 12.0 * ((n + 1) - tie_term / ((double)n * (n - 1)));
+    if (variance <= 0) {
+        return 1.0;
+    }
+    double diff = fabs(u - mean) - 0.5;
+    if (diff < 0) {
+        diff = 0;
+    }
+    return erfc(diff / sqrt(variance) / sqrt(2.0));
+}
+
+// Pin jc (and so every run it starts) to a list like "0-3,6"
+static int pin_to_cpus(const char *list) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0 || first >= CPU_SETSIZE) {
+            return -1;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, &set);
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            return -1;
+        }
+        p = end;
+    }
+    return sched_setaffinity(0, sizeof(set), &set);
+#else
+    (void)list;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Format seconds with a unit suited to the magnitude
+static void format_time(double seconds, char *out, size_t size) {
+    if (seconds >= 1) {
+        snprintf(out, size, "%.3f s", seconds);
+    } else if (seconds >= 1e-3) {
+        snprintf(out, size, "%.2f ms", seconds * 1e3);
+    } else {
+        snprintf(out, size, "%.1f us", seconds * 1e6);
+    }
+}
+
+static void print_stats_row(const char *label, const bench_stats *stats) {
+    double values[] = {stats->mean, stats->median, stats->stddev, stats->min,
+                       stats->max, stats->p95, stats->p99};
+    printf("%-10s", label);
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        char cell[32];
+        format_time(values[i], cell, sizeof(cell));
+        printf(" %10s", cell);
+    }
+    printf("\n");
+}
+
+// A series of saved results
+typedef struct {
+    double *wall;
+    double *cpu;
+    int count;
+    char *command;
+    char *profile;
+    char *date;
+} bench_series;
+
+static void free_series(bench_series *series) {
+    free(series->wall);
+    free(series->cpu);
+    free(series->command);
+    free(series->profile);
+    free(series->date);
+}
+
+/**
+ * Check a name given to --save or --compare
+ *
+ * The name becomes a file under .jc/bench/<program>/, so it may not contain
+ * a '/' or start with a '.'.
+ *
+ * @param name Name of the saved results
+ * @return 1 if valid, 0 otherwise
+ */
+int bench_valid_name(const char *name) {
+    if (!*name || *name == '.' || strlen(name) >= 64) {
+        return 0;
+    }
+    for (const char *p = name; *p; p++) {
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+              (*p >= '0' && *p <= '9') || *p == '_' || *p == '-' || *p == '.')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int load_series(const char *path, bench_series *series) {
+    memset(series, 0, sizeof(*series));
+    char *content = read_file(path);
+    if (!content) {
+        return -1;
+    }
+
+    int capacity = 0;
+    char *save = NULL;
+    for (char *line = strtok_r(content, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        double wall;
+        double cpu;
+        if (sscanf(line, "sample = %lf %lf", &wall, &cpu) != 2) {
+            continue;
+        }
+        if (series->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            series->wall = realloc(series->wall, capacity * sizeof(double));
+            series->cpu = realloc(series->cpu, capacity * sizeof(double));
+        }
+        series->wall[series->count] = wall;
+        series->cpu[series->count] = cpu;
+        series->count++;
+    }
+    free(content);
+
+    series->command = read_setting(path, "command");
+    series->profile = read_setting(path, "profile");
+    series->date = read_setting(path, "date");
+    if (series->count == 0) {
+        free_series(series);
+        memset(series, 0, sizeof(*series));
+        return -1;
+    }
+    return 0;
+}
+
+static int save_series(const char *path, const bench_series *series) {
+    char *content = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    append_format(&content, &len, &cap, "# jc bench results: wall and CPU seconds per run\n");
+    append_format(&content, &len, &cap, "command = %s\n", series->command);
+    append_format(&content, &len, &cap, "profile = %s\n", series->profile ? series->profile : "");
+    append_format(&content, &len, &cap, "date = %s\n", series->date);
+    for (int i = 0; i < series->count; i++) {
+        append_format(&content, &len, &cap, "sample = %.9f %.9f\n", series->wall[i], series->cpu[i]);
+    }
+    int result = write_file(path, content);
+    free(content);
+    return result;
+}
+
+static void print_delta(const char *label, const double *before, int nb, const double *after, int na) {
+    bench_stats old_stats;
+    bench_stats new_stats;
+    bench_compute(before, nb, &old_stats);
+    bench_compute(after, na, &new_stats);
+    double p = bench_mann_whitney(before, nb, after, na);
+    double change = old_stats.median > 0 ? (new_stats.median - old_stats.median) * 100 / old_stats.median : 0;
+
+    char from[32];
+    char to[32];
+    format_time(old_stats.median, from, sizeof(from));
+    format_time(new_stats.median, to, sizeof(to));
+    const char *verdict = p >= BENCH_ALPHA ? "no significant change"
+                        : change < 0       ? "faster"
+                                           : "slower";
+    printf("  %-12s %10s -> %-10s %+6.1f%%  (p = %.3f, %s)\n", label, from, to, change, p, verdict);
+}
+
+static void write_series_json(FILE *out, const char *name, const double *samples, int count) {
+    bench_stats stats;
+    bench_compute(samples, count, &stats);
+    fprintf(out, "\"%s\":{\"mean\":%.9f,\"median\":%.9f,\"stddev\":%.9f,\"min\":%.9f,\"max\":%.9f,"
+            "\"p95\":%.9f,\"p99\":%.9f,\"mild_outliers\":%d,\"severe_outliers\":%d,\"samples\":[",
+            name, stats.mean, stats.median, stats.stddev, stats.min, stats.max, stats.p95, stats.p99,
+            stats.mild_outliers, stats.severe_outliers);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%s%.9f", i ? "," : "", samples[i]);
+    }
+    fprintf(out, "]}");
+}
+
+static void write_json(FILE *out, const bench_series *series, const bench_series *baseline,
+                       const char *baseline_name) {
+    fprintf(out, "{\"command\":");
+    json_write_string(out, series->command);
+    fprintf(out, ",\"runs\":%d,", series->count);
+    write_series_json(out, "wall_s", series->wall, series->count);
+    fprintf(out, ",");
+    write_series_json(out, "cpu_s", series->cpu, series->count);
+    if (baseline) {
+        fprintf(out, ",\"baseline\":{\"name\":");
+        json_write_string(out, baseline_name);
+        fprintf(out, ",\"wall_p\":%.6f,\"cpu_p\":%.6f,",
+                bench_mann_whitney(baseline->wall, baseline->count, series->wall, series->count),
+                bench_mann_whitney(baseline->cpu, baseline->count, series->cpu, series->count));
+        write_series_json(out, "wall_s", baseline->wall, baseline->count);
+        fprintf(out, "}");
+    }
+    fprintf(out, "}\n");
+}
+
+/**
+ * Run a program repeatedly and report timing statistics
+ *
+ * The program's stdout is discarded; a failing run stops the benchmark.
+ * Results are saved in .jc/bench/<program>/last (and under --save's name)
+ * and compared with the previous 'last' (or --compare's baseline) using
+ * a Mann-Whitney U test.
+ *
+ * @param executable Path of the program
+ * @param argv Program and arguments, argv[0] being the executable
+ * @return 0 on success, 1 on error
+ */
+int bench_run(const char *executable, char *const argv[], const bench_options *options) {
+    if (options->runs < 1) {
+        fprintf(stderr, "Error: The number of runs must be at least 1\n");
+        return 1;
+    }
+    errno = 0;
+    if (options->cpus && pin_to_cpus(options->cpus) != 0) {
+        fprintf(stderr, "Error: Cannot pin to CPUs '%s': %s\n", options->cpus,
+                errno ? strerror(errno) : "invalid CPU list");
+        return 1;
+    }
+
+    char command[PATH_MAX * 2];
+    process_format(argv, command, sizeof(command));
+    printf("Benchmarking: %s\n", command);
+    printf("%d run%s after %d warmup run%s%s%s\n", options->runs, options->runs == 1 ? "" : "s",
+           options->warmup, options->warmup == 1 ? "" : "s",
+           options->cpus ? ", pinned to CPUs " : "", options->cpus ? options->cpus : "");
+    fflush(stdout);
+
+    bench_series series = {0};
+    series.wall = malloc(options->runs * sizeof(double));
+    series.cpu = malloc(options->runs * sizeof(double));
+    series.command = strdup(command);
+    series.profile = options->profile ? strdup(options->profile) : NULL;
+
+    process_options run_options = {0};
+    run_options.out = PROCESS_DISCARD;
+    int progress = isatty(STDOUT_FILENO);
+
+    for (int i = 0; i < options->warmup + options->runs; i++) {
+        process_result result;
+        if (process_run(argv, &run_options, &result) != 0) {
+            fprintf(stderr, "Error: Cannot run %s: %s\n", executable, strerror(errno));
+            free_series(&series);
+            return 1;
+        }
+        if (!result.exited || result.exit_code != 0) {
+            char how[128];
+            process_describe(&result, how, sizeof(how));
+            fprintf(stderr, "%sError: Run %d %s\n", progress ? "\n" : "", i + 1, how);
+            free_series(&series);
+            return 1;
+        }
+
+        int measured = i - options->warmup;
+        if (measured >= 0) {
+            const struct rusage *ru = &result.usage;
+            series.wall[measured] = result.wall_us / 1e6;
+            series.cpu[measured] = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+                                   ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+            series.count++;
+        }
+        if (progress) {
+            printf("\r  %s %d/%d", measured < 0 ? "warmup" : "run   ",
+                   measured < 0 ? i + 1 : measured + 1, measured < 0 ? options->warmup : options->runs);
+            fflush(stdout);
+        }
+    }
+    if (progress) {
+        printf("\r%30s\r", "");
+    }
+
+    bench_stats wall;
+    bench_stats cpu;
+    bench_compute(series.wall, series.count, &wall);
+    bench_compute(series.cpu, series.count, &cpu);
+
+    printf("\n%-10s %10s %10s %10s %10s %10s %10s %10s\n", "", "mean", "median", "stddev", "min",
+           "max", "p95", "p99");
+    print_stats_row("Wall time", &wall);
+    print_stats_row("CPU time", &cpu);
+    if (wall.mild_outliers + wall.severe_outliers > 0) {
+        printf("\nOutliers: %d of %d wall time samples (%d mild, %d severe)\n",
+               wall.mild_outliers + wall.severe_outliers, wall.count, wall.mild_outliers,
+               wall.severe_outliers);
+        if (wall.severe_outliers > 0) {
+            printf("  Severe outliers usually mean interference from other load; "
+                   "consider --cpus and more runs\n");
+        }
+    }
+
+    // Compare with the baseline, then become the new 'last'
+    const char *program = strrchr(executable, '/');
+    program = program ? program + 1 : executable;
+    char dir[PATH_MAX];
+    char path[PATH_MAX + 64];
+    snprintf(dir, sizeof(dir), "%s/%s", BENCH_DIR, program);
+    const char *baseline_name = options->compare ? options->compare : "last";
+    snprintf(path, sizeof(path), "%s/%s", dir, baseline_name);
+
+    bench_series baseline;
+    int have_baseline = load_series(path, &baseline) == 0;
+    if (have_baseline) {
+        printf("\nCompared with '%s' (%s%s%s):\n", baseline_name, baseline.date ? baseline.date : "?",
+               baseline.profile && *baseline.profile ? ", profile " : "",
+               baseline.profile && *baseline.profile ? baseline.profile : "");
+        if (baseline.command && strcmp(baseline.command, command) != 0) {
+            printf("  Note: the baseline ran '%s'\n", baseline.command);
+        }
+        print_delta("Wall median", baseline.wall, baseline.count, series.wall, series.count);
+        print_delta("CPU median", baseline.cpu, baseline.count, series.cpu, series.count);
+    } else if (options->compare) {
+        fprintf(stderr, "Warning: No saved results named '%s' for %s\n", options->compare, program);
+    }
+
+    char date[32];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    series.date = strdup(date);
+
+    create_directory(".jc");
+    create_directory(BENCH_DIR);
+    create_directory(dir);
+    snprintf(path, sizeof(path), "%s/last", dir);
+    save_series(path, &series);
+    if (options->save) {
+        snprintf(path, sizeof(path), "%s/%s", dir, options->save);
+        if (save_series(path, &series) == 0) {
+            printf("\nSaved as '%s' (compare with --compare=%s)\n", options->save, options->save);
+        }
+    }
+
+    if (options->json_path) {
+        FILE *out = strcmp(options->json_path, "-") == 0 ? stderr : fopen(options->json_path, "w");
+        if (out) {
+            write_json(out, &series, have_baseline ? &baseline : NULL, baseline_name);
+            if (out != stderr) {
+                fclose(out);
+            }
+        } else {
+            fprintf(stderr, "Warning: Cannot write %s\n", options->json_path);
+        }
+    }
+
+    if (have_baseline) {
+        free_series(&baseline);
+    }
+    free_series(&series);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+typedef struct {
+    int runs;                    // measured runs
+    int warmup;                  // unmeasured runs first
+    const char *cpus;            // CPU list to pin to ("0-3,6"), or NULL
+    const char *save;            // also save the results under this name, or NULL
+    const char *compare;         // baseline to compare with (default "last")
+    const char *json_path;       // "-" for stderr, a file, or NULL
+    const char *profile;         // build profile, recorded with the results
+} bench_options;
+
+// Summary statistics of one series of samples
+typedef struct {
+    int count;
+    double mean;
+    double median;
+    double stddev;
+    double min;
+    double max;
+    double p95;
+    double p99;
+    int mild_outliers;           // beyond 1.5 IQR of the quartiles
+    int severe_outliers;         // beyond 3 IQR
+} bench_stats;
+
+int bench_run(const char *executable, char *const argv[], const bench_options *options);
+void bench_compute(const double *samples, int count, bench_stats *stats);
+double bench_mann_whitney(const double *a, int na, const double *b, int nb);
+int bench_valid_name(const char *name);
+
+#endif // BENCH_H
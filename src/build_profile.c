@@ -0,0 +1,271 @@
+#include "jc.h"
+#include "utils.h"
+#include "build_profile.h"
+#include "pgo.h"
+#include "manifest.h"
+#include "stale.h"
+#include <limits.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// Profiles available without any configuration
+static const build_profile builtin_profiles[] = {
+    {"debug", "-O0 -g3", ""},
+    {"release", "-O3 -march=native -flto -DNDEBUG", "-O3 -flto"},
+    {"asan", "-O1 -g -fsanitize=address,undefined -fno-omit-frame-pointer",
+     "-fsanitize=address,undefined"},
+    {"tsan", "-O1 -g -fsanitize=thread", "-fsanitize=thread"},
+};
+
+static int valid_profile_name(const char *name) {
+    if (!*name || strlen(name) >= sizeof(((build_profile *)0)->name)) {
+        return 0;
+    }
+    for (const char *p = name; *p; p++) {
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+              (*p >= '0' && *p <= '9') || *p == '_' || *p == '-')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Resolve a build profile by name
+ *
+ * Built-in profiles can be overridden, and new ones defined, with
+ * "profile.<name>.cflags" and "profile.<name>.ldflags" in .jc/config.
+ *
+ * @return 0 on success, -1 if the profile is unknown or the name invalid
+ */
+int profile_lookup(const char *name, build_profile *profile) {
+    if (!valid_profile_name(name)) {
+        return -1;
+    }
+
+    // The PGO profiles derive their flags from another profile
+    if (pgo_profile_flags(name, profile) == 0) {
+        return 0;
+    }
+
+    memset(profile, 0, sizeof(*profile));
+    snprintf(profile->name, sizeof(profile->name), "%s", name);
+
+    int found = 0;
+    for (size_t i = 0; i < sizeof(builtin_profiles) / sizeof(builtin_profiles[0]); i++) {
+        if (strcmp(builtin_profiles[i].name, name) == 0) {
+            *profile = builtin_profiles[i];
+            found = 1;
+            break;
+        }
+    }
+
+    char key[128];
+    snprintf(key, sizeof(key), "profile.%s.cflags", name);
+    char *cflags = get_project_setting(key);
+    if (cflags) {
+        snprintf(profile->cflags, sizeof(profile->cflags), "%s", cflags);
+        free(cflags);
+        found = 1;
+    }
+
+    snprintf(key, sizeof(key), "profile.%s.ldflags", name);
+    char *ldflags = get_project_setting(key);
+    if (ldflags) {
+        snprintf(profile->ldflags, sizeof(profile->ldflags), "%s", ldflags);
+        free(ldflags);
+        found = 1;
+    }
+
+    return found ? 0 : -1;
+}
+
+// Build directory for a profile: build/<name>, or "." for the in-tree build
+void profile_build_dir(const char *name, char *output, size_t output_size) {
+    if (name) {
+        snprintf(output, output_size, "build/%s", name);
+    } else {
+        snprintf(output, output_size, ".");
+    }
+}
+
+/**
+ * Remove leading "--profile=<name>" / "--profile <name>" options from argv
+ *
+ * Only options before the first other argument are taken, so program
+ * arguments passed through by 'jc run' are left alone. Without an option,
+ * the "profile" setting in .jc/config is used.
+ *
+ * @return The selected profile (caller frees), or NULL for the in-tree build
+ */
+char *take_profile_option(int *argc, char *argv[]) {
+    char *profile = NULL;
+
+    while (*argc > 1) {
+        int consumed = 0;
+        if (strncmp(argv[1], "--profile=", 10) == 0) {
+            free(profile);
+            profile = strdup(argv[1] + 10);
+            consumed = 1;
+        } else if (strcmp(argv[1], "--profile") == 0 && *argc > 2) {
+            free(profile);
+            profile = strdup(argv[2]);
+            consumed = 2;
+        } else {
+            break;
+        }
+
+        for (int i = 1; i + consumed <= *argc; i++) {
+            argv[i] = argv[i + consumed];
+        }
+        *argc -= consumed;
+    }
+
+    if (!profile) {
+        profile = get_project_setting("profile");
+    }
+    if (profile && !*profile) {
+        free(profile);
+        profile = NULL;
+    }
+    return profile;
+}
+
+/**
+ * Take a leading program name from argv, as in 'jc run <target> [args...]'
+ *
+ * The first argument is only a target if the manifest lists a program of
+ * that name for the profile, so plain program arguments still pass through.
+ *
+ * @return The target (points into argv), or NULL
+ */
+const char *take_target_argument(int *argc, char *argv[], const char *profile) {
+    if (*argc < 2 || argv[1][0] == '-') {
+        return NULL;
+    }
+    manifest m;
+    manifest_load(&m, MANIFEST_FILE);
+    const char *target = manifest_find(&m, profile, 0, argv[1]) ? argv[1] : NULL;
+    manifest_free(&m);
+    if (target) {
+        for (int i = 1; i < *argc; i++) {
+            argv[i] = argv[i + 1];
+        }
+        (*argc)--;
+    }
+    return target;
+}
+
+/**
+ * Find the program built for a profile (NULL for the in-tree build)
+ *
+ * The manifest 'jc build' writes names the program directly; without one
+ * (or when it's out of date) the build directories are searched.
+ *
+ * @param target The program to find, or NULL for the first one declared
+ * @return 0 if found, -1 otherwise
+ */
+int find_built_executable(const char *profile, const char *target, char *output, size_t output_size) {
+    manifest m;
+    if (manifest_load(&m, MANIFEST_FILE) == 0) {
+        const manifest_entry *entry = manifest_find(&m, profile, 0, target);
+        int found = entry && strcmp(entry->path, "-") != 0 && file_exists(entry->path);
+        if (found) {
+            snprintf(output, output_size, "%s", entry->path);
+        }
+        manifest_free(&m);
+        if (found) {
+            return 0;
+        }
+    }
+
+    char build_dir[PATH_MAX];
+    profile_build_dir(profile, build_dir, sizeof(build_dir));
+
+    char search_dirs[2][PATH_MAX + 16];
+    snprintf(search_dirs[0], sizeof(search_dirs[0]), "%s/src/build", build_dir);
+    snprintf(search_dirs[1], sizeof(search_dirs[1]), "%s/src", build_dir);
+
+    // The make backend moves the program to src/build, ninja leaves it in
+    // src; after switching backends the newer one is current
+    time_t newest = 0;
+    int found = 0;
+    for (int i = 0; i < 2; i++) {
+        const char *dir = search_dirs[i];
+        if (strncmp(dir, "./", 2) == 0) {
+            dir += 2;
+        }
+        char candidate[PATH_MAX * 2];
+        struct stat st;
+        if (target) {
+            if (snprintf(candidate, sizeof(candidate), "%s/%s", dir, target) >= (int)sizeof(candidate)) {
+                continue;
+            }
+        } else if (find_executable(dir, candidate, sizeof(candidate)) != 0) {
+            continue;
+        }
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & S_IXUSR) &&
+            (!found || st.st_mtime > newest)) {
+            snprintf(output, output_size, "%s", candidate);
+            newest = st.st_mtime;
+            found = 1;
+        }
+    }
+    if (found) {
+        return 0;
+    }
+
+    // In-tree builds may also put the program at the top level; a
+    // profile directory only holds configure output there
+    if (!profile && !target && find_executable(".", output, output_size) == 0) {
+        return 0;
+    }
+    return -1;
+}
+
+// Whether the profile's build directory has been configured
+int profile_is_configured(const char *profile) {
+    char path[PATH_MAX];
+    char build_dir[PATH_MAX - 16];
+    profile_build_dir(profile, build_dir, sizeof(build_dir));
+    snprintf(path, sizeof(path), "%s/Makefile", build_dir);
+    return file_exists(path);
+}
+
+/**
+ * Build the profile first if it was never built or its programs are out of date
+ *
+ * stale_check() answers from the depfiles of the last build without
+ * running make, so an up-to-date tree costs a few stat calls.
+ *
+ * @return 0 when the programs are current, nonzero if the build failed
+ */
+int ensure_built(const char *profile) {
+    if (!profile_is_configured(profile)) {
+        printf("Project not built yet. Building first...\n");
+        return build_with_profile(profile);
+    }
+
+    char build_dir[PATH_MAX];
+    char reason[PATH_MAX * 2];
+    profile_build_dir(profile, build_dir, sizeof(build_dir));
+    if (stale_check(profile, build_dir, reason, sizeof(reason)) == 0) {
+        return 0;
+    }
+    printf("Rebuilding: %s\n", reason);
+    return build_with_profile(profile);
+}
+
+// Build the given profile (NULL for the in-tree build) through cmd_build
+int build_with_profile(const char *profile) {
+    char option[128];
+    char *build_argv[] = {"build", option, NULL};
+
+    if (!profile) {
+        return cmd_build(1, build_argv);
+    }
+    snprintf(option, sizeof(option), "--profile=%s", profile);
+    return cmd_build(2, build_argv);
+}
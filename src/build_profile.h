@@ -0,0 +1,22 @@
+#ifndef BUILD_PROFILE_H
+#define BUILD_PROFILE_H
+
+#include <stddef.h>
+
+// Compiler and linker flags for an out-of-tree build profile
+typedef struct {
+    char name[64];
+    char cflags[512];
+    char ldflags[512];
+} build_profile;
+
+int profile_lookup(const char *name, build_profile *profile);
+void profile_build_dir(const char *name, char *output, size_t output_size);
+char *take_profile_option(int *argc, char *argv[]);
+const char *take_target_argument(int *argc, char *argv[], const char *profile);
+int find_built_executable(const char *profile, const char *target, char *output, size_t output_size);
+int profile_is_configured(const char *profile);
+int build_with_profile(const char *profile);
+int ensure_built(const char *profile);
+
+#endif // BUILD_PROFILE_H
@@ -1,5 +1,8 @@
 #include "jc.h"
 #include "utils.h"
+#include "makefile_am.h"
+#include "trace.h"
+#include <ctype.h>
 #include <dirent.h>
 #include <libgen.h>
 
@@ -11,7 +14,10 @@
 static int add_file(const char *src_path, const char *dst_path);
 static int add_directory(const char *src_path, const char *dst_path);
 static int add_dependency(const char *dep_name);
+static int add_pch(const char *header);
+static int add_library(const char *library);
 static int update_makefile_am(const char *file_path);
+static int defines_main(const char *path);
 static int is_c_source_file(const char *path);
 static int is_header_file(const char *path);
 static void print_add_usage(void);
@@ -23,8 +29,8 @@ static int is_c_source_file(const char *path) {
     return (strcmp(ext, ".c") == 0);
 }
 
-// Check if file is a header file (currently unused but kept for future use)
-__attribute__((unused)) static int is_header_file(const char *path) {
+// Check if file is a header file
+static int is_header_file(const char *path) {
     const char *ext = strrchr(path, '.');
     if (!ext) return 0;
     return (strcmp(ext, ".h") == 0);
@@ -36,13 +42,17 @@ static void print_add_usage(void) {
     printf("Types:\n");
     printf("  file <path>        Add a single file to the project\n");
     printf("  dir <path>         Add a directory to the project\n");
-    printf("  dep <library>      Add a library dependency\n\n");
+    printf("  dep <library>      Add a library dependency\n");
+    printf("  pch <header>       Precompile a header and include it in every source\n");
+    printf("  lib [name.a]       Build all sources but main() once, as a library the tests link\n\n");
     printf("Examples:\n");
     printf("  jc add file utils.c\n");
     printf("  jc add file src/utils.c\n");
     printf("  jc add dir src/lib\n");
     printf("  jc add dep math\n");
-    printf("  jc add dep pthread\n\n");
+    printf("  jc add dep pthread\n");
+    printf("  jc add pch project.h\n");
+    printf("  jc add lib\n\n");
 }
 
 // Add a single file to the project
@@ -312,24 +322,32 @@ static int update_makefile_am(const char *file_path) {
         return 0;
     }
 
-    // Read current Makefile.am content
-    char *content = read_file("src/Makefile.am");
-    if (!content) {
-        return -1;
-    }
-
     // Extract just the filename from the full path
     char *filename = basename((char*)file_path);
-    
-    // Check if file is already in the SOURCES list
-    char *sources_line = strstr(content, "_SOURCES");
-    if (sources_line) {
-        if (strstr(sources_line, filename) != NULL) {
+
+    // Check if file is already in a SOURCES list
+    am_file am;
+    if (am_parse("src/Makefile.am", &am) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < am.count; i++) {
+        size_t len = strlen(am.vars[i].name);
+        if (len > 8 && strcmp(am.vars[i].name + len - 8, "_SOURCES") == 0 &&
+            am_has_word(am.vars[i].value, filename)) {
             // File already in SOURCES, nothing to do
-            free(content);
+            am_free(&am);
             return 0;
         }
     }
+    char library[256];
+    int has_library = am_convenience_library(&am, library, sizeof(library)) == 0;
+    am_free(&am);
+
+    // Read current Makefile.am content
+    char *content = read_file("src/Makefile.am");
+    if (!content) {
+        return -1;
+    }
 
     // Add the file to SOURCES
     char *new_content = malloc(strlen(content) + strlen(filename) + 10);
@@ -349,8 +367,9 @@ static int update_makefile_am(const char *file_path) {
             line_end = line_start + strlen(line_start);
         }
 
-        // Look for the specific SOURCES line (e.g., "test_project_SOURCES = main.c")
-        if (strstr(line_start, "_SOURCES =") != NULL && !sources_updated) {
+        // Look for the first SOURCES line (the convenience library's, else the program's)
+        char *sources_var = strstr(line_start, "_SOURCES =");
+        if (sources_var && sources_var < line_end && line_start[0] != '#' && !sources_updated) {
             // Copy the line up to the end
             size_t len = line_end - line_start;
             memcpy(output, line_start, len);
@@ -360,8 +379,8 @@ static int update_makefile_am(const char *file_path) {
             if (line_end > line_start && *(line_end - 1) != ' ') {
                 *output++ = ' ';
             }
-            sprintf(output, " %s", filename);
-            output += strlen(filename) + 1;
+            sprintf(output, "%s", filename);
+            output += strlen(filename);
             
             sources_updated = 1;
         } else {
@@ -391,17 +410,712 @@ static int update_makefile_am(const char *file_path) {
 
     free(content);
     free(new_content);
+
+    // The first source besides main() starts the convenience library
+    if (!has_library && !defines_main(file_path)) {
+        return add_library(NULL);
+    }
+    return 0;
+}
+
+// Marks the precompiled header block in src/Makefile.am
+#define PCH_MARKER "# Precompiled header (added by 'jc add pch')"
+
+// Find the header below src/ and return its path relative to src/
+static int resolve_pch_header(const char *header, char *rel, size_t size) {
+    const char *candidates[] = {"%s", "include/%s"};
+    const char *name = strncmp(header, "src/", 4) == 0 ? header + 4 : header;
+
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        char path[PATH_MAX + 8];
+        snprintf(rel, size, candidates[i], name);
+        snprintf(path, sizeof(path), "src/%s", rel);
+        if (file_exists(path)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Replace the value of a "NAME = value" line in place
+static char *replace_assignment(char *content, const char *name, const char *value) {
+    size_t name_len = strlen(name);
+    for (char *line = content; line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+        if (strncmp(line, name, name_len) != 0 || strncmp(line + name_len, " =", 2) != 0) {
+            continue;
+        }
+        char *end = strchr(line, '\n');
+        size_t tail_len = end ? strlen(end) : 0;
+        char *updated = malloc((line - content) + name_len + strlen(value) + tail_len + 8);
+        if (!updated) {
+            return content;
+        }
+        sprintf(updated, "%.*s%s = %s%s", (int)(line - content), content, name, value, end ? end : "");
+        free(content);
+        return updated;
+    }
+    return content;
+}
+
+/**
+ * Find a "NAME = value" assignment, with continuations
+ *
+ * @param start Receives the offset of its first line
+ * @param end Receives the offset just past its last line
+ * @return The value with continuations joined (malloc'd), or NULL if not set
+ */
+static char *find_assignment(const char *content, const char *name, size_t *start, size_t *end) {
+    size_t name_len = strlen(name);
+    for (const char *line = content; line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+        const char *p = line + name_len;
+        if (strncmp(line, name, name_len) != 0 || (*p != ' ' && *p != '\t' && *p != '=')) {
+            continue;
+        }
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != '=') {
+            continue;
+        }
+        p++;
+
+        const char *stop = p;
+        while (*stop && !(*stop == '\n' && stop[-1] != '\\')) stop++;
+
+        char *value = strndup(p, stop - p);
+        for (char *c = value; *c; c++) {
+            if (*c == '\\' || *c == '\n') *c = ' ';
+        }
+        *start = line - content;
+        *end = (*stop ? stop + 1 : stop) - content;
+        return value;
+    }
+    return NULL;
+}
+
+// Remove a "NAME = value" assignment (with continuations), returning its value
+static char *take_assignment(char *content, const char *name) {
+    size_t start;
+    size_t end;
+    char *value = find_assignment(content, name, &start, &end);
+    if (value) {
+        memmove(content + start, content + end, strlen(content + end) + 1);
+    }
+    return value;
+}
+
+// Set "NAME = value" in place of its assignment, else after the one named after (else at the end)
+static char *set_assignment(char *content, const char *name, const char *value, const char *after) {
+    size_t start;
+    size_t end;
+    char *old = find_assignment(content, name, &start, &end);
+    if (!old) {
+        char *anchor = after ? find_assignment(content, after, &start, &end) : NULL;
+        start = end = anchor ? end : strlen(content);
+        free(anchor);
+    }
+    free(old);
+
+    char *updated = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    append_format(&updated, &len, &cap, "%.*s%s%s = %s\n%s", (int)start, content,
+                  start > 0 && content[start - 1] != '\n' ? "\n" : "", name, value, content + end);
+    free(content);
+    return updated;
+}
+
+/**
+ * Time a clean, serial compile of the program in src/
+ *
+ * @param program Program name from bin_PROGRAMS
+ * @param make_var Extra variable assignment for make, or NULL
+ * @return Microseconds, or -1 if the build failed
+ */
+static long long time_compile(const char *program, const char *make_var) {
+    char *const clean[] = {"make", "-s", "-C", "src", "mostlyclean-compile", NULL};
+    if (execute_command_quiet(clean) != 0) {
+        return -1;
+    }
+
+    char target[256];
+    snprintf(target, sizeof(target), "%s", program);
+    char var[512];
+    snprintf(var, sizeof(var), "%s", make_var ? make_var : "");
+    char *const compile[] = {"make", "-s", "-j1", "-C", "src", target, make_var ? var : NULL, NULL};
+    long long start = trace_now();
+    if (execute_command_quiet(compile) != 0) {
+        return -1;
+    }
+    return trace_now() - start;
+}
+
+// Compare compile times with and without the precompiled header
+static void report_pch_timing(const char *program, const char *canonical, const char *header) {
+    if (!file_exists("src/Makefile")) {
+        printf("  Run 'jc build', then 'jc add pch %s' again to measure the speedup\n", header);
+        return;
+    }
+
+    printf("Measuring compile time (clean serial build of %s)...\n", program);
+
+    char gch_path[PATH_MAX];
+    char stub[PATH_MAX];
+    char gch[PATH_MAX];
+    snprintf(gch_path, sizeof(gch_path), "src/pch/%s.gch", header);
+    snprintf(stub, sizeof(stub), "pch/%s", header);
+    snprintf(gch, sizeof(gch), "pch/%s.gch", header);
+    char *const build_gch[] = {"make", "-s", "-C", "src", stub, gch, NULL};
+    unlink(gch_path);
+    long long start = trace_now();
+    if (execute_command_quiet(build_gch) != 0) {
+        fprintf(stderr, "Warning: Failed to build the precompiled header; run 'jc build' to see why\n");
+        return;
+    }
+    long long gch_time = trace_now() - start;
+
+    // Without: the target's preprocessor flags minus the -include
+    char without_vars[512];
+    snprintf(without_vars, sizeof(without_vars), "%s_CPPFLAGS=$(PCH_CPPFLAGS)", canonical);
+    long long without = time_compile(program, without_vars);
+    long long with = time_compile(program, NULL);
+    if (without < 0 || with < 0) {
+        fprintf(stderr, "Warning: Build failed while measuring; run 'jc build' to see why\n");
+        return;
+    }
+
+    printf("  Without PCH:        %8.3f s\n", without / 1e6);
+    printf("  With PCH:           %8.3f s (%.2fx)\n", with / 1e6, with > 0 ? (double)without / with : 0.0);
+    printf("  Building the PCH:   %8.3f s\n", gch_time / 1e6);
+}
+
+// Compile every noinst_LIBRARIES target with the program's preprocessor flags, and so the PCH
+static char *add_pch_to_libraries(char *content, const char *canonical, char **libraries, int count) {
+    char program_var[300];
+    char program_flags[304];
+    char program_rule[512];
+    snprintf(program_var, sizeof(program_var), "%s_CPPFLAGS", canonical);
+    snprintf(program_flags, sizeof(program_flags), "$(%s)", program_var);
+    snprintf(program_rule, sizeof(program_rule), "$(%s_OBJECTS): pch/$(PCH_HEADER) pch/$(PCH_HEADER).gch\n",
+             canonical);
+
+    for (int i = 0; i < count && content; i++) {
+        char library[256];
+        char var[300];
+        am_canonical_name(libraries[i], library, sizeof(library));
+        snprintf(var, sizeof(var), "%s_CPPFLAGS", library);
+
+        size_t start;
+        size_t end;
+        char *flags = find_assignment(content, var, &start, &end);
+        if (!flags) {
+            content = set_assignment(content, var, program_flags, program_var);
+        } else if (!strstr(flags, program_flags) && !strstr(flags, "pch/$(PCH_HEADER)")) {
+            // The library's own flags stay, with the header in front
+            const char *own = flags;
+            while (*own == ' ' || *own == '\t') own++;
+            char *value = NULL;
+            size_t len = 0;
+            size_t cap = 0;
+            append_format(&value, &len, &cap, "-include pch/$(PCH_HEADER) -Winvalid-pch %s", own);
+            content = set_assignment(content, var, value, NULL);
+            free(value);
+        }
+        free(flags);
+
+        char rule[512];
+        snprintf(rule, sizeof(rule), "$(%s_OBJECTS): pch/$(PCH_HEADER) pch/$(PCH_HEADER).gch\n", library);
+        if (!strstr(content, rule)) {
+            char *anchor = strstr(content, program_rule);
+            size_t at = anchor ? (size_t)(anchor - content) + strlen(program_rule) : strlen(content);
+            char *updated = NULL;
+            size_t len = 0;
+            size_t cap = 0;
+            append_format(&updated, &len, &cap, "%.*s%s%s", (int)at, content, rule, content + at);
+            free(content);
+            content = updated;
+        }
+    }
+    return content;
+}
+
+/**
+ * Precompile a header for the first program in src/Makefile.am
+ *
+ * Generates rules that build src/pch/<header>.gch with the program's
+ * flags and compile every source, the program's and its convenience
+ * libraries', with -include pch/<header>. pch/<header>
+ * is a stub including the real header, so the compiler falls back to
+ * parsing it whenever it can't use the .gch (-Winvalid-pch says why).
+ */
+static int add_pch(const char *header) {
+    char rel[PATH_MAX];
+    if (!is_header_file(header) || resolve_pch_header(header, rel, sizeof(rel)) != 0) {
+        fprintf(stderr, "Error: Header '%s' not found in src/ or src/include/\n", header);
+        return 1;
+    }
+
+    am_file am;
+    if (am_parse("src/Makefile.am", &am) != 0) {
+        fprintf(stderr, "Error: Failed to read src/Makefile.am\n");
+        return 1;
+    }
+    const char *programs = am_get(&am, "bin_PROGRAMS");
+    char **words = NULL;
+    int count = programs ? am_split_words(programs, &words) : 0;
+    if (count <= 0) {
+        fprintf(stderr, "Error: No bin_PROGRAMS in src/Makefile.am\n");
+        am_free(&am);
+        return 1;
+    }
+    char program[256];
+    char canonical[256];
+    snprintf(program, sizeof(program), "%s", words[0]);
+    am_canonical_name(program, canonical, sizeof(canonical));
+    int has_cleanfiles = am_get(&am, "CLEANFILES") != NULL;
+    am_free_words(words, count);
+    char **libraries = NULL;
+    int library_count = am_expand_words(&am, "noinst_LIBRARIES", &libraries, 0);
+    am_free(&am);
+
+    char *content = read_file("src/Makefile.am");
+    if (!content) {
+        fprintf(stderr, "Error: Failed to read src/Makefile.am\n");
+        am_free_words(libraries, library_count);
+        return 1;
+    }
+
+    const char *name = strrchr(rel, '/') ? strrchr(rel, '/') + 1 : rel;
+    char *updated;
+    if (strstr(content, PCH_MARKER)) {
+        // Already set up: just point it at the new header
+        content = replace_assignment(content, "PCH_HEADER", name);
+        content = replace_assignment(content, "PCH_SOURCE", rel);
+        updated = content;
+    } else {
+        // The target's own CPPFLAGS are kept in PCH_CPPFLAGS
+        char cppflags_var[300];
+        snprintf(cppflags_var, sizeof(cppflags_var), "%s_CPPFLAGS", canonical);
+        char *cppflags = take_assignment(content, cppflags_var);
+
+        const char *block_format =
+            "\n" PCH_MARKER "\n"
+            "# Every %s source is compiled with -include pch/$(PCH_HEADER); the\n"
+            "# compiler uses pch/$(PCH_HEADER).gch instead when the flags match.\n"
+            "PCH_HEADER = %s\n"
+            "PCH_SOURCE = %s\n"
+            "PCH_CPPFLAGS = %s\n"
+            "%s_CPPFLAGS = -include pch/$(PCH_HEADER) -Winvalid-pch $(PCH_CPPFLAGS)\n"
+            "CLEANFILES %s pch/$(PCH_HEADER) pch/$(PCH_HEADER).gch\n"
+            "\n"
+            "$(%s_OBJECTS): pch/$(PCH_HEADER) pch/$(PCH_HEADER).gch\n"
+            "\n"
+            "pch/$(PCH_HEADER): Makefile\n"
+            "\t@$(MKDIR_P) pch\n"
+            "\t$(AM_V_GEN)echo '#include \"$(abs_srcdir)/$(PCH_SOURCE)\"' > $@\n"
+            "\n"
+            "pch/$(PCH_HEADER).gch: $(srcdir)/$(PCH_SOURCE)\n"
+            "\t@$(MKDIR_P) pch $(DEPDIR)\n"
+            "\t$(AM_V_CC)$(CC) $(DEFS) $(DEFAULT_INCLUDES) $(INCLUDES) $(PCH_CPPFLAGS) $(CPPFLAGS) "
+            "$(%s_CFLAGS) $(CFLAGS) -x c-header -MT $@ -MD -MP -MF $(DEPDIR)/pch.Tpo "
+            "-c -o $@ $(srcdir)/$(PCH_SOURCE)\n"
+            "\t$(AM_V_at)mv -f $(DEPDIR)/pch.Tpo $(DEPDIR)/pch.Po\n"
+            "\n"
+            "# Headers the precompiled header depends on\n"
+            "@am__include@ @am__quote@./$(DEPDIR)/pch.Po@am__quote@\n"
+            "./$(DEPDIR)/pch.Po:\n"
+            "\t@$(MKDIR_P) $(DEPDIR)\n"
+            "\t@echo '# dummy' > $@\n";
+
+        const char *base_flags = cppflags ? cppflags : "$(AM_CPPFLAGS)";
+        while (*base_flags == ' ') base_flags++;
+        size_t size = strlen(content) + strlen(block_format) + strlen(base_flags) +
+                      strlen(rel) * 2 + strlen(canonical) * 3 + strlen(program) + 16;
+        updated = malloc(size);
+        if (!updated) {
+            free(cppflags);
+            free(content);
+            am_free_words(libraries, library_count);
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            return 1;
+        }
+
+        size_t len = strlen(content);
+        while (len > 0 && content[len - 1] == '\n') len--;
+        int written = snprintf(updated, size, "%.*s\n", (int)len, content);
+        snprintf(updated + written, size - written, block_format, program, name, rel,
+                 base_flags, canonical, has_cleanfiles ? "+=" : "=", canonical, canonical);
+        free(cppflags);
+        free(content);
+    }
+    updated = add_pch_to_libraries(updated, canonical, libraries, library_count);
+    am_free_words(libraries, library_count);
+
+    if (write_file("src/Makefile.am", updated) != 0) {
+        fprintf(stderr, "Error: Failed to update src/Makefile.am\n");
+        free(updated);
+        return 1;
+    }
+    free(updated);
+
+    printf("✓ Added precompiled header src/%s for %s\n", rel, program);
+    report_pch_timing(program, canonical, name);
     return 0;
 }
 
+// Whether a source defines main(), as written at the start of a line
+static int defines_main(const char *path) {
+    char *content = read_file(path);
+    if (!content) {
+        return 0;
+    }
+    int found = 0;
+    for (char *line = content; line && !found; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+        const char *p = line;
+        if (strncmp(p, "static ", 7) == 0) p += 7;
+        if (strncmp(p, "int", 3) != 0) {
+            continue;
+        }
+        p += 3;
+        while (*p == ' ' || *p == '\t' || *p == '\n') p++;
+        if (strncmp(p, "main", 4) == 0) {
+            p += 4;
+            while (*p == ' ' || *p == '\t') p++;
+            found = *p == '(';
+        }
+    }
+    free(content);
+    return found;
+}
+
+// Make sure configure.ac sets up the archiver, which automake needs for libraries
+static int add_archiver_checks(void) {
+    char *content = read_file("configure.ac");
+    if (!content) {
+        return -1;
+    }
+    const char *checks[] = {"AM_PROG_AR", "AC_PROG_RANLIB"};
+    char missing[64] = "";
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        if (!strstr(content, checks[i])) {
+            strcat(missing, checks[i]);
+            strcat(missing, "\n");
+        }
+    }
+    char *cc = strstr(content, "AC_PROG_CC");
+    if (!*missing || !cc) {
+        free(content);
+        return *missing ? -1 : 0;
+    }
+
+    char *line_end = strchr(cc, '\n');
+    size_t offset = line_end ? (size_t)(line_end + 1 - content) : strlen(content);
+    char *updated = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    append_format(&updated, &len, &cap, "%.*s%s%s%s", (int)offset, content, line_end ? "" : "\n", missing,
+                  content + offset);
+    int result = write_file("configure.ac", updated);
+    if (result == 0) {
+        printf("✓ Added archiver checks to configure.ac\n");
+    }
+    free(updated);
+    free(content);
+    return result;
+}
+
+/**
+ * Link the tests in tests/Makefile.am against the convenience library
+ *
+ * Sources of the library that a test lists in its _SOURCES (written as
+ * ../src/x.c, $(top_srcdir)/src/x.c or $(srcdir)/../src/x.c) are dropped,
+ * so they're no longer compiled once per test.
+ *
+ * @param moved Library sources, relative to src/
+ * @param dropped Receives the number of sources dropped
+ * @return The number of tests linked, or -1 on error
+ */
+static int link_tests_to_library(const char *library, char **moved, int moved_count, int *dropped) {
+    *dropped = 0;
+    am_file am;
+    if (!file_exists("tests/Makefile.am") || am_parse("tests/Makefile.am", &am) != 0) {
+        return 0;
+    }
+    char *content = read_file("tests/Makefile.am");
+    if (!content) {
+        am_free(&am);
+        return -1;
+    }
+
+    char library_path[512];
+    snprintf(library_path, sizeof(library_path), "$(top_builddir)/src/%s", library);
+    char **programs = NULL;
+    int program_count = am_expand_words(&am, "check_PROGRAMS", &programs, 0);
+    int linked = 0;
+    for (int i = 0; i < program_count; i++) {
+        char canonical[256];
+        char name[300];
+        am_canonical_name(programs[i], canonical, sizeof(canonical));
+
+        snprintf(name, sizeof(name), "%s_SOURCES", canonical);
+        const char *value = am_get(&am, name);
+        char **sources = NULL;
+        int source_count = value ? am_split_words(value, &sources) : 0;
+        char *kept = NULL;
+        size_t kept_len = 0;
+        size_t kept_cap = 0;
+        int removed = 0;
+        for (int j = 0; j < source_count; j++) {
+            const char *rest = sources[j];
+            const char *prefixes[] = {"$(top_srcdir)/src/", "${top_srcdir}/src/", "$(srcdir)/../src/",
+                                      "${srcdir}/../src/", "../src/"};
+            const char *relative = NULL;
+            for (size_t k = 0; k < sizeof(prefixes) / sizeof(prefixes[0]) && !relative; k++) {
+                size_t prefix_len = strlen(prefixes[k]);
+                if (strncmp(rest, prefixes[k], prefix_len) == 0) {
+                    relative = rest + prefix_len;
+                }
+            }
+            int in_library = 0;
+            for (int k = 0; relative && k < moved_count && !in_library; k++) {
+                in_library = strcmp(relative, moved[k]) == 0;
+            }
+            if (in_library) {
+                removed++;
+            } else {
+                append_format(&kept, &kept_len, &kept_cap, "%s%s", kept_len ? " " : "", sources[j]);
+            }
+        }
+        am_free_words(sources, source_count > 0 ? source_count : 0);
+        if (removed > 0) {
+            content = set_assignment(content, name, kept ? kept : "", NULL);
+            *dropped += removed;
+        }
+        free(kept);
+
+        // The library goes first so the libraries after it resolve its symbols
+        char ldadd_name[300];
+        snprintf(ldadd_name, sizeof(ldadd_name), "%s_LDADD", canonical);
+        const char *ldadd = am_get(&am, ldadd_name);
+        if (!ldadd) {
+            ldadd = am_get(&am, "LDADD") ? "$(LDADD)" : "";
+        }
+        if (!am_has_word(ldadd, library_path)) {
+            char updated[PATH_MAX];
+            snprintf(updated, sizeof(updated), "%s%s%s", library_path, *ldadd ? " " : "", ldadd);
+            content = set_assignment(content, ldadd_name, updated, name);
+            linked++;
+        }
+    }
+    am_free_words(programs, program_count);
+    am_free(&am);
+
+    int result = linked > 0 || *dropped > 0 ? write_file("tests/Makefile.am", content) : 0;
+    free(content);
+    return result == 0 ? linked : -1;
+}
+
+/**
+ * Move the sources of the first program, all but the one defining main(),
+ * into a convenience library that the program and the tests link
+ *
+ * Tests that compiled project sources themselves link the library instead,
+ * so each source is compiled once rather than once per test program.
+ *
+ * @param library Name of the library, or NULL for lib<program>.a
+ */
+static int add_library(const char *library) {
+    am_file am;
+    if (am_parse("src/Makefile.am", &am) != 0) {
+        fprintf(stderr, "Error: Failed to read src/Makefile.am\n");
+        return 1;
+    }
+    char **words = NULL;
+    int count = am_expand_words(&am, "bin_PROGRAMS", &words, 0);
+    if (count <= 0) {
+        fprintf(stderr, "Error: No bin_PROGRAMS in src/Makefile.am\n");
+        am_free(&am);
+        return 1;
+    }
+    char program[256];
+    char canonical[256];
+    snprintf(program, sizeof(program), "%s", words[0]);
+    am_canonical_name(program, canonical, sizeof(canonical));
+    am_free_words(words, count);
+
+    char name[264];
+    char existing[256];
+    int has_library = am_convenience_library(&am, existing, sizeof(existing)) == 0;
+    if (has_library) {
+        snprintf(name, sizeof(name), "%s", existing);
+    } else if (library) {
+        snprintf(name, sizeof(name), "%s", library);
+    } else {
+        snprintf(name, sizeof(name), "lib%s.a", canonical);
+    }
+    size_t name_len = strlen(name);
+    if (!has_library && (name_len < 3 || strcmp(name + name_len - 2, ".a") != 0)) {
+        fprintf(stderr, "Error: Library name '%s' must end in .a\n", name);
+        am_free(&am);
+        return 1;
+    }
+    char library_canonical[256];
+    am_canonical_name(name, library_canonical, sizeof(library_canonical));
+
+    // Sources defining main() and ones named through variables stay with the program
+    char var[300];
+    snprintf(var, sizeof(var), "%s_SOURCES", canonical);
+    char default_source[300];
+    snprintf(default_source, sizeof(default_source), "%s.c", program);
+    const char *sources_value = am_get(&am, var);
+    char **sources = NULL;
+    int source_count = am_split_words(sources_value ? sources_value : default_source, &sources);
+    char **moved = NULL;
+    int moved_count = 0;
+    char *kept = NULL;
+    size_t kept_len = 0;
+    size_t kept_cap = 0;
+    char *library_sources = NULL;
+    size_t library_len = 0;
+    size_t library_cap = 0;
+    for (int i = 0; i < source_count; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "src/%s", sources[i]);
+        if (!has_library && !strchr(sources[i], '$') && !defines_main(path)) {
+            moved = realloc(moved, (moved_count + 1) * sizeof(char *));
+            moved[moved_count++] = strdup(sources[i]);
+            append_format(&library_sources, &library_len, &library_cap, "%s%s", library_len ? " " : "",
+                          sources[i]);
+        } else {
+            append_format(&kept, &kept_len, &kept_cap, "%s%s", kept_len ? " " : "", sources[i]);
+        }
+    }
+    am_free_words(sources, source_count > 0 ? source_count : 0);
+    if (has_library) {
+        // Already migrated: the tests may still need linking
+        char library_var[300];
+        snprintf(library_var, sizeof(library_var), "%s_SOURCES", library_canonical);
+        const char *value = am_get(&am, library_var);
+        moved_count = value ? am_split_words(value, &moved) : 0;
+    }
+    snprintf(var, sizeof(var), "%s_CPPFLAGS", canonical);
+    int has_cppflags = am_get(&am, var) != NULL;
+    snprintf(var, sizeof(var), "%s_CFLAGS", canonical);
+    int has_cflags = am_get(&am, var) != NULL;
+    int has_arflags = am_get(&am, "ARFLAGS") != NULL;
+    am_free(&am);
+
+    int result = 0;
+    if (!has_library && moved_count == 0) {
+        // An empty archive is rejected by BSD and macOS ar
+        fprintf(stderr, "Error: %s has no sources besides main() to move into %s\n", program, name);
+        fprintf(stderr, "'jc add file' creates the library with the first one\n");
+        result = 1;
+        goto done;
+    }
+    if (has_library) {
+        printf("✓ src/Makefile.am already builds %s\n", name);
+    } else {
+        char *content = read_file("src/Makefile.am");
+        if (!content) {
+            fprintf(stderr, "Error: Failed to read src/Makefile.am\n");
+            result = 1;
+            goto done;
+        }
+
+        char block[PATH_MAX * 2];
+        int written = snprintf(block, sizeof(block),
+                               "\n"
+                               "# Sources other than main(), compiled once and linked into the program and the tests\n"
+                               "noinst_LIBRARIES = %s\n"
+                               "%s_SOURCES = %s\n",
+                               name, library_canonical, library_sources ? library_sources : "");
+        if (has_cflags) {
+            written += snprintf(block + written, sizeof(block) - written, "%s_CFLAGS = $(%s_CFLAGS)\n",
+                                library_canonical, canonical);
+        }
+        if (has_cppflags) {
+            written += snprintf(block + written, sizeof(block) - written, "%s_CPPFLAGS = $(%s_CPPFLAGS)\n",
+                                library_canonical, canonical);
+        }
+        if (!has_arflags) {
+            // automake's default "cru" makes binutils warn on every archive
+            written += snprintf(block + written, sizeof(block) - written, "ARFLAGS = cr\n");
+        }
+        if (has_cppflags && strstr(content, PCH_MARKER)) {
+            snprintf(block + written, sizeof(block) - written,
+                     "$(%s_OBJECTS): pch/$(PCH_HEADER) pch/$(PCH_HEADER).gch\n", library_canonical);
+        }
+
+        // The library block goes right after bin_PROGRAMS, ahead of the program's
+        // _SOURCES, which is where 'jc add file' puts new sources
+        size_t start;
+        size_t end;
+        char *programs = find_assignment(content, "bin_PROGRAMS", &start, &end);
+        if (!programs) {
+            end = 0;
+        }
+        free(programs);
+        char *updated = NULL;
+        size_t len = 0;
+        size_t cap = 0;
+        append_format(&updated, &len, &cap, "%.*s%s%s", (int)end, content, block + (end == 0), content + end);
+        free(content);
+
+        snprintf(var, sizeof(var), "%s_SOURCES", canonical);
+        updated = set_assignment(updated, var, kept ? kept : "", NULL);
+        char ldadd_name[300];
+        char ldadd[PATH_MAX];
+        snprintf(ldadd_name, sizeof(ldadd_name), "%s_LDADD", canonical);
+        size_t ldadd_start;
+        size_t ldadd_end;
+        char *old_ldadd = find_assignment(updated, ldadd_name, &ldadd_start, &ldadd_end);
+        const char *rest = old_ldadd ? old_ldadd : "";
+        while (*rest == ' ' || *rest == '\t') rest++;
+        snprintf(ldadd, sizeof(ldadd), "%s%s%s", name, *rest ? " " : "", rest);
+        free(old_ldadd);
+        updated = set_assignment(updated, ldadd_name, ldadd, var);
+
+        if (write_file("src/Makefile.am", updated) != 0) {
+            fprintf(stderr, "Error: Failed to update src/Makefile.am\n");
+            free(updated);
+            result = 1;
+            goto done;
+        }
+        free(updated);
+        printf("✓ Moved %d source%s of %s into %s\n", moved_count, moved_count == 1 ? "" : "s", program, name);
+
+        if (add_archiver_checks() != 0) {
+            fprintf(stderr, "Warning: Add AM_PROG_AR and AC_PROG_RANLIB after AC_PROG_CC in configure.ac\n");
+        }
+    }
+
+    int dropped;
+    int linked = link_tests_to_library(name, moved, moved_count, &dropped);
+    if (linked < 0) {
+        fprintf(stderr, "Error: Failed to update tests/Makefile.am\n");
+        result = 1;
+    } else if (linked > 0 || dropped > 0) {
+        printf("✓ Linked %d test%s against %s (%d source%s no longer compiled per test)\n", linked,
+               linked == 1 ? "" : "s", name, dropped, dropped == 1 ? "" : "s");
+    }
+    if (result == 0 && (!has_library || linked > 0 || dropped > 0)) {
+        printf("  Run 'jc build' to rebuild the project with the library\n");
+    }
+
+done:
+    am_free_words(moved, moved_count);
+    free(kept);
+    free(library_sources);
+    return result;
+}
+
 int cmd_add(int argc, char *argv[]) {
-    if (argc < 3) {
+    if (argc < 3 && !(argc == 2 && strcmp(argv[1], "lib") == 0)) {
         print_add_usage();
         return 1;
     }
 
     const char *type = argv[1];
-    const char *target = argv[2];
+    const char *target = argc > 2 ? argv[2] : NULL;
 
     // Check if we're in an automake project (except for dependency addition)
     if (strcmp(type, "dep") != 0 && !is_automake_project()) {
@@ -434,6 +1148,14 @@ int cmd_add(int argc, char *argv[]) {
         // Add a library dependency
         return add_dependency(target);
 
+    } else if (strcmp(type, "pch") == 0) {
+        // Add a precompiled header
+        return add_pch(target);
+
+    } else if (strcmp(type, "lib") == 0) {
+        // Move the sources shared with the tests into a library
+        return add_library(target);
+
     } else {
         fprintf(stderr, "Error: Unknown type '%s'\n\n", type);
         print_add_usage();
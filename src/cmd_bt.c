@@ -1,5 +1,8 @@
 #include "jc.h"
 #include "utils.h"
+#include "build_profile.h"
+#include "process.h"
+#include <errno.h>
 #include <limits.h>
 
 #ifndef PATH_MAX
@@ -18,6 +21,16 @@
 #endif
 #endif
 
+// Run the debugger on the terminal; returns its exit status
+static int run_debugger(char *const argv[]) {
+    process_result result;
+    if (process_run(argv, NULL, &result) != 0) {
+        fprintf(stderr, "Error: Cannot run %s: %s\n", argv[0], strerror(errno));
+        return -1;
+    }
+    return process_status(&result);
+}
+
 #ifdef HAVE_LLDB
 static void print_lldb_usage(const char *executable) {
     printf("\nTo debug with lldb:\n");
@@ -54,27 +67,25 @@ int cmd_bt(int argc, char *argv[]) {
         return 1;
     }
 
-    // Ensure project is built
-    if (!file_exists("Makefile")) {
-        printf("Project not built. Building first...\n");
-        if (cmd_build(0, NULL) != 0) {
-            return 1;
-        }
+    char *profile = take_profile_option(&argc, argv);
+
+    // Ensure project is built and up to date
+    if (ensure_built(profile) != 0) {
+        free(profile);
+        return 1;
     }
 
-    // Find the executable
+    // Find the executable, or the one named by 'jc bt <target>'
+    const char *target = take_target_argument(&argc, argv, profile);
     char executable[PATH_MAX];
-    const char *search_dirs[] = {"src/build", "src", ".", NULL};
-    
-    int found = 0;
-    for (int i = 0; search_dirs[i] != NULL; i++) {
-        if (find_executable(search_dirs[i], executable, sizeof(executable)) == 0) {
-            found = 1;
-            break;
-        }
-    }
-    
+    int found = find_built_executable(profile, target, executable, sizeof(executable)) == 0;
+    free(profile);
+
     if (!found) {
+        if (target) {
+            fprintf(stderr, "Error: Program '%s' has not been built\n", target);
+            return 1;
+        }
         fprintf(stderr, "Error: Could not find executable\n");
         return 1;
     }
@@ -90,27 +101,31 @@ int cmd_bt(int argc, char *argv[]) {
         printf("Core dump found: core\n");
         printf("\nLoading core dump in lldb...\n");
         
-        char cmd[PATH_MAX * 2];
-        snprintf(cmd, sizeof(cmd), "lldb %s -c core", executable);
+        char *const lldb[] = {"lldb", executable, "-c", "core", NULL};
         
         printf("Run 'bt' in lldb to see the backtrace\n");
         printf("----------------------------------------\n");
-        return system(cmd) == 0 ? 0 : 1;
+        fflush(stdout);
+        return run_debugger(lldb) == 0 ? 0 : 1;
     } else {
-        // Run with debugger
-        char cmd[PATH_MAX * 2];
-        int offset = snprintf(cmd, sizeof(cmd), "lldb -o run -o bt");
-        
-        // Add any additional arguments
+        // Run with debugger, passing any additional arguments to the program
+        arg_list lldb = {0};
+        args_add(&lldb, "lldb");
+        args_add(&lldb, "-o");
+        args_add(&lldb, "run");
+        args_add(&lldb, "-o");
+        args_add(&lldb, "bt");
+        args_add(&lldb, "--");
+        args_add(&lldb, executable);
         for (int i = 1; i < argc; i++) {
-            offset += snprintf(cmd + offset, sizeof(cmd) - offset, " -o 'settings set target.run-args %s'", argv[i]);
+            args_add(&lldb, argv[i]);
         }
         
-        offset += snprintf(cmd + offset, sizeof(cmd) - offset, " %s", executable);
-        
         printf("\nRunning with lldb...\n");
         printf("----------------------------------------\n");
-        int ret = system(cmd);
+        fflush(stdout);
+        int ret = run_debugger(lldb.argv);
+        args_free(&lldb);
         
         if (ret != 0) {
             print_lldb_usage(executable);
@@ -125,20 +140,31 @@ int cmd_bt(int argc, char *argv[]) {
         printf("Core dump found: core\n");
         printf("\nLoading core dump in gdb...\n");
         
-        char cmd[PATH_MAX * 2];
-        snprintf(cmd, sizeof(cmd), "gdb %s core", executable);
+        char *const gdb[] = {"gdb", executable, "core", NULL};
         
         printf("Run 'bt' in gdb to see the backtrace\n");
         printf("----------------------------------------\n");
-        return system(cmd) == 0 ? 0 : 1;
+        fflush(stdout);
+        return run_debugger(gdb) == 0 ? 0 : 1;
     } else {
-        // Run with debugger
-        char cmd[PATH_MAX * 2];
-        snprintf(cmd, sizeof(cmd), "gdb -ex run -ex bt %s", executable);
+        // Run with debugger, passing any additional arguments to the program
+        arg_list gdb = {0};
+        args_add(&gdb, "gdb");
+        args_add(&gdb, "-ex");
+        args_add(&gdb, "run");
+        args_add(&gdb, "-ex");
+        args_add(&gdb, "bt");
+        args_add(&gdb, "--args");
+        args_add(&gdb, executable);
+        for (int i = 1; i < argc; i++) {
+            args_add(&gdb, argv[i]);
+        }
         
         printf("\nRunning with gdb...\n");
         printf("----------------------------------------\n");
-        int ret = system(cmd);
+        fflush(stdout);
+        int ret = run_debugger(gdb.argv);
+        args_free(&gdb);
         
         if (ret != 0) {
             print_gdb_usage(executable);
@@ -1,55 +1,890 @@
 #include "jc.h"
 #include "utils.h"
+#include "hash.h"
+#include "build_profile.h"
+#include "trace.h"
+#include "unity.h"
+#include "pgo.h"
+#include "ninja.h"
+#include "watch.h"
+#include "process.h"
+#include "diag.h"
+#include "manifest.h"
+#include "makefile_am.h"
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/utsname.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define STATE_FILE ".jc/state"
+
+// Environment variables that influence the result of ./configure
+static const char *configure_env_vars[] = {
+    "CC", "CFLAGS", "CPP", "CPPFLAGS", "LDFLAGS", "LIBS", "PKG_CONFIG_PATH", NULL
+};
+
+// Print usage information for build command
+static void print_build_usage(void) {
+    printf("Usage: jc build [options]\n\n");
+    printf("Options:\n");
+    printf("  -j, --jobs <n>     Run <n> make jobs in parallel\n");
+    printf("                     (default: 'jobs' in .jc/config, else auto-detected)\n");
+    printf("  --cache            Compile through the shared object cache\n");
+    printf("  --no-cache         Compile without the object cache\n");
+    printf("                     (default: 'cache' in .jc/config, else off)\n");
+    printf("  --no-config-cache  Don't share configure results with other projects\n");
+    printf("                     (default: 'config_cache' in .jc/config, else on)\n");
+    printf("  --profile <name>   Build out of tree in build/<name>/ with the profile's flags\n");
+    printf("                     (debug, release, asan, tsan, or profile.<name>.cflags\n");
+    printf("                     in .jc/config; default: 'profile' in .jc/config)\n");
+    printf("  --trace            Time every build step, write .jc/trace.json and\n");
+    printf("                     print the slowest files and the critical path\n");
+    printf("  --unity[=<n>]      Compile src/ sources in batches of <n> per unity file\n");
+    printf("                     (default: spread over the job count)\n");
+    printf("  --no-unity         Compile every source separately\n");
+    printf("                     (default: 'unity' in .jc/config, else off)\n");
+    printf("  --pgo              Profile-guided optimization: instrument, train and\n");
+    printf("                     rebuild (see 'jc build --pgo --help')\n");
+    printf("  --backend=<name>   make (default) or ninja, which compiles and links from a\n");
+    printf("                     build.ninja generated from the Makefile.am files\n");
+    printf("                     (default: 'backend' in .jc/config)\n");
+    printf("  --fail-fast        Stop every running job at the first failing one\n");
+    printf("  --json[=<file>]    Also write the diagnostics as JSON Lines\n");
+    printf("                     (default file: .jc/diagnostics.json)\n");
+    printf("  --raw-output       Show compiler output as it arrives instead of grouping\n");
+    printf("                     and deduplicating it after the build\n");
+    printf("  --watch            Rebuild on every change; --run or --test afterwards\n");
+    printf("                     (see 'jc build --watch --help')\n\n");
+    printf("Examples:\n");
+    printf("  jc build\n");
+    printf("  jc build -j8\n");
+    printf("  jc build --cache\n");
+    printf("  jc build --profile=release\n");
+    printf("  jc build --trace\n");
+    printf("  jc build --unity=16\n");
+    printf("  jc build --pgo -- input.txt\n");
+    printf("  jc build --backend=ninja\n");
+    printf("  jc build -j16 --fail-fast\n");
+    printf("  jc build --watch --run\n\n");
+}
+
+static void add_makefile_am(char ***list, int *count, const char *dir, size_t dir_len) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%.*s%sMakefile.am", (int)dir_len, dir, dir_len ? "/" : "");
+    for (int i = 0; i < *count; i++) {
+        if (strcmp((*list)[i], path) == 0) {
+            return;
+        }
+    }
+    if (file_exists(path)) {
+        *list = realloc(*list, (*count + 1) * sizeof(char *));
+        (*list)[(*count)++] = strdup(path);
+    }
+}
+
+/**
+ * Collect the Makefile.am files automake generates a Makefile.in for
+ *
+ * Those are the Makefiles named in configure.ac's AC_CONFIG_FILES; a
+ * Makefile.am nothing references (e.g. tests/ before it is added to
+ * SUBDIRS) never gets a Makefile.in and must not force autogen. Without
+ * a readable AC_CONFIG_FILES, "." and the top-level SUBDIRS are used.
+ */
+static void collect_makefile_ams(char ***list, int *count) {
+    char *configure_ac = read_file("configure.ac");
+    for (const char *p = configure_ac; p && (p = strstr(p, "AC_CONFIG_FILES(")) != NULL;) {
+        p += strlen("AC_CONFIG_FILES(");
+        const char *end = strchr(p, ')');
+        if (!end) {
+            break;
+        }
+        while (p < end) {
+            p += strspn(p, " \t\n\\[],");
+            size_t len = strcspn(p, " \t\n\\[],)");
+            if (len >= 8 && strncmp(p + len - 8, "Makefile", 8) == 0 && (len == 8 || p[len - 9] == '/')) {
+                add_makefile_am(list, count, p, len > 8 ? len - 9 : 0);
+            }
+            p += len;
+        }
+    }
+    free(configure_ac);
+    if (*count > 0) {
+        return;
+    }
+
+    char **dirs;
+    int dir_count = am_project_dirs(&dirs);
+    for (int i = 0; i < dir_count; i++) {
+        add_makefile_am(list, count, dirs[i], strcmp(dirs[i], ".") == 0 ? 0 : strlen(dirs[i]));
+    }
+    am_free_words(dirs, dir_count);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void free_list(char **list, int count) {
+    for (int i = 0; i < count; i++) {
+        free(list[i]);
+    }
+    free(list);
+}
+
+// Fingerprint the inputs of autogen: configure.ac, autogen.sh and the tools
+static void autogen_fingerprint(char hex[HASH_HEX_SIZE]) {
+    hash_ctx ctx;
+    hash_init(&ctx);
+    hash_update_string(&ctx, "configure.ac");
+    hash_update_file(&ctx, file_exists("configure.ac") ? "configure.ac" : "configure.in");
+    hash_update_string(&ctx, "autogen.sh");
+    hash_update_file(&ctx, "autogen.sh");
+    hash_update_program(&ctx, "autoconf");
+    hash_update_program(&ctx, "automake");
+    hash_update_program(&ctx, "aclocal");
+    hash_final(&ctx, hex);
+}
+
+// Fingerprint the arguments and environment that configure sees
+static void configure_args_fingerprint(const char *args, char hex[HASH_HEX_SIZE]) {
+    hash_ctx ctx;
+    hash_init(&ctx);
+    hash_update_string(&ctx, args);
+    for (int i = 0; configure_env_vars[i] != NULL; i++) {
+        const char *value = getenv(configure_env_vars[i]);
+        hash_update_string(&ctx, configure_env_vars[i]);
+        hash_update_string(&ctx, value ? value : "");
+    }
+    hash_final(&ctx, hex);
+}
+
+// Compare a fingerprint with the one recorded in .jc/state
+static int state_matches(const char *key, const char *hex) {
+    char *stored = read_setting(STATE_FILE, key);
+    int matches = stored && strcmp(stored, hex) == 0;
+    free(stored);
+    return matches;
+}
+
+static void state_record(const char *key, const char *hex) {
+    create_directory(".jc");
+    write_setting(STATE_FILE, key, hex);
+}
+
+static int run_autogen(void) {
+    if (file_exists("autogen.sh")) {
+        char *const autogen[] = {"./autogen.sh", NULL};
+        if (execute_command(autogen) != 0) {
+            fprintf(stderr, "Error: autogen.sh failed\n");
+            return -1;
+        }
+    } else {
+        // Fall back to autoreconf
+        char *const autoreconf[] = {"autoreconf", "--install", NULL};
+        if (execute_command(autoreconf) != 0) {
+            fprintf(stderr, "Error: autoreconf failed\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Bring configure and the Makefile.in files up to date
+ *
+ * A change to configure.ac, autogen.sh or the autotools themselves
+ * reruns autogen. A change limited to some Makefile.am files only reruns
+ * automake for those directories.
+ *
+ * @return 0 if nothing was regenerated, 1 if some Makefile.in files were
+ *         regenerated, -1 on error
+ */
+static int update_autogen_phase(void) {
+    char fingerprint[HASH_HEX_SIZE];
+    autogen_fingerprint(fingerprint);
+
+    char **ams = NULL;
+    int am_count = 0;
+    collect_makefile_ams(&ams, &am_count);
+    if (am_count > 0) {
+        qsort(ams, am_count, sizeof(char *), compare_strings);
+    }
+
+    char (*am_hashes)[HASH_HEX_SIZE] = calloc(am_count ? am_count : 1, HASH_HEX_SIZE);
+    int *am_changed = calloc(am_count ? am_count : 1, sizeof(int));
+    int full = !file_exists("configure") || !state_matches("autogen", fingerprint);
+    int changed = 0;
+
+    for (int i = 0; i < am_count; i++) {
+        char key[PATH_MAX + 8];
+        snprintf(key, sizeof(key), "am:%s", ams[i]);
+        hash_file(ams[i], am_hashes[i]);
+
+        char *stored = read_setting(STATE_FILE, key);
+        char makefile_in[PATH_MAX];
+        snprintf(makefile_in, sizeof(makefile_in), "%.*sin", (int)strlen(ams[i]) - 2, ams[i]);
+
+        if (!stored || !file_exists(makefile_in)) {
+            // A new directory needs aclocal/autoconf to know about it
+            full = 1;
+        } else if (strcmp(stored, am_hashes[i]) != 0) {
+            am_changed[i] = 1;
+            changed++;
+        }
+        free(stored);
+    }
+
+    int ret = 0;
+    if (full) {
+        printf("Running autogen to generate configure script...\n");
+        if (run_autogen() != 0) {
+            ret = -1;
+            goto out;
+        }
+        printf("\n");
+        ret = 1;
+    } else if (changed > 0) {
+        // Only Makefile.am files changed: regenerate just their Makefile.in
+        for (int i = 0; i < am_count; i++) {
+            if (!am_changed[i]) {
+                continue;
+            }
+            char makefile[PATH_MAX];
+            printf("%s changed, running automake for it...\n", ams[i]);
+            snprintf(makefile, sizeof(makefile), "%.*s", (int)strlen(ams[i]) - 3, ams[i]);
+            char *const automake[] = {"automake", makefile, NULL};
+            if (execute_command(automake) != 0) {
+                fprintf(stderr, "Error: automake failed for %s\n", ams[i]);
+                ret = -1;
+                goto out;
+            }
+        }
+        printf("\n");
+        ret = 1;
+    }
+
+    // Record what the generated files now correspond to
+    if (full || changed > 0) {
+        state_record("autogen", fingerprint);
+        for (int i = 0; i < am_count; i++) {
+            char key[PATH_MAX + 8];
+            snprintf(key, sizeof(key), "am:%s", ams[i]);
+            state_record(key, am_hashes[i]);
+        }
+    }
+
+out:
+    free(am_hashes);
+    free(am_changed);
+    free_list(ams, am_count);
+    return ret;
+}
+
+/**
+ * Bring a configured build directory up to date
+ *
+ * Runs configure when the directory was never configured or the configure
+ * arguments/environment changed, "config.status --recheck" when only the
+ * configure script changed, and a plain config.status when only some
+ * Makefile.in files were regenerated.
+ *
+ * @param build_dir "." for the in-tree build, else a VPATH build directory
+ * @param args Extra arguments passed to configure
+ * @param cache_file Shared configure cache named in args, or NULL
+ * @param regenerated Whether the autogen phase regenerated any files
+ * @return 0 on success, -1 on error
+ */
+static int update_configure_phase(const char *build_dir, const char *args,
+                                  const char *cache_file, int regenerated) {
+    int in_tree = strcmp(build_dir, ".") == 0;
+    char script_hash[HASH_HEX_SIZE];
+    char args_hash[HASH_HEX_SIZE];
+    hash_file("configure", script_hash);
+    configure_args_fingerprint(args, args_hash);
+
+    // In-tree state keeps its historical keys; profiles are prefixed
+    char script_key[PATH_MAX + 32];
+    char args_key[PATH_MAX + 32];
+    snprintf(script_key, sizeof(script_key), "%s%sconfigure-script",
+             in_tree ? "" : build_dir, in_tree ? "" : ":");
+    snprintf(args_key, sizeof(args_key), "%s%sconfigure-args",
+             in_tree ? "" : build_dir, in_tree ? "" : ":");
+
+    // Commands run inside the build directory
+    const char *cwd = in_tree ? NULL : build_dir;
+    char top_srcdir[PATH_MAX] = ".";
+    if (!in_tree) {
+        top_srcdir[0] = '\0';
+        for (const char *p = build_dir; p; p = strchr(p + 1, '/')) {
+            strcat(top_srcdir, *top_srcdir ? "/.." : "..");
+        }
+    }
+
+    char makefile[PATH_MAX + 16];
+    char config_status[PATH_MAX + 16];
+    snprintf(makefile, sizeof(makefile), "%s/Makefile", build_dir);
+    snprintf(config_status, sizeof(config_status), "%s/config.status", build_dir);
+    int configured = file_exists(makefile) && file_exists(config_status);
+
+    char *const recheck[] = {"./config.status", "--recheck", NULL};
+    char *const config_status_argv[] = {"./config.status", NULL};
+
+    if (!configured || !state_matches(args_key, args_hash)) {
+        printf("Running configure%s%s...\n", in_tree ? "" : " in ", in_tree ? "" : build_dir);
+        arg_list configure = {0};
+        args_addf(&configure, "%s/configure", top_srcdir);
+        if (args_add_split(&configure, args) < 0) {
+            fprintf(stderr, "Error: Unbalanced quotes in configure arguments: %s\n", args);
+            args_free(&configure);
+            return -1;
+        }
+        int ret = execute_command_in(cwd, configure.argv);
+        if (ret != 0 && cache_file) {
+            // A stale or clashing shared cache must never break the build
+            printf("\nRetrying with a fresh configure cache...\n");
+            unlink(cache_file);
+            ret = execute_command_in(cwd, configure.argv);
+        }
+        args_free(&configure);
+        if (ret != 0) {
+            fprintf(stderr, "Error: configure failed\n");
+            return -1;
+        }
+        printf("\n");
+    } else if (!state_matches(script_key, script_hash)) {
+        printf("configure changed, rechecking with cached arguments...\n");
+        if (execute_command_in(cwd, recheck) != 0 ||
+            execute_command_in(cwd, config_status_argv) != 0) {
+            fprintf(stderr, "Error: config.status failed\n");
+            return -1;
+        }
+        printf("\n");
+    } else if (regenerated) {
+        printf("Regenerating Makefiles...\n");
+        if (execute_command_in(cwd, config_status_argv) != 0) {
+            fprintf(stderr, "Error: config.status failed\n");
+            return -1;
+        }
+        printf("\n");
+    } else {
+        return 0;
+    }
+
+    state_record(script_key, script_hash);
+    state_record(args_key, args_hash);
+    return 0;
+}
+
+// Interpret a yes/no style setting; returns -1 if unrecognized
+static int parse_bool(const char *value) {
+    if (strcmp(value, "yes") == 0 || strcmp(value, "true") == 0 ||
+        strcmp(value, "on") == 0 || strcmp(value, "1") == 0) {
+        return 1;
+    }
+    if (strcmp(value, "no") == 0 || strcmp(value, "false") == 0 ||
+        strcmp(value, "off") == 0 || strcmp(value, "0") == 0) {
+        return 0;
+    }
+    return -1;
+}
+
+// Append CC=<jc> cache cc <compiler> to the configure arguments
+static int append_cache_compiler(char *args, size_t size) {
+    char self[PATH_MAX];
+    if (get_self_path(self, sizeof(self)) != 0) {
+        fprintf(stderr, "Warning: Cannot locate the jc binary, building without the object cache\n");
+        return -1;
+    }
+
+    const char *compiler = getenv("CC");
+    char found[PATH_MAX];
+    if (!compiler || !*compiler) {
+        compiler = find_in_path("gcc", found, sizeof(found)) == 0 ? "gcc" : "cc";
+    }
+
+    size_t len = strlen(args);
+    snprintf(args + len, size - len, "%sCC='%s cache cc %s'", len ? " " : "", self, compiler);
+    return 0;
+}
+
+// The --host=<triplet> (or --host <triplet>) given to configure, if any
+static int host_argument(const char *args, char *output, size_t size) {
+    for (const char *p = strstr(args, "--host"); p; p = strstr(p + 1, "--host")) {
+        if (p > args && p[-1] != ' ' && p[-1] != '\'' && p[-1] != '"') {
+            continue;
+        }
+        const char *value = p + 6;
+        if (*value != '=' && *value != ' ') {
+            continue;
+        }
+        value += strspn(value, "= '\"");
+        size_t len = strcspn(value, " '\"");
+        if (len > 0 && len < size) {
+            snprintf(output, size, "%.*s", (int)len, value);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// The target triplet the compiler builds for ($CC -dumpmachine)
+static int compiler_triplet(const char *compiler, char *output, size_t size) {
+    arg_list command = {0};
+    if (args_add_split(&command, compiler) <= 0) {
+        args_free(&command);
+        return -1;
+    }
+    args_add(&command, "-dumpmachine");
+
+    process_options options = {0};
+    options.out = PROCESS_PIPE;
+    options.err = PROCESS_DISCARD;
+    options.capture = 1;
+    process_result result;
+    int ret = -1;
+    if (process_run(command.argv, &options, &result) == 0) {
+        if (process_status(&result) == 0 && result.output) {
+            size_t len = strcspn(result.output, "\r\n");
+            if (len > 0 && len < size) {
+                snprintf(output, size, "%.*s", (int)len, result.output);
+                ret = 0;
+            }
+        }
+        process_result_free(&result);
+    }
+    args_free(&command);
+    return ret;
+}
+
+/**
+ * Append --cache-file=<shared cache> to the configure arguments
+ *
+ * The cache lives in ~/.cache/jc/config-cache and is keyed by the target
+ * triplet (--host, else what the compiler reports), the compiler binary
+ * and everything else configure treats as precious (arguments and
+ * CC/CFLAGS style variables), so projects built with the same toolchain
+ * share probe results while a cross and a native compiler on one machine
+ * never do.
+ */
+static int append_config_cache(char *args, size_t size, char *cache_file, size_t cache_file_size) {
+    char cache_dir[PATH_MAX];
+    if (get_cache_dir(cache_dir, sizeof(cache_dir)) != 0) {
+        return -1;
+    }
+
+    char dir[PATH_MAX + 16];
+    snprintf(dir, sizeof(dir), "%s/config-cache", cache_dir);
+    if (create_directory(dir) != 0) {
+        return -1;
+    }
+
+    const char *compiler = getenv("CC");
+    char found[PATH_MAX];
+    if (!compiler || !*compiler) {
+        compiler = find_in_path("gcc", found, sizeof(found)) == 0 ? "gcc" : "cc";
+    }
+
+    char triplet[128];
+    if (host_argument(args, triplet, sizeof(triplet)) != 0 &&
+        compiler_triplet(compiler, triplet, sizeof(triplet)) != 0) {
+        struct utsname host;
+        if (uname(&host) != 0) {
+            return -1;
+        }
+        snprintf(triplet, sizeof(triplet), "%.60s-%.60s", host.machine, host.sysname);
+    }
+    // The triplet names the file, so keep it to characters safe in a path
+    for (char *c = triplet; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '.' && *c != '_' && *c != '-') {
+            *c = '_';
+        }
+    }
+
+    hash_ctx ctx;
+    char key[HASH_HEX_SIZE];
+    hash_init(&ctx);
+    hash_update_string(&ctx, triplet);
+    hash_update_program(&ctx, compiler);
+    hash_final(&ctx, key);
+
+    // Arguments and environment are part of the key as well
+    char args_hash[HASH_HEX_SIZE];
+    configure_args_fingerprint(args, args_hash);
+
+    snprintf(cache_file, cache_file_size, "%s/%s-%.16s-%.8s.cache", dir, triplet, key, args_hash);
+
+    size_t len = strlen(args);
+    snprintf(args + len, size - len, "%s--cache-file='%s'", len ? " " : "", cache_file);
+    return 0;
+}
 
 int cmd_build(int argc, char *argv[]) {
-    (void)argc;  // unused
-    (void)argv;  // unused
-    
+    int jobs = 0;
+    int jobs_given = 0;
+    int use_cache = -1;
+    int use_config_cache = -1;
+    int trace = 0;
+    int unity = -1;
+    int fail_fast = 0;
+    int raw_output = 0;
+    const char *json_path = NULL;
+    const char *backend = NULL;
+    char *backend_setting = NULL;
+
+    // The PGO and watch loops drive cmd_build themselves
+    for (int i = 1; i < argc && strcmp(argv[i], "--") != 0; i++) {
+        if (strcmp(argv[i], "--pgo") == 0) {
+            return pgo_build(argc, argv);
+        }
+        if (strcmp(argv[i], "--watch") == 0) {
+            return watch_build(argc, argv);
+        }
+    }
+
+    char *profile_name = take_profile_option(&argc, argv);
+    build_profile profile = {0};
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = NULL;
+
+        if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: '%s' requires a job count\n\n", arg);
+                print_build_usage();
+                return 1;
+            }
+            value = argv[++i];
+        } else if (strncmp(arg, "--jobs=", 7) == 0) {
+            value = arg + 7;
+        } else if (strncmp(arg, "-j", 2) == 0) {
+            value = arg + 2;
+        } else if (strcmp(arg, "--cache") == 0) {
+            use_cache = 1;
+            continue;
+        } else if (strcmp(arg, "--no-cache") == 0) {
+            use_cache = 0;
+            continue;
+        } else if (strcmp(arg, "--no-config-cache") == 0) {
+            use_config_cache = 0;
+            continue;
+        } else if (strcmp(arg, "--trace") == 0) {
+            trace = 1;
+            continue;
+        } else if (strcmp(arg, "--fail-fast") == 0) {
+            fail_fast = 1;
+            continue;
+        } else if (strcmp(arg, "--json") == 0) {
+            json_path = ".jc/diagnostics.json";
+            continue;
+        } else if (strncmp(arg, "--json=", 7) == 0) {
+            json_path = arg + 7;
+            continue;
+        } else if (strcmp(arg, "--raw-output") == 0) {
+            raw_output = 1;
+            continue;
+        } else if (strcmp(arg, "--unity") == 0) {
+            unity = 0;
+            continue;
+        } else if (strncmp(arg, "--unity=", 8) == 0) {
+            unity = parse_jobs(arg + 8);
+            if (unity < 0) {
+                fprintf(stderr, "Error: Invalid unity batch size '%s'\n", arg + 8);
+                free(profile_name);
+                return 1;
+            }
+            continue;
+        } else if (strcmp(arg, "--no-unity") == 0) {
+            unity = -2;
+            continue;
+        } else if (strcmp(arg, "--backend") == 0 && i + 1 < argc) {
+            backend = argv[++i];
+            continue;
+        } else if (strncmp(arg, "--backend=", 10) == 0) {
+            backend = arg + 10;
+            continue;
+        } else if (strcmp(arg, "--profile") == 0 && i + 1 < argc) {
+            free(profile_name);
+            profile_name = strdup(argv[++i]);
+            continue;
+        } else if (strncmp(arg, "--profile=", 10) == 0) {
+            free(profile_name);
+            profile_name = strdup(arg + 10);
+            continue;
+        } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            print_build_usage();
+            free(profile_name);
+            return 0;
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n\n", arg);
+            print_build_usage();
+            free(profile_name);
+            return 1;
+        }
+
+        jobs = parse_jobs(value);
+        if (jobs < 0) {
+            fprintf(stderr, "Error: Invalid job count '%s'\n", value);
+            free(profile_name);
+            return 1;
+        }
+        jobs_given = 1;
+    }
+
     if (!is_automake_project()) {
         fprintf(stderr, "Error: Not in an automake project directory\n");
         fprintf(stderr, "Please run this command in a directory containing configure.ac\n");
+        free(profile_name);
         return 1;
     }
 
-    printf("Building project...\n\n");
+    // Pick the backend: --backend, then 'backend' in .jc/config, then make
+    if (!backend) {
+        backend_setting = get_project_setting("backend");
+        backend = backend_setting ? backend_setting : "make";
+    }
+    if (strcmp(backend, "make") != 0 && strcmp(backend, "ninja") != 0) {
+        fprintf(stderr, "Error: Unknown backend '%s' (expected make or ninja)\n", backend);
+        free(backend_setting);
+        free(profile_name);
+        return 1;
+    }
+    int use_ninja = strcmp(backend, "ninja") == 0;
+    const char *backend_name = use_ninja ? "ninja" : "make";
+    free(backend_setting);
 
-    // Check if configure script exists
-    if (!file_exists("configure")) {
-        printf("Running autogen.sh to generate configure script...\n");
-        
-        // Try autogen.sh if it exists
-        if (file_exists("autogen.sh")) {
-            if (execute_command("./autogen.sh") != 0) {
-                fprintf(stderr, "Error: autogen.sh failed\n");
-                return 1;
+    char ninja[PATH_MAX];
+    if (use_ninja && find_in_path("ninja", ninja, sizeof(ninja)) != 0 &&
+        find_in_path("ninja-build", ninja, sizeof(ninja)) != 0) {
+        fprintf(stderr, "Error: ninja not found; install it or build with --backend=make\n");
+        free(profile_name);
+        return 1;
+    }
+
+    char build_dir[PATH_MAX];
+    profile_build_dir(profile_name, build_dir, sizeof(build_dir));
+
+    if (profile_name) {
+        if (profile_lookup(profile_name, &profile) != 0) {
+            fprintf(stderr, "Error: Unknown build profile '%s'\n", profile_name);
+            fprintf(stderr, "Built-in profiles: debug, release, asan, tsan\n");
+            fprintf(stderr, "Define others with profile.%s.cflags in .jc/config\n", profile_name);
+            free(profile_name);
+            return 1;
+        }
+
+        // Automake refuses VPATH builds next to an in-tree configuration
+        if (file_exists("config.status")) {
+            fprintf(stderr, "Error: The source tree has an in-tree build\n");
+            fprintf(stderr, "Run 'jc clean' once before using build profiles\n");
+            free(profile_name);
+            return 1;
+        }
+
+        create_directory("build");
+        if (create_directory(build_dir) != 0) {
+            free(profile_name);
+            return 1;
+        }
+        printf("Building profile '%s' in %s/...\n\n", profile_name, build_dir);
+    } else {
+        printf("Building project...\n\n");
+    }
+    free(profile_name);
+
+    if (trace && trace_begin() != 0) {
+        fprintf(stderr, "Warning: Could not set up build tracing, building without it\n");
+    }
+
+    // Ninja already buffers each job's output and stops at the first failure
+    int capture = !raw_output && !use_ninja;
+    if (use_ninja && json_path) {
+        fprintf(stderr, "Warning: --json needs the make backend, ignoring it\n");
+    } else if (raw_output && (json_path || fail_fast)) {
+        fprintf(stderr, "Warning: --json and --fail-fast need grouped output, ignoring them\n");
+    }
+    if (capture && diag_begin(fail_fast) != 0) {
+        fprintf(stderr, "Warning: Could not capture diagnostics, showing raw compiler output\n");
+        capture = 0;
+    }
+
+    // From here on every exit reports what was captured and frees make's arguments
+    arg_list make = {0};
+    int result_code = 1;
+    int make_failed = 0;
+    int stopped = 0;
+    char how[128];
+
+    // Regenerate the build system only where its inputs changed
+    long long phase_start = trace_now();
+    int regenerated = update_autogen_phase();
+    if (regenerated < 0) {
+        goto done;
+    }
+    trace_phase("autogen", phase_start, trace_now());
+
+    // Route compiles through the object cache when requested
+    char configure_args[PATH_MAX * 2] = "";
+    if (use_cache < 0) {
+        char *setting = get_project_setting("cache");
+        use_cache = setting ? parse_bool(setting) == 1 : 0;
+        free(setting);
+    }
+    if (use_cache) {
+        append_cache_compiler(configure_args, sizeof(configure_args));
+    }
+
+    if (strcmp(build_dir, ".") != 0) {
+        size_t len = strlen(configure_args);
+        snprintf(configure_args + len, sizeof(configure_args) - len,
+                 "%sCFLAGS='%s' LDFLAGS='%s'", len ? " " : "", profile.cflags, profile.ldflags);
+    }
+
+    // Share configure probe results between projects with the same toolchain
+    char cache_file[PATH_MAX * 2] = "";
+    if (use_config_cache < 0) {
+        char *setting = get_project_setting("config_cache");
+        use_config_cache = setting ? parse_bool(setting) != 0 : 1;
+        free(setting);
+    }
+    if (use_config_cache) {
+        append_config_cache(configure_args, sizeof(configure_args), cache_file, sizeof(cache_file));
+    }
+
+    phase_start = trace_now();
+    if (update_configure_phase(build_dir, configure_args, *cache_file ? cache_file : NULL,
+                               regenerated) != 0) {
+        goto done;
+    }
+    trace_phase("configure", phase_start, trace_now());
+
+    // Pick the job count: command line, then .jc/config, then auto-detect.
+    // When a parent make already runs a jobserver, inherit it instead.
+    if (!jobs_given) {
+        char *setting = get_project_setting("jobs");
+        if (setting) {
+            jobs = parse_jobs(setting);
+            if (jobs < 0) {
+                fprintf(stderr, "Warning: Ignoring invalid 'jobs' value in .jc/config: %s\n", setting);
+                jobs = 0;
             }
+            free(setting);
+        }
+    }
+
+    if (use_ninja) {
+        // Translate the Makefile.am files configure just processed
+        if (ninja_generate(build_dir) != 0) {
+            fprintf(stderr, "Build with --backend=make instead\n");
+            goto done;
+        }
+        if (jobs == 0) {
+            jobs = detect_job_count();
+        }
+        printf("Running ninja with %d job%s...\n", jobs, jobs == 1 ? "" : "s");
+        args_add(&make, ninja);
+        args_add(&make, "-C");
+        args_add(&make, build_dir);
+        args_addf(&make, "-j%d", jobs);
+    } else {
+        int jobserver = !jobs_given && makeflags_has_jobserver();
+        if (jobserver) {
+            printf("Running make (using parent jobserver)...\n");
         } else {
-            // Fall back to autoreconf
-            if (execute_command("autoreconf --install") != 0) {
-                fprintf(stderr, "Error: autoreconf failed\n");
-                return 1;
+            if (jobs == 0) {
+                jobs = detect_job_count();
             }
+            printf("Running make with %d job%s...\n", jobs, jobs == 1 ? "" : "s");
+        }
+        args_add(&make, "make");
+        if (strcmp(build_dir, ".") != 0) {
+            args_add(&make, "-C");
+            args_add(&make, build_dir);
+        }
+        if (!jobserver) {
+            args_addf(&make, "-j%d", jobs);
         }
-        printf("\n");
     }
 
-    // Check if Makefile exists (need to run configure)
-    if (!file_exists("Makefile")) {
-        printf("Running configure...\n");
-        if (execute_command("./configure") != 0) {
-            fprintf(stderr, "Error: configure failed\n");
-            return 1;
+    // Batch src/ sources into unity files: 'unity = yes|no|<n>' in .jc/config
+    if (unity == -1) {
+        char *setting = get_project_setting("unity");
+        if (setting) {
+            int enabled = parse_bool(setting);
+            unity = enabled == 1 ? 0 : enabled == 0 ? -2 : parse_jobs(setting);
+            if (unity == -1) {
+                fprintf(stderr, "Warning: Ignoring invalid 'unity' value in .jc/config: %s\n", setting);
+            }
+            free(setting);
         }
-        printf("\n");
     }
+    if (unity >= 0 && use_ninja) {
+        fprintf(stderr, "Warning: Unity builds need the make backend, building without\n");
+    }
+    char unity_env[PATH_MAX + 32] = "";
+    if (unity >= 0 && !use_ninja) {
+        unity_prepare(build_dir, unity, jobs, unity_env, sizeof(unity_env));
+    }
+
+    if ((trace_active() || capture) && !use_ninja) {
+        args_add(&make, trace_make_args());
+    }
+
+    char display[PATH_MAX * 4];
+    process_format(make.argv, display, sizeof(display));
+    printf("Executing: %s%s%s\n", unity_env, *unity_env ? " " : "", display);
+    fflush(stdout);
+
+    char *const env[] = {unity_env, NULL};
+    process_options options = {0};
+    options.env = *unity_env ? env : NULL;
+    // --fail-fast stops make by signalling its process group
+    options.new_group = capture && fail_fast;
+    process_result result;
+    long ninja_log_offset = use_ninja ? trace_ninja_offset(build_dir) : 0;
+    phase_start = trace_now();
+    if (process_run(make.argv, &options, &result) != 0) {
+        snprintf(how, sizeof(how), "%s", strerror(errno));
+        make_failed = 1;
+    } else if (process_status(&result) != 0) {
+        process_describe(&result, how, sizeof(how));
+        make_failed = 1;
+        stopped = capture && fail_fast && result.signaled && result.signal == SIGTERM;
+    }
+    trace_phase(backend_name, phase_start, trace_now());
+    if (use_ninja) {
+        trace_ninja_edges(build_dir, ninja_log_offset, phase_start);
+    }
+    result_code = make_failed;
+
+done:
+    // Report even a failed build; the trace shows where it stopped
+    if (capture) {
+        diag_report(json_path);
+    }
+    if (trace_active()) {
+        trace_report(backend_name);
+    }
+    args_free(&make);
 
-    // Run make
-    printf("Running make...\n");
-    if (execute_command("make") != 0) {
-        fprintf(stderr, "Error: make failed\n");
+    if (result_code != 0) {
+        if (stopped) {
+            fprintf(stderr, "Error: Stopped at the first failing job (--fail-fast)\n");
+        } else if (make_failed) {
+            fprintf(stderr, "Error: %s failed (%s)\n", backend_name, how);
+        }
         return 1;
     }
 
+    // Record what was built so run, bt and test find it without searching
+    if (manifest_update(*profile.name ? profile.name : NULL, build_dir) != 0) {
+        fprintf(stderr, "Warning: Could not write %s\n", MANIFEST_FILE);
+    }
     printf("\n✓ Build completed successfully!\n");
     return 0;
 }
@@ -0,0 +1,508 @@
+#include "jc.h"
+#include "utils.h"
+#include "hash.h"
+#include "process.h"
+#include "compile_args.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// Default upper bound for the object cache (5 GiB)
+#define DEFAULT_MAX_SIZE (5LL * 1024 * 1024 * 1024)
+
+// A cache entry seen while scanning for eviction
+typedef struct {
+    char path[PATH_MAX + 80];
+    time_t mtime;
+    long long size;
+} cache_entry;
+
+// Print usage information for cache command
+static void print_cache_usage(void) {
+    printf("Usage: jc cache <subcommand>\n\n");
+    printf("Subcommands:\n");
+    printf("  stats              Show object cache statistics\n");
+    printf("  clear              Remove all cached objects\n");
+    printf("  cc <compiler> ...  Compile through the cache (used as CC by 'jc build --cache')\n\n");
+    printf("Environment:\n");
+    printf("  JC_CACHE_DIR       Cache location (default: ~/.cache/jc)\n");
+    printf("  JC_CACHE_MAXSIZE   Size limit, e.g. 500M or 5G (default: 5G)\n");
+    printf("  JC_CACHE_DISABLE   Set to bypass the cache in 'jc cache cc'\n\n");
+}
+
+// Feed one line of the preprocessor output into the key
+static void hash_output_line(void *context, int fd, const char *line, size_t len) {
+    (void)fd;
+    hash_update((hash_ctx *)context, line, len);
+}
+
+/**
+ * Run a command, optionally hashing its stdout and/or capturing its stderr
+ *
+ * @param argv The command to run
+ * @param stdout_hash If non-NULL, stdout is fed into this hash
+ * @param err If non-NULL, receives a malloc'd copy of stderr
+ * @param err_len Length of the captured stderr
+ * @return The exit status, 128+signal if killed, or -1 on error
+ */
+static int run_compiler(char *argv[], hash_ctx *stdout_hash, char **err, size_t *err_len) {
+    process_options options = {0};
+    if (stdout_hash) {
+        // Preprocessing: diagnostics are reproduced by the real compile
+        options.out = PROCESS_PIPE;
+        options.err = PROCESS_DISCARD;
+        options.on_line = hash_output_line;
+        options.context = stdout_hash;
+    } else {
+        options.err = PROCESS_PIPE;
+        options.capture = err != NULL;
+    }
+
+    process_result result;
+    if (process_run(argv, &options, &result) != 0) {
+        return -1;
+    }
+
+    if (err) {
+        *err = result.errors;
+        *err_len = result.errors_len;
+        result.errors = NULL;
+    }
+    process_result_free(&result);
+    return process_status(&result);
+}
+
+// Copy src to dst through a temporary file so readers never see partial data
+static int copy_atomic(const char *src, const char *dst) {
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", dst, (long)getpid());
+    if (copy_file(src, tmp) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    if (rename(tmp, dst) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static long long file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long long)st.st_size : 0;
+}
+
+// Parse sizes like "500M", "5G" or plain bytes
+static long long parse_size(const char *value) {
+    char *end;
+    double size = strtod(value, &end);
+    switch (*end) {
+    case 'k': case 'K': size *= 1024; break;
+    case 'm': case 'M': size *= 1024 * 1024; break;
+    case 'g': case 'G': size *= 1024.0 * 1024 * 1024; break;
+    default: break;
+    }
+    return size > 0 ? (long long)size : DEFAULT_MAX_SIZE;
+}
+
+static long long cache_max_size(const char *objects_dir) {
+    const char *env = getenv("JC_CACHE_MAXSIZE");
+    if (env && *env) {
+        return parse_size(env);
+    }
+
+    char config[PATH_MAX];
+    snprintf(config, sizeof(config), "%s/../config", objects_dir);
+    char *value = read_setting(config, "max_size");
+    long long size = value ? parse_size(value) : DEFAULT_MAX_SIZE;
+    free(value);
+    return size;
+}
+
+static void format_size(long long bytes, char *output, size_t size) {
+    if (bytes >= 1024LL * 1024 * 1024) {
+        snprintf(output, size, "%.1f GB", bytes / (1024.0 * 1024 * 1024));
+    } else if (bytes >= 1024 * 1024) {
+        snprintf(output, size, "%.1f MB", bytes / (1024.0 * 1024));
+    } else {
+        snprintf(output, size, "%.1f KB", bytes / 1024.0);
+    }
+}
+
+// Take the cache-wide lock protecting the stats file
+static int lock_cache(const char *objects_dir) {
+    char path[PATH_MAX + 8];
+    snprintf(path, sizeof(path), "%s/lock", objects_dir);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct flock fl = {0};
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &fl) != 0) {
+        if (errno != EINTR) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static long long stat_value(const char *stats_path, const char *key) {
+    char *value = read_setting(stats_path, key);
+    long long n = value ? atoll(value) : 0;
+    free(value);
+    return n;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const cache_entry *x = a;
+    const cache_entry *y = b;
+    return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/**
+ * Evict least recently used entries until the cache is below 90% of
+ * its limit. Hits refresh an entry's mtime, so mtime order is LRU order.
+ *
+ * @return The size of the cache after eviction
+ */
+static long long evict_entries(const char *objects_dir, long long max_size) {
+    cache_entry *entries = NULL;
+    int count = 0;
+    int capacity = 0;
+    long long total = 0;
+
+    DIR *top = opendir(objects_dir);
+    if (!top) {
+        return 0;
+    }
+
+    struct dirent *bucket;
+    while ((bucket = readdir(top)) != NULL) {
+        if (strlen(bucket->d_name) != 2) {
+            continue;
+        }
+
+        char bucket_path[PATH_MAX + 8];
+        snprintf(bucket_path, sizeof(bucket_path), "%s/%s", objects_dir, bucket->d_name);
+        DIR *d = opendir(bucket_path);
+        if (!d) {
+            continue;
+        }
+
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+            size_t len = strlen(entry->d_name);
+            if (len < 3 || strcmp(entry->d_name + len - 2, ".o") != 0) {
+                continue;
+            }
+
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                entries = realloc(entries, capacity * sizeof(cache_entry));
+            }
+
+            cache_entry *e = &entries[count];
+            snprintf(e->path, sizeof(e->path), "%s/%.*s", bucket_path, (int)len - 2, entry->d_name);
+
+            char file[PATH_MAX + 96];
+            struct stat st;
+            snprintf(file, sizeof(file), "%s.o", e->path);
+            if (stat(file, &st) != 0) {
+                continue;
+            }
+            e->mtime = st.st_mtime;
+            e->size = st.st_size;
+            snprintf(file, sizeof(file), "%s.d", e->path);
+            e->size += file_size(file);
+            snprintf(file, sizeof(file), "%s.stderr", e->path);
+            e->size += file_size(file);
+
+            total += e->size;
+            count++;
+        }
+        closedir(d);
+    }
+    closedir(top);
+
+    if (total > max_size && count > 0) {
+        qsort(entries, count, sizeof(cache_entry), compare_entries);
+        long long target = max_size / 10 * 9;
+        for (int i = 0; i < count && total > target; i++) {
+            char file[PATH_MAX + 96];
+            snprintf(file, sizeof(file), "%s.o", entries[i].path);
+            unlink(file);
+            snprintf(file, sizeof(file), "%s.d", entries[i].path);
+            unlink(file);
+            snprintf(file, sizeof(file), "%s.stderr", entries[i].path);
+            unlink(file);
+            total -= entries[i].size;
+        }
+    }
+
+    free(entries);
+    return total;
+}
+
+// Record one cache event and evict if the cache grew past its limit
+static void update_stats(const char *objects_dir, int hit, int miss, int uncacheable, long long added) {
+    int lock = lock_cache(objects_dir);
+    if (lock < 0) {
+        return;
+    }
+
+    char stats_path[PATH_MAX + 16];
+    snprintf(stats_path, sizeof(stats_path), "%s/stats", objects_dir);
+
+    long long hits = stat_value(stats_path, "hits") + hit;
+    long long misses = stat_value(stats_path, "misses") + miss;
+    long long skipped = stat_value(stats_path, "uncacheable") + uncacheable;
+    long long size = stat_value(stats_path, "size") + added;
+
+    if (added > 0) {
+        long long max_size = cache_max_size(objects_dir);
+        if (size > max_size) {
+            size = evict_entries(objects_dir, max_size);
+        }
+    }
+
+    char content[256];
+    snprintf(content, sizeof(content),
+             "hits = %lld\nmisses = %lld\nuncacheable = %lld\nsize = %lld\n",
+             hits, misses, skipped, size);
+    write_file(stats_path, content);
+    close(lock);
+}
+
+static int get_objects_dir(char *output, size_t size) {
+    char cache_dir[PATH_MAX];
+    if (get_cache_dir(cache_dir, sizeof(cache_dir)) != 0) {
+        return -1;
+    }
+    if (snprintf(output, size, "%s/objects", cache_dir) >= (int)size) {
+        return -1;
+    }
+    return create_directory(output);
+}
+
+/**
+ * Compile through the object cache
+ *
+ * The key is a hash of the compiler identity, the command line (minus
+ * the depfile location), the directory when debug info records it, and
+ * the preprocessed source. On a hit the object,
+ * depfile and any compiler diagnostics are restored from the cache.
+ */
+static int cache_compile(int argc, char *argv[]) {
+    char objects_dir[PATH_MAX];
+    compile_args args;
+    parse_compile_args(argc, argv, &args);
+
+    const char *disable = getenv("JC_CACHE_DISABLE");
+    int disabled = disable && *disable;
+    int have_dir = !disabled && get_objects_dir(objects_dir, sizeof(objects_dir)) == 0;
+
+    if (!args.cacheable || !have_dir) {
+        free(args.preprocess_argv);
+        if (have_dir && args.compile_only) {
+            update_stats(objects_dir, 0, 0, 1, 0);
+        }
+        execvp(argv[0], argv);
+        fprintf(stderr, "jc cache: cannot run %s\n", argv[0]);
+        return 127;
+    }
+
+    // Default output names follow the compiler's own rules
+    char default_output[PATH_MAX];
+    if (!args.output) {
+        const char *base = strrchr(args.source, '/');
+        base = base ? base + 1 : args.source;
+        const char *dot = strrchr(base, '.');
+        int len = dot ? (int)(dot - base) : (int)strlen(base);
+        snprintf(default_output, sizeof(default_output), "%.*s.o", len, base);
+        args.output = default_output;
+    }
+
+    char default_depfile[PATH_MAX];
+    if (args.wants_deps && !args.depfile) {
+        const char *dot = strrchr(args.output, '.');
+        int len = dot ? (int)(dot - args.output) : (int)strlen(args.output);
+        snprintf(default_depfile, sizeof(default_depfile), "%.*s.d", len, args.output);
+        args.depfile = default_depfile;
+    }
+
+    hash_ctx ctx;
+    hash_init(&ctx);
+    compile_args_hash(&ctx, argc, argv);
+
+    if (run_compiler(args.preprocess_argv, &ctx, NULL, NULL) != 0) {
+        // Let the real compiler report the error
+        free(args.preprocess_argv);
+        execvp(argv[0], argv);
+        return 127;
+    }
+    free(args.preprocess_argv);
+
+    char key[HASH_HEX_SIZE];
+    hash_final(&ctx, key);
+
+    char bucket[PATH_MAX + 8];
+    char entry[PATH_MAX + HASH_HEX_SIZE + 8];
+    char object[PATH_MAX + HASH_HEX_SIZE + 16];
+    char depfile[PATH_MAX + HASH_HEX_SIZE + 16];
+    char stderr_file[PATH_MAX + HASH_HEX_SIZE + 16];
+    snprintf(bucket, sizeof(bucket), "%s/%.2s", objects_dir, key);
+    snprintf(entry, sizeof(entry), "%s/%s", bucket, key + 2);
+    snprintf(object, sizeof(object), "%s.o", entry);
+    snprintf(depfile, sizeof(depfile), "%s.d", entry);
+    snprintf(stderr_file, sizeof(stderr_file), "%s.stderr", entry);
+
+    // Hit: restore outputs and replay diagnostics
+    if (file_exists(object) && (!args.depfile || file_exists(depfile))) {
+        if (copy_atomic(object, args.output) == 0 &&
+            (!args.depfile || copy_atomic(depfile, args.depfile) == 0)) {
+            char *diagnostics = read_file(stderr_file);
+            if (diagnostics) {
+                fputs(diagnostics, stderr);
+                free(diagnostics);
+            }
+            utimensat(AT_FDCWD, object, NULL, 0);
+            update_stats(objects_dir, 1, 0, 0, 0);
+            return 0;
+        }
+    }
+
+    // Miss: compile for real and store the results
+    char *diagnostics = NULL;
+    size_t diagnostics_len = 0;
+    int ret = run_compiler(argv, NULL, &diagnostics, &diagnostics_len);
+    if (diagnostics_len > 0) {
+        fwrite(diagnostics, 1, diagnostics_len, stderr);
+    }
+
+    if (ret != 0) {
+        free(diagnostics);
+        return ret < 0 ? 1 : ret;
+    }
+
+    long long added = 0;
+    create_directory(bucket);
+    if (args.depfile && copy_atomic(args.depfile, depfile) == 0) {
+        added += file_size(depfile);
+    }
+    if (diagnostics_len > 0) {
+        char tmp[PATH_MAX + HASH_HEX_SIZE + 48];
+        snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", stderr_file, (long)getpid());
+        FILE *f = fopen(tmp, "w");
+        if (f) {
+            fwrite(diagnostics, 1, diagnostics_len, f);
+            fclose(f);
+            rename(tmp, stderr_file);
+            added += diagnostics_len;
+        }
+    }
+    // The object goes last: its presence marks the entry complete
+    if (copy_atomic(args.output, object) == 0) {
+        added += file_size(object);
+    }
+
+    free(diagnostics);
+    update_stats(objects_dir, 0, 1, 0, added);
+    return 0;
+}
+
+static int cache_stats(void) {
+    char objects_dir[PATH_MAX];
+    if (get_objects_dir(objects_dir, sizeof(objects_dir)) != 0) {
+        fprintf(stderr, "Error: Cannot access the cache directory\n");
+        return 1;
+    }
+
+    char stats_path[PATH_MAX + 16];
+    snprintf(stats_path, sizeof(stats_path), "%s/stats", objects_dir);
+
+    long long hits = stat_value(stats_path, "hits");
+    long long misses = stat_value(stats_path, "misses");
+    long long uncacheable = stat_value(stats_path, "uncacheable");
+    long long size = stat_value(stats_path, "size");
+    long long max_size = cache_max_size(objects_dir);
+    long long lookups = hits + misses;
+
+    char size_str[32];
+    char max_str[32];
+    format_size(size, size_str, sizeof(size_str));
+    format_size(max_size, max_str, sizeof(max_str));
+
+    printf("Cache directory:  %s\n", objects_dir);
+    printf("Hits:             %lld\n", hits);
+    printf("Misses:           %lld\n", misses);
+    printf("Hit rate:         %.1f%%\n", lookups ? 100.0 * hits / lookups : 0.0);
+    printf("Uncacheable:      %lld\n", uncacheable);
+    printf("Size:             %s / %s\n", size_str, max_str);
+    return 0;
+}
+
+static int cache_clear(void) {
+    char objects_dir[PATH_MAX];
+    if (get_objects_dir(objects_dir, sizeof(objects_dir)) != 0) {
+        fprintf(stderr, "Error: Cannot access the cache directory\n");
+        return 1;
+    }
+
+    int lock = lock_cache(objects_dir);
+    DIR *d = opendir(objects_dir);
+    if (d) {
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (strlen(entry->d_name) == 2 && entry->d_name[0] != '.') {
+                char path[PATH_MAX + 264];
+                snprintf(path, sizeof(path), "%s/%s", objects_dir, entry->d_name);
+                remove_directory(path);
+            }
+        }
+        closedir(d);
+    }
+
+    char stats_path[PATH_MAX + 16];
+    snprintf(stats_path, sizeof(stats_path), "%s/stats", objects_dir);
+    unlink(stats_path);
+    if (lock >= 0) {
+        close(lock);
+    }
+
+    printf("✓ Object cache cleared\n");
+    return 0;
+}
+
+int cmd_cache(int argc, char *argv[]) {
+    if (argc < 2) {
+        print_cache_usage();
+        return 1;
+    }
+
+    const char *subcommand = argv[1];
+
+    if (strcmp(subcommand, "cc") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Error: 'cc' requires a compiler command\n");
+            return 1;
+        }
+        return cache_compile(argc - 2, argv + 2);
+    } else if (strcmp(subcommand, "stats") == 0) {
+        return cache_stats();
+    } else if (strcmp(subcommand, "clear") == 0) {
+        return cache_clear();
+    } else {
+        fprintf(stderr, "Error: Unknown subcommand '%s'\n\n", subcommand);
+        print_cache_usage();
+        return 1;
+    }
+}
@@ -2,38 +2,6 @@
 #include "utils.h"
 #include <dirent.h>
 
-// Helper function to remove a directory recursively
-static int remove_directory(const char *path) {
-    DIR *d = opendir(path);
-    if (!d) {
-        return 0; // Directory doesn't exist or can't be opened
-    }
-    
-    struct dirent *entry;
-    char filepath[1024];
-    
-    while ((entry = readdir(d)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        
-        snprintf(filepath, sizeof(filepath), "%s/%s", path, entry->d_name);
-        
-        struct stat st;
-        if (stat(filepath, &st) == 0) {
-            if (S_ISDIR(st.st_mode)) {
-                remove_directory(filepath);
-            } else {
-                unlink(filepath);
-            }
-        }
-    }
-    
-    closedir(d);
-    rmdir(path);
-    return 0;
-}
-
 // Helper function to remove a file if it exists
 static void remove_file_if_exists(const char *path) {
     if (file_exists(path)) {
@@ -120,6 +88,34 @@ static void clean_src_directory(void) {
     closedir(d);
 }
 
+// Remove configured build/<profile> directories, leaving anything else alone
+static void clean_profile_builds(void) {
+    DIR *d = opendir("build");
+    if (!d) {
+        return;
+    }
+
+    struct dirent *entry;
+    char path[1024];
+    char config_status[1100];
+
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "build/%s", entry->d_name);
+        snprintf(config_status, sizeof(config_status), "%s/config.status", path);
+        if (directory_exists(path) && file_exists(config_status)) {
+            printf("  Removing %s/\n", path);
+            remove_directory(path);
+        }
+    }
+
+    closedir(d);
+    rmdir("build");
+}
+
 int cmd_clean(int argc, char *argv[]) {
     (void)argc;  // unused
     (void)argv;  // unused
@@ -135,10 +131,12 @@ int cmd_clean(int argc, char *argv[]) {
     // If Makefile exists, use make clean and make distclean
     if (file_exists("Makefile")) {
         printf("Running make clean...\n");
-        execute_command_quiet("make clean 2>/dev/null");
+        char *const clean[] = {"make", "clean", NULL};
+        execute_command_quiet(clean);
         
         printf("Running make distclean...\n");
-        execute_command_quiet("make distclean 2>/dev/null");
+        char *const distclean[] = {"make", "distclean", NULL};
+        execute_command_quiet(distclean);
         printf("\n");
     }
 
@@ -153,6 +151,9 @@ int cmd_clean(int argc, char *argv[]) {
     
     // Remove object files and executables in src/
     clean_src_directory();
+
+    // Remove out-of-tree profile builds (build/<profile>/)
+    clean_profile_builds();
     
     // Remove generated files
     remove_file_if_exists("config.log");
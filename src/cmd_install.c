@@ -1,27 +1,38 @@
 #include "jc.h"
 #include "utils.h"
+#include "build_profile.h"
+#include <limits.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
 
 int cmd_install(int argc, char *argv[]) {
-    (void)argc;  // unused
-    (void)argv;  // unused
-    
     if (!is_automake_project()) {
         fprintf(stderr, "Error: Not in an automake project directory\n");
         return 1;
     }
 
+    char *profile = take_profile_option(&argc, argv);
+
     // Ensure project is built
-    if (!file_exists("Makefile")) {
-        printf("Project not configured. Building first...\n");
-        if (cmd_build(0, NULL) != 0) {
-            return 1;
-        }
+    if (ensure_built(profile) != 0) {
+        free(profile);
+        return 1;
     }
 
     printf("Installing project...\n\n");
 
-    // Run make install
-    if (execute_command("make install") != 0) {
+    // Run make install in the profile's build tree
+    char build_dir[PATH_MAX] = ".";
+    if (profile) {
+        profile_build_dir(profile, build_dir, sizeof(build_dir));
+    }
+    free(profile);
+
+    char *const install[] = {"make", "-C", build_dir, "install", NULL};
+    char *const install_in_tree[] = {"make", "install", NULL};
+    if (execute_command(strcmp(build_dir, ".") == 0 ? install_in_tree : install) != 0) {
         fprintf(stderr, "\nError: Installation failed\n");
         fprintf(stderr, "You may need to run with sudo: sudo jc install\n");
         return 1;
@@ -11,6 +11,8 @@ static const char *configure_ac_template =
 "\n"
 "# Checks for programs\n"
 "AC_PROG_CC\n"
+"AM_PROG_AR\n"
+"AC_PROG_RANLIB\n"
 "\n"
 "# Check for Check testing framework (optional for testing)\n"
 "AC_ARG_ENABLE([tests],\n"
@@ -54,8 +56,8 @@ static const char *src_makefile_am_template =
 "# Source files\n"
 "%s_SOURCES = main.c\n"
 "\n"
-"# Compiler flags\n"
-"%s_CFLAGS = -Wall -Wextra -std=c11 -g -I$(srcdir)/include\n"
+"# Compiler flags (optimization and debug info come from CFLAGS, see 'jc build --profile')\n"
+"%s_CFLAGS = -Wall -Wextra -std=c11 -I$(srcdir)/include\n"
 "\n"
 "# Custom build rule to put executable in build directory\n"
 "all-local:\n"
@@ -146,8 +148,13 @@ static const char *gitignore_template =
 "*.a\n"
 "*.so\n"
 "*.dylib\n"
+"*.gch\n"
 "src/%s\n"
 "\n"
+"# jc local state (keep the shared .jc/config)\n"
+".jc/*\n"
+"!.jc/config\n"
+"\n"
 "# Debug\n"
 "*.dSYM/\n"
 "core\n"
@@ -0,0 +1,224 @@
+#include "jc.h"
+#include "utils.h"
+#include "build_profile.h"
+#include "process.h"
+#include "profile.h"
+#include <errno.h>
+#include <limits.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define PROFILE_DIR ".jc/profile"
+#define PROFILE_LIBRARY "libjc_prof.so"
+
+// Functions listed after the run
+#define PROFILE_TOP 15
+
+static void print_profile_usage(void) {
+    printf("Usage: jc profile [--freq=HZ] [--sampler=perf|preload] [--profile=NAME] [target] [--] [args...]\n");
+    printf("\nRuns the program under a sampling profiler and writes\n");
+    printf("%s/<program>.folded and %s/<program>.svg (a flame graph).\n", PROFILE_DIR, PROFILE_DIR);
+}
+
+// Run the program with libjc_prof.so preloaded, then read what it recorded
+static int run_preloaded(char *const argv[], const char *samples_path, int frequency,
+                         profile_data *data, process_result *result) {
+    char preload[PATH_MAX * 2];
+    if (get_preload_env(PROFILE_LIBRARY, preload, sizeof(preload)) != 0) {
+        fprintf(stderr, "Error: Cannot find %s (set JC_LIB_DIR to its directory)\n", PROFILE_LIBRARY);
+        return -1;
+    }
+    char file_env[PATH_MAX + 96];
+    snprintf(file_env, sizeof(file_env), "%s=%s", PROFILE_FILE_ENV, samples_path);
+    char hz_env[64];
+    snprintf(hz_env, sizeof(hz_env), "%s=%d", PROFILE_HZ_ENV, frequency);
+    char *env[] = {preload, file_env, hz_env, NULL};
+
+    unlink(samples_path);
+    process_options options = {0};
+    options.env = env;
+    if (process_run(argv, &options, result) != 0) {
+        fprintf(stderr, "Error: Cannot run %s: %s\n", argv[0], strerror(errno));
+        return -1;
+    }
+    if (profile_load_preload(data, samples_path) != 0) {
+        fprintf(stderr, "Error: The profiler recorded nothing (was %s loaded?)\n", PROFILE_LIBRARY);
+        return -1;
+    }
+    unlink(samples_path);
+    return 0;
+}
+
+int cmd_profile(int argc, char *argv[]) {
+    if (!is_automake_project()) {
+        fprintf(stderr, "Error: Not in an automake project directory\n");
+        return 1;
+    }
+
+    char *profile = take_profile_option(&argc, argv);
+    int frequency = 999;
+    const char *sampler = NULL;
+    int separated = 0;
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--") == 0) {
+            argv++;
+            argc--;
+            separated = 1;
+            break;
+        } else if (strncmp(argv[1], "--freq=", 7) == 0) {
+            frequency = atoi(argv[1] + 7);
+            if (frequency < 1 || frequency > 10000) {
+                fprintf(stderr, "Error: --freq must be between 1 and 10000 Hz\n");
+                free(profile);
+                return 1;
+            }
+        } else if (strncmp(argv[1], "--sampler=", 10) == 0) {
+            sampler = argv[1] + 10;
+            if (strcmp(sampler, "perf") != 0 && strcmp(sampler, "preload") != 0) {
+                fprintf(stderr, "Error: Unknown sampler '%s' (use perf or preload)\n", sampler);
+                free(profile);
+                return 1;
+            }
+        } else if (strcmp(argv[1], "--help") == 0) {
+            print_profile_usage();
+            free(profile);
+            return 0;
+        } else {
+            break;
+        }
+        argv++;
+        argc--;
+    }
+
+    if (ensure_built(profile) != 0) {
+        free(profile);
+        return 1;
+    }
+
+    const char *target = separated ? NULL : take_target_argument(&argc, argv, profile);
+    char executable[PATH_MAX];
+    int found = find_built_executable(profile, target, executable, sizeof(executable)) == 0;
+    free(profile);
+    if (!found && target) {
+        fprintf(stderr, "Error: Program '%s' has not been built\n", target);
+        return 1;
+    } else if (!found) {
+        fprintf(stderr, "Error: Could not find executable to profile\n");
+        fprintf(stderr, "Make sure the project is built successfully\n");
+        return 1;
+    }
+
+    const char *program = strrchr(executable, '/');
+    program = program ? program + 1 : executable;
+    create_directory(".jc");
+    create_directory(PROFILE_DIR);
+
+    // perf events sample the whole process tree; the preloaded sampler is the fallback
+    profile_data data = {0};
+    profile_perf perf;
+    int use_perf = !sampler || strcmp(sampler, "perf") == 0;
+    if (use_perf && profile_perf_open(&perf, &data, frequency) != 0) {
+        if (sampler) {
+            fprintf(stderr, "Error: Cannot open perf events: %s\n", strerror(errno));
+            return 1;
+        }
+        fprintf(stderr, "Warning: perf events are unavailable (%s); using %s\n", strerror(errno),
+                PROFILE_LIBRARY);
+        use_perf = 0;
+    }
+
+    printf("Profiling: %s (%s at %d Hz)\n", executable,
+           !use_perf ? "SIGPROF sampler" : perf.hardware ? "perf, cycles" : "perf, cpu-clock", frequency);
+    printf("----------------------------------------\n");
+    fflush(stdout);
+
+    argv[0] = executable;
+    process_result result;
+    int failed;
+    if (use_perf) {
+        process_options options = {0};
+        options.watch_fd = perf.fds[0];
+        options.on_ready = profile_perf_drain;
+        options.context = &perf;
+        failed = process_run(argv, &options, &result) != 0;
+        if (failed) {
+            fprintf(stderr, "Error: Cannot run %s: %s\n", executable, strerror(errno));
+        } else {
+            profile_perf_drain(&perf, -1);
+        }
+        profile_perf_close(&perf);
+    } else {
+        char cwd[PATH_MAX];
+        char samples_path[PATH_MAX + 64];
+        if (!getcwd(cwd, sizeof(cwd))) {
+            fprintf(stderr, "Error: Cannot get current directory\n");
+            return 1;
+        }
+        int written = snprintf(samples_path, sizeof(samples_path), "%s/%s/%s.samples",
+                               cwd, PROFILE_DIR, program);
+        if (written < 0 || (size_t)written >= sizeof(samples_path)) {
+            fprintf(stderr, "Error: Sample file path is too long\n");
+            return 1;
+        }
+        failed = run_preloaded(argv, samples_path, frequency, &data, &result) != 0;
+    }
+    if (failed) {
+        profile_data_free(&data);
+        return 1;
+    }
+    printf("----------------------------------------\n");
+
+    if (result.signaled || result.exit_code != 0) {
+        char how[128];
+        process_describe(&result, how, sizeof(how));
+        printf("Program %s\n", how);
+    }
+
+    folded_set stacks;
+    profile_fold(&data, &stacks);
+    // Without frame pointers the kernel's walk stops after a frame or two
+    int shallow_count = 0;
+    for (int i = 0; i < data.sample_count; i++) {
+        shallow_count += data.samples[i].depth <= 2;
+    }
+    int shallow = shallow_count * 10 >= data.sample_count * 9;
+    long long lost = data.lost;
+    profile_data_free(&data);
+
+    if (stacks.total == 0) {
+        printf("No samples were collected (the program may have run too briefly; try --freq)\n");
+        return process_status(&result) == 0 ? 0 : 1;
+    }
+
+    printf("%ld samples", stacks.total);
+    if (lost > 0) {
+        printf(" (%lld lost)", lost);
+    }
+    printf("\n\n");
+    profile_print_top(&stacks, PROFILE_TOP);
+    if (shallow && use_perf) {
+        printf("\nNote: call stacks are shallow; build with -fno-omit-frame-pointer "
+               "(e.g. in a build profile) or use --sampler=preload, which unwinds with DWARF\n");
+    }
+
+    char folded_path[PATH_MAX + 32];
+    char svg_path[PATH_MAX + 32];
+    char title[PATH_MAX + 32];
+    snprintf(folded_path, sizeof(folded_path), "%s/%s.folded", PROFILE_DIR, program);
+    snprintf(svg_path, sizeof(svg_path), "%s/%s.svg", PROFILE_DIR, program);
+    snprintf(title, sizeof(title), "Flame graph: %s", program);
+
+    int status = process_status(&result) == 0 ? 0 : 1;
+    if (profile_write_folded(&stacks, folded_path) != 0 ||
+        profile_write_flame_graph(&stacks, svg_path, title, "samples") != 0) {
+        fprintf(stderr, "Error: Cannot write the profile to %s\n", PROFILE_DIR);
+        status = 1;
+    } else {
+        printf("\n✓ Flame graph: %s\n", svg_path);
+        printf("  Folded stacks: %s\n", folded_path);
+    }
+    folded_set_free(&stacks);
+    return status;
+}
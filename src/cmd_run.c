@@ -1,78 +1,378 @@
 #include "jc.h"
 #include "utils.h"
+#include "build_profile.h"
+#include "process.h"
+#include "bench.h"
+#include "counters.h"
+#include "heap.h"
+#include <errno.h>
+#include <signal.h>
 #include <limits.h>
 
 #ifndef PATH_MAX
 #define PATH_MAX 4096
 #endif
 
+#define HEAP_DIR ".jc/heap"
+#define HEAP_LIBRARY "libjc_heap.so"
+
+// Sites listed in each table of the heap report
+#define HEAP_TOP 10
+
+// Maximum resident set size in kilobytes (macOS reports bytes)
+static long max_rss_kb(const struct rusage *usage) {
+#ifdef __APPLE__
+    return usage->ru_maxrss / 1024;
+#else
+    return usage->ru_maxrss;
+#endif
+}
+
+static double seconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+// Print how the program performed, as /usr/bin/time -v would
+static void print_usage_report(const process_result *result) {
+    const struct rusage *ru = &result->usage;
+    double wall = result->wall_us / 1e6;
+    double user = seconds(&ru->ru_utime);
+    double sys = seconds(&ru->ru_stime);
+    long rss = max_rss_kb(ru);
+
+    printf("Wall time:        %.3f s\n", wall);
+    printf("CPU time:         %.3f s user, %.3f s system (%.0f%% CPU)\n", user, sys,
+           wall > 0 ? (user + sys) * 100 / wall : 0.0);
+    if (rss >= 10 * 1024) {
+        printf("Max RSS:          %.1f MB\n", rss / 1024.0);
+    } else {
+        printf("Max RSS:          %ld KB\n", rss);
+    }
+    printf("Page faults:      %ld major, %ld minor\n", ru->ru_majflt, ru->ru_minflt);
+    printf("Context switches: %ld voluntary, %ld involuntary\n", ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+// The same report as one JSON object, with the counters when there are any
+static void write_usage_json(FILE *out, const char *executable, const process_result *result,
+                             const counter_set *counters) {
+    const struct rusage *ru = &result->usage;
+    fprintf(out, "{\"executable\":");
+    json_write_string(out, executable);
+    fprintf(out, ",\"exit_code\":%d,\"signal\":%d", result->exited ? result->exit_code : -1,
+            result->signaled ? result->signal : 0);
+    fprintf(out, ",\"wall_s\":%.6f,\"user_s\":%.6f,\"sys_s\":%.6f", result->wall_us / 1e6,
+            seconds(&ru->ru_utime), seconds(&ru->ru_stime));
+    fprintf(out, ",\"max_rss_kb\":%ld,\"major_faults\":%ld,\"minor_faults\":%ld",
+            max_rss_kb(ru), ru->ru_majflt, ru->ru_minflt);
+    fprintf(out, ",\"voluntary_switches\":%ld,\"involuntary_switches\":%ld",
+            ru->ru_nvcsw, ru->ru_nivcsw);
+    if (counters) {
+        fprintf(out, ",\"counters\":");
+        counters_write_json(out, counters);
+    }
+    fprintf(out, "}\n");
+}
+
+static const char *program_name(const char *executable) {
+    const char *slash = strrchr(executable, '/');
+    return slash ? slash + 1 : executable;
+}
+
+// Print what libjc_heap.so recorded and write the allocation flame graph
+static void report_heap(const char *samples_path, const char *program, long rate) {
+    heap_profile heap = {0};
+    heap.rate = rate;
+    printf("\n");
+    if (heap_load(&heap, samples_path) != 0) {
+        fprintf(stderr, "Warning: The heap profiler recorded nothing (was %s loaded?)\n", HEAP_LIBRARY);
+        return;
+    }
+    unlink(samples_path);
+
+    heap_site_set sites;
+    folded_set stacks;
+    heap_sites(&heap, &sites, &stacks);
+    heap_print(&heap, &sites, HEAP_TOP);
+    heap_sites_free(&sites);
+    heap_free(&heap);
+
+    if (stacks.count > 0) {
+        char folded_path[PATH_MAX + 32];
+        char svg_path[PATH_MAX + 32];
+        char title[PATH_MAX + 32];
+        snprintf(folded_path, sizeof(folded_path), "%s/%s.folded", HEAP_DIR, program);
+        snprintf(svg_path, sizeof(svg_path), "%s/%s.svg", HEAP_DIR, program);
+        snprintf(title, sizeof(title), "Allocated bytes: %s", program);
+        if (profile_write_folded(&stacks, folded_path) == 0 &&
+            profile_write_flame_graph(&stacks, svg_path, title, "bytes") == 0) {
+            printf("\n✓ Allocation flame graph: %s\n", svg_path);
+        } else {
+            fprintf(stderr, "Warning: Cannot write the heap profile to %s\n", HEAP_DIR);
+        }
+    }
+    folded_set_free(&stacks);
+}
+
+/**
+ * Remove jc's own leading options from argv
+ *
+ * --json[=<file>], --counters, --heap[=<bytes>] and the benchmark options
+ * may be mixed with --profile;
+ * a "--" ends jc's options and is removed once the profile has been
+ * taken, so the program can receive arguments that look like jc options.
+ * bench->runs stays 0 unless --bench was given, and *heap_rate unless --heap was.
+ *
+ * @return 0 on success, -1 on an invalid option value
+ */
+static int take_run_options(int *argc, char *argv[], const char **json_path, int *counters,
+                            long *heap_rate, bench_options *bench) {
+    int i = 1;
+    while (i < *argc) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--json") == 0 || strncmp(arg, "--json=", 7) == 0) {
+            *json_path = arg[6] == '=' ? arg + 7 : "-";
+        } else if (strcmp(arg, "--counters") == 0) {
+            *counters = 1;
+        } else if (strcmp(arg, "--heap") == 0) {
+            *heap_rate = HEAP_DEFAULT_RATE;
+        } else if (strncmp(arg, "--heap=", 7) == 0) {
+            char *end;
+            *heap_rate = strtol(arg + 7, &end, 10);
+            if (*end == 'k' || *end == 'K') {
+                *heap_rate *= 1024;
+                end++;
+            } else if (*end == 'm' || *end == 'M') {
+                *heap_rate *= 1024 * 1024;
+                end++;
+            }
+            if (*heap_rate < 1 || *end) {
+                fprintf(stderr, "Error: Invalid heap sampling rate: %s\n", arg + 7);
+                return -1;
+            }
+        } else if (strcmp(arg, "--bench") == 0) {
+            bench->runs = 10;
+        } else if (strncmp(arg, "--bench=", 8) == 0) {
+            bench->runs = atoi(arg + 8);
+            if (bench->runs < 1) {
+                fprintf(stderr, "Error: Invalid number of runs: %s\n", arg + 8);
+                return -1;
+            }
+        } else if (strncmp(arg, "--warmup=", 9) == 0) {
+            bench->warmup = atoi(arg + 9);
+            if (bench->warmup < 0) {
+                fprintf(stderr, "Error: Invalid number of warmup runs: %s\n", arg + 9);
+                return -1;
+            }
+        } else if (strncmp(arg, "--cpus=", 7) == 0) {
+            bench->cpus = arg + 7;
+        } else if (strncmp(arg, "--save=", 7) == 0) {
+            bench->save = arg + 7;
+        } else if (strncmp(arg, "--compare=", 10) == 0) {
+            bench->compare = arg + 10;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            i += 2;
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            i++;
+        } else {
+            break;
+        }
+        if (i < *argc && argv[i] == arg) {
+            for (int j = i; j < *argc; j++) {
+                argv[j] = argv[j + 1];
+            }
+            (*argc)--;
+        }
+    }
+    const char *names[] = {bench->save, bench->compare};
+    for (int n = 0; n < 2; n++) {
+        if (names[n] && !bench_valid_name(names[n])) {
+            fprintf(stderr, "Error: Invalid name for saved results: %s\n", names[n]);
+            fprintf(stderr, "Use letters, digits, '_', '-' and '.', not starting with '.'\n");
+            return -1;
+        }
+    }
+    if (!bench->runs && (bench->cpus || bench->save || bench->compare)) {
+        fprintf(stderr, "Error: --cpus, --save and --compare need --bench\n");
+        return -1;
+    }
+    if (bench->runs && (*counters || *heap_rate)) {
+        fprintf(stderr, "Error: --counters and --heap cannot be combined with --bench\n");
+        return -1;
+    }
+    return 0;
+}
+
 int cmd_run(int argc, char *argv[]) {
     if (!is_automake_project()) {
         fprintf(stderr, "Error: Not in an automake project directory\n");
         return 1;
     }
 
-    // First, ensure the project is built
-    if (!file_exists("Makefile")) {
-        printf("Project not built yet. Building first...\n");
-        if (cmd_build(0, NULL) != 0) {
-            return 1;
-        }
+    const char *json_path = NULL;
+    int use_counters = 0;
+    long heap_rate = 0;
+    bench_options bench = {0};
+    bench.warmup = 1;
+    if (take_run_options(&argc, argv, &json_path, &use_counters, &heap_rate, &bench) != 0) {
+        return 1;
     }
+    char *profile = take_profile_option(&argc, argv);
 
-    // Find the executable in src/ directory
-    char executable[PATH_MAX];
-    
-    // Try to find executable in common locations
-    const char *search_dirs[] = {
-        "src/build",
-        "src",
-        ".",
-        NULL
-    };
-    
-    int found = 0;
-    for (int i = 0; search_dirs[i] != NULL; i++) {
-        if (find_executable(search_dirs[i], executable, sizeof(executable)) == 0) {
-            found = 1;
-            break;
+    // First, ensure the build is current
+    if (ensure_built(profile) != 0) {
+        free(profile);
+        return 1;
+    }
+
+    // 'jc run <target> [args...]' picks one of several programs; "--"
+    // passes everything after it to the program
+    const char *target = take_target_argument(&argc, argv, profile);
+    if (argc > 1 && strcmp(argv[1], "--") == 0) {
+        for (int i = 1; i < argc; i++) {
+            argv[i] = argv[i + 1];
         }
+        argc--;
     }
-    
+
+    // Find the executable in the profile's build tree
+    char executable[PATH_MAX];
+    int found = find_built_executable(profile, target, executable, sizeof(executable)) == 0;
+
     if (!found) {
+        free(profile);
+        if (target) {
+            fprintf(stderr, "Error: Program '%s' has not been built\n", target);
+            return 1;
+        }
         fprintf(stderr, "Error: Could not find executable to run\n");
         fprintf(stderr, "Make sure the project is built successfully\n");
         return 1;
     }
 
+    argv[0] = executable;
+    if (bench.runs) {
+        bench.json_path = json_path;
+        bench.profile = profile;
+        int status = bench_run(executable, argv, &bench);
+        free(profile);
+        return status;
+    }
+    free(profile);
+
     printf("Running: %s\n", executable);
     printf("----------------------------------------\n");
+    fflush(stdout);
 
-    // Build command with any additional arguments
-    char cmd[PATH_MAX * 2];
-    int offset = snprintf(cmd, sizeof(cmd), "%s", executable);
-    
-    // Pass through any additional arguments
-    for (int i = 1; i < argc; i++) {
-        offset += snprintf(cmd + offset, sizeof(cmd) - offset, " %s", argv[i]);
+    // Counters attach to jc and are inherited by the program when it starts
+    counter_set counters;
+    int counting = 0;
+    if (use_counters) {
+        counting = counters_open(&counters) == 0;
+        if (!counting) {
+            fprintf(stderr, "Warning: Performance counters are unavailable: %s\n", strerror(errno));
+        }
+    }
+
+    // The heap profiler is preloaded and appends its records to heap_path
+    char preload[PATH_MAX * 2];
+    char heap_path[PATH_MAX + 64];
+    char file_env[sizeof(heap_path) + 32];
+    char rate_env[64];
+    char *heap_env[] = {preload, file_env, rate_env, NULL};
+    process_options options = {0};
+    if (heap_rate) {
+        char cwd[PATH_MAX];
+        if (get_preload_env(HEAP_LIBRARY, preload, sizeof(preload)) != 0) {
+            fprintf(stderr, "Error: Cannot find %s (set JC_LIB_DIR to its directory)\n", HEAP_LIBRARY);
+            return 1;
+        }
+        if (!getcwd(cwd, sizeof(cwd))) {
+            fprintf(stderr, "Error: Cannot get current directory\n");
+            return 1;
+        }
+        int written = snprintf(heap_path, sizeof(heap_path), "%s/%s/%s.samples",
+                               cwd, HEAP_DIR, program_name(executable));
+        if (written < 0 || (size_t)written >= sizeof(heap_path)) {
+            fprintf(stderr, "Error: Heap profile path is too long\n");
+            return 1;
+        }
+        create_directory(".jc");
+        create_directory(HEAP_DIR);
+        snprintf(file_env, sizeof(file_env), "%s=%s", HEAP_FILE_ENV, heap_path);
+        snprintf(rate_env, sizeof(rate_env), "%s=%ld", HEAP_RATE_ENV, heap_rate);
+        unlink(heap_path);
+        options.env = heap_env;
     }
 
-    // Execute the program
-    int ret = system(cmd);
+    // Execute the program directly, passing any additional arguments through
+    process_result result;
+    if (process_run(argv, &options, &result) != 0) {
+        fprintf(stderr, "Error: Cannot run %s: %s\n", executable, strerror(errno));
+        if (use_counters) {
+            counters_close(&counters);
+        }
+        return 1;
+    }
+    if (use_counters) {
+        counters_read(&counters);
+        counters_close(&counters);
+    }
     
     printf("----------------------------------------\n");
+    print_usage_report(&result);
+    if (counting) {
+        counters_print(&counters);
+    }
+    if (heap_rate) {
+        report_heap(heap_path, program_name(executable), heap_rate);
+    }
+
+    if (json_path && strcmp(json_path, "-") == 0) {
+        write_usage_json(stderr, executable, &result, counting ? &counters : NULL);
+    } else if (json_path) {
+        FILE *out = fopen(json_path, "w");
+        if (out) {
+            write_usage_json(out, executable, &result, counting ? &counters : NULL);
+            fclose(out);
+        } else {
+            fprintf(stderr, "Warning: Cannot write %s\n", json_path);
+        }
+    }
     
-    if (ret != 0) {
-        printf("Program exited with code: %d\n", ret);
-        if (ret == 139 || ret == 11 || ret / 256 == 139 || ret / 256 == 11) {
+    if (result.signaled) {
+        char how[128];
+        process_describe(&result, how, sizeof(how));
+        printf("\nProgram %s\n", how);
+        if (result.signal == SIGSEGV || result.signal == SIGBUS) {
             printf("\nSegmentation fault detected!\n");
             printf("Run 'jc bt' to debug the issue\n");
-        } else if (ret == 134 || ret == 6 || ret / 256 == 134 || ret / 256 == 6) {
+        } else if (result.signal == SIGABRT) {
             printf("\nAbort signal detected!\n");
             printf("Run 'jc bt' to debug the issue\n");
         }
         return 1;
     }
+    if (result.exit_code != 0) {
+        printf("\nProgram exited with code: %d\n", result.exit_code);
+        return 1;
+    }
     
     return 0;
 }
+
+/**
+ * Benchmark the project's program: 'jc bench' is 'jc run --bench'
+ */
+int cmd_bench(int argc, char *argv[]) {
+    char **args = malloc((argc + 2) * sizeof(char *));
+    args[0] = argv[0];
+    args[1] = "--bench";
+    for (int i = 1; i <= argc; i++) {
+        args[i + 1] = argv[i];
+    }
+
+    // An explicit --bench=N overrides the default count added here
+    int status = cmd_run(argc + 1, args);
+    free(args);
+    return status;
+}
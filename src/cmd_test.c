@@ -1,5 +1,10 @@
 #include "jc.h"
 #include "utils.h"
+#include "build_profile.h"
+#include "manifest.h"
+#include "runner.h"
+#include "shard.h"
+#include "makefile_am.h"
 #include <libgen.h>
 
 #ifndef PATH_MAX
@@ -9,7 +14,7 @@
 // Forward declarations
 static int test_add(const char *source_file);
 static int test_remove(const char *source_file);
-static int test_run(const char *test_file);
+static int test_run(const char *test_file, const char *profile, const runner_options *options);
 static void print_test_usage(void);
 static char *generate_test_template(const char *basename);
 static int create_initial_test_makefile(void);
@@ -23,10 +28,20 @@ static void print_test_usage(void) {
     printf("  add <file>         Create a test file for the given source file\n");
     printf("  remove <file>      Remove the test file for the given source file\n");
     printf("  run [test_file]    Run tests (all tests if no file specified)\n\n");
+    printf("Options:\n");
+    printf("  --profile <name>   Run the tests of an out-of-tree build profile\n");
+    printf("  -j, --jobs <N>     Build and run N tests at once (default: auto)\n");
+    printf("  --shard <i>/<n>    Run only the i-th of n equal shares of the tests\n");
+    printf("  --shard-times <f>  Balance the shards by the test times in <f>\n");
+    printf("  --no-cache         Run tests that passed before with the same inputs\n");
+    printf("  --affected[=<rev>] Run only tests whose sources changed since <rev> (HEAD)\n\n");
     printf("Examples:\n");
     printf("  jc test add src/utils.c       # Creates tests/test_utils.c\n");
     printf("  jc test remove src/utils.c    # Removes tests/test_utils.c\n");
     printf("  jc test run                   # Run all tests\n");
+    printf("  jc test run -j8               # Run all tests, 8 at a time\n");
+    printf("  jc test run --shard=2/4       # Second of four CI machines\n");
+    printf("  jc test run --affected        # Only tests of uncommitted changes\n");
     printf("  jc test run test_utils        # Run specific test\n\n");
 }
 
@@ -46,6 +61,20 @@ static char *generate_test_template(const char *basename) {
         "}\n"
         "END_TEST\n"
         "\n"
+        "// TCases created with add_tcase() are listed for 'jc test run', which\n"
+        "// runs each one separately with CK_RUN_SUITE and CK_RUN_CASE\n"
+        "static const char *tcase_names[128];\n"
+        "static int tcase_count = 0;\n"
+        "\n"
+        "static TCase *add_tcase(Suite *s, const char *name) {\n"
+        "    TCase *tc = tcase_create(name);\n"
+        "    suite_add_tcase(s, tc);\n"
+        "    if (tcase_count < 128) {\n"
+        "        tcase_names[tcase_count++] = name;\n"
+        "    }\n"
+        "    return tc;\n"
+        "}\n"
+        "\n"
         "// Create test suite\n"
         "Suite *%s_suite(void) {\n"
         "    Suite *s;\n"
@@ -54,9 +83,8 @@ static char *generate_test_template(const char *basename) {
         "    s = suite_create(\"%s\");\n"
         "    \n"
         "    // Core test case\n"
-        "    tc_core = tcase_create(\"Core\");\n"
+        "    tc_core = add_tcase(s, \"Core\");\n"
         "    tcase_add_test(tc_core, test_example);\n"
-        "    suite_add_tcase(s, tc_core);\n"
         "    \n"
         "    return s;\n"
         "}\n"
@@ -70,6 +98,15 @@ static char *generate_test_template(const char *basename) {
         "    s = %s_suite();\n"
         "    sr = srunner_create(s);\n"
         "    \n"
+        "    // List the TCases instead of running them\n"
+        "    if (getenv(\"JC_TEST_LIST\")) {\n"
+        "        for (int i = 0; i < tcase_count; i++) {\n"
+        "            printf(\"%s\\t%%s\\n\", tcase_names[i]);\n"
+        "        }\n"
+        "        srunner_free(sr);\n"
+        "        return EXIT_SUCCESS;\n"
+        "    }\n"
+        "    \n"
         "    // Run tests\n"
         "    srunner_run_all(sr, CK_NORMAL);\n"
         "    number_failed = srunner_ntests_failed(sr);\n"
@@ -77,7 +114,7 @@ static char *generate_test_template(const char *basename) {
         "    \n"
         "    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;\n"
         "}\n",
-        basename, basename, basename, basename);
+        basename, basename, basename, basename, basename);
     
     return template;
 }
@@ -135,6 +172,17 @@ static int update_test_makefile(const char *test_file) {
         return 0;
     }
     
+    // Tests link the project's convenience library rather than compiling its sources
+    char ldadd[PATH_MAX] = "$(CHECK_LIBS)";
+    am_file src_am;
+    if (am_parse("src/Makefile.am", &src_am) == 0) {
+        char library[256];
+        if (am_convenience_library(&src_am, library, sizeof(library)) == 0) {
+            snprintf(ldadd, sizeof(ldadd), "$(top_builddir)/src/%s $(CHECK_LIBS)", library);
+        }
+        am_free(&src_am);
+    }
+
     // Add the test program to check_PROGRAMS and TESTS
     char new_content[8192];
     char *output = new_content;
@@ -169,7 +217,7 @@ static int update_test_makefile(const char *test_file) {
             *output++ = '\n';
             output += sprintf(output, "%s_SOURCES = %s\n", test_prog, test_file);
             output += sprintf(output, "%s_CFLAGS = -I$(top_srcdir)/src $(CHECK_CFLAGS) -Wall -Wextra -g\n", test_prog);
-            output += sprintf(output, "%s_LDADD = $(CHECK_LIBS)\n", test_prog);
+            output += sprintf(output, "%s_LDADD = %s\n", test_prog, ldadd);
             added_program_entry = 1;
         }
         // Add to TESTS line
@@ -463,7 +511,7 @@ static int test_remove(const char *source_file) {
 }
 
 // Run tests
-static int test_run(const char *test_file) {
+static int test_run(const char *test_file, const char *profile, const runner_options *options) {
     // Check if we're in an automake project
     if (!is_automake_project()) {
         fprintf(stderr, "Error: Not in an automake project directory\n");
@@ -478,39 +526,61 @@ static int test_run(const char *test_file) {
         return 1;
     }
     
+    // Test binaries live in the profile's build tree
+    char build_dir[PATH_MAX];
+    profile_build_dir(profile, build_dir, sizeof(build_dir));
+    const char *tests_prefix = profile ? build_dir : "";
+    const char *tests_sep = profile ? "/" : "";
+
     if (test_file) {
         // Run specific test
-        char test_path[PATH_MAX];
+        char name[256];
         
         // Handle different input formats
         if (strstr(test_file, "test_") == test_file) {
             // Input is like "test_utils"
-            snprintf(test_path, sizeof(test_path), "tests/%s", test_file);
+            snprintf(name, sizeof(name), "%s", test_file);
         } else if (strstr(test_file, ".c") != NULL) {
             // Input is like "test_utils.c"
             char *base = basename((char*)test_file);
             char *dot = strrchr(base, '.');
             if (dot) *dot = '\0';
-            snprintf(test_path, sizeof(test_path), "tests/%s", base);
+            snprintf(name, sizeof(name), "%s", base);
         } else {
             // Input is like "utils" - add test_ prefix
-            snprintf(test_path, sizeof(test_path), "tests/test_%s", test_file);
+            snprintf(name, sizeof(name), "test_%s", test_file);
+        }
+
+        // The manifest knows where the last 'make check' put each test;
+        // without one, tests are expected in tests/
+        char test_path[PATH_MAX * 2];
+        snprintf(test_path, sizeof(test_path), "%s%stests/%s", tests_prefix, tests_sep, name);
+        manifest m;
+        if (manifest_load(&m, MANIFEST_FILE) == 0) {
+            const manifest_entry *entry = manifest_find(&m, profile, 1, name);
+            if (entry && strcmp(entry->path, "-") != 0) {
+                snprintf(test_path, sizeof(test_path), "%s", entry->path);
+            }
+            manifest_free(&m);
         }
         
         // Check if test binary exists
         if (!file_exists(test_path)) {
             fprintf(stderr, "Error: Test '%s' not found\n", test_path);
-            fprintf(stderr, "Run 'make check' first to build tests\n");
+            fprintf(stderr, "Run 'jc test run' first to build tests\n");
             return 1;
         }
         
         printf("Running test: %s\n\n", test_path);
-        return execute_command(test_path);
+        char *const test[] = {test_path, NULL};
+        return execute_command(test);
         
     } else {
-        // Run all tests using make check
-        printf("Running all tests...\n\n");
-        return execute_command("make check");
+        // Build and run every test, jobs at a time
+        runner_options all = *options;
+        all.profile = profile;
+        all.jobs = options->jobs ? options->jobs : detect_job_count();
+        return runner_run(&all);
     }
 }
 
@@ -540,8 +610,88 @@ int cmd_test(int argc, char *argv[]) {
         return test_remove(argv[2]);
         
     } else if (strcmp(subcommand, "run") == 0) {
-        const char *test_file = (argc >= 3) ? argv[2] : NULL;
-        return test_run(test_file);
+        int run_argc = argc - 1;
+        char *profile = take_profile_option(&run_argc, argv + 1);
+        const char *test_file = NULL;
+        runner_options options = {0};
+        for (int i = 2; i <= run_argc; i++) {
+            const char *arg = argv[i];
+            const char *value = NULL;
+            if (strcmp(arg, "--shard") == 0 || strncmp(arg, "--shard=", 8) == 0) {
+                if (arg[7] == '\0' && i == run_argc) {
+                    fprintf(stderr, "Error: '--shard' requires <i>/<n>\n");
+                    free(profile);
+                    return 1;
+                }
+                value = arg[7] ? arg + 8 : argv[++i];
+                if (shard_parse(value, &options.shard, &options.shards) != 0) {
+                    fprintf(stderr, "Error: Invalid shard '%s' (expected <i>/<n> with 1 <= i <= n)\n", value);
+                    free(profile);
+                    return 1;
+                }
+                continue;
+            } else if (strcmp(arg, "--shard-times") == 0 || strncmp(arg, "--shard-times=", 14) == 0) {
+                if (arg[13] == '\0' && i == run_argc) {
+                    fprintf(stderr, "Error: '--shard-times' requires a file\n");
+                    free(profile);
+                    return 1;
+                }
+                options.shard_times = arg[13] ? arg + 14 : argv[++i];
+                continue;
+            } else if (strcmp(arg, "--no-cache") == 0) {
+                options.no_cache = 1;
+                continue;
+            } else if (strcmp(arg, "--affected") == 0 || strncmp(arg, "--affected=", 11) == 0) {
+                // The revision is optional, so it has to be attached with '='
+                options.affected = 1;
+                options.affected_rev = arg[10] ? arg + 11 : NULL;
+                if (options.affected_rev && options.affected_rev[0] == '\0') {
+                    fprintf(stderr, "Error: '--affected=' requires a git revision\n");
+                    free(profile);
+                    return 1;
+                }
+                continue;
+            } else if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0) {
+                if (i == run_argc) {
+                    fprintf(stderr, "Error: '%s' requires a job count\n", arg);
+                    free(profile);
+                    return 1;
+                }
+                value = argv[++i];
+            } else if (strncmp(arg, "-j", 2) == 0) {
+                value = arg + 2;
+            } else if (strncmp(arg, "--jobs=", 7) == 0) {
+                value = arg + 7;
+            } else if (arg[0] == '-') {
+                fprintf(stderr, "Error: Unknown option '%s'\n\n", arg);
+                print_test_usage();
+                free(profile);
+                return 1;
+            } else {
+                test_file = arg;
+                continue;
+            }
+            options.jobs = parse_jobs(value);
+            if (options.jobs < 0) {
+                fprintf(stderr, "Error: Invalid job count '%s'\n", value);
+                free(profile);
+                return 1;
+            }
+        }
+        if (test_file && (options.shards || options.affected)) {
+            fprintf(stderr, "Error: '%s' applies to the whole suite, not a single test\n",
+                    options.shards ? "--shard" : "--affected");
+            free(profile);
+            return 1;
+        }
+        if (options.shard_times && !options.shards) {
+            fprintf(stderr, "Error: '--shard-times' needs --shard\n");
+            free(profile);
+            return 1;
+        }
+        int ret = test_run(test_file, profile, &options);
+        free(profile);
+        return ret;
         
     } else {
         fprintf(stderr, "Error: Unknown subcommand '%s'\n\n", subcommand);
@@ -0,0 +1,129 @@
+#include "jc.h"
+#include "hash.h"
+#include "compile_args.h"
+#include <limits.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// Bumped whenever the key derivation or entry layout changes
+#define CACHE_KEY_VERSION "jc-objcache-2"
+
+// Options whose value is a separate argument
+static int takes_value(const char *arg) {
+    static const char *options[] = {
+        "-I", "-D", "-U", "-include", "-imacros", "-isystem", "-iquote", "-idirafter",
+        "-L", "-l", "-MT", "-MQ", "-MF", "-o", "-Xpreprocessor", "-Xassembler",
+        "-Xlinker", "-arch", "-target", "--sysroot", "-isysroot", NULL
+    };
+    for (int i = 0; options[i] != NULL; i++) {
+        if (strcmp(arg, options[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Options whose output depends on more than the preprocessed source
+static int is_uncacheable_option(const char *arg) {
+    return strcmp(arg, "-E") == 0 || strcmp(arg, "-S") == 0 ||
+           strcmp(arg, "-M") == 0 || strcmp(arg, "-MM") == 0 ||
+           strcmp(arg, "-x") == 0 || strcmp(arg, "-") == 0 ||
+           strcmp(arg, "--coverage") == 0 || strcmp(arg, "-ftest-coverage") == 0 ||
+           strcmp(arg, "-fsyntax-only") == 0 ||
+           strncmp(arg, "-fprofile-", 10) == 0 ||
+           strncmp(arg, "-fauto-profile", 14) == 0 ||
+           strncmp(arg, "-save-temps", 11) == 0 ||
+           arg[0] == '@';
+}
+
+/**
+ * Parse a compiler command line (argv[0] is the compiler)
+ *
+ * Fills in the source/output/depfile and an argv for running only the
+ * preprocessor. The caller frees args->preprocess_argv.
+ */
+void parse_compile_args(int argc, char *argv[], compile_args *args) {
+    memset(args, 0, sizeof(*args));
+    args->cacheable = 1;
+    args->preprocess_argv = calloc(argc + 3, sizeof(char *));
+    args->preprocess_argv[args->preprocess_argc++] = argv[0];
+
+    int sources = 0;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (is_uncacheable_option(arg)) {
+            args->cacheable = 0;
+        } else if (strcmp(arg, "-c") == 0) {
+            args->compile_only = 1;
+        } else if (strcmp(arg, "-o") == 0) {
+            args->output = value;
+            i++;
+        } else if (strncmp(arg, "-o", 2) == 0) {
+            args->output = arg + 2;
+        } else if (strcmp(arg, "-MD") == 0 || strcmp(arg, "-MMD") == 0) {
+            args->wants_deps = 1;
+        } else if (strcmp(arg, "-MF") == 0) {
+            args->depfile = value;
+            i++;
+        } else if (strncmp(arg, "-MF", 3) == 0) {
+            args->depfile = arg + 3;
+        } else if (strcmp(arg, "-MT") == 0 || strcmp(arg, "-MQ") == 0) {
+            i++;
+        } else if (strcmp(arg, "-MP") == 0 || strncmp(arg, "-MT", 3) == 0 ||
+                   strncmp(arg, "-MQ", 3) == 0) {
+            // Dependency output only: not needed for preprocessing
+        } else if (arg[0] == '-') {
+            args->preprocess_argv[args->preprocess_argc++] = argv[i];
+            if (takes_value(arg) && value) {
+                args->preprocess_argv[args->preprocess_argc++] = argv[++i];
+            }
+        } else {
+            args->source = arg;
+            sources++;
+        }
+    }
+
+    if (!args->compile_only || sources != 1) {
+        args->cacheable = 0;
+        return;
+    }
+
+    args->preprocess_argv[args->preprocess_argc++] = "-E";
+    args->preprocess_argv[args->preprocess_argc++] = (char *)args->source;
+    args->preprocess_argv[args->preprocess_argc] = NULL;
+}
+
+/**
+ * Hash everything about a compile but the preprocessed source
+ *
+ * The compiler identity and the arguments, minus the depfile location.
+ * With -g the object records the working directory (DW_AT_comp_dir), so
+ * it's hashed too; otherwise a checkout elsewhere with the same relative
+ * paths would get objects pointing debuggers into the wrong tree.
+ */
+void compile_args_hash(hash_ctx *ctx, int argc, char *argv[]) {
+    hash_update_string(ctx, CACHE_KEY_VERSION);
+    hash_update_program(ctx, argv[0]);
+    int debug_info = 0;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-MF") == 0) && i + 1 < argc) {
+            i++;
+            continue;
+        }
+        if (strncmp(argv[i], "-MF", 3) == 0) {
+            continue;
+        }
+        debug_info |= strncmp(argv[i], "-g", 2) == 0;
+        hash_update_string(ctx, argv[i]);
+    }
+
+    char cwd[PATH_MAX];
+    if (debug_info && getcwd(cwd, sizeof(cwd))) {
+        hash_update_string(ctx, "cwd");
+        hash_update_string(ctx, cwd);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef COMPILE_ARGS_H
+#define COMPILE_ARGS_H
+
+#include "hash.h"
+
+// A compiler invocation split into the parts the cache cares about
+typedef struct {
+    const char *source;
+    const char *output;
+    const char *depfile;
+    int compile_only;
+    int wants_deps;
+    int cacheable;
+    int preprocess_argc;
+    char **preprocess_argv;
+} compile_args;
+
+void parse_compile_args(int argc, char *argv[], compile_args *args);
+void compile_args_hash(hash_ctx *ctx, int argc, char *argv[]);
+
+#endif // COMPILE_ARGS_H
@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+
+#include "jc.h"
+#include "utils.h"
+#include "counters.h"
+#include <errno.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+static const char *counter_names[COUNTER_COUNT] = {
+    "cycles",
+    "instructions",
+    "branches",
+    "branch-misses",
+    "cache-references",
+    "cache-misses",
+    "L1-dcache-loads",
+    "L1-dcache-load-misses",
+    "task-clock",
+    "context-switches",
+    "cpu-migrations",
+    "page-faults",
+};
+
+#ifdef __linux__
+
+// Hardware events opened together so that ratios compare the same intervals
+static const counter_id hardware_groups[][2] = {
+    {COUNTER_CYCLES, COUNTER_INSTRUCTIONS},
+    {COUNTER_BRANCHES, COUNTER_BRANCH_MISSES},
+    {COUNTER_CACHE_REFERENCES, COUNTER_CACHE_MISSES},
+    {COUNTER_L1D_LOADS, COUNTER_L1D_MISSES},
+};
+
+static void event_type(counter_id id, __u32 *type, __u64 *config) {
+    static const __u64 l1d_read = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8);
+    *type = PERF_TYPE_HARDWARE;
+    switch (id) {
+    case COUNTER_CYCLES:           *config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case COUNTER_INSTRUCTIONS:     *config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case COUNTER_BRANCHES:         *config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS; break;
+    case COUNTER_BRANCH_MISSES:    *config = PERF_COUNT_HW_BRANCH_MISSES; break;
+    case COUNTER_CACHE_REFERENCES: *config = PERF_COUNT_HW_CACHE_REFERENCES; break;
+    case COUNTER_CACHE_MISSES:     *config = PERF_COUNT_HW_CACHE_MISSES; break;
+    case COUNTER_L1D_LOADS:
+        *type = PERF_TYPE_HW_CACHE;
+        *config = l1d_read | ((__u64)PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16);
+        break;
+    case COUNTER_L1D_MISSES:
+        *type = PERF_TYPE_HW_CACHE;
+        *config = l1d_read | ((__u64)PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case COUNTER_TASK_CLOCK:       *type = PERF_TYPE_SOFTWARE; *config = PERF_COUNT_SW_TASK_CLOCK; break;
+    case COUNTER_CONTEXT_SWITCHES: *type = PERF_TYPE_SOFTWARE; *config = PERF_COUNT_SW_CONTEXT_SWITCHES; break;
+    case COUNTER_CPU_MIGRATIONS:   *type = PERF_TYPE_SOFTWARE; *config = PERF_COUNT_SW_CPU_MIGRATIONS; break;
+    case COUNTER_PAGE_FAULTS:      *type = PERF_TYPE_SOFTWARE; *config = PERF_COUNT_SW_PAGE_FAULTS; break;
+    default:                       *config = 0; break;
+    }
+}
+
+/**
+ * Open one event on jc itself
+ *
+ * The event starts disabled and is inherited by every process jc starts
+ * afterwards; enable_on_exec turns it on in the child when it execs, so
+ * jc's own work between now and then isn't counted. The children's counts
+ * are folded back into this fd as they exit.
+ */
+static int open_event(counter_set *set, counter_id id, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    event_type(id, &attr.type, &attr.config);
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_hv = 1;
+    attr.exclude_kernel = set->user_only;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && (errno == EACCES || errno == EPERM) && !set->user_only) {
+        // perf_event_paranoid >= 2: unprivileged users may only count user space
+        set->user_only = 1;
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+    }
+    set->items[id].fd = fd;
+    return fd;
+}
+
+/**
+ * Prepare counters for the next program jc runs
+ *
+ * Hardware events are opened in small groups; a group the CPU (or the
+ * hypervisor) can't count is left out. Software events are always tried,
+ * so a VM without a virtual PMU still gets task-clock, context switches,
+ * migrations and page faults.
+ *
+ * @return 0 when at least one event is counting, -1 otherwise
+ */
+int counters_open(counter_set *set) {
+    memset(set, 0, sizeof(*set));
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        set->items[i].fd = -1;
+    }
+
+    for (size_t g = 0; g < sizeof(hardware_groups) / sizeof(hardware_groups[0]); g++) {
+        int leader = open_event(set, hardware_groups[g][0], -1);
+        if (leader < 0) {
+            continue;
+        }
+        if (open_event(set, hardware_groups[g][1], leader) < 0) {
+            close(leader);
+            set->items[hardware_groups[g][0]].fd = -1;
+            continue;
+        }
+        set->hardware = 1;
+    }
+
+    int leader = open_event(set, COUNTER_TASK_CLOCK, -1);
+    for (int id = COUNTER_CONTEXT_SWITCHES; id <= COUNTER_PAGE_FAULTS; id++) {
+        open_event(set, id, leader);
+    }
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (set->items[i].fd >= 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Read the totals once the program has exited
+void counters_read(counter_set *set) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        counter *c = &set->items[i];
+        uint64_t values[3];
+        if (c->fd < 0 || read(c->fd, values, sizeof(values)) != sizeof(values)) {
+            c->counted = 0;
+            continue;
+        }
+        c->counted = 1;
+        // values: count, time enabled, time running
+        c->running = values[1] ? (double)values[2] / values[1] : 1.0;
+        c->value = c->running > 0 ? values[0] / c->running : 0;
+    }
+}
+
+void counters_close(counter_set *set) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (set->items[i].fd >= 0) {
+            close(set->items[i].fd);
+            set->items[i].fd = -1;
+        }
+    }
+}
+
+#else
+
+int counters_open(counter_set *set) {
+    memset(set, 0, sizeof(*set));
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        set->items[i].fd = -1;
+    }
+    errno = ENOSYS;
+    return -1;
+}
+
+void counters_read(counter_set *set) {
+    (void)set;
+}
+
+void counters_close(counter_set *set) {
+    (void)set;
+}
+
+#endif
+
+static int have(const counter_set *set, counter_id id) {
+    return set->items[id].counted;
+}
+
+// The ratio of two counters, or -1 when either is missing
+static double ratio(const counter_set *set, counter_id num, counter_id den) {
+    if (!have(set, num) || !have(set, den) || set->items[den].value <= 0) {
+        return -1;
+    }
+    return set->items[num].value / set->items[den].value;
+}
+
+// Format a count with thousands separators
+static void format_count(double value, char *out, size_t size) {
+    char digits[32];
+    snprintf(digits, sizeof(digits), "%.0f", value);
+    size_t len = strlen(digits);
+    size_t pos = 0;
+    for (size_t i = 0; i < len && pos + 2 < size; i++) {
+        if (i > 0 && (len - i) % 3 == 0) {
+            out[pos++] = ',';
+        }
+        out[pos++] = digits[i];
+    }
+    out[pos] = '\0';
+}
+
+/**
+ * Print the counters with IPC and miss rates, as perf stat would
+ */
+void counters_print(const counter_set *set) {
+    printf("\nCounters%s:\n", set->user_only ? " (user space only)" : "");
+    if (!set->hardware) {
+        printf("  Hardware counters are unavailable (no PMU, as in most VMs); "
+               "showing software events\n");
+    }
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        const counter *c = &set->items[i];
+        if (!c->counted) {
+            continue;
+        }
+        char value[48];
+        if (i == COUNTER_TASK_CLOCK) {
+            snprintf(value, sizeof(value), "%.2f ms", c->value / 1e6);
+        } else {
+            format_count(c->value, value, sizeof(value));
+        }
+        printf("  %-22s %18s", counter_names[i], value);
+
+        double r;
+        switch (i) {
+        case COUNTER_INSTRUCTIONS:
+            if ((r = ratio(set, COUNTER_INSTRUCTIONS, COUNTER_CYCLES)) >= 0) {
+                printf("   %.2f insn per cycle", r);
+            }
+            break;
+        case COUNTER_BRANCH_MISSES:
+            if ((r = ratio(set, COUNTER_BRANCH_MISSES, COUNTER_BRANCHES)) >= 0) {
+                printf("   %.2f%% of branches", r * 100);
+            }
+            break;
+        case COUNTER_CACHE_MISSES:
+            if ((r = ratio(set, COUNTER_CACHE_MISSES, COUNTER_CACHE_REFERENCES)) >= 0) {
+                printf("   %.2f%% of cache references", r * 100);
+            }
+            break;
+        case COUNTER_L1D_MISSES:
+            if ((r = ratio(set, COUNTER_L1D_MISSES, COUNTER_L1D_LOADS)) >= 0) {
+                printf("   %.2f%% of L1d loads", r * 100);
+            }
+            break;
+        case COUNTER_CYCLES:
+            if (have(set, COUNTER_TASK_CLOCK) && set->items[COUNTER_TASK_CLOCK].value > 0) {
+                printf("   %.3f GHz", c->value / set->items[COUNTER_TASK_CLOCK].value);
+            }
+            break;
+        }
+        if (c->running < 0.999) {
+            printf("   (scaled, counted %.0f%%)", c->running * 100);
+        }
+        printf("\n");
+    }
+}
+
+// The counters and derived rates as the members of a JSON object
+void counters_write_json(FILE *out, const counter_set *set) {
+    fprintf(out, "{\"hardware\":%s,\"user_only\":%s", set->hardware ? "true" : "false",
+            set->user_only ? "true" : "false");
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (have(set, i)) {
+            fprintf(out, ",\"%s\":%.0f", counter_names[i], set->items[i].value);
+        }
+    }
+
+    const struct {
+        const char *name;
+        counter_id num;
+        counter_id den;
+    } rates[] = {
+        {"ipc", COUNTER_INSTRUCTIONS, COUNTER_CYCLES},
+        {"branch_miss_rate", COUNTER_BRANCH_MISSES, COUNTER_BRANCHES},
+        {"cache_miss_rate", COUNTER_CACHE_MISSES, COUNTER_CACHE_REFERENCES},
+        {"l1d_miss_rate", COUNTER_L1D_MISSES, COUNTER_L1D_LOADS},
+    };
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        double r = ratio(set, rates[i].num, rates[i].den);
+        if (r >= 0) {
+            fprintf(out, ",\"%s\":%.6f", rates[i].name, r);
+        }
+    }
+    fprintf(out, "}");
+}
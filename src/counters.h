@@ -0,0 +1,41 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdio.h>
+
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCHES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_CACHE_REFERENCES,
+    COUNTER_CACHE_MISSES,
+    COUNTER_L1D_LOADS,
+    COUNTER_L1D_MISSES,
+    COUNTER_TASK_CLOCK,          // nanoseconds
+    COUNTER_CONTEXT_SWITCHES,
+    COUNTER_CPU_MIGRATIONS,
+    COUNTER_PAGE_FAULTS,
+    COUNTER_COUNT
+} counter_id;
+
+typedef struct {
+    int fd;                      // -1 when the event could not be opened
+    int counted;                 // set by counters_read() when it got a value
+    double value;                // scaled up when the event was multiplexed
+    double running;              // fraction of the time it was counting
+} counter;
+
+typedef struct {
+    counter items[COUNTER_COUNT];
+    int hardware;                // at least one hardware event is counting
+    int user_only;               // kernel-mode counting was not permitted
+} counter_set;
+
+int counters_open(counter_set *set);
+void counters_read(counter_set *set);
+void counters_print(const counter_set *set);
+void counters_write_json(FILE *out, const counter_set *set);
+void counters_close(counter_set *set);
+
+#endif // COUNTERS_H
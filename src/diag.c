@@ -0,0 +1,585 @@
+#define _XOPEN_SOURCE 700
+
+#include "jc.h"
+#include "utils.h"
+#include "diag.h"
+#include "trace.h"
+#include "process.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define DIAG_LOG ".jc/diagnostics.log"
+
+// Set when the first failing job should stop the whole build
+#define DIAG_FAIL_FAST_ENV "JC_DIAG_FAIL_FAST"
+
+static const char *severity_names[] = {"error", "warning", "note", "output"};
+
+/**
+ * Capture the stderr of every recipe during the build
+ *
+ * Truncates .jc/diagnostics.log and exports its location, so the recipe
+ * shell (see trace_shell_main()) records each job's stderr there instead
+ * of letting parallel jobs interleave on the terminal.
+ *
+ * @param fail_fast Whether a failing job kills make's process group; make
+ *                  must then run in a process group of its own
+ * @return 0 on success, -1 on error
+ */
+int diag_begin(int fail_fast) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)) || trace_install_shell() != 0) {
+        return -1;
+    }
+
+    char log[PATH_MAX + 32];
+    snprintf(log, sizeof(log), "%s/%s", cwd, DIAG_LOG);
+    if (write_file(log, "") != 0) {
+        return -1;
+    }
+
+    setenv(DIAG_ENV, log, 1);
+    if (fail_fast) {
+        setenv(DIAG_FAIL_FAST_ENV, "1", 1);
+    } else {
+        unsetenv(DIAG_FAIL_FAST_ENV);
+    }
+    return 0;
+}
+
+// Whether a recipe runs make itself (automake's recursive targets)
+static int runs_make(const char *recipe) {
+    static const char *const names[] = {"make", "gmake", NULL};
+    for (int n = 0; names[n]; n++) {
+        size_t len = strlen(names[n]);
+        for (const char *p = strstr(recipe, names[n]); p; p = strstr(p + 1, names[n])) {
+            int starts = p == recipe || strchr(" \t/(;&|`", p[-1]) != NULL;
+            int ends = p[len] == '\0' || p[len] == ' ' || p[len] == '\t';
+            if (starts && ends) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Run a recipe for the recipe shell, recording its stderr
+ *
+ * stdout (progress lines such as "CC foo.o") still goes to the terminal.
+ * Recursive make invocations aren't captured, so make's own messages
+ * appear as they happen.
+ *
+ * @param argv The /bin/sh -c command line
+ * @param failed Set when the recipe failed and reported something
+ * @return The recipe's exit status, as a shell reports it
+ */
+int diag_run_recipe(char *const argv[], int *failed) {
+    *failed = 0;
+    process_result result;
+
+    if (runs_make(argv[2])) {
+        return process_run(argv, NULL, &result) == 0 ? process_status(&result) : 127;
+    }
+
+    process_options options = {0};
+    options.err = PROCESS_PIPE;
+    options.capture = 1;
+    if (process_run(argv, &options, &result) != 0) {
+        perror(argv[0]);
+        return 127;
+    }
+
+    int code = process_status(&result);
+    const char *log = getenv(DIAG_ENV);
+
+    // Jobs cut short by --fail-fast only left partial output
+    int stopped = result.signaled && result.signal == SIGTERM && getenv(DIAG_FAIL_FAST_ENV);
+    if (result.errors_len > 0 && log && !stopped) {
+        char cwd[PATH_MAX];
+        if (!getcwd(cwd, sizeof(cwd))) {
+            snprintf(cwd, sizeof(cwd), ".");
+        }
+
+        // One write per record keeps parallel jobs' records apart
+        char *record = NULL;
+        size_t len = 0;
+        size_t cap = 0;
+        append_format(&record, &len, &cap, "D\t%d\t%s\t%zu\n", code, cwd, result.errors_len);
+        if (len + result.errors_len + 1 > cap) {
+            cap = len + result.errors_len + 1;
+            record = realloc(record, cap);
+        }
+        memcpy(record + len, result.errors, result.errors_len);
+        len += result.errors_len;
+
+        int fd = open(log, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (fd < 0 || write(fd, record, len) != (ssize_t)len) {
+            // Never lose a diagnostic: fall back to the terminal
+            fwrite(result.errors, 1, result.errors_len, stderr);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(record);
+        *failed = code != 0;
+    }
+
+    process_result_free(&result);
+    return code;
+}
+
+// With --fail-fast, stop make and every running job after a failure
+void diag_fail_fast(void) {
+    if (getenv(DIAG_FAIL_FAST_ENV)) {
+        kill(0, SIGTERM);
+    }
+}
+
+void diag_set_free(diag_set *set) {
+    for (int i = 0; i < set->count; i++) {
+        free(set->items[i].file);
+        free(set->items[i].message);
+        free(set->items[i].text);
+    }
+    free(set->items);
+    set->items = NULL;
+    set->count = 0;
+    set->capacity = 0;
+}
+
+// Add a diagnostic, or count it again if an identical one was seen
+static void add_diagnostic(diag_set *set, const diagnostic *d) {
+    for (int i = 0; i < set->count; i++) {
+        diagnostic *seen = &set->items[i];
+        int same = seen->severity == d->severity;
+        if (same && d->severity == DIAG_OUTPUT) {
+            same = strcmp(seen->text, d->text) == 0;
+        } else if (same) {
+            same = seen->line == d->line && seen->column == d->column &&
+                   strcmp(seen->file, d->file) == 0 && strcmp(seen->message, d->message) == 0;
+        }
+        if (same) {
+            seen->count++;
+            free(d->file);
+            free(d->message);
+            free(d->text);
+            return;
+        }
+    }
+
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity ? set->capacity * 2 : 32;
+        set->items = realloc(set->items, set->capacity * sizeof(diagnostic));
+    }
+    set->items[set->count] = *d;
+    set->items[set->count].count = 1;
+    set->count++;
+}
+
+// "In file included from ...", "foo.c: In function 'f':" and similar
+static int is_context_line(const char *line, size_t len) {
+    if (strncmp(line, "In file included from ", 22) == 0) {
+        return 1;
+    }
+    size_t indent = strspn(line, " ");
+    if (indent > 0 && strncmp(line + indent, "from ", 5) == 0) {
+        return 1;
+    }
+    if (len > 0 && line[len - 1] == ':') {
+        const char *in = strstr(line, ": In ");
+        const char *top = strstr(line, ": At top level:");
+        return (in && in < line + len) || (top && top < line + len);
+    }
+    return 0;
+}
+
+/**
+ * Parse "file:line[:column]: severity: message"
+ *
+ * @return 1 for a located diagnostic, 0 for anything else (including
+ *         unlocated ones such as "collect2: error: ...")
+ */
+static int parse_location(const char *line, size_t len, diagnostic *d, size_t *rest) {
+    static const struct {
+        const char *marker;
+        diag_severity severity;
+    } markers[] = {
+        {": fatal error: ", DIAG_ERROR},
+        {": error: ", DIAG_ERROR},
+        {": warning: ", DIAG_WARNING},
+        {": note: ", DIAG_NOTE},
+    };
+
+    const char *found = NULL;
+    size_t marker_len = 0;
+    for (size_t i = 0; i < sizeof(markers) / sizeof(markers[0]); i++) {
+        const char *p = strstr(line, markers[i].marker);
+        if (p && p < line + len && (!found || p < found)) {
+            found = p;
+            marker_len = strlen(markers[i].marker);
+            d->severity = markers[i].severity;
+        }
+    }
+    if (!found) {
+        return 0;
+    }
+
+    // Numbers are taken from the end: paths may contain colons
+    int numbers[2] = {0, 0};
+    int count = 0;
+    const char *end = found;
+    while (count < 2) {
+        const char *p = end;
+        while (p > line && isdigit((unsigned char)p[-1])) {
+            p--;
+        }
+        if (p == end || p == line || p[-1] != ':') {
+            break;
+        }
+        numbers[count++] = atoi(p);
+        end = p - 1;
+    }
+    if (count == 0 || end == line) {
+        return 0;
+    }
+
+    d->line = count == 2 ? numbers[1] : numbers[0];
+    d->column = count == 2 ? numbers[0] : 0;
+    d->file = strndup(line, end - line);
+    d->message = strndup(found + marker_len, len - (found + marker_len - line));
+    *rest = found + 2 - line;
+    return 1;
+}
+
+// Make a path reported from cwd relative to the project root
+static char *project_path(const char *file, const char *cwd, const char *root) {
+    char joined[PATH_MAX * 2];
+    if (file[0] == '/') {
+        snprintf(joined, sizeof(joined), "%s", file);
+    } else {
+        snprintf(joined, sizeof(joined), "%s/%s", cwd, file);
+    }
+
+    char resolved[PATH_MAX];
+    if (!realpath(joined, resolved)) {
+        return strdup(file);
+    }
+    size_t root_len = strlen(root);
+    if (strncmp(resolved, root, root_len) == 0 && resolved[root_len] == '/') {
+        return strdup(resolved + root_len + 1);
+    }
+    return strdup(resolved);
+}
+
+// Append a context line with its file name made project-relative
+static void append_context(char **buf, size_t *len, size_t *cap, const char *line,
+                           const char *cwd, const char *root) {
+    const char *from = strstr(line, "from ");
+    const char *start = from ? from + 5 : line;
+    const char *end = NULL;
+    if (from) {
+        // "In file included from <file>:<line>[:<column>]," and "from <file>:<line>,"
+        for (const char *p = start; *p && !end; p++) {
+            if (*p == ':' && isdigit((unsigned char)p[1])) {
+                end = p;
+            }
+        }
+    } else {
+        // "<file>: In function 'f':" and "<file>: At top level:"
+        end = strstr(line, ": In ");
+        if (!end) {
+            end = strstr(line, ": At top level:");
+        }
+    }
+    if (!end || end == start) {
+        append_format(buf, len, cap, "%s\n", line);
+        return;
+    }
+
+    char *file = strndup(start, end - start);
+    char *relative = project_path(file, cwd, root);
+    append_format(buf, len, cap, "%.*s%s%s\n", (int)(start - line), line, relative, end);
+    free(relative);
+    free(file);
+}
+
+/**
+ * Split one job's compiler output into diagnostics and add them to set
+ *
+ * Each diagnostic keeps the lines the compiler printed with it: the
+ * include/function context before it, and the source excerpt and notes
+ * after it. Its location is rewritten relative to the project root so
+ * the same header warning seen from different directories compares
+ * equal. Lines that belong to no diagnostic are kept as one
+ * DIAG_OUTPUT entry.
+ *
+ * @param output The job's stderr (need not be NUL-terminated)
+ * @param cwd Directory the job ran in
+ * @param root Project root
+ */
+void diag_parse(diag_set *set, const char *output, size_t len, const char *cwd, const char *root) {
+    char *context = NULL;
+    size_t context_len = 0;
+    size_t context_cap = 0;
+    char *other = NULL;
+    size_t other_len = 0;
+    size_t other_cap = 0;
+
+    diagnostic current = {0};
+    size_t current_len = 0;
+    size_t current_cap = 0;
+    int open = 0;
+
+    const char *p = output;
+    const char *end = output + len;
+    while (p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        size_t line_len = newline ? (size_t)(newline - p) : (size_t)(end - p);
+        char *line = strndup(p, line_len);
+        p += line_len + (newline ? 1 : 0);
+
+        diagnostic parsed = {0};
+        size_t rest = 0;
+        int located = parse_location(line, line_len, &parsed, &rest);
+
+        if (located) {
+            char *file = project_path(parsed.file, cwd, root);
+            free(parsed.file);
+            parsed.file = file;
+
+            // Notes explain the diagnostic before them
+            int note = parsed.severity == DIAG_NOTE && open;
+            if (!note) {
+                if (open) {
+                    add_diagnostic(set, &current);
+                }
+                current = parsed;
+                current.text = NULL;
+                current_len = 0;
+                current_cap = 0;
+                append_format(&current.text, &current_len, &current_cap, "%s", context ? context : "");
+            }
+            if (parsed.column > 0) {
+                append_format(&current.text, &current_len, &current_cap, "%s:%d:%d: %s\n",
+                              file, parsed.line, parsed.column, line + rest);
+            } else {
+                append_format(&current.text, &current_len, &current_cap, "%s:%d: %s\n",
+                              file, parsed.line, line + rest);
+            }
+            if (note) {
+                free(parsed.file);
+                free(parsed.message);
+            }
+            context_len = 0;
+            if (context) {
+                context[0] = '\0';
+            }
+            open = 1;
+        } else if (is_context_line(line, line_len)) {
+            if (open) {
+                add_diagnostic(set, &current);
+                open = 0;
+            }
+            append_context(&context, &context_len, &context_cap, line, cwd, root);
+        } else if (open && line_len > 0 && strchr(" \t|+", line[0])) {
+            // Source excerpt, caret line or fix-it hint
+            append_format(&current.text, &current_len, &current_cap, "%s\n", line);
+        } else {
+            if (open) {
+                add_diagnostic(set, &current);
+                open = 0;
+            }
+            append_format(&other, &other_len, &other_cap, "%s%s\n", context ? context : "", line);
+            context_len = 0;
+            if (context) {
+                context[0] = '\0';
+            }
+        }
+        free(line);
+    }
+
+    // A trailing context line without its diagnostic says nothing
+    if (open) {
+        add_diagnostic(set, &current);
+    }
+    if (other_len > 0) {
+        diagnostic output_entry = {0};
+        output_entry.severity = DIAG_OUTPUT;
+        output_entry.text = other;
+        add_diagnostic(set, &output_entry);
+    } else {
+        free(other);
+    }
+    free(context);
+}
+
+// Load every job record from the diagnostics log
+static int load_diagnostics(const char *path, const char *root, diag_set *set) {
+    char *log = read_file(path);
+    if (!log) {
+        return -1;
+    }
+
+    size_t total = strlen(log);
+    char *p = log;
+    while (p < log + total) {
+        char *header_end = strchr(p, '\n');
+        if (!header_end || strncmp(p, "D\t", 2) != 0) {
+            break;
+        }
+        *header_end = '\0';
+
+        // D <status> <cwd> <length>
+        char *cwd = strchr(p + 2, '\t');
+        char *length = cwd ? strrchr(cwd + 1, '\t') : NULL;
+        if (!cwd || !length || length == cwd) {
+            break;
+        }
+        *length = '\0';
+        size_t len = strtoull(length + 1, NULL, 10);
+        char *text = header_end + 1;
+        if (text + len > log + total) {
+            len = log + total - text;
+        }
+        diag_parse(set, text, len, cwd + 1, root);
+        p = text + len;
+    }
+
+    free(log);
+    return 0;
+}
+
+static void write_json(const char *path, const diag_set *set) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Warning: Cannot write %s\n", path);
+        return;
+    }
+    for (int i = 0; i < set->count; i++) {
+        const diagnostic *d = &set->items[i];
+        fprintf(out, "{\"severity\":\"%s\"", severity_names[d->severity]);
+        if (d->severity != DIAG_OUTPUT) {
+            fprintf(out, ",\"file\":");
+            json_write_string(out, d->file);
+            fprintf(out, ",\"line\":%d,\"column\":%d,\"message\":", d->line, d->column);
+            json_write_string(out, d->message);
+        }
+        fprintf(out, ",\"count\":%d,\"text\":", d->count);
+        json_write_string(out, d->text);
+        fprintf(out, "}\n");
+    }
+    fclose(out);
+    printf("Diagnostics written to %s\n", path);
+}
+
+/**
+ * Print the captured diagnostics of the last build, grouped by file
+ *
+ * Identical diagnostics from different jobs (typically a warning in a
+ * header every translation unit includes) are shown once with a count.
+ * The first error is repeated at the end so it can't be buried.
+ *
+ * @param json_path Also write them as JSON Lines here, or NULL
+ * @return The number of distinct errors, or -1 if nothing was captured
+ */
+int diag_report(const char *json_path) {
+    const char *log = getenv(DIAG_ENV);
+    char root[PATH_MAX];
+    if (!log || !getcwd(root, sizeof(root))) {
+        return -1;
+    }
+
+    diag_set set = {0};
+    if (load_diagnostics(log, root, &set) != 0) {
+        return -1;
+    }
+    if (set.count == 0) {
+        if (json_path) {
+            write_json(json_path, &set);
+        }
+        diag_set_free(&set);
+        return 0;
+    }
+
+    int errors = 0;
+    int warnings = 0;
+    int duplicates = 0;
+    int first_error = -1;
+    for (int i = 0; i < set.count; i++) {
+        if (set.items[i].severity == DIAG_ERROR) {
+            errors++;
+            if (first_error < 0) {
+                first_error = i;
+            }
+        } else if (set.items[i].severity == DIAG_WARNING) {
+            warnings++;
+        }
+        duplicates += set.items[i].count - 1;
+    }
+
+    printf("\nDiagnostics: %d error%s, %d warning%s", errors, errors == 1 ? "" : "s",
+           warnings, warnings == 1 ? "" : "s");
+    if (duplicates > 0) {
+        printf(" (%d duplicate%s collapsed)", duplicates, duplicates == 1 ? "" : "s");
+    }
+    printf("\n----------------------------------------\n");
+
+    // Files in the order their first diagnostic arrived
+    int *printed = calloc(set.count, sizeof(int));
+    for (int i = 0; i < set.count; i++) {
+        if (printed[i] || set.items[i].severity == DIAG_OUTPUT) {
+            continue;
+        }
+        const char *file = set.items[i].file;
+        printf("%s:\n", file);
+        for (int j = i; j < set.count; j++) {
+            diagnostic *d = &set.items[j];
+            if (printed[j] || d->severity == DIAG_OUTPUT || strcmp(d->file, file) != 0) {
+                continue;
+            }
+            printed[j] = 1;
+            fputs(d->text, stdout);
+            if (d->count > 1) {
+                printf("  (reported by %d jobs)\n", d->count);
+            }
+        }
+        printf("\n");
+    }
+
+    int other = 0;
+    for (int i = 0; i < set.count; i++) {
+        if (set.items[i].severity == DIAG_OUTPUT) {
+            if (!other++) {
+                printf("Other output:\n");
+            }
+            fputs(set.items[i].text, stdout);
+        }
+    }
+    if (other) {
+        printf("\n");
+    }
+
+    if (first_error >= 0) {
+        diagnostic *d = &set.items[first_error];
+        if (d->column > 0) {
+            printf("First error: %s:%d:%d: %s\n", d->file, d->line, d->column, d->message);
+        } else {
+            printf("First error: %s:%d: %s\n", d->file, d->line, d->message);
+        }
+    }
+    if (json_path) {
+        write_json(json_path, &set);
+    }
+    fflush(stdout);
+
+    free(printed);
+    diag_set_free(&set);
+    return errors;
+}
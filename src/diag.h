@@ -0,0 +1,40 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stddef.h>
+
+// Set in make's environment while recipe stderr is being captured
+#define DIAG_ENV "JC_DIAG_FILE"
+
+typedef enum {
+    DIAG_ERROR,
+    DIAG_WARNING,
+    DIAG_NOTE,
+    DIAG_OUTPUT      // anything that isn't a compiler diagnostic
+} diag_severity;
+
+// One distinct diagnostic, however many jobs reported it
+typedef struct {
+    char *file;                  // project-relative when inside it; NULL for DIAG_OUTPUT
+    int line;
+    int column;                  // 0 when the compiler gave none
+    diag_severity severity;
+    char *message;
+    char *text;                  // as printed: context, location, source excerpt, notes
+    int count;
+} diagnostic;
+
+typedef struct {
+    diagnostic *items;
+    int count;
+    int capacity;
+} diag_set;
+
+int diag_begin(int fail_fast);
+int diag_run_recipe(char *const argv[], int *failed);
+void diag_fail_fast(void);
+int diag_report(const char *json_path);
+void diag_parse(diag_set *set, const char *output, size_t len, const char *cwd, const char *root);
+void diag_set_free(diag_set *set);
+
+#endif // DIAG_H
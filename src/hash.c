@@ -0,0 +1,191 @@
+#define _XOPEN_SOURCE 700
+
+#include "hash.h"
+#include "utils.h"
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void hash_block(hash_ctx *ctx, const unsigned char *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) |
+               ((uint32_t)p[i * 4 + 2] << 8) | (uint32_t)p[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + k[i] + w[i];
+        uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+void hash_init(hash_ctx *ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+void hash_update(hash_ctx *ctx, const void *data, size_t len) {
+    const unsigned char *p = data;
+    ctx->length += len;
+
+    if (ctx->used > 0) {
+        size_t take = 64 - ctx->used;
+        if (take > len) take = len;
+        memcpy(ctx->block + ctx->used, p, take);
+        ctx->used += take;
+        p += take;
+        len -= take;
+        if (ctx->used < 64) {
+            return;
+        }
+        hash_block(ctx, ctx->block);
+        ctx->used = 0;
+    }
+
+    while (len >= 64) {
+        hash_block(ctx, p);
+        p += 64;
+        len -= 64;
+    }
+
+    memcpy(ctx->block, p, len);
+    ctx->used = len;
+}
+
+// Strings are hashed with their terminator so "ab","c" differs from "a","bc"
+void hash_update_string(hash_ctx *ctx, const char *str) {
+    hash_update(ctx, str, strlen(str) + 1);
+}
+
+int hash_update_file(hash_ctx *ctx, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+
+    unsigned char buffer[65536];
+    size_t bytes;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        hash_update(ctx, buffer, bytes);
+    }
+
+    int err = ferror(file);
+    fclose(file);
+    return err ? -1 : 0;
+}
+
+void hash_final(hash_ctx *ctx, char hex[HASH_HEX_SIZE]) {
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad = 0x80;
+    hash_update(ctx, &pad, 1);
+
+    unsigned char zero = 0;
+    while (ctx->used != 56) {
+        hash_update(ctx, &zero, 1);
+    }
+
+    unsigned char len_be[8];
+    for (int i = 0; i < 8; i++) {
+        len_be[i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    hash_update(ctx, len_be, 8);
+
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 4; j++) {
+            unsigned char byte = (unsigned char)(ctx->state[i] >> (24 - j * 8));
+            hex[i * 8 + j * 2] = digits[byte >> 4];
+            hex[i * 8 + j * 2 + 1] = digits[byte & 0xf];
+        }
+    }
+    hex[64] = '\0';
+}
+
+/**
+ * Hash the full contents of a file
+ *
+ * @param path The file to hash
+ * @param hex Output buffer for the hex digest
+ * @return 0 on success, -1 if the file could not be read
+ */
+int hash_file(const char *path, char hex[HASH_HEX_SIZE]) {
+    hash_ctx ctx;
+    hash_init(&ctx);
+    if (hash_update_file(&ctx, path) != 0) {
+        return -1;
+    }
+    hash_final(&ctx, hex);
+    return 0;
+}
+
+/**
+ * Hash the identity of an installed program
+ *
+ * The program is resolved through $PATH (unless it contains a '/') and
+ * identified by its real path, size and mtime, so an upgrade changes the
+ * hash without having to run the program.
+ *
+ * @param ctx The hashing context
+ * @param name The program name or path
+ */
+void hash_update_program(hash_ctx *ctx, const char *name) {
+    char path[PATH_MAX];
+    char resolved[PATH_MAX];
+    struct stat st;
+
+    if (strchr(name, '/')) {
+        snprintf(path, sizeof(path), "%s", name);
+    } else if (find_in_path(name, path, sizeof(path)) != 0) {
+        hash_update_string(ctx, name);
+        return;
+    }
+
+    if (!realpath(path, resolved) || stat(resolved, &st) != 0) {
+        hash_update_string(ctx, name);
+        return;
+    }
+
+    char identity[PATH_MAX + 64];
+    snprintf(identity, sizeof(identity), "%s:%lld:%lld", resolved,
+             (long long)st.st_size, (long long)st.st_mtime);
+    hash_update_string(ctx, identity);
+}
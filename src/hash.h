@@ -0,0 +1,26 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Length of a hex digest including the terminating NUL
+#define HASH_HEX_SIZE 65
+
+// SHA-256 hashing context
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+} hash_ctx;
+
+void hash_init(hash_ctx *ctx);
+void hash_update(hash_ctx *ctx, const void *data, size_t len);
+void hash_update_string(hash_ctx *ctx, const char *str);
+int hash_update_file(hash_ctx *ctx, const char *path);
+void hash_final(hash_ctx *ctx, char hex[HASH_HEX_SIZE]);
+int hash_file(const char *path, char hex[HASH_HEX_SIZE]);
+void hash_update_program(hash_ctx *ctx, const char *name);
+
+#endif // HASH_H
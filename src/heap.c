@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+
+#include "jc.h"
+#include "utils.h"
+#include "heap.h"
+#include <math.h>
+
+// A sampled allocation freed: which one, and how long it lived
+typedef struct {
+    pid_t pid;
+    uint64_t id;
+    uint64_t lifetime;
+} heap_release;
+
+static void add_heap_sample(heap_profile *heap, uint64_t id, long size) {
+    if (heap->data.sample_count > heap->sample_capacity) {
+        heap->sample_capacity = heap->data.sample_capacity;
+        heap->samples = realloc(heap->samples, heap->sample_capacity * sizeof(heap_sample));
+    }
+    heap_sample *sample = &heap->samples[heap->data.sample_count - 1];
+    sample->id = id;
+    sample->size = size;
+    sample->freed = 0;
+    sample->lifetime = 0;
+}
+
+static int compare_release(const void *a, const void *b) {
+    const heap_release *x = a;
+    const heap_release *y = b;
+    if (x->pid != y->pid) {
+        return x->pid < y->pid ? -1 : 1;
+    }
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/**
+ * Read the records written by libjc_heap.so
+ *
+ * Besides the exec, fork and maps records of profile_parse_record(), the
+ * library writes "A <pid> <size> <id> <frames>" for a sampled allocation,
+ * "D <pid> <id> <lifetime ns>" when one is freed and "T <pid> <totals>" at
+ * exit. heap->rate must be set to the sampling rate the library used.
+ *
+ * @return 0 on success, -1 if the file can't be read
+ */
+int heap_load(heap_profile *heap, const char *path) {
+    char *content = read_file(path);
+    if (!content) {
+        return -1;
+    }
+
+    heap_release *releases = NULL;
+    int release_count = 0;
+    int release_capacity = 0;
+    uint64_t time = 0;
+    char *save = NULL;
+    for (char *line = strtok_r(content, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        time++;
+        char *rest;
+        long pid = strtol(line + 1, &rest, 10);
+        if (line[0] == 'A') {
+            long size = strtol(rest, &rest, 10);
+            uint64_t id = strtoull(rest, &rest, 10);
+            uint64_t frames[PROFILE_MAX_FRAMES];
+            int depth = profile_parse_frames(rest, frames, PROFILE_MAX_FRAMES);
+            int before = heap->data.sample_count;
+            profile_add_sample(&heap->data, pid, time, frames, depth);
+            if (heap->data.sample_count > before) {
+                add_heap_sample(heap, id, size);
+            }
+        } else if (line[0] == 'D') {
+            if (release_count == release_capacity) {
+                release_capacity = release_capacity ? release_capacity * 2 : 256;
+                releases = realloc(releases, release_capacity * sizeof(heap_release));
+            }
+            heap_release *release = &releases[release_count++];
+            release->pid = pid;
+            release->id = strtoull(rest, &rest, 10);
+            release->lifetime = strtoull(rest, NULL, 10);
+        } else if (line[0] == 'T') {
+            heap->processes = realloc(heap->processes, (heap->process_count + 1) * sizeof(heap_totals));
+            heap_totals *totals = &heap->processes[heap->process_count++];
+            memset(totals, 0, sizeof(*totals));
+            totals->pid = pid;
+            long long rate = 0;
+            sscanf(rest, "%lld %lld %lld %lld %lld %lld %lld", &totals->allocations, &totals->bytes,
+                   &totals->frees, &totals->peak, &totals->in_use, &totals->dropped, &rate);
+            if (rate > 0) {
+                heap->rate = rate;
+            }
+        } else {
+            profile_parse_record(&heap->data, line, time);
+        }
+    }
+    free(content);
+
+    // Match each free with its allocation by (pid, id)
+    qsort(releases, release_count, sizeof(heap_release), compare_release);
+    for (int i = 0; i < heap->data.sample_count; i++) {
+        heap_release key = {heap->data.samples[i].pid, heap->samples[i].id, 0};
+        heap_release *found = bsearch(&key, releases, release_count, sizeof(heap_release), compare_release);
+        if (found) {
+            heap->samples[i].freed = 1;
+            heap->samples[i].lifetime = found->lifetime;
+        }
+    }
+    free(releases);
+    return 0;
+}
+
+void heap_free(heap_profile *heap) {
+    profile_data_free(&heap->data);
+    free(heap->samples);
+    free(heap->processes);
+    memset(heap, 0, sizeof(*heap));
+}
+
+/**
+ * How many allocations one sample stands for
+ *
+ * An allocation of size bytes is sampled with probability
+ * 1 - exp(-size / rate), so big ones are nearly always caught and small
+ * ones stand for many.
+ */
+static double sample_weight(long size, long rate) {
+    double p = 1 - exp(-(double)size / rate);
+    return p > 0 ? 1 / p : 1;
+}
+
+// The innermost HEAP_SITE_FRAMES frames of a folded stack, innermost first
+static char *site_name(const char *stack) {
+    char *name = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    const char *end = stack + strlen(stack);
+    for (int i = 0; i < HEAP_SITE_FRAMES && end > stack; i++) {
+        const char *start = end;
+        while (start > stack && start[-1] != ';') {
+            start--;
+        }
+        append_format(&name, &len, &cap, "%s%.*s", i ? " < " : "", (int)(end - start), start);
+        end = start > stack ? start - 1 : stack;
+    }
+    return name ? name : strdup("[unknown]");
+}
+
+typedef struct {
+    char *key;
+    int sample;
+} keyed_sample;
+
+static int compare_keyed(const void *a, const void *b) {
+    return strcmp(((const keyed_sample *)a)->key, ((const keyed_sample *)b)->key);
+}
+
+/**
+ * Symbolize the samples and total them by allocation site
+ *
+ * stacks gets the full call stacks weighted by estimated bytes allocated,
+ * for the folded file and the flame graph.
+ */
+void heap_sites(const heap_profile *heap, heap_site_set *sites, folded_set *stacks) {
+    memset(sites, 0, sizeof(*sites));
+    memset(stacks, 0, sizeof(*stacks));
+    int count = heap->data.sample_count;
+    if (count == 0) {
+        return;
+    }
+
+    char **folded = profile_symbolize(&heap->data);
+    keyed_sample *by_site = malloc(count * sizeof(keyed_sample));
+    keyed_sample *by_stack = malloc(count * sizeof(keyed_sample));
+    for (int i = 0; i < count; i++) {
+        by_site[i].key = site_name(folded[i]);
+        by_site[i].sample = i;
+        by_stack[i].key = folded[i];
+        by_stack[i].sample = i;
+    }
+    free(folded);
+    qsort(by_site, count, sizeof(keyed_sample), compare_keyed);
+    qsort(by_stack, count, sizeof(keyed_sample), compare_keyed);
+
+    sites->items = malloc(count * sizeof(heap_site));
+    for (int i = 0; i < count; i++) {
+        const heap_sample *sample = &heap->samples[by_site[i].sample];
+        if (sites->count == 0 || strcmp(sites->items[sites->count - 1].name, by_site[i].key) != 0) {
+            memset(&sites->items[sites->count], 0, sizeof(heap_site));
+            sites->items[sites->count++].name = by_site[i].key;
+        } else {
+            free(by_site[i].key);
+        }
+        heap_site *site = &sites->items[sites->count - 1];
+        double weight = sample_weight(sample->size, heap->rate);
+        site->count += weight;
+        site->bytes += weight * sample->size;
+        if (sample->freed && sample->lifetime < HEAP_SHORT_LIVED_NS) {
+            site->churn_count += weight;
+            site->churn_bytes += weight * sample->size;
+        } else if (!sample->freed) {
+            site->leaked_count += weight;
+            site->leaked_bytes += weight * sample->size;
+        }
+    }
+
+    stacks->items = malloc(count * sizeof(folded_stack));
+    for (int i = 0; i < count; i++) {
+        const heap_sample *sample = &heap->samples[by_stack[i].sample];
+        long bytes = (long)(sample_weight(sample->size, heap->rate) * sample->size + 0.5);
+        if (stacks->count == 0 || strcmp(stacks->items[stacks->count - 1].stack, by_stack[i].key) != 0) {
+            stacks->items[stacks->count].stack = by_stack[i].key;
+            stacks->items[stacks->count++].count = 0;
+        } else {
+            free(by_stack[i].key);
+        }
+        stacks->items[stacks->count - 1].count += bytes;
+        stacks->total += bytes;
+    }
+    free(by_site);
+    free(by_stack);
+}
+
+static void format_bytes(double bytes, char *out, size_t size) {
+    if (bytes >= 1024.0 * 1024 * 1024) {
+        snprintf(out, size, "%.1f GB", bytes / (1024.0 * 1024 * 1024));
+    } else if (bytes >= 1024 * 1024) {
+        snprintf(out, size, "%.1f MB", bytes / (1024.0 * 1024));
+    } else if (bytes >= 1024) {
+        snprintf(out, size, "%.1f KB", bytes / 1024.0);
+    } else {
+        snprintf(out, size, "%.0f B", bytes);
+    }
+}
+
+static int by_bytes(const void *a, const void *b) {
+    double x = ((const heap_site *)a)->bytes;
+    double y = ((const heap_site *)b)->bytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int by_count(const void *a, const void *b) {
+    double x = ((const heap_site *)a)->count;
+    double y = ((const heap_site *)b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int by_churn(const void *a, const void *b) {
+    double x = ((const heap_site *)a)->churn_count;
+    double y = ((const heap_site *)b)->churn_count;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int by_leaked(const void *a, const void *b) {
+    double x = ((const heap_site *)a)->leaked_bytes;
+    double y = ((const heap_site *)b)->leaked_bytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// One table of sites, ranked by compare; rows whose value is zero are left out
+static void print_sites(heap_site_set *sites, int limit, const char *title,
+                        int (*compare)(const void *, const void *), int churn, int leaked) {
+    qsort(sites->items, sites->count, sizeof(heap_site), compare);
+    int shown = 0;
+    for (int i = 0; i < sites->count && shown < limit; i++) {
+        const heap_site *site = &sites->items[i];
+        double bytes = churn ? site->churn_bytes : leaked ? site->leaked_bytes : site->bytes;
+        double count = churn ? site->churn_count : leaked ? site->leaked_count : site->count;
+        if (count < 0.5) {
+            continue;
+        }
+        if (shown++ == 0) {
+            printf("\n%s:\n", title);
+            printf("  %10s %12s  %s\n", "bytes", "allocations", "site");
+        }
+        char size[32];
+        format_bytes(bytes, size, sizeof(size));
+        printf("  %10s %12.0f  %s\n", size, count, site->name);
+    }
+}
+
+/**
+ * Print the totals and the top sites by bytes, count, churn and leaks
+ */
+void heap_print(const heap_profile *heap, heap_site_set *sites, int limit) {
+    heap_totals sum = {0};
+    for (int i = 0; i < heap->process_count; i++) {
+        const heap_totals *totals = &heap->processes[i];
+        sum.allocations += totals->allocations;
+        sum.bytes += totals->bytes;
+        sum.frees += totals->frees;
+        sum.in_use += totals->in_use;
+        sum.dropped += totals->dropped;
+        if (totals->peak > sum.peak) {
+            sum.peak = totals->peak;
+        }
+    }
+
+    char rate[32];
+    format_bytes(heap->rate, rate, sizeof(rate));
+    printf("Heap (sampling one allocation per %s on average, %d sampled):\n", rate,
+           heap->data.sample_count);
+    if (heap->process_count == 0) {
+        printf("  No totals were recorded (the program did not exit normally)\n");
+    } else {
+        char bytes[32];
+        format_bytes(sum.bytes, bytes, sizeof(bytes));
+        printf("  Allocations:    %lld (%s), %lld freed\n", sum.allocations, bytes, sum.frees);
+        format_bytes(sum.peak, bytes, sizeof(bytes));
+        printf("  Peak in use:    %s%s\n", bytes, heap->process_count > 1 ? " (largest of any process)" : "");
+        format_bytes(sum.in_use, bytes, sizeof(bytes));
+        printf("  In use at exit: %s in %lld blocks\n", bytes, sum.allocations - sum.frees);
+    }
+    if (sum.dropped > 0) {
+        printf("  %lld samples were dropped (too many live sampled blocks)\n", sum.dropped);
+    }
+
+    print_sites(sites, limit, "Top allocation sites by bytes", by_bytes, 0, 0);
+    print_sites(sites, limit, "Top allocation sites by count", by_count, 0, 0);
+    print_sites(sites, limit, "Short-lived allocations (freed within 1 ms)", by_churn, 1, 0);
+    print_sites(sites, limit, "Leaked at exit", by_leaked, 0, 1);
+}
+
+void heap_sites_free(heap_site_set *sites) {
+    for (int i = 0; i < sites->count; i++) {
+        free(sites->items[i].name);
+    }
+    free(sites->items);
+    memset(sites, 0, sizeof(*sites));
+}
@@ -0,0 +1,69 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "profile.h"
+
+// Set in the program's environment for libjc_heap.so
+#define HEAP_FILE_ENV "JC_HEAP_FILE"
+#define HEAP_RATE_ENV "JC_HEAP_RATE"
+
+// Mean bytes between sampled allocations (tcmalloc's default)
+#define HEAP_DEFAULT_RATE (512 * 1024)
+
+// Allocations freed sooner than this count as churn
+#define HEAP_SHORT_LIVED_NS 1000000ULL
+
+// Frames of the call stack that name an allocation site
+#define HEAP_SITE_FRAMES 3
+
+// A sampled allocation; heap_profile.samples[i] goes with data.samples[i]
+typedef struct {
+    uint64_t id;
+    long size;
+    int freed;
+    uint64_t lifetime;           // ns, when freed
+} heap_sample;
+
+// Exact totals one process reported at exit
+typedef struct {
+    pid_t pid;
+    long long allocations;
+    long long bytes;
+    long long frees;
+    long long peak;              // most bytes in use at once
+    long long in_use;            // bytes still allocated at exit
+    long long dropped;           // samples that didn't fit the table
+} heap_totals;
+
+typedef struct {
+    profile_data data;           // maps, tasks and the sampled stacks
+    heap_sample *samples;
+    int sample_capacity;
+    heap_totals *processes;
+    int process_count;
+    long rate;                   // mean bytes between samples
+} heap_profile;
+
+// One allocation site, with counts scaled up from the samples
+typedef struct {
+    char *name;                  // innermost frames, "inner < caller < ..."
+    double bytes;
+    double count;
+    double churn_bytes;
+    double churn_count;
+    double leaked_bytes;
+    double leaked_count;
+} heap_site;
+
+typedef struct {
+    heap_site *items;
+    int count;
+} heap_site_set;
+
+int heap_load(heap_profile *heap, const char *path);
+void heap_free(heap_profile *heap);
+void heap_sites(const heap_profile *heap, heap_site_set *sites, folded_set *stacks);
+void heap_print(const heap_profile *heap, heap_site_set *sites, int limit);
+void heap_sites_free(heap_site_set *sites);
+
+#endif // HEAP_H
@@ -14,11 +14,14 @@
 int cmd_new(int argc, char *argv[]);
 int cmd_build(int argc, char *argv[]);
 int cmd_run(int argc, char *argv[]);
+int cmd_bench(int argc, char *argv[]);
 int cmd_install(int argc, char *argv[]);
 int cmd_bt(int argc, char *argv[]);
+int cmd_profile(int argc, char *argv[]);
 int cmd_clean(int argc, char *argv[]);
 int cmd_add(int argc, char *argv[]);
 int cmd_test(int argc, char *argv[]);
+int cmd_cache(int argc, char *argv[]);
 
 // Version info
 #define JC_VERSION "1.0.0"
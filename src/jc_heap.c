@@ -0,0 +1,515 @@
+// libjc_heap.so: sampling heap profiler for 'jc run --heap'. Loaded with
+// LD_PRELOAD, it wraps the allocator, keeps exact totals and the peak, and
+// records the call stack of one allocation per $JC_HEAP_RATE bytes on
+// average (as tcmalloc samples). Sampled allocations are remembered until
+// they are freed, so their lifetimes and the leaks at exit can be
+// reported. Records go to $JC_HEAP_FILE in the format heap_load() reads.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FRAMES 64
+
+// Records are buffered, as one write per sample would dominate the cost
+#define OUTPUT_SIZE (64 * 1024)
+
+// Sampled allocations still live (open addressing on the address)
+#define TABLE_SIZE (1 << 16)
+#define TABLE_PROBES 32
+#define TOMBSTONE ((uintptr_t)1)
+
+// Counts of live sampled allocations by hash, so most frees skip the table
+#define FILTER_SIZE 4096
+
+// Threads count locally and add to the totals after this many bytes or
+// allocations, so the peak is exact to within FLUSH_BYTES per thread
+#define FLUSH_BYTES (64 * 1024)
+#define FLUSH_COUNT 4096
+
+// glibc's allocator, underneath this one
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+extern void __libc_free(void *ptr);
+
+typedef struct {
+    _Atomic uintptr_t address;
+    uint64_t id;
+    uint64_t born;               // CLOCK_MONOTONIC, ns
+} sampled_block;
+
+static int out_fd = -1;
+static char output[OUTPUT_SIZE];
+static size_t output_len;
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static long sample_rate = 0;
+static sampled_block *table;
+static _Atomic uint16_t filter[FILTER_SIZE];
+static _Atomic uint64_t next_id;
+static _Atomic long long allocations;
+static _Atomic long long allocated_bytes;
+static _Atomic long long frees;
+static _Atomic long long in_use;
+static _Atomic long long peak;
+static _Atomic long long dropped;
+
+// This library's code, so its frames can be left out of stacks
+static uintptr_t own_start;
+static uintptr_t own_end;
+
+// initial-exec: reaching these must not call into the allocator
+static __thread long bytes_until_sample __attribute__((tls_model("initial-exec")));
+static __thread uint64_t random_state __attribute__((tls_model("initial-exec")));
+static __thread int busy __attribute__((tls_model("initial-exec")));
+static __thread struct {
+    long long allocations;
+    long long bytes;
+    long long frees;
+    long long in_use;
+} local __attribute__((tls_model("initial-exec")));
+
+// Flushes a thread's counts when it exits
+static pthread_key_t flush_key;
+
+static size_t put_text(char *buf, size_t len, const char *text) {
+    while (*text) {
+        buf[len++] = *text++;
+    }
+    return len;
+}
+
+static size_t put_number(char *buf, size_t len, unsigned long long value, int base) {
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value);
+    while (n) {
+        buf[len++] = digits[--n];
+    }
+    return len;
+}
+
+static void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(out_fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+// Append one record to the output buffer
+static void emit(const char *line, size_t len) {
+    pthread_mutex_lock(&output_lock);
+    if (output_len + len > sizeof(output)) {
+        write_all(output, output_len);
+        output_len = 0;
+    }
+    if (len > sizeof(output)) {
+        // Too big to buffer; the buffer was just flushed, so order holds
+        write_all(line, len);
+    } else {
+        memcpy(output + output_len, line, len);
+        output_len += len;
+    }
+    pthread_mutex_unlock(&output_lock);
+}
+
+static void flush_output(void) {
+    write_all(output, output_len);
+    output_len = 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned hash_address(uintptr_t address) {
+    uint64_t h = (uint64_t)address * 0x9e3779b97f4a7c15ULL;
+    return (unsigned)(h >> 40);
+}
+
+// Bytes until the next sample: exponential with mean sample_rate, so every
+// byte is equally likely to be the one that triggers it
+static long next_sample_distance(void) {
+    if (!random_state) {
+        random_state = (uintptr_t)&random_state ^ now_ns() ^ 0x2545f4914f6cdd1dULL;
+    }
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    double u = ((random_state >> 11) + 0.5) / 9007199254740992.0;
+    return (long)(-log(u) * sample_rate) + 1;
+}
+
+static void remember(uintptr_t address, uint64_t id, uint64_t born) {
+    unsigned h = hash_address(address);
+    for (int i = 0; i < TABLE_PROBES; i++) {
+        sampled_block *slot = &table[(h + i) % TABLE_SIZE];
+        uintptr_t seen = slot->address;
+        if ((seen == 0 || seen == TOMBSTONE) &&
+            __atomic_compare_exchange_n(&slot->address, &seen, address, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED)) {
+            slot->id = id;
+            slot->born = born;
+            filter[h % FILTER_SIZE]++;
+            return;
+        }
+    }
+    dropped++;
+}
+
+// Take address out of the table; returns 1 if it was a sampled allocation
+static int forget(uintptr_t address, uint64_t *id, uint64_t *born) {
+    unsigned h = hash_address(address);
+    if (filter[h % FILTER_SIZE] == 0) {
+        return 0;
+    }
+    for (int i = 0; i < TABLE_PROBES; i++) {
+        sampled_block *slot = &table[(h + i) % TABLE_SIZE];
+        uintptr_t seen = slot->address;
+        if (seen == 0) {
+            return 0;
+        }
+        if (seen == address) {
+            *id = slot->id;
+            *born = slot->born;
+            slot->address = TOMBSTONE;
+            filter[h % FILTER_SIZE]--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Record the stack of a sampled allocation: "A <pid> <size> <id> <frames>"
+static void record_allocation(void *ptr, size_t size) {
+    busy = 1;
+    void *frames[MAX_FRAMES];
+    int depth = backtrace(frames, MAX_FRAMES);
+    int first = 0;
+    while (first < depth && (uintptr_t)frames[first] >= own_start && (uintptr_t)frames[first] < own_end) {
+        first++;
+    }
+
+    uint64_t id = ++next_id;
+    char line[MAX_FRAMES * 17 + 96];
+    size_t len = put_text(line, 0, "A ");
+    len = put_number(line, len, getpid(), 10);
+    line[len++] = ' ';
+    len = put_number(line, len, size, 10);
+    line[len++] = ' ';
+    len = put_number(line, len, id, 10);
+    for (int i = first; i < depth; i++) {
+        line[len++] = ' ';
+        // Every frame is a return address; step back into the call for the first
+        uintptr_t address = (uintptr_t)frames[i] - (i == first ? 1 : 0);
+        len = put_number(line, len, address, 16);
+    }
+    line[len++] = '\n';
+    emit(line, len);
+    remember((uintptr_t)ptr, id, now_ns());
+    busy = 0;
+}
+
+// Record a sampled allocation being freed: "D <pid> <id> <lifetime ns>"
+static void record_free(uint64_t id, uint64_t born) {
+    char line[96];
+    size_t len = put_text(line, 0, "D ");
+    len = put_number(line, len, getpid(), 10);
+    line[len++] = ' ';
+    len = put_number(line, len, id, 10);
+    line[len++] = ' ';
+    len = put_number(line, len, now_ns() - born, 10);
+    line[len++] = '\n';
+    emit(line, len);
+}
+
+static void flush_local(void) {
+    allocations += local.allocations;
+    allocated_bytes += local.bytes;
+    frees += local.frees;
+    long long now = in_use += local.in_use;
+    long long high = peak;
+    while (now > high && !__atomic_compare_exchange_n(&peak, &high, now, 0, __ATOMIC_RELAXED,
+                                                      __ATOMIC_RELAXED)) {
+    }
+    memset(&local, 0, sizeof(local));
+}
+
+static void flush_at_thread_exit(void *unused) {
+    (void)unused;
+    flush_local();
+}
+
+static void on_allocate(void *ptr, size_t size) {
+    if (!ptr || out_fd < 0) {
+        return;
+    }
+    local.allocations++;
+    local.bytes += size;
+    local.in_use += malloc_usable_size(ptr);
+    if (local.in_use > FLUSH_BYTES || local.allocations >= FLUSH_COUNT) {
+        flush_local();
+    }
+
+    bytes_until_sample -= size;
+    if (bytes_until_sample < 0 && !busy) {
+        // The first allocation of each thread only draws its distance
+        int first = random_state == 0;
+        bytes_until_sample = next_sample_distance();
+        if (first) {
+            pthread_setspecific(flush_key, &local);
+        } else {
+            record_allocation(ptr, size);
+        }
+    }
+}
+
+// A block of the given usable size is going back to the allocator
+static void on_release(void *ptr, size_t usable) {
+    local.frees++;
+    local.in_use -= usable;
+    if (local.in_use < -FLUSH_BYTES) {
+        flush_local();
+    }
+    uint64_t id;
+    uint64_t born;
+    if (forget((uintptr_t)ptr, &id, &born)) {
+        record_free(id, born);
+    }
+}
+
+void *malloc(size_t size) {
+    void *ptr = __libc_malloc(size);
+    on_allocate(ptr, size);
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size) {
+    void *ptr = __libc_calloc(count, size);
+    on_allocate(ptr, count * size);
+    return ptr;
+}
+
+void *realloc(void *old, size_t size) {
+    if (!old) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(old);
+        return NULL;
+    }
+    // Counted as a free and a new allocation; a failed realloc changes nothing
+    size_t old_usable = malloc_usable_size(old);
+    void *ptr = __libc_realloc(old, size);
+    if (ptr && out_fd >= 0) {
+        on_release(old, old_usable);
+        on_allocate(ptr, size);
+    }
+    return ptr;
+}
+
+void free(void *ptr) {
+    if (ptr && out_fd >= 0) {
+        on_release(ptr, malloc_usable_size(ptr));
+    }
+    __libc_free(ptr);
+}
+
+int posix_memalign(void **result, size_t alignment, size_t size) {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+        return EINVAL;
+    }
+    void *ptr = __libc_memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    on_allocate(ptr, size);
+    *result = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    void *ptr = __libc_memalign(alignment, size);
+    on_allocate(ptr, size);
+    return ptr;
+}
+
+void *memalign(size_t alignment, size_t size) {
+    void *ptr = __libc_memalign(alignment, size);
+    on_allocate(ptr, size);
+    return ptr;
+}
+
+void *valloc(size_t size) {
+    void *ptr = __libc_valloc(size);
+    on_allocate(ptr, size);
+    return ptr;
+}
+
+void *pvalloc(size_t size) {
+    void *ptr = __libc_pvalloc(size);
+    on_allocate(ptr, size);
+    return ptr;
+}
+
+// Record the executable mappings, and where this library's code is
+static void write_maps(void) {
+    int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    // Read with plain syscalls: stdio would allocate through us
+    static char maps[1 << 17];
+    size_t size = 0;
+    ssize_t n;
+    while (size < sizeof(maps) - 1 && (n = read(fd, maps + size, sizeof(maps) - 1 - size)) > 0) {
+        size += n;
+    }
+    close(fd);
+    maps[size] = '\0';
+
+    uintptr_t self = (uintptr_t)&write_maps;
+    char line[4096 + 160];
+    for (char *entry = maps; *entry;) {
+        char *end = strchr(entry, '\n');
+        size_t entry_len = end ? (size_t)(end - entry) : strlen(entry);
+        unsigned long start;
+        unsigned long stop;
+        if (sscanf(entry, "%lx-%lx", &start, &stop) == 2 && self >= start && self < stop) {
+            own_start = start;
+            own_end = stop;
+        }
+        if (entry_len < 4096) {
+            size_t len = put_text(line, 0, "M ");
+            len = put_number(line, len, getpid(), 10);
+            line[len++] = ' ';
+            memcpy(line + len, entry, entry_len);
+            len += entry_len;
+            line[len++] = '\n';
+            emit(line, len);
+        }
+        entry = end ? end + 1 : entry + entry_len;
+    }
+}
+
+// Write out what the parent buffered, so the child doesn't write it again
+static void before_fork(void) {
+    pthread_mutex_lock(&output_lock);
+    flush_output();
+}
+
+static void after_fork_parent(void) {
+    pthread_mutex_unlock(&output_lock);
+}
+
+// The child starts its own accounting; its copies of the parent's blocks are untracked
+static void after_fork(void) {
+    pthread_mutex_unlock(&output_lock);
+    memset(table, 0, TABLE_SIZE * sizeof(sampled_block));
+    memset(filter, 0, sizeof(filter));
+    memset(&local, 0, sizeof(local));
+    allocations = 0;
+    allocated_bytes = 0;
+    frees = 0;
+    in_use = 0;
+    peak = 0;
+    dropped = 0;
+    char line[64];
+    size_t len = put_text(line, 0, "F ");
+    len = put_number(line, len, getpid(), 10);
+    line[len++] = ' ';
+    len = put_number(line, len, getppid(), 10);
+    line[len++] = '\n';
+    emit(line, len);
+}
+
+__attribute__((constructor)) static void heap_start(void) {
+    const char *path = getenv("JC_HEAP_FILE");
+    if (!path || !*path) {
+        return;
+    }
+    const char *rate = getenv("JC_HEAP_RATE");
+    sample_rate = rate ? atol(rate) : 0;
+    if (sample_rate <= 0) {
+        sample_rate = 512 * 1024;
+    }
+    table = mmap(NULL, TABLE_SIZE * sizeof(sampled_block), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+        table = NULL;
+        return;
+    }
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+
+    // The first backtrace() loads the unwinder, which allocates
+    busy = 1;
+    void *warm[4];
+    backtrace(warm, 4);
+    busy = 0;
+
+    pthread_key_create(&flush_key, flush_at_thread_exit);
+    out_fd = fd;
+    char line[64];
+    size_t len = put_text(line, 0, "E ");
+    len = put_number(line, len, getpid(), 10);
+    line[len++] = '\n';
+    emit(line, len);
+    write_maps();
+    pthread_atfork(before_fork, after_fork_parent, after_fork);
+}
+
+// Totals at exit: "T <pid> <allocations> <bytes> <frees> <peak> <in use> <dropped> <rate>"
+__attribute__((destructor)) static void heap_stop(void) {
+    if (out_fd < 0) {
+        return;
+    }
+    flush_local();
+    // Libraries opened with dlopen() since startup
+    write_maps();
+    char line[256];
+    size_t len = put_text(line, 0, "T ");
+    len = put_number(line, len, getpid(), 10);
+    long long values[] = {allocations, allocated_bytes, frees, peak, in_use, dropped, sample_rate};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        line[len++] = ' ';
+        len = put_number(line, len, values[i] > 0 ? values[i] : 0, 10);
+    }
+    line[len++] = '\n';
+    emit(line, len);
+    pthread_mutex_lock(&output_lock);
+    flush_output();
+    int fd = out_fd;
+    out_fd = -1;
+    close(fd);
+    pthread_mutex_unlock(&output_lock);
+}
@@ -0,0 +1,188 @@
+// libjc_prof.so: in-process sampler for 'jc profile' when perf events are
+// unavailable. Loaded with LD_PRELOAD, it samples the call stack on SIGPROF
+// (process CPU time) and appends the records profile_load_preload() reads
+// to $JC_PROFILE_FILE.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#define MAX_FRAMES 128
+
+static int out_fd = -1;
+static long interval_us = 0;
+
+// Append text to buf; returns the new length
+static size_t put_text(char *buf, size_t len, const char *text) {
+    while (*text) {
+        buf[len++] = *text++;
+    }
+    return len;
+}
+
+static size_t put_number(char *buf, size_t len, unsigned long long value, int base) {
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value);
+    while (n) {
+        buf[len++] = digits[--n];
+    }
+    return len;
+}
+
+static void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(out_fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+// The interrupted instruction, to find where the handler's frames end
+static void *interrupted_pc(void *context) {
+    ucontext_t *uc = context;
+#if defined(__x86_64__)
+    return (void *)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+    return (void *)uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+    return (void *)uc->uc_mcontext.pc;
+#else
+    (void)uc;
+    return NULL;
+#endif
+}
+
+static void on_sample(int sig, siginfo_t *info, void *context) {
+    (void)sig;
+    (void)info;
+    int saved_errno = errno;
+
+    void *frames[MAX_FRAMES];
+    int depth = backtrace(frames, MAX_FRAMES);
+
+    // Skip this handler and the signal trampoline
+    void *pc = interrupted_pc(context);
+    int first = depth > 2 ? 2 : depth;
+    for (int i = 0; pc && i < depth; i++) {
+        if (frames[i] == pc) {
+            first = i;
+            break;
+        }
+    }
+
+    char line[MAX_FRAMES * 17 + 32];
+    size_t len = put_text(line, 0, "S ");
+    len = put_number(line, len, getpid(), 10);
+    for (int i = first; i < depth; i++) {
+        line[len++] = ' ';
+        len = put_number(line, len, (unsigned long long)(uintptr_t)frames[i], 16);
+    }
+    line[len++] = '\n';
+    if (depth > first) {
+        write_all(line, len);
+    }
+    errno = saved_errno;
+}
+
+static void start_timer(void) {
+    struct itimerval timer;
+    timer.it_interval.tv_sec = interval_us / 1000000;
+    timer.it_interval.tv_usec = interval_us % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+static void stop_timer(void) {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+// Record the executable mappings, so addresses can be symbolized later
+static void write_maps(void) {
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (!maps) {
+        return;
+    }
+    char entry[4096 + 128];
+    char line[sizeof(entry) + 32];
+    while (fgets(entry, sizeof(entry), maps)) {
+        int len = snprintf(line, sizeof(line), "M %d %s", (int)getpid(), entry);
+        if (len > 0 && (size_t)len < sizeof(line)) {
+            write_all(line, len);
+        }
+    }
+    fclose(maps);
+}
+
+// Timers aren't inherited across fork; the child keeps sampling with its own pid
+static void after_fork(void) {
+    char line[64];
+    int len = snprintf(line, sizeof(line), "F %d %d\n", (int)getpid(), (int)getppid());
+    write_all(line, len);
+    start_timer();
+}
+
+__attribute__((constructor)) static void profiler_start(void) {
+    const char *path = getenv("JC_PROFILE_FILE");
+    if (!path || !*path) {
+        return;
+    }
+    out_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (out_fd < 0) {
+        return;
+    }
+    const char *hz = getenv("JC_PROFILE_HZ");
+    long frequency = hz ? atol(hz) : 0;
+    interval_us = 1000000 / (frequency > 0 && frequency <= 10000 ? frequency : 999);
+
+    char line[64];
+    int len = snprintf(line, sizeof(line), "E %d\n", (int)getpid());
+    write_all(line, len);
+    write_maps();
+
+    // The first backtrace() loads the unwinder, which isn't safe in a handler
+    void *warm[4];
+    backtrace(warm, 4);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_sample;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    pthread_atfork(NULL, NULL, after_fork);
+    start_timer();
+}
+
+__attribute__((destructor)) static void profiler_stop(void) {
+    if (out_fd < 0) {
+        return;
+    }
+    stop_timer();
+    // Libraries opened with dlopen() since startup
+    write_maps();
+    close(out_fd);
+    out_fd = -1;
+}
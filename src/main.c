@@ -1,5 +1,6 @@
 #include "jc.h"
 #include "utils.h"
+#include "trace.h"
 
 void print_usage(const char *program_name) {
     printf("jc - A modern C project management tool\n");
@@ -10,10 +11,13 @@ void print_usage(const char *program_name) {
     printf("  add <type> <target> Add files, directories, or dependencies\n");
     printf("  build           Build the current project\n");
     printf("  run             Run the current project\n");
+    printf("  bench           Benchmark the current project's program\n");
     printf("  install         Install the current project\n");
     printf("  clean           Clean build artifacts\n");
     printf("  test            Manage and run tests\n");
     printf("  bt              Show backtrace (debug crashed program)\n");
+    printf("  profile         Profile the program and draw a flame graph\n");
+    printf("  cache           Manage the compiled object cache\n");
     printf("  help            Show this help message\n");
     printf("  version         Show version information\n");
     printf("\n");
@@ -24,6 +28,12 @@ void print_version(void) {
 }
 
 int main(int argc, char *argv[]) {
+    // During 'jc build --trace', make runs jc as its SHELL
+    const char *self = strrchr(argv[0], '/');
+    if (strcmp(self ? self + 1 : argv[0], TRACE_SHELL_NAME) == 0) {
+        return trace_shell_main(argc, argv);
+    }
+
     if (argc < 2) {
         print_usage(argv[0]);
         return 1;
@@ -39,6 +49,8 @@ int main(int argc, char *argv[]) {
         return cmd_build(argc - 1, argv + 1);
     } else if (strcmp(command, "run") == 0) {
         return cmd_run(argc - 1, argv + 1);
+    } else if (strcmp(command, "bench") == 0) {
+        return cmd_bench(argc - 1, argv + 1);
     } else if (strcmp(command, "install") == 0) {
         return cmd_install(argc - 1, argv + 1);
     } else if (strcmp(command, "clean") == 0) {
@@ -47,6 +59,10 @@ int main(int argc, char *argv[]) {
         return cmd_test(argc - 1, argv + 1);
     } else if (strcmp(command, "bt") == 0) {
         return cmd_bt(argc - 1, argv + 1);
+    } else if (strcmp(command, "profile") == 0) {
+        return cmd_profile(argc - 1, argv + 1);
+    } else if (strcmp(command, "cache") == 0) {
+        return cmd_cache(argc - 1, argv + 1);
     } else if (strcmp(command, "help") == 0 || strcmp(command, "--help") == 0 || strcmp(command, "-h") == 0) {
         print_usage(argv[0]);
         return 0;
@@ -0,0 +1,324 @@
+#include "jc.h"
+#include "utils.h"
+#include "makefile_am.h"
+#include <ctype.h>
+
+// Find a variable by name, or NULL
+static am_variable *find_variable(am_file *am, const char *name) {
+    for (int i = 0; i < am->count; i++) {
+        if (strcmp(am->vars[i].name, name) == 0) {
+            return &am->vars[i];
+        }
+    }
+    return NULL;
+}
+
+// Record "name = value" or "name += value"
+static int set_variable(am_file *am, const char *name, const char *value, int append) {
+    am_variable *var = find_variable(am, name);
+    if (!var) {
+        am_variable *vars = realloc(am->vars, (am->count + 1) * sizeof(am_variable));
+        if (!vars) {
+            return -1;
+        }
+        am->vars = vars;
+        var = &am->vars[am->count++];
+        var->name = strdup(name);
+        var->value = strdup(value);
+        return 0;
+    }
+
+    if (!append) {
+        free(var->value);
+        var->value = strdup(value);
+        return 0;
+    }
+
+    size_t len = strlen(var->value);
+    char *joined = malloc(len + strlen(value) + 2);
+    if (!joined) {
+        return -1;
+    }
+    sprintf(joined, "%s%s%s", var->value, len ? " " : "", value);
+    free(var->value);
+    var->value = joined;
+    return 0;
+}
+
+/**
+ * Parse the variable assignments of a Makefile.am
+ *
+ * Handles comments, backslash continuations and "+=". Rules, recipe lines
+ * and conditionals are skipped, so variables set in both branches of an
+ * automake conditional end up with the last assignment.
+ *
+ * @param path Path to the Makefile.am
+ * @param am Receives the variables; release with am_free()
+ * @return 0 on success, -1 if the file cannot be read
+ */
+int am_parse(const char *path, am_file *am) {
+    am->vars = NULL;
+    am->count = 0;
+
+    char *content = read_file(path);
+    if (!content) {
+        return -1;
+    }
+
+    // Join continuation lines in place
+    char *out = content;
+    for (char *p = content; *p; p++) {
+        if (p[0] == '\\' && p[1] == '\n') {
+            *out++ = ' ';
+            p++;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+
+    char *save = NULL;
+    for (char *line = strtok_r(content, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        // Recipe lines belong to rules
+        if (line[0] == '\t') {
+            continue;
+        }
+
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+
+        char *eq = strchr(line, '=');
+        if (!eq) {
+            continue;
+        }
+        char *colon = strchr(line, ':');
+        if (colon && colon < eq) {
+            // A rule, or a ":=" assignment
+            if (colon + 1 != eq) {
+                continue;
+            }
+        }
+
+        int append = eq > line && eq[-1] == '+';
+        char *name_end = eq - ((append || (colon && colon + 1 == eq)) ? 1 : 0);
+        while (name_end > line && isspace((unsigned char)name_end[-1])) {
+            name_end--;
+        }
+        char *name = line;
+        while (name < name_end && isspace((unsigned char)*name)) {
+            name++;
+        }
+        if (name == name_end) {
+            continue;
+        }
+        *name_end = '\0';
+
+        char *value = eq + 1;
+        while (isspace((unsigned char)*value)) {
+            value++;
+        }
+        char *value_end = value + strlen(value);
+        while (value_end > value && isspace((unsigned char)value_end[-1])) {
+            *--value_end = '\0';
+        }
+
+        if (set_variable(am, name, value, append) != 0) {
+            free(content);
+            am_free(am);
+            return -1;
+        }
+    }
+
+    free(content);
+    return 0;
+}
+
+// Release everything am_parse() allocated
+void am_free(am_file *am) {
+    for (int i = 0; i < am->count; i++) {
+        free(am->vars[i].name);
+        free(am->vars[i].value);
+    }
+    free(am->vars);
+    am->vars = NULL;
+    am->count = 0;
+}
+
+// Value of a variable, or NULL if the Makefile.am doesn't set it
+const char *am_get(const am_file *am, const char *name) {
+    for (int i = 0; i < am->count; i++) {
+        if (strcmp(am->vars[i].name, name) == 0) {
+            return am->vars[i].value;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Split a variable value into whitespace-separated words
+ *
+ * @param value Variable value
+ * @param words Receives a malloc'd array of malloc'd words
+ * @return Number of words, or -1 on allocation failure
+ */
+int am_split_words(const char *value, char ***words) {
+    *words = NULL;
+    int count = 0;
+    const char *p = value;
+
+    while (*p) {
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (!*p) {
+            break;
+        }
+        const char *start = p;
+        while (*p && !isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        char **grown = realloc(*words, (count + 1) * sizeof(char *));
+        if (!grown) {
+            am_free_words(*words, count);
+            *words = NULL;
+            return -1;
+        }
+        *words = grown;
+        (*words)[count++] = strndup(start, p - start);
+    }
+
+    return count;
+}
+
+static int expand_words(const am_file *am, const char *name, char ***words, int count, int depth) {
+    const char *value = am_get(am, name);
+    char **parts = NULL;
+    int part_count = value && depth < 8 ? am_split_words(value, &parts) : 0;
+    for (int i = 0; i < part_count; i++) {
+        char *w = parts[i];
+        size_t len = strlen(w);
+        char *exeext = strstr(w, "$(EXEEXT)");
+        if (exeext && exeext[9] == '\0') {
+            *exeext = '\0';
+        }
+        if (!strchr(w, '$')) {
+            *words = realloc(*words, (count + 1) * sizeof(char *));
+            (*words)[count++] = strdup(w);
+        } else if (len > 3 && w[0] == '$' &&
+                   ((w[1] == '(' && w[len - 1] == ')') || (w[1] == '{' && w[len - 1] == '}'))) {
+            w[len - 1] = '\0';
+            count = expand_words(am, w + 2, words, count, depth + 1);
+        }
+    }
+    am_free_words(parts, part_count);
+    return count;
+}
+
+/**
+ * Append the words of a variable, with references to other variables expanded
+ *
+ * TESTS is usually written as $(check_PROGRAMS) plus scripts, so words
+ * that are a whole $(VAR) or ${VAR} reference are replaced by that
+ * variable's words, and a trailing $(EXEEXT) is dropped. Other words
+ * with references (configure substitutions) are left out.
+ *
+ * @param words A malloc'd array to append to, or NULL
+ * @param count Words already in it
+ * @return The new number of words
+ */
+int am_expand_words(const am_file *am, const char *name, char ***words, int count) {
+    return expand_words(am, name, words, count, 0);
+}
+
+/**
+ * List the directories make visits: "." and the top-level SUBDIRS
+ *
+ * @param dirs Receives a malloc'd array of malloc'd paths
+ * @return Number of directories (at least 1)
+ */
+int am_project_dirs(char ***dirs) {
+    int count = 0;
+    *dirs = malloc(sizeof(char *));
+    (*dirs)[count++] = strdup(".");
+
+    am_file top;
+    if (am_parse("Makefile.am", &top) != 0) {
+        return count;
+    }
+    const char *value = am_get(&top, "SUBDIRS");
+    char **words = NULL;
+    int word_count = value ? am_split_words(value, &words) : 0;
+    for (int i = 0; i < word_count; i++) {
+        if (strcmp(words[i], ".") == 0 || strchr(words[i], '$')) {
+            continue;
+        }
+        *dirs = realloc(*dirs, (count + 1) * sizeof(char *));
+        (*dirs)[count++] = strdup(words[i]);
+    }
+    am_free_words(words, word_count);
+    am_free(&top);
+    return count;
+}
+
+void am_free_words(char **words, int count) {
+    for (int i = 0; i < count; i++) {
+        free(words[i]);
+    }
+    free(words);
+}
+
+// Check whether a variable value lists word exactly (not as a substring)
+int am_has_word(const char *value, const char *word) {
+    size_t len = strlen(word);
+    for (const char *p = strstr(value, word); p; p = strstr(p + 1, word)) {
+        int starts = p == value || isspace((unsigned char)p[-1]);
+        int ends = p[len] == '\0' || isspace((unsigned char)p[len]);
+        if (starts && ends) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Strip a suffix such as "_SOURCES" from a variable name to get the
+ * automake canonical target name ("demo_SOURCES" -> "demo")
+ */
+void am_target_name(const char *var_name, const char *suffix, char *target, size_t size) {
+    size_t len = strlen(var_name);
+    size_t suffix_len = strlen(suffix);
+    if (len >= suffix_len && strcmp(var_name + len - suffix_len, suffix) == 0) {
+        len -= suffix_len;
+    }
+    snprintf(target, size, "%.*s", (int)len, var_name);
+}
+
+// Automake's canonical form of a program name, as used in its variables
+void am_canonical_name(const char *name, char *out, size_t size) {
+    size_t i = 0;
+    for (; name[i] && i < size - 1; i++) {
+        out[i] = (isalnum((unsigned char)name[i]) || name[i] == '_' || name[i] == '@') ? name[i] : '_';
+    }
+    out[i] = '\0';
+}
+
+/**
+ * Find the convenience library of a Makefile.am, the first word of
+ * noinst_LIBRARIES (or noinst_LTLIBRARIES), which its programs and the
+ * tests link instead of compiling its sources again
+ *
+ * @return 0 if there is one, -1 otherwise
+ */
+int am_convenience_library(const am_file *am, char *name, size_t size) {
+    char **words = NULL;
+    int count = am_expand_words(am, "noinst_LIBRARIES", &words, 0);
+    count = am_expand_words(am, "noinst_LTLIBRARIES", &words, count);
+    if (count > 0) {
+        snprintf(name, size, "%s", words[0]);
+    }
+    am_free_words(words, count);
+    return count > 0 ? 0 : -1;
+}
@@ -0,0 +1,28 @@
+#ifndef MAKEFILE_AM_H
+#define MAKEFILE_AM_H
+
+// One variable assignment from a Makefile.am
+typedef struct {
+    char *name;   // e.g. "demo_SOURCES"
+    char *value;  // continuation lines joined, "+=" appended
+} am_variable;
+
+// The variables of a parsed Makefile.am, in order of first assignment
+typedef struct {
+    am_variable *vars;
+    int count;
+} am_file;
+
+int am_parse(const char *path, am_file *am);
+void am_free(am_file *am);
+const char *am_get(const am_file *am, const char *name);
+int am_split_words(const char *value, char ***words);
+int am_expand_words(const am_file *am, const char *name, char ***words, int count);
+void am_free_words(char **words, int count);
+int am_project_dirs(char ***dirs);
+int am_has_word(const char *value, const char *word);
+void am_target_name(const char *var_name, const char *suffix, char *target, size_t size);
+void am_canonical_name(const char *name, char *out, size_t size);
+int am_convenience_library(const am_file *am, char *name, size_t size);
+
+#endif // MAKEFILE_AM_H
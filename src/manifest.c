@@ -0,0 +1,214 @@
+#include "jc.h"
+#include "utils.h"
+#include "makefile_am.h"
+#include "manifest.h"
+#include "symbols.h"
+#include <limits.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// Program lists the manifest records, and the kind each is stored as
+static const struct {
+    const char *variable;
+    const char *kind;
+} program_lists[] = {
+    {"bin_PROGRAMS", "bin"},
+    {"noinst_PROGRAMS", "noinst"},
+    {"check_PROGRAMS", "check"},
+};
+
+static void add_entry(manifest *m, const char *profile, const char *kind, const char *name,
+                      long long mtime, const char *build_id, const char *path) {
+    if (m->count == m->capacity) {
+        m->capacity = m->capacity ? m->capacity * 2 : 16;
+        m->entries = realloc(m->entries, m->capacity * sizeof(manifest_entry));
+    }
+    manifest_entry *e = &m->entries[m->count++];
+    e->profile = strdup(profile);
+    e->kind = strdup(kind);
+    e->name = strdup(name);
+    e->mtime = mtime;
+    e->build_id = strdup(build_id);
+    e->path = strdup(path);
+}
+
+static void free_entry(manifest_entry *e) {
+    free(e->profile);
+    free(e->kind);
+    free(e->name);
+    free(e->build_id);
+    free(e->path);
+}
+
+/**
+ * Read a manifest written by manifest_save
+ *
+ * Each line is "<profile> <kind> <name> <mtime> <build-id> <path>", with
+ * the path last so it may contain spaces.
+ *
+ * @return 0 on success, -1 if the file can't be read
+ */
+int manifest_load(manifest *m, const char *path) {
+    memset(m, 0, sizeof(*m));
+    char *content = read_file(path);
+    if (!content) {
+        return -1;
+    }
+
+    char *save = NULL;
+    for (char *line = strtok_r(content, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        char profile[256];
+        char kind[16];
+        char name[256];
+        char build_id[128];
+        long long mtime;
+        int offset = 0;
+        if (line[0] == '#' ||
+            sscanf(line, "%255s %15s %255s %lld %127s %n", profile, kind, name, &mtime, build_id,
+                   &offset) != 5 || offset == 0 || line[offset] == '\0') {
+            continue;
+        }
+        add_entry(m, profile, kind, name, mtime, build_id, line + offset);
+    }
+    free(content);
+    return 0;
+}
+
+int manifest_save(const manifest *m, const char *path) {
+    char *content = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    append_format(&content, &len, &cap, "# Written by 'jc build': <profile> <kind> <name> <mtime> <build-id> <path>\n");
+    for (int i = 0; i < m->count; i++) {
+        const manifest_entry *e = &m->entries[i];
+        append_format(&content, &len, &cap, "%s %s %s %lld %s %s\n", e->profile, e->kind, e->name,
+                      e->mtime, e->build_id, e->path);
+    }
+    int result = write_file(path, content);
+    free(content);
+    return result;
+}
+
+// Record the programs one Makefile.am declares, with what the build left for them
+static void scan_directory(manifest *m, const char *key, const char *build_dir, const char *subdir) {
+    char am_path[PATH_MAX];
+    join_path(am_path, sizeof(am_path), subdir, "Makefile.am");
+    am_file am;
+    if (am_parse(am_path, &am) != 0) {
+        return;
+    }
+
+    // The jc templates move programs to build/ after linking; the ninja
+    // backend leaves them where they were linked, so the newer one is current
+    char out_dir[PATH_MAX];
+    char moved_dir[PATH_MAX];
+    join_path(out_dir, sizeof(out_dir), build_dir, subdir);
+    join_path(moved_dir, sizeof(moved_dir), out_dir, "build");
+
+    for (size_t l = 0; l < sizeof(program_lists) / sizeof(program_lists[0]); l++) {
+        const char *value = am_get(&am, program_lists[l].variable);
+        char **names = NULL;
+        int count = value ? am_split_words(value, &names) : 0;
+        for (int i = 0; i < count; i++) {
+            if (strchr(names[i], '$')) {
+                continue;
+            }
+            const char *dirs[] = {moved_dir, out_dir};
+            char path[PATH_MAX] = "-";
+            long long mtime = 0;
+            for (int d = 0; d < 2; d++) {
+                char candidate[PATH_MAX];
+                struct stat st;
+                join_path(candidate, sizeof(candidate), dirs[d], names[i]);
+                if (!strchr(candidate, '/')) {
+                    // Keep top-level programs from being looked up on $PATH
+                    snprintf(candidate, sizeof(candidate), "./%s", names[i]);
+                }
+                if (stat(candidate, &st) != 0 || !S_ISREG(st.st_mode)) {
+                    continue;
+                }
+                long long t = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+                if (t > mtime) {
+                    snprintf(path, sizeof(path), "%s", candidate);
+                    mtime = t;
+                }
+            }
+            char build_id[128] = "-";
+            if (mtime && symbols_build_id(path, build_id, sizeof(build_id)) != 0) {
+                snprintf(build_id, sizeof(build_id), "-");
+            }
+            add_entry(m, key, program_lists[l].kind, names[i], mtime, build_id, path);
+        }
+        am_free_words(names, count);
+    }
+    am_free(&am);
+}
+
+/**
+ * Replace a profile's entries with the programs the Makefile.am files declare
+ *
+ * Looks at the top-level Makefile.am and the directories in its SUBDIRS.
+ *
+ * @param profile The build profile, NULL for the in-tree build
+ * @param build_dir Where that profile builds ("." in-tree)
+ */
+void manifest_scan(manifest *m, const char *profile, const char *build_dir) {
+    const char *key = profile ? profile : ".";
+    int kept = 0;
+    for (int i = 0; i < m->count; i++) {
+        if (strcmp(m->entries[i].profile, key) == 0) {
+            free_entry(&m->entries[i]);
+        } else {
+            m->entries[kept++] = m->entries[i];
+        }
+    }
+    m->count = kept;
+
+    char **dirs;
+    int count = am_project_dirs(&dirs);
+    for (int i = 0; i < count; i++) {
+        scan_directory(m, key, build_dir, dirs[i]);
+    }
+    am_free_words(dirs, count);
+}
+
+// Rescan one profile's programs into MANIFEST_FILE after a build
+int manifest_update(const char *profile, const char *build_dir) {
+    manifest m;
+    manifest_load(&m, MANIFEST_FILE);
+    manifest_scan(&m, profile, build_dir);
+    create_directory(".jc");
+    int result = manifest_save(&m, MANIFEST_FILE);
+    manifest_free(&m);
+    return result;
+}
+
+/**
+ * Look up a program of a profile
+ *
+ * @param profile The build profile, NULL for the in-tree build
+ * @param check Nonzero for check_PROGRAMS, else bin_PROGRAMS and noinst_PROGRAMS
+ * @param name The program, or NULL for the first one declared
+ * @return The entry, or NULL if the manifest doesn't list it
+ */
+const manifest_entry *manifest_find(const manifest *m, const char *profile, int check, const char *name) {
+    const char *key = profile ? profile : ".";
+    for (int i = 0; i < m->count; i++) {
+        const manifest_entry *e = &m->entries[i];
+        if (strcmp(e->profile, key) == 0 && (strcmp(e->kind, "check") == 0) == (check != 0) &&
+            (!name || strcmp(e->name, name) == 0)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+void manifest_free(manifest *m) {
+    for (int i = 0; i < m->count; i++) {
+        free_entry(&m->entries[i]);
+    }
+    free(m->entries);
+    memset(m, 0, sizeof(*m));
+}
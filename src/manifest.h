@@ -0,0 +1,32 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stddef.h>
+
+// Programs 'jc build' and 'jc test run' produced, for each build profile
+#define MANIFEST_FILE ".jc/manifest"
+
+// One program from a bin_PROGRAMS, noinst_PROGRAMS or check_PROGRAMS list
+typedef struct {
+    char *profile;               // "." for the in-tree build
+    char *kind;                  // "bin", "noinst" or "check"
+    char *name;
+    long long mtime;             // ns, 0 if not built
+    char *build_id;              // hex, "-" if none
+    char *path;                  // relative to the project, "-" if not built
+} manifest_entry;
+
+typedef struct {
+    manifest_entry *entries;
+    int count;
+    int capacity;
+} manifest;
+
+int manifest_load(manifest *m, const char *path);
+int manifest_save(const manifest *m, const char *path);
+void manifest_scan(manifest *m, const char *profile, const char *build_dir);
+int manifest_update(const char *profile, const char *build_dir);
+const manifest_entry *manifest_find(const manifest *m, const char *profile, int check, const char *name);
+void manifest_free(manifest *m);
+
+#endif // MANIFEST_H
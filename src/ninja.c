@@ -0,0 +1,639 @@
+#define _XOPEN_SOURCE 700
+
+#include "ninja.h"
+#include "utils.h"
+#include "makefile_am.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// Longest expanded variable value
+#define NINJA_VALUE_MAX 8192
+
+// Directories whose Makefile.am jc writes, in build order
+static const char *const ninja_subdirs[] = {"src", "tests", NULL};
+
+// Program and library lists and the ninja target that builds them ('all' is the default)
+static const struct {
+    const char *variable;
+    const char *phony;
+    int library;
+} program_lists[] = {
+    {"noinst_LIBRARIES", "all", 1},
+    {"lib_LIBRARIES", "all", 1},
+    {"check_LIBRARIES", "check", 1},
+    {"bin_PROGRAMS", "all", 0},
+    {"noinst_PROGRAMS", "all", 0},
+    {"check_PROGRAMS", "check", 0},
+};
+
+// One Makefile.am directory, seen from the build directory ninja runs in
+typedef struct {
+    char srcdir[PATH_MAX];             // absolute
+    char top_srcdir[PATH_MAX];         // absolute
+    char builddir[PATH_MAX];           // relative to the build directory
+    char abs_builddir[PATH_MAX];
+    char abs_top_builddir[PATH_MAX];
+    const char *top_builddir;          // "." for flags; absolute while reading libraries
+    char default_includes[PATH_MAX * 3];
+    am_file am;                        // <subdir>/Makefile.am
+    am_file configured;                // <build>/<subdir>/Makefile, for configure's values
+} ninja_dir;
+
+// The build.ninja being written
+typedef struct {
+    char *text;
+    size_t len;
+    size_t cap;
+    char *all;                         // outputs of the 'all' target
+    size_t all_len;
+    size_t all_cap;
+    char *check;                       // outputs of the 'check' target
+    size_t check_len;
+    size_t check_cap;
+} ninja_file;
+
+/**
+ * Value of a make variable in a directory
+ *
+ * Directory variables point into the source tree (absolute) and the build
+ * directory (relative, since ninja runs there); everything else comes from
+ * the Makefile.am, then from the Makefile configure generated.
+ */
+static const char *lookup(const ninja_dir *dir, const char *name) {
+    const char *const fixed[][2] = {
+        {"srcdir", dir->srcdir},
+        {"abs_srcdir", dir->srcdir},
+        {"top_srcdir", dir->top_srcdir},
+        {"abs_top_srcdir", dir->top_srcdir},
+        {"builddir", dir->builddir},
+        {"abs_builddir", dir->abs_builddir},
+        {"top_builddir", dir->top_builddir ? dir->top_builddir : "."},
+        {"abs_top_builddir", dir->abs_top_builddir},
+        {"DEFAULT_INCLUDES", dir->default_includes},
+        {"DEPDIR", ".deps"},
+    };
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+        if (strcmp(fixed[i][0], name) == 0) {
+            return fixed[i][1];
+        }
+    }
+
+    const char *value = am_get(&dir->am, name);
+    if (!value) {
+        value = am_get(&dir->configured, name);
+    }
+    if (!value) {
+        value = getenv(name);
+    }
+    return value ? value : "";
+}
+
+static int append_text(char *out, size_t size, size_t *len, const char *text, size_t text_len) {
+    if (*len + text_len >= size) {
+        return -1;
+    }
+    memcpy(out + *len, text, text_len);
+    *len += text_len;
+    out[*len] = '\0';
+    return 0;
+}
+
+/**
+ * Expand $(VAR), ${VAR}, $X and @VAR@ references the way make would
+ *
+ * @return 0 on success, -1 for make functions and substitution references
+ *         (which the ninja backend doesn't translate) or overlong values
+ */
+static int expand(const ninja_dir *dir, const char *value, char *out, size_t size, int depth) {
+    size_t len = 0;
+    out[0] = '\0';
+    if (depth > 32) {
+        return -1;
+    }
+
+    for (const char *p = value; *p; p++) {
+        char name[256];
+        const char *replacement;
+
+        if (*p == '$') {
+            p++;
+            if (*p == '$') {
+                if (append_text(out, size, &len, "$", 1) != 0) {
+                    return -1;
+                }
+                continue;
+            }
+            if (*p == '(' || *p == '{') {
+                const char *end = strchr(p + 1, *p == '(' ? ')' : '}');
+                if (!end || (size_t)(end - p - 1) >= sizeof(name)) {
+                    return -1;
+                }
+                snprintf(name, sizeof(name), "%.*s", (int)(end - p - 1), p + 1);
+                if (strpbrk(name, " \t:=,$")) {
+                    return -1;
+                }
+                p = end;
+            } else if (*p) {
+                name[0] = *p;
+                name[1] = '\0';
+            } else {
+                return -1;
+            }
+            replacement = lookup(dir, name);
+        } else if (*p == '@') {
+            // A configure substitution left in the Makefile.am
+            size_t n = strspn(p + 1, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_");
+            if (n == 0 || p[n + 1] != '@' || n >= sizeof(name)) {
+                if (append_text(out, size, &len, p, 1) != 0) {
+                    return -1;
+                }
+                continue;
+            }
+            snprintf(name, sizeof(name), "%.*s", (int)n, p + 1);
+            replacement = am_get(&dir->configured, name);
+            if (!replacement) {
+                replacement = "";
+            }
+            p += n + 1;
+        } else {
+            if (append_text(out, size, &len, p, 1) != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        char *sub = malloc(size);
+        int ok = sub && expand(dir, replacement, sub, size, depth + 1) == 0 &&
+                 append_text(out, size, &len, sub, strlen(sub)) == 0;
+        free(sub);
+        if (!ok) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Append text escaped for build.ninja: '$' always, spaces and ':' in paths
+static void append_escaped(char **buf, size_t *len, size_t *cap, const char *s, int path) {
+    char escaped[NINJA_VALUE_MAX * 2];
+    size_t n = 0;
+    for (; *s && n + 2 < sizeof(escaped); s++) {
+        if (*s == '$' || (path && (*s == ' ' || *s == ':'))) {
+            escaped[n++] = '$';
+        }
+        escaped[n++] = *s;
+    }
+    escaped[n] = '\0';
+    append_format(buf, len, cap, "%s", escaped);
+}
+
+/**
+ * Expand a flags template and write it as a ninja variable
+ *
+ * @return 0 on success, -1 if the template can't be expanded
+ */
+static int write_variable(ninja_file *nf, const ninja_dir *dir, const char *name, const char *template) {
+    char value[NINJA_VALUE_MAX];
+    if (expand(dir, template, value, sizeof(value), 0) != 0) {
+        return -1;
+    }
+    append_format(&nf->text, &nf->len, &nf->cap, "%s = ", name);
+    append_escaped(&nf->text, &nf->len, &nf->cap, value, 0);
+    append_format(&nf->text, &nf->len, &nf->cap, "\n");
+    return 0;
+}
+
+/**
+ * Link libraries for a program
+ *
+ * Library files in *_LDADD are relative to the Makefile's directory, or
+ * start with $(top_builddir); ninja runs from the top of the build
+ * directory. Archives are also added to inputs, so the program is linked
+ * after them.
+ */
+static int write_libs(ninja_file *nf, ninja_dir *dir, const char *name, const char *template, char **inputs,
+                      size_t *inputs_len, size_t *inputs_cap) {
+    char value[NINJA_VALUE_MAX];
+    dir->top_builddir = dir->abs_top_builddir;
+    int expanded = expand(dir, template, value, sizeof(value), 0);
+    dir->top_builddir = NULL;
+    if (expanded != 0) {
+        return -1;
+    }
+
+    char **words;
+    int count = am_split_words(value, &words);
+    if (count < 0) {
+        return -1;
+    }
+    append_format(&nf->text, &nf->len, &nf->cap, "%s = ", name);
+    size_t top_len = strlen(dir->abs_top_builddir);
+    for (int i = 0; i < count; i++) {
+        char joined[PATH_MAX * 3];
+        char word[PATH_MAX * 2];
+        if (strncmp(words[i], dir->abs_top_builddir, top_len) == 0 && words[i][top_len] == '/') {
+            clean_path(words[i] + top_len + 1, word, sizeof(word));
+        } else if (words[i][0] != '-' && words[i][0] != '/') {
+            snprintf(joined, sizeof(joined), "%s/%s", dir->builddir, words[i]);
+            clean_path(joined, word, sizeof(word));
+        } else {
+            snprintf(word, sizeof(word), "%s", words[i]);
+        }
+        append_format(&nf->text, &nf->len, &nf->cap, "%s", i > 0 ? " " : "");
+        append_escaped(&nf->text, &nf->len, &nf->cap, word, 0);
+        if (word[0] != '-' && has_suffix(word, ".a")) {
+            append_format(inputs, inputs_len, inputs_cap, " ");
+            append_escaped(inputs, inputs_len, inputs_cap, word, 1);
+        }
+    }
+    append_format(&nf->text, &nf->len, &nf->cap, "\n");
+    am_free_words(words, count);
+    return 0;
+}
+
+/**
+ * Write the precompiled header set up by 'jc add pch'
+ *
+ * The stub header that includes the real one is written here rather than
+ * by a rule, since ninja has no way to 'echo' it only when it's missing.
+ *
+ * @param canonical Program whose flags build the header
+ * @param gch Receives the path of the .gch, which objects depend on
+ */
+static int write_pch(ninja_file *nf, ninja_dir *dir, const char *canonical, char *gch, size_t size) {
+    const char *header = am_get(&dir->am, "PCH_HEADER");
+    const char *source = am_get(&dir->am, "PCH_SOURCE");
+
+    char pch_dir[PATH_MAX * 2];
+    char stub_path[PATH_MAX * 3];
+    char stub[PATH_MAX * 3];
+    snprintf(pch_dir, sizeof(pch_dir), "%s/pch", dir->abs_builddir);
+    snprintf(stub_path, sizeof(stub_path), "%s/%s", pch_dir, header);
+    snprintf(stub, sizeof(stub), "#include \"%s/%s\"\n", dir->srcdir, source);
+    create_directory(pch_dir);
+    if (write_if_changed(stub_path, stub) != 0) {
+        return -1;
+    }
+
+    char flags[PATH_MAX];
+    snprintf(flags, sizeof(flags),
+             "$(DEFS) $(DEFAULT_INCLUDES) $(INCLUDES) $(PCH_CPPFLAGS) $(CPPFLAGS) $(%s_CFLAGS) $(CFLAGS)",
+             canonical);
+    if (write_variable(nf, dir, "pch_cflags", flags) != 0) {
+        return -1;
+    }
+
+    char input[PATH_MAX * 2];
+    snprintf(gch, size, "%s/pch/%s.gch", dir->builddir, header);
+    snprintf(input, sizeof(input), "%s/%s", dir->srcdir, source);
+    append_format(&nf->text, &nf->len, &nf->cap, "build ");
+    append_escaped(&nf->text, &nf->len, &nf->cap, gch, 1);
+    append_format(&nf->text, &nf->len, &nf->cap, ": pch ");
+    append_escaped(&nf->text, &nf->len, &nf->cap, input, 1);
+    append_format(&nf->text, &nf->len, &nf->cap, "\n  cflags = $pch_cflags\n\n");
+    return 0;
+}
+
+// "<program>_<suffix>" if the Makefile.am sets it, else automake's default
+static int program_variable(const ninja_dir *dir, const char *canonical, const char *suffix,
+                            const char *fallback, char *name, size_t size) {
+    snprintf(name, size, "%s_%s", canonical, suffix);
+    if (am_get(&dir->am, name)) {
+        return 1;
+    }
+    snprintf(name, size, "%s", fallback);
+    return 0;
+}
+
+/**
+ * Write the compile and link edges of one program, or the archive edge of
+ * one library
+ *
+ * Mirrors automake: a program with its own _CFLAGS or _CPPFLAGS gets
+ * "<program>-" prefixed objects, and per-program flags replace the AM_
+ * defaults.
+ */
+static int write_program(ninja_file *nf, ninja_dir *dir, const char *program, const char *phony,
+                         const char *gch, int library) {
+    char canonical[256];
+    am_canonical_name(program, canonical, sizeof(canonical));
+
+    char cflags[300];
+    char cppflags[300];
+    char ldflags[300];
+    char ldadd[300];
+    int own_cflags = program_variable(dir, canonical, "CFLAGS", "AM_CFLAGS", cflags, sizeof(cflags));
+    int own_cppflags = program_variable(dir, canonical, "CPPFLAGS", "AM_CPPFLAGS", cppflags, sizeof(cppflags));
+    program_variable(dir, canonical, "LDFLAGS", "AM_LDFLAGS", ldflags, sizeof(ldflags));
+    program_variable(dir, canonical, "LDADD", "LDADD", ldadd, sizeof(ldadd));
+    const char *cppflags_value = own_cppflags ? am_get(&dir->am, cppflags) : NULL;
+    int uses_pch = gch && cppflags_value && strstr(cppflags_value, "pch/$(PCH_HEADER)");
+
+    char template[PATH_MAX];
+    char flags_var[300];
+    char link_var[300];
+    char libs_var[300];
+    snprintf(flags_var, sizeof(flags_var), "%s_cflags", canonical);
+    snprintf(link_var, sizeof(link_var), "%s_ldflags", canonical);
+    snprintf(libs_var, sizeof(libs_var), "%s_libs", canonical);
+
+    snprintf(template, sizeof(template),
+             "$(DEFS) $(DEFAULT_INCLUDES) $(INCLUDES) $(%s) $(CPPFLAGS) $(%s) $(CFLAGS)", cppflags, cflags);
+    if (write_variable(nf, dir, flags_var, template) != 0) {
+        fprintf(stderr, "Error: Cannot translate the compile flags of '%s'\n", program);
+        return -1;
+    }
+    char *archives = NULL;
+    size_t archives_len = 0;
+    size_t archives_cap = 0;
+    snprintf(template, sizeof(template), "$(%s) $(CFLAGS) $(%s) $(LDFLAGS)", cflags, ldflags);
+    if (!library && write_variable(nf, dir, link_var, template) != 0) {
+        fprintf(stderr, "Error: Cannot translate the link flags of '%s'\n", program);
+        return -1;
+    }
+    snprintf(template, sizeof(template), "$(%s) $(LIBS)", ldadd);
+    if (!library && write_libs(nf, dir, libs_var, template, &archives, &archives_len, &archives_cap) != 0) {
+        fprintf(stderr, "Error: Cannot translate the libraries of '%s'\n", program);
+        free(archives);
+        return -1;
+    }
+
+    // automake's default source is <program>.c; libraries have none
+    char var[300];
+    char sources_value[NINJA_VALUE_MAX];
+    snprintf(var, sizeof(var), "%s_SOURCES", canonical);
+    const char *sources = am_get(&dir->am, var);
+    char default_source[512];
+    snprintf(default_source, sizeof(default_source), "%s%s", library ? "" : program, library ? "" : ".c");
+    if (expand(dir, sources ? sources : default_source, sources_value, sizeof(sources_value), 0) != 0) {
+        fprintf(stderr, "Error: Cannot translate %s\n", var);
+        free(archives);
+        return -1;
+    }
+
+    char **words;
+    int count = am_split_words(sources_value, &words);
+    if (count < 0) {
+        free(archives);
+        return -1;
+    }
+
+    char *objects = NULL;
+    size_t objects_len = 0;
+    size_t objects_cap = 0;
+    int result = 0;
+    size_t srcdir_len = strlen(dir->srcdir);
+
+    for (int i = 0; i < count && result == 0; i++) {
+        const char *word = words[i];
+        if (has_suffix(word, ".h")) {
+            continue;
+        }
+        if (!has_suffix(word, ".c")) {
+            fprintf(stderr, "Error: The ninja backend only compiles C sources, not '%s'\n", word);
+            result = -1;
+            break;
+        }
+
+        // Objects keep the source's subdirectory, as with subdir-objects;
+        // sources outside the directory build in its top
+        const char *rel = word;
+        if (strncmp(word, dir->srcdir, srcdir_len) == 0 && word[srcdir_len] == '/') {
+            rel = word + srcdir_len + 1;
+        }
+        if (rel[0] == '/' || strstr(rel, "..")) {
+            rel = strrchr(rel, '/') ? strrchr(rel, '/') + 1 : rel;
+        }
+        const char *base = strrchr(rel, '/') ? strrchr(rel, '/') + 1 : rel;
+
+        char source[PATH_MAX * 2];
+        char object[PATH_MAX * 3];
+        if (word[0] == '/') {
+            snprintf(source, sizeof(source), "%s", word);
+        } else {
+            snprintf(source, sizeof(source), "%s/%s", dir->srcdir, word);
+        }
+        snprintf(object, sizeof(object), "%s/%.*s%s%s%.*s.o", dir->builddir, (int)(base - rel), rel,
+                 own_cflags || own_cppflags ? canonical : "", own_cflags || own_cppflags ? "-" : "",
+                 (int)strlen(base) - 2, base);
+
+        append_format(&nf->text, &nf->len, &nf->cap, "build ");
+        append_escaped(&nf->text, &nf->len, &nf->cap, object, 1);
+        append_format(&nf->text, &nf->len, &nf->cap, ": cc ");
+        append_escaped(&nf->text, &nf->len, &nf->cap, source, 1);
+        if (uses_pch) {
+            append_format(&nf->text, &nf->len, &nf->cap, " | ");
+            append_escaped(&nf->text, &nf->len, &nf->cap, gch, 1);
+        }
+        append_format(&nf->text, &nf->len, &nf->cap, "\n  cflags = $%s\n", flags_var);
+
+        append_format(&objects, &objects_len, &objects_cap, " ");
+        append_escaped(&objects, &objects_len, &objects_cap, object, 1);
+    }
+    am_free_words(words, count);
+
+    if (result == 0 && library) {
+        char output[PATH_MAX * 2];
+        snprintf(output, sizeof(output), "%s/%s", dir->builddir, program);
+        append_format(&nf->text, &nf->len, &nf->cap, "build ");
+        append_escaped(&nf->text, &nf->len, &nf->cap, output, 1);
+        append_format(&nf->text, &nf->len, &nf->cap, ": ar%s\n\n", objects ? objects : "");
+    } else if (result == 0) {
+        char output[PATH_MAX * 2];
+        snprintf(output, sizeof(output), "%s/%s%s", dir->builddir, program, lookup(dir, "EXEEXT"));
+        append_format(&nf->text, &nf->len, &nf->cap, "build ");
+        append_escaped(&nf->text, &nf->len, &nf->cap, output, 1);
+        append_format(&nf->text, &nf->len, &nf->cap, ": link%s%s%s\n  ldflags = $%s\n  libs = $%s\n\n",
+                      objects ? objects : "", archives ? " |" : "", archives ? archives : "", link_var, libs_var);
+
+        int check = strcmp(phony, "check") == 0;
+        append_format(check ? &nf->check : &nf->all, check ? &nf->check_len : &nf->all_len,
+                      check ? &nf->check_cap : &nf->all_cap, " ");
+        append_escaped(check ? &nf->check : &nf->all, check ? &nf->check_len : &nf->all_len,
+                       check ? &nf->check_cap : &nf->all_cap, output, 1);
+    }
+    free(objects);
+    free(archives);
+    return result;
+}
+
+// Translate one configured Makefile.am directory
+static int write_directory(ninja_file *nf, const char *build_dir, const char *cwd, const char *subdir) {
+    char am_path[PATH_MAX];
+    char configured_path[PATH_MAX * 2];
+    snprintf(am_path, sizeof(am_path), "%s/Makefile.am", subdir);
+    snprintf(configured_path, sizeof(configured_path), "%s/%s/Makefile", build_dir, subdir);
+    if (!file_exists(am_path) || !file_exists(configured_path)) {
+        return 0;
+    }
+
+    ninja_dir *dir = calloc(1, sizeof(ninja_dir));
+    if (!dir) {
+        return -1;
+    }
+    const char *top = strcmp(build_dir, ".") == 0 ? "" : build_dir;
+    if (snprintf(dir->srcdir, sizeof(dir->srcdir), "%s/%s", cwd, subdir) >= (int)sizeof(dir->srcdir) ||
+        snprintf(dir->abs_top_builddir, sizeof(dir->abs_top_builddir), "%s%s%s",
+                 cwd, *top ? "/" : "", top) >= (int)sizeof(dir->abs_top_builddir) ||
+        snprintf(dir->abs_builddir, sizeof(dir->abs_builddir), "%s/%s",
+                 dir->abs_top_builddir, subdir) >= (int)sizeof(dir->abs_builddir)) {
+        fprintf(stderr, "Error: Build paths for %s are too long\n", am_path);
+        free(dir);
+        return -1;
+    }
+    snprintf(dir->top_srcdir, sizeof(dir->top_srcdir), "%s", cwd);
+    snprintf(dir->builddir, sizeof(dir->builddir), "%s", subdir);
+    snprintf(dir->default_includes, sizeof(dir->default_includes), "-I%s -I%s -I.", subdir, dir->srcdir);
+
+    if (am_parse(am_path, &dir->am) != 0 || am_parse(configured_path, &dir->configured) != 0) {
+        fprintf(stderr, "Error: Cannot read %s\n", am_path);
+        am_free(&dir->am);
+        free(dir);
+        return -1;
+    }
+
+    append_format(&nf->text, &nf->len, &nf->cap, "# %s\n", am_path);
+
+    int result = 0;
+    char gch[PATH_MAX * 2] = "";
+    for (size_t l = 0; l < sizeof(program_lists) / sizeof(program_lists[0]) && result == 0; l++) {
+        const char *list = am_get(&dir->am, program_lists[l].variable);
+        char value[NINJA_VALUE_MAX];
+        if (!list) {
+            continue;
+        }
+        if (expand(dir, list, value, sizeof(value), 0) != 0) {
+            fprintf(stderr, "Error: Cannot translate %s in %s\n", program_lists[l].variable, am_path);
+            result = -1;
+            break;
+        }
+
+        char **programs;
+        int count = am_split_words(value, &programs);
+        for (int i = 0; i < count && result == 0; i++) {
+            char program[256];
+            snprintf(program, sizeof(program), "%s", programs[i]);
+            // Programs may be listed with $(EXEEXT)
+            const char *exeext = lookup(dir, "EXEEXT");
+            if (*exeext && has_suffix(program, exeext)) {
+                program[strlen(program) - strlen(exeext)] = '\0';
+            }
+
+            // The first program's flags build the precompiled header
+            if (!*gch && !program_lists[l].library && am_get(&dir->am, "PCH_HEADER") &&
+                am_get(&dir->am, "PCH_SOURCE")) {
+                char canonical[256];
+                am_canonical_name(program, canonical, sizeof(canonical));
+                if (write_pch(nf, dir, canonical, gch, sizeof(gch)) != 0) {
+                    fprintf(stderr, "Error: Cannot translate the precompiled header in %s\n", am_path);
+                    result = -1;
+                    break;
+                }
+            }
+            result = write_program(nf, dir, program, program_lists[l].phony, *gch ? gch : NULL,
+                                   program_lists[l].library);
+        }
+        am_free_words(programs, count > 0 ? count : 0);
+    }
+
+    am_free(&dir->am);
+    am_free(&dir->configured);
+    free(dir);
+    return result;
+}
+
+/**
+ * Generate <build_dir>/build.ninja from src/Makefile.am and tests/Makefile.am
+ *
+ * Translates the program and library lists and their _SOURCES, _CFLAGS,
+ * _CPPFLAGS, _LDFLAGS and _LDADD (with the AM_ defaults) into compile,
+ * link and archive edges.
+ * Configure's results (CC, CFLAGS, DEFS, CHECK_LIBS, ...) are read from the
+ * Makefiles it generated, so configure runs as usual. Objects are compiled
+ * with -MMD and their headers kept in ninja's deps log. Custom rules and
+ * *-local targets are make-only. The file is rewritten only when its
+ * content changes.
+ *
+ * @return 0 on success, -1 if a Makefile.am uses something that can't be
+ *         translated
+ */
+int ninja_generate(const char *build_dir) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return -1;
+    }
+
+    ninja_file nf = {0};
+    append_format(&nf.text, &nf.len, &nf.cap,
+                  "# Generated by 'jc build --backend=ninja' from src/Makefile.am and\n"
+                  "# tests/Makefile.am; do not edit\n"
+                  "ninja_required_version = 1.3\n\n");
+
+    // CC and CCLD are the same for every directory; take them from src/
+    char configured_path[PATH_MAX * 2];
+    snprintf(configured_path, sizeof(configured_path), "%s/src/Makefile", build_dir);
+    ninja_dir *top = calloc(1, sizeof(ninja_dir));
+    if (!top || am_parse(configured_path, &top->configured) != 0) {
+        fprintf(stderr, "Error: %s is missing; configure did not run\n", configured_path);
+        free(top);
+        free(nf.text);
+        return -1;
+    }
+    int result = 0;
+    if (write_variable(&nf, top, "cc", "$(CC)") != 0 || write_variable(&nf, top, "ccld", "$(CCLD)") != 0 ||
+        write_variable(&nf, top, "ar", *lookup(top, "AR") ? "$(AR)" : "ar") != 0 ||
+        write_variable(&nf, top, "arflags", *lookup(top, "ARFLAGS") ? "$(ARFLAGS)" : "cr") != 0 ||
+        write_variable(&nf, top, "ranlib", *lookup(top, "RANLIB") ? "$(RANLIB)" : "ranlib") != 0) {
+        result = -1;
+    }
+    am_free(&top->configured);
+    free(top);
+
+    append_format(&nf.text, &nf.len, &nf.cap,
+                  "\n"
+                  "rule cc\n"
+                  "  command = $cc $cflags -MMD -MT $out -MF $out.d -c $in -o $out\n"
+                  "  depfile = $out.d\n"
+                  "  deps = gcc\n"
+                  "  description = CC $out\n\n"
+                  "rule pch\n"
+                  "  command = $cc $cflags -MMD -MT $out -MF $out.d -x c-header -c $in -o $out\n"
+                  "  depfile = $out.d\n"
+                  "  deps = gcc\n"
+                  "  description = PCH $out\n\n"
+                  "rule link\n"
+                  "  command = $ccld $ldflags -o $out $in $libs\n"
+                  "  description = LINK $out\n\n"
+                  "rule ar\n"
+                  "  command = rm -f $out && $ar $arflags $out $in && $ranlib $out\n"
+                  "  description = AR $out\n\n");
+
+    for (int i = 0; ninja_subdirs[i] && result == 0; i++) {
+        result = write_directory(&nf, build_dir, cwd, ninja_subdirs[i]);
+    }
+
+    if (result == 0) {
+        append_format(&nf.text, &nf.len, &nf.cap, "build all: phony%s\n", nf.all ? nf.all : "");
+        append_format(&nf.text, &nf.len, &nf.cap, "build check: phony%s\n", nf.check ? nf.check : "");
+        append_format(&nf.text, &nf.len, &nf.cap, "default all\n");
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/build.ninja", build_dir);
+        if (write_if_changed(path, nf.text) != 0) {
+            fprintf(stderr, "Error: Cannot write %s\n", path);
+            result = -1;
+        }
+    }
+
+    free(nf.text);
+    free(nf.all);
+    free(nf.check);
+    return result;
+}
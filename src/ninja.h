@@ -0,0 +1,6 @@
+#ifndef NINJA_H
+#define NINJA_H
+
+int ninja_generate(const char *build_dir);
+
+#endif // NINJA_H
@@ -0,0 +1,633 @@
+#include "jc.h"
+#include "utils.h"
+#include "hash.h"
+#include "pgo.h"
+#include "process.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define PGO_DIR ".jc/pgo"
+#define PGO_DATA_DIR ".jc/pgo/data"
+#define PGO_RAW_DIR ".jc/pgo/raw"
+#define PGO_STATE_FILE ".jc/pgo/state"
+#define PGO_MERGED_FILE "merged.profdata"
+
+// Most training commands that can be given with --train
+#define MAX_TRAIN_COMMANDS 16
+
+// A sorted list of paths relative to some root
+typedef struct {
+    char **paths;
+    int count;
+} path_list;
+
+static void print_pgo_usage(void) {
+    printf("Usage: jc build --pgo [options] [-- <training arguments>]\n\n");
+    printf("Builds an instrumented binary in build/%s/, trains it, and rebuilds\n", PGO_GENERATE_PROFILE);
+    printf("build/%s/ with the recorded profile.\n\n", PGO_USE_PROFILE);
+    printf("Options:\n");
+    printf("  --train <command>  Train with a shell command instead of running the program\n");
+    printf("                     ($JC_PGO_EXECUTABLE is the instrumented program; may be\n");
+    printf("                     repeated; default: 'pgo.train' in .jc/config)\n");
+    printf("  --retrain          Train again even if the cached profile is current\n");
+    printf("  --no-train         Use the cached profile even if sources changed\n");
+    printf("  Other 'jc build' options (-j, --cache, --unity, --trace) are passed on.\n\n");
+    printf("The base flags come from the 'release' profile, or 'pgo.base' in .jc/config.\n\n");
+    printf("Examples:\n");
+    printf("  jc build --pgo -- input.txt\n");
+    printf("  jc build --pgo --train 'make -C build/pgo-gen check'\n");
+    printf("  jc run --profile=pgo\n\n");
+}
+
+// The C compiler configure will pick: $CC, else gcc, else cc
+static const char *configured_compiler(void) {
+    const char *cc = getenv("CC");
+    if (cc && *cc) {
+        return cc;
+    }
+    char path[PATH_MAX];
+    return find_in_path("gcc", path, sizeof(path)) == 0 ? "gcc" : "cc";
+}
+
+// Whether the compiler is clang, which uses .profraw/.profdata files
+static int compiler_is_clang(void) {
+    arg_list version = {0};
+    if (args_add_split(&version, configured_compiler()) <= 0) {
+        args_free(&version);
+        return 0;
+    }
+    args_add(&version, "--version");
+
+    process_options options = {0};
+    options.out = PROCESS_PIPE;
+    options.err = PROCESS_DISCARD;
+    options.capture = 1;
+    process_result result;
+    int clang = 0;
+    if (process_run(version.argv, &options, &result) == 0) {
+        clang = result.output && strstr(result.output, "clang") != NULL;
+        process_result_free(&result);
+    }
+    args_free(&version);
+    return clang;
+}
+
+// Join base and extra flags into output; -1 if they don't fit
+static int append_flags(char *output, size_t size, const char *base, const char *extra) {
+    int written = snprintf(output, size, "%s%s%s", base, base[0] && extra[0] ? " " : "", extra);
+    return written < 0 || (size_t)written >= size ? -1 : 0;
+}
+
+/**
+ * Flags for the PGO build profiles
+ *
+ * Both start from the base profile ('pgo.base', default release). The
+ * generate profile adds instrumentation; the use profile reads the data
+ * trained into .jc/pgo/data.
+ *
+ * @return 0 if name is a PGO profile, -1 otherwise
+ */
+int pgo_profile_flags(const char *name, build_profile *profile) {
+    int generate = strcmp(name, PGO_GENERATE_PROFILE) == 0;
+    if (!generate && strcmp(name, PGO_USE_PROFILE) != 0) {
+        return -1;
+    }
+
+    char *base = get_project_setting("pgo.base");
+    build_profile base_profile;
+    if (profile_lookup(base ? base : "release", &base_profile) != 0) {
+        fprintf(stderr, "Warning: Unknown pgo.base profile '%s', using release\n", base);
+        profile_lookup("release", &base_profile);
+    }
+    free(base);
+
+    memset(profile, 0, sizeof(*profile));
+    snprintf(profile->name, sizeof(profile->name), "%s", name);
+
+    char use_flags[PATH_MAX + 128];
+    if (generate) {
+        snprintf(use_flags, sizeof(use_flags), "-fprofile-generate");
+    } else if (compiler_is_clang()) {
+        char cwd[PATH_MAX];
+        if (!getcwd(cwd, sizeof(cwd))) {
+            return -1;
+        }
+        snprintf(use_flags, sizeof(use_flags),
+                 "-fprofile-use=%s/%s/%s -Wno-profile-instr-out-of-date -Wno-profile-instr-unprofiled",
+                 cwd, PGO_DATA_DIR, PGO_MERGED_FILE);
+    } else {
+        // GCC reads <object>.gcda next to each object; stale counters are
+        // reported but don't fail the build
+        snprintf(use_flags, sizeof(use_flags),
+                 "-fprofile-use -fprofile-correction -Wno-missing-profile "
+                 "-Wno-error=coverage-mismatch");
+    }
+
+    // A truncated flag would silently build without (or with broken) PGO
+    if (append_flags(profile->cflags, sizeof(profile->cflags), base_profile.cflags, use_flags) != 0 ||
+        append_flags(profile->ldflags, sizeof(profile->ldflags), base_profile.ldflags,
+                     generate ? use_flags : "") != 0) {
+        fprintf(stderr, "Warning: Flags for the %s profile are too long\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+// Create a directory and any missing parents
+static int create_directories(const char *path) {
+    char partial[PATH_MAX];
+    snprintf(partial, sizeof(partial), "%s", path);
+    for (char *p = partial + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (!directory_exists(partial) && create_directory(partial) != 0) {
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    return directory_exists(partial) ? 0 : create_directory(partial);
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Collect files below root whose names end in one of the suffixes
+ *
+ * @param root Directory to search
+ * @param rel Subdirectory being searched ("" at the top)
+ * @param suffixes NULL-terminated list of suffixes; NULL matches everything
+ * @param min_depth Skip files less than this many directories below root
+ */
+static void collect_files(const char *root, const char *rel, const char *const *suffixes,
+                          int min_depth, int depth, path_list *list) {
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s%s%s", root, *rel ? "/" : "", rel);
+
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        char rel_path[PATH_MAX];
+        char full_path[PATH_MAX * 2];
+        snprintf(rel_path, sizeof(rel_path), "%s%s%s", rel, *rel ? "/" : "", entry->d_name);
+        snprintf(full_path, sizeof(full_path), "%s/%s", root, rel_path);
+
+        struct stat st;
+        if (stat(full_path, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            collect_files(root, rel_path, suffixes, min_depth, depth + 1, list);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) || depth < min_depth) {
+            continue;
+        }
+
+        int match = suffixes == NULL;
+        size_t len = strlen(entry->d_name);
+        for (int i = 0; suffixes && suffixes[i]; i++) {
+            size_t suffix_len = strlen(suffixes[i]);
+            if (len >= suffix_len && strcmp(entry->d_name + len - suffix_len, suffixes[i]) == 0) {
+                match = 1;
+            }
+        }
+        if (match) {
+            list->paths = realloc(list->paths, (list->count + 1) * sizeof(char *));
+            list->paths[list->count++] = strdup(rel_path);
+        }
+    }
+    closedir(dir);
+
+    if (depth == 0) {
+        qsort(list->paths, list->count, sizeof(char *), compare_paths);
+    }
+}
+
+static void free_path_list(path_list *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    list->paths = NULL;
+    list->count = 0;
+}
+
+// Hash the names and contents of files below root
+static void hash_tree(hash_ctx *ctx, const char *root, const char *const *suffixes) {
+    path_list list = {0};
+    collect_files(root, "", suffixes, 0, 0, &list);
+    for (int i = 0; i < list.count; i++) {
+        char path[PATH_MAX * 2];
+        snprintf(path, sizeof(path), "%s/%s", root, list.paths[i]);
+        hash_update_string(ctx, list.paths[i]);
+        hash_update_file(ctx, path);
+    }
+    free_path_list(&list);
+}
+
+/**
+ * Fingerprint of everything a trained profile depends on: the sources,
+ * the build files, the compiler and the base flags
+ */
+static void source_fingerprint(char hex[HASH_HEX_SIZE]) {
+    static const char *const source_suffixes[] = {".c", ".h", "Makefile.am", NULL};
+    hash_ctx ctx;
+    hash_init(&ctx);
+    hash_tree(&ctx, "src", source_suffixes);
+    hash_update_file(&ctx, "configure.ac");
+    hash_update_program(&ctx, configured_compiler());
+
+    build_profile profile;
+    if (pgo_profile_flags(PGO_GENERATE_PROFILE, &profile) == 0) {
+        hash_update_string(&ctx, profile.cflags);
+        hash_update_string(&ctx, profile.ldflags);
+    }
+    hash_final(&ctx, hex);
+}
+
+// Copy every file in the list from one tree to another
+static int copy_tree(const char *from, const char *to, const path_list *list) {
+    for (int i = 0; i < list->count; i++) {
+        char src[PATH_MAX * 2];
+        char dst[PATH_MAX * 2];
+        snprintf(src, sizeof(src), "%s/%s", from, list->paths[i]);
+        snprintf(dst, sizeof(dst), "%s/%s", to, list->paths[i]);
+
+        char parent[PATH_MAX * 2];
+        snprintf(parent, sizeof(parent), "%s", dst);
+        char *slash = strrchr(parent, '/');
+        if (slash) {
+            *slash = '\0';
+            create_directories(parent);
+        }
+        if (copy_file(src, dst) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Delete the files in the list below root
+static void remove_files(const char *root, const path_list *list) {
+    for (int i = 0; i < list->count; i++) {
+        char path[PATH_MAX * 2];
+        snprintf(path, sizeof(path), "%s/%s", root, list->paths[i]);
+        unlink(path);
+    }
+}
+
+// Build one of the PGO profiles through cmd_build, passing other options on
+static int build_pgo_profile(const char *profile, int argc, char *argv[]) {
+    char option[128];
+    snprintf(option, sizeof(option), "--profile=%s", profile);
+
+    char **build_argv = calloc(argc + 2, sizeof(char *));
+    build_argv[0] = "build";
+    build_argv[1] = option;
+    for (int i = 0; i < argc; i++) {
+        build_argv[i + 2] = argv[i];
+    }
+    int result = cmd_build(argc + 2, build_argv);
+    free(build_argv);
+    return result;
+}
+
+// Run one training command; only a crash is fatal
+static int run_training(char *const argv[]) {
+    char display[PATH_MAX * 4];
+    if (strcmp(argv[0], "/bin/sh") == 0) {
+        snprintf(display, sizeof(display), "%s", argv[2]);
+    } else {
+        process_format(argv, display, sizeof(display));
+    }
+    printf("Executing: %s\n", display);
+    fflush(stdout);
+
+    process_result result;
+    if (process_run(argv, NULL, &result) != 0) {
+        fprintf(stderr, "Error: Cannot run %s: %s\n", argv[0], strerror(errno));
+        return -1;
+    }
+    if (result.signaled) {
+        char how[128];
+        process_describe(&result, how, sizeof(how));
+        fprintf(stderr, "Error: Training run %s\n", how);
+        return -1;
+    }
+    if (result.exit_code != 0) {
+        // The counters are still written at exit, so the profile is usable
+        fprintf(stderr, "Warning: Training command exited with status %d\n", result.exit_code);
+    }
+    return 0;
+}
+
+/**
+ * Build the instrumented profile, run the training workload and store
+ * the merged profile data in .jc/pgo/data
+ */
+static int train(int clang, char **train_commands, int train_count, int train_argc,
+                 char *train_argv[], int build_argc, char *build_argv[]) {
+    char gen_dir[PATH_MAX];
+    profile_build_dir(PGO_GENERATE_PROFILE, gen_dir, sizeof(gen_dir));
+
+    // Start from zeroed counters
+    static const char *const gcda_suffix[] = {".gcda", NULL};
+    path_list old = {0};
+    collect_files(gen_dir, "", gcda_suffix, 0, 0, &old);
+    remove_files(gen_dir, &old);
+    free_path_list(&old);
+    remove_directory(PGO_RAW_DIR);
+
+    printf("==> Building instrumented binary (build/%s)\n\n", PGO_GENERATE_PROFILE);
+    fflush(stdout);
+    if (build_pgo_profile(PGO_GENERATE_PROFILE, build_argc, build_argv) != 0) {
+        return -1;
+    }
+
+    char executable[PATH_MAX];
+    if (find_built_executable(PGO_GENERATE_PROFILE, NULL, executable, sizeof(executable)) != 0) {
+        fprintf(stderr, "Error: Could not find the instrumented executable\n");
+        return -1;
+    }
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return -1;
+    }
+    char absolute[PATH_MAX * 2];
+    snprintf(absolute, sizeof(absolute), "%s/%s", cwd, executable);
+    setenv("JC_PGO_EXECUTABLE", absolute, 1);
+
+    if (clang) {
+        char raw_pattern[PATH_MAX * 2];
+        create_directories(PGO_RAW_DIR);
+        snprintf(raw_pattern, sizeof(raw_pattern), "%s/%s/%%p-%%m.profraw", cwd, PGO_RAW_DIR);
+        setenv("LLVM_PROFILE_FILE", raw_pattern, 1);
+    }
+
+    printf("\n==> Training\n");
+    fflush(stdout);
+    if (train_count > 0) {
+        // Training commands are shell command lines by design
+        for (int i = 0; i < train_count; i++) {
+            char *const shell[] = {"/bin/sh", "-c", train_commands[i], NULL};
+            if (run_training(shell) != 0) {
+                return -1;
+            }
+        }
+    } else {
+        arg_list run = {0};
+        args_add(&run, absolute);
+        for (int i = 0; i < train_argc; i++) {
+            args_add(&run, train_argv[i]);
+        }
+        int result = run_training(run.argv);
+        args_free(&run);
+        if (result != 0) {
+            return -1;
+        }
+    }
+
+    printf("\n==> Merging profile data\n");
+    fflush(stdout);
+    remove_directory(PGO_DATA_DIR);
+    create_directories(PGO_DATA_DIR);
+
+    if (clang) {
+        char profdata[PATH_MAX];
+        if (find_in_path("llvm-profdata", profdata, sizeof(profdata)) != 0) {
+            fprintf(stderr, "Error: llvm-profdata not found; install the LLVM tools for clang PGO\n");
+            return -1;
+        }
+        static const char *const profraw_suffix[] = {".profraw", NULL};
+        path_list raw = {0};
+        collect_files(PGO_RAW_DIR, "", profraw_suffix, 0, 0, &raw);
+
+        arg_list merge = {0};
+        args_add(&merge, profdata);
+        args_add(&merge, "merge");
+        args_add(&merge, "-o");
+        args_addf(&merge, "%s/%s", PGO_DATA_DIR, PGO_MERGED_FILE);
+        for (int i = 0; i < raw.count; i++) {
+            args_addf(&merge, "%s/%s", PGO_RAW_DIR, raw.paths[i]);
+        }
+        int merged = raw.count > 0 && execute_command(merge.argv) == 0;
+        args_free(&merge);
+        free_path_list(&raw);
+        if (!merged) {
+            fprintf(stderr, "Error: Failed to merge profile data (did the training run the program?)\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    // GCC merges counters across runs itself; collect the .gcda files of
+    // the project's objects (configure's conftest files sit at the top)
+    path_list data = {0};
+    collect_files(gen_dir, "", gcda_suffix, 1, 0, &data);
+    if (data.count == 0) {
+        fprintf(stderr, "Error: Training produced no profile data (did it run the program?)\n");
+        free_path_list(&data);
+        return -1;
+    }
+    int result = copy_tree(gen_dir, PGO_DATA_DIR, &data);
+    printf("Collected %d profile data file%s\n", data.count, data.count == 1 ? "" : "s");
+    free_path_list(&data);
+    return result;
+}
+
+/**
+ * Install the cached profile data into the final build tree
+ *
+ * Objects don't depend on profile data in the Makefile, so the tree is
+ * cleaned whenever different data is applied.
+ */
+static int apply_profile(int clang) {
+    char use_dir[PATH_MAX];
+    profile_build_dir(PGO_USE_PROFILE, use_dir, sizeof(use_dir));
+
+    char data_hash[HASH_HEX_SIZE];
+    hash_ctx ctx;
+    hash_init(&ctx);
+    hash_tree(&ctx, PGO_DATA_DIR, NULL);
+    hash_final(&ctx, data_hash);
+
+    char *applied = read_setting(PGO_STATE_FILE, "applied");
+    int changed = !applied || strcmp(applied, data_hash) != 0;
+    free(applied);
+
+    if (changed && profile_is_configured(PGO_USE_PROFILE)) {
+        char *const clean[] = {"make", "-s", "-C", use_dir, "clean", NULL};
+        execute_command_quiet(clean);
+    }
+
+    if (!clang) {
+        static const char *const gcda_suffix[] = {".gcda", NULL};
+        path_list data = {0};
+        collect_files(PGO_DATA_DIR, "", gcda_suffix, 0, 0, &data);
+        create_directories(use_dir);
+        int result = copy_tree(PGO_DATA_DIR, use_dir, &data);
+        free_path_list(&data);
+        if (result != 0) {
+            fprintf(stderr, "Error: Failed to copy profile data into %s\n", use_dir);
+            return -1;
+        }
+    }
+
+    write_setting(PGO_STATE_FILE, "applied", data_hash);
+    return 0;
+}
+
+// Options for one 'jc build --pgo' run
+typedef struct {
+    char *train_commands[MAX_TRAIN_COMMANDS];
+    int train_count;
+    int train_argc;
+    char **train_argv;
+    char **build_argv;
+    int build_argc;
+    int retrain;
+    int no_train;
+} pgo_options;
+
+// Train if needed, then build the optimized profile
+static int run_pgo(pgo_options *opts) {
+    if (!is_automake_project()) {
+        fprintf(stderr, "Error: Not in an automake project directory\n");
+        return 1;
+    }
+
+    create_directories(PGO_DIR);
+    int clang = compiler_is_clang();
+
+    char fingerprint[HASH_HEX_SIZE];
+    source_fingerprint(fingerprint);
+    char *trained_on = read_setting(PGO_STATE_FILE, "sources");
+    char *trained_at = read_setting(PGO_STATE_FILE, "trained");
+    int have_data = directory_exists(PGO_DATA_DIR) && trained_on;
+    int current = have_data && strcmp(trained_on, fingerprint) == 0;
+    const char *when = trained_at ? trained_at : "an unknown date";
+
+    int need_training = opts->retrain || !have_data;
+    if (have_data && !current) {
+        if (opts->no_train) {
+            printf("Warning: Profile data is stale (sources changed since training on %s); using it anyway\n\n", when);
+        } else {
+            printf("Profile data is stale (sources changed since training on %s); retraining\n\n", when);
+            need_training = 1;
+        }
+    } else if (current && !opts->retrain) {
+        printf("✓ Using cached profile data (trained %s)\n\n", when);
+    }
+    free(trained_on);
+    free(trained_at);
+    fflush(stdout);
+
+    if (need_training && opts->no_train && !have_data) {
+        fprintf(stderr, "Error: No cached profile data; run 'jc build --pgo' without --no-train\n");
+        return 1;
+    }
+
+    if (need_training) {
+        if (train(clang, opts->train_commands, opts->train_count, opts->train_argc, opts->train_argv,
+                  opts->build_argc, opts->build_argv) != 0) {
+            return 1;
+        }
+
+        char now[64];
+        time_t t = time(NULL);
+        strftime(now, sizeof(now), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        write_setting(PGO_STATE_FILE, "sources", fingerprint);
+        write_setting(PGO_STATE_FILE, "trained", now);
+        write_setting(PGO_STATE_FILE, "compiler", clang ? "clang" : "gcc");
+        printf("✓ Profile data saved in %s\n\n", PGO_DATA_DIR);
+    }
+
+    printf("==> Building optimized binary (build/%s)\n\n", PGO_USE_PROFILE);
+    fflush(stdout);
+    if (apply_profile(clang) != 0 || build_pgo_profile(PGO_USE_PROFILE, opts->build_argc, opts->build_argv) != 0) {
+        return 1;
+    }
+
+    printf("\n✓ PGO build completed; run it with 'jc run --profile=%s'\n", PGO_USE_PROFILE);
+    return 0;
+}
+
+/**
+ * Run the whole profile-guided optimization loop for 'jc build --pgo'
+ *
+ * 1. Reuse .jc/pgo/data if it was trained on the current sources,
+ *    otherwise build build/pgo-gen with -fprofile-generate and train it
+ * 2. Merge the profile (llvm-profdata for clang; GCC merges itself)
+ * 3. Build build/pgo with -fprofile-use
+ */
+int pgo_build(int argc, char *argv[]) {
+    pgo_options opts = {0};
+    opts.build_argv = calloc(argc, sizeof(char *));
+    int result = -1;
+
+    for (int i = 1; i < argc && result < 0; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--pgo") == 0) {
+            continue;
+        } else if (strcmp(arg, "--") == 0) {
+            opts.train_argc = argc - i - 1;
+            opts.train_argv = argv + i + 1;
+            break;
+        } else if ((strcmp(arg, "--train") == 0 && i + 1 < argc) || strncmp(arg, "--train=", 8) == 0) {
+            if (opts.train_count == MAX_TRAIN_COMMANDS) {
+                fprintf(stderr, "Error: At most %d training commands\n", MAX_TRAIN_COMMANDS);
+                result = 1;
+                break;
+            }
+            opts.train_commands[opts.train_count++] = strdup(arg[7] == '=' ? arg + 8 : argv[++i]);
+        } else if (strcmp(arg, "--retrain") == 0) {
+            opts.retrain = 1;
+        } else if (strcmp(arg, "--no-train") == 0) {
+            opts.no_train = 1;
+        } else if (strncmp(arg, "--profile", 9) == 0) {
+            fprintf(stderr, "Error: --pgo builds the '%s' and '%s' profiles itself\n",
+                    PGO_GENERATE_PROFILE, PGO_USE_PROFILE);
+            fprintf(stderr, "Set 'pgo.base' in .jc/config to choose the base flags\n");
+            result = 1;
+        } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            print_pgo_usage();
+            result = 0;
+        } else {
+            opts.build_argv[opts.build_argc++] = argv[i];
+        }
+    }
+
+    if (result < 0) {
+        if (opts.train_count == 0 && opts.train_argc == 0) {
+            char *setting = get_project_setting("pgo.train");
+            if (setting) {
+                opts.train_commands[opts.train_count++] = setting;
+            }
+        }
+        result = run_pgo(&opts);
+    }
+
+    for (int i = 0; i < opts.train_count; i++) {
+        free(opts.train_commands[i]);
+    }
+    free(opts.build_argv);
+    return result;
+}
@@ -0,0 +1,13 @@
+#ifndef PGO_H
+#define PGO_H
+
+#include "build_profile.h"
+
+// Build profiles used by 'jc build --pgo'
+#define PGO_GENERATE_PROFILE "pgo-gen"
+#define PGO_USE_PROFILE "pgo"
+
+int pgo_profile_flags(const char *name, build_profile *profile);
+int pgo_build(int argc, char *argv[]);
+
+#endif // PGO_H
@@ -0,0 +1,729 @@
+#define _GNU_SOURCE
+
+#include "process.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// posix_spawn can change directory itself on glibc 2.29+ and macOS
+#if (defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))) || \
+    defined(__APPLE__)
+#define HAVE_SPAWN_CHDIR 1
+#endif
+
+// Time between SIGTERM and SIGKILL when a child times out
+#define PROCESS_KILL_GRACE_MS 2000
+
+// Longest wait between on_ready calls
+#define PROCESS_WATCH_MS 100
+
+// Child (or negated process group) of the running process_run(), for
+// forwarded signals
+static volatile pid_t forward_pid = 0;
+
+void args_add(arg_list *list, const char *arg) {
+    if (list->count + 2 > list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->argv = realloc(list->argv, list->capacity * sizeof(char *));
+    }
+    list->argv[list->count++] = strdup(arg);
+    list->argv[list->count] = NULL;
+}
+
+void args_addf(arg_list *list, const char *fmt, ...) {
+    char arg[8192];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(arg, sizeof(arg), fmt, ap);
+    va_end(ap);
+    args_add(list, arg);
+}
+
+/**
+ * Split words with shell quoting rules and add them to the list
+ *
+ * Handles whitespace, '...', "..." and backslash escapes, so strings jc
+ * composes for display (configure arguments) run without a shell. No
+ * expansion of any kind takes place.
+ *
+ * @return Number of words added, or -1 for an unterminated quote
+ */
+int args_add_split(arg_list *list, const char *words) {
+    size_t size = strlen(words) + 1;
+    char *word = malloc(size);
+    int added = 0;
+    const char *p = words;
+
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == '\n') {
+            p++;
+        }
+        if (!*p) {
+            break;
+        }
+
+        size_t len = 0;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\n') {
+            if (*p == '\'') {
+                const char *end = strchr(p + 1, '\'');
+                if (!end) {
+                    free(word);
+                    return -1;
+                }
+                memcpy(word + len, p + 1, end - p - 1);
+                len += end - p - 1;
+                p = end + 1;
+            } else if (*p == '"') {
+                for (p++; *p && *p != '"'; p++) {
+                    if (*p == '\\' && p[1] && strchr("\"\\$`", p[1])) {
+                        p++;
+                    }
+                    word[len++] = *p;
+                }
+                if (*p != '"') {
+                    free(word);
+                    return -1;
+                }
+                p++;
+            } else if (*p == '\\' && p[1]) {
+                word[len++] = p[1];
+                p += 2;
+            } else {
+                word[len++] = *p++;
+            }
+        }
+        word[len] = '\0';
+        args_add(list, word);
+        added++;
+    }
+
+    free(word);
+    return added;
+}
+
+void args_free(arg_list *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->argv[i]);
+    }
+    free(list->argv);
+    list->argv = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static long long now_ms(void) {
+    return now_us() / 1000;
+}
+
+static void forward_signal(int sig) {
+    if (forward_pid > 0) {
+        kill(forward_pid, sig);
+    }
+}
+
+// The environment with NAME=value overrides applied
+static char **merged_environment(char *const *overrides) {
+    int count = 0;
+    int extra = 0;
+    while (environ[count]) {
+        count++;
+    }
+    while (overrides[extra]) {
+        extra++;
+    }
+
+    char **env = calloc(count + extra + 1, sizeof(char *));
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        size_t name_len = strcspn(environ[i], "=");
+        int overridden = 0;
+        for (int j = 0; j < extra; j++) {
+            if (strncmp(overrides[j], environ[i], name_len) == 0 && overrides[j][name_len] == '=') {
+                overridden = 1;
+            }
+        }
+        if (!overridden) {
+            env[n++] = environ[i];
+        }
+    }
+    for (int j = 0; j < extra; j++) {
+        env[n++] = overrides[j];
+    }
+    env[n] = NULL;
+    return env;
+}
+
+// Output of one piped stream, split into lines for on_line
+typedef struct {
+    int fd;                      // read end, or -1 once closed
+    int target;                  // STDOUT_FILENO or STDERR_FILENO
+    char *line;
+    size_t line_len;
+    size_t line_cap;
+    char **captured;
+    size_t *captured_len;
+} stream_reader;
+
+static void append_bytes(char **buf, size_t *len, size_t *cap, const char *data, size_t n) {
+    if (*len + n + 1 > *cap) {
+        while (*len + n + 1 > *cap) {
+            *cap = *cap ? *cap * 2 : 4096;
+        }
+        *buf = realloc(*buf, *cap);
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+    (*buf)[*len] = '\0';
+}
+
+static void read_stream(stream_reader *reader, const process_options *options, size_t *captured_cap) {
+    char buffer[65536];
+    ssize_t n = read(reader->fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+        return;
+    }
+    if (n <= 0) {
+        if (options->on_line && reader->line_len > 0) {
+            options->on_line(options->context, reader->target, reader->line, reader->line_len);
+        }
+        reader->line_len = 0;
+        close(reader->fd);
+        reader->fd = -1;
+        return;
+    }
+
+    if (options->capture) {
+        append_bytes(reader->captured, reader->captured_len, captured_cap, buffer, n);
+    }
+    if (!options->on_line) {
+        return;
+    }
+
+    const char *p = buffer;
+    const char *end = buffer + n;
+    while (p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        size_t chunk = newline ? (size_t)(newline - p + 1) : (size_t)(end - p);
+        if (reader->line_len == 0 && newline) {
+            // A whole line in the buffer: no copy needed
+            options->on_line(options->context, reader->target, p, chunk);
+        } else {
+            append_bytes(&reader->line, &reader->line_len, &reader->line_cap, p, chunk);
+            if (newline) {
+                options->on_line(options->context, reader->target, reader->line, reader->line_len);
+                reader->line_len = 0;
+            }
+        }
+        p += chunk;
+    }
+}
+
+static int open_pipe(int fds[2]) {
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+#ifndef HAVE_SPAWN_CHDIR
+// fork/exec for a child in another directory where posix_spawn can't chdir
+static pid_t spawn_in_directory(char *const argv[], const process_options *options, char **env,
+                                int out_fd, int err_fd) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    int devnull = open("/dev/null", O_WRONLY);
+    if (options->out == PROCESS_PIPE) {
+        dup2(out_fd, STDOUT_FILENO);
+    } else if (options->out == PROCESS_DISCARD) {
+        dup2(devnull, STDOUT_FILENO);
+    }
+    if (options->err == PROCESS_PIPE) {
+        dup2(err_fd, STDERR_FILENO);
+    } else if (options->err == PROCESS_DISCARD) {
+        dup2(devnull, STDERR_FILENO);
+    } else if (options->err == PROCESS_MERGE) {
+        dup2(STDOUT_FILENO, STDERR_FILENO);
+    }
+
+    if (options->new_group) {
+        setpgid(0, 0);
+    }
+
+    const int defaults[] = {SIGINT, SIGQUIT, SIGTERM, SIGHUP, SIGPIPE};
+    for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++) {
+        signal(defaults[i], SIG_DFL);
+    }
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+
+    if (chdir(options->cwd) != 0) {
+        perror(options->cwd);
+        _exit(127);
+    }
+    environ = env;
+    execvp(argv[0], argv);
+    perror(argv[0]);
+    _exit(127);
+}
+#endif
+
+// Start the child with its streams connected; returns 0 or an errno value
+static int spawn_child(char *const argv[], const process_options *options, char **env, int out_fd,
+                       int err_fd, pid_t *pid) {
+#ifndef HAVE_SPAWN_CHDIR
+    if (options->cwd) {
+        *pid = spawn_in_directory(argv, options, env, out_fd, err_fd);
+        return *pid < 0 ? errno : 0;
+    }
+#endif
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    // The child starts with default dispositions and nothing blocked
+    sigset_t defaults_set;
+    sigset_t empty;
+    sigemptyset(&defaults_set);
+    sigaddset(&defaults_set, SIGINT);
+    sigaddset(&defaults_set, SIGQUIT);
+    sigaddset(&defaults_set, SIGTERM);
+    sigaddset(&defaults_set, SIGHUP);
+    sigaddset(&defaults_set, SIGPIPE);
+    sigemptyset(&empty);
+    posix_spawnattr_setsigdefault(&attr, &defaults_set);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (options->new_group) {
+        posix_spawnattr_setpgroup(&attr, 0);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    if (options->out == PROCESS_PIPE) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    } else if (options->out == PROCESS_DISCARD) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+    if (options->err == PROCESS_PIPE) {
+        posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+    } else if (options->err == PROCESS_DISCARD) {
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    } else if (options->err == PROCESS_MERGE) {
+        posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    }
+#ifdef HAVE_SPAWN_CHDIR
+    if (options->cwd) {
+        posix_spawn_file_actions_addchdir_np(&actions, options->cwd);
+    }
+#endif
+
+    int error = posix_spawnp(pid, argv[0], &actions, &attr, argv, env);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return error;
+}
+
+// Fill in how the child ended from its wait status
+static void decode_status(int status, process_result *result) {
+    if (WIFSIGNALED(status)) {
+        result->signaled = 1;
+        result->signal = WTERMSIG(status);
+#ifdef WCOREDUMP
+        result->core_dumped = WCOREDUMP(status) != 0;
+#endif
+    } else if (WIFEXITED(status)) {
+        result->exited = 1;
+        result->exit_code = WEXITSTATUS(status);
+    }
+}
+
+/**
+ * Run a program without a shell and wait for it
+ *
+ * While the child runs, SIGINT and SIGQUIT are ignored by jc (the
+ * terminal delivers them to the child too) and SIGTERM and SIGHUP are
+ * forwarded to it, as a shell would do for its foreground job. A child
+ * in its own process group doesn't get terminal signals, so all four are
+ * forwarded to the group instead.
+ *
+ * @param argv Program and arguments; the program is looked up on $PATH
+ * @param options How to run it, or NULL to inherit everything
+ * @param result Receives the exact exit status, wall time, resource usage
+ *        and captured output; release with process_result_free()
+ * @return 0 once the child has been waited for, -1 if it could not be
+ *         started (errno is set)
+ */
+int process_run(char *const argv[], const process_options *options, process_result *result) {
+    static const process_options defaults = {0};
+    if (!options) {
+        options = &defaults;
+    }
+    memset(result, 0, sizeof(*result));
+
+    int out_pipe[2] = {-1, -1};
+    int err_pipe[2] = {-1, -1};
+    if ((options->out == PROCESS_PIPE && open_pipe(out_pipe) != 0) ||
+        (options->err == PROCESS_PIPE && open_pipe(err_pipe) != 0)) {
+        int saved = errno;
+        for (int i = 0; i < 2; i++) {
+            if (out_pipe[i] >= 0) close(out_pipe[i]);
+            if (err_pipe[i] >= 0) close(err_pipe[i]);
+        }
+        errno = saved;
+        return -1;
+    }
+
+    char **env = options->env ? merged_environment(options->env) : environ;
+
+    // Ignore terminal signals and forward the others while the child runs
+    struct sigaction ignore;
+    struct sigaction forward;
+    struct sigaction saved_int, saved_quit, saved_term, saved_hup;
+    memset(&ignore, 0, sizeof(ignore));
+    memset(&forward, 0, sizeof(forward));
+    ignore.sa_handler = SIG_IGN;
+    forward.sa_handler = forward_signal;
+    sigaction(SIGINT, options->new_group ? &forward : &ignore, &saved_int);
+    sigaction(SIGQUIT, options->new_group ? &forward : &ignore, &saved_quit);
+    sigaction(SIGTERM, &forward, &saved_term);
+    sigaction(SIGHUP, &forward, &saved_hup);
+
+    pid_t pid = -1;
+    long long started = now_us();
+    int spawn_error = spawn_child(argv, options, env, out_pipe[1], err_pipe[1], &pid);
+
+    if (env != environ) {
+        free(env);
+    }
+    if (out_pipe[1] >= 0) {
+        close(out_pipe[1]);
+    }
+    if (err_pipe[1] >= 0) {
+        close(err_pipe[1]);
+    }
+
+    int status = 0;
+    if (spawn_error != 0) {
+        if (out_pipe[0] >= 0) close(out_pipe[0]);
+        if (err_pipe[0] >= 0) close(err_pipe[0]);
+    } else {
+        pid_t target = options->new_group ? -pid : pid;
+        forward_pid = target;
+        result->pid = pid;
+
+        size_t output_cap = 0;
+        size_t errors_cap = 0;
+        stream_reader readers[2] = {
+            {out_pipe[0], STDOUT_FILENO, NULL, 0, 0, &result->output, &result->output_len},
+            {err_pipe[0], STDERR_FILENO, NULL, 0, 0, &result->errors, &result->errors_len},
+        };
+        size_t *caps[2] = {&output_cap, &errors_cap};
+
+        long long deadline = options->timeout_ms > 0 ? now_ms() + options->timeout_ms : 0;
+        int terminated = 0;
+        int reaped = 0;
+
+        while (!reaped) {
+            struct pollfd fds[3];
+            int nfds = 0;
+            int which[3];
+            for (int i = 0; i < 2; i++) {
+                if (readers[i].fd >= 0) {
+                    fds[nfds].fd = readers[i].fd;
+                    fds[nfds].events = POLLIN;
+                    which[nfds++] = i;
+                }
+            }
+            int open_streams = nfds;
+            if (options->on_ready) {
+                fds[nfds].fd = options->watch_fd;
+                fds[nfds].events = POLLIN;
+                which[nfds++] = -1;
+            }
+
+            int wait_ms = -1;
+            if (deadline) {
+                long long left = deadline - now_ms();
+                wait_ms = left > 0 ? (int)left : 0;
+            }
+            if (options->on_ready && (wait_ms < 0 || wait_ms > PROCESS_WATCH_MS)) {
+                wait_ms = PROCESS_WATCH_MS;
+            }
+
+            if (open_streams > 0) {
+                int ready = poll(fds, nfds, wait_ms);
+                for (int i = 0; i < nfds && ready > 0; i++) {
+                    if (fds[i].revents && which[i] >= 0) {
+                        read_stream(&readers[which[i]], options, caps[which[i]]);
+                    }
+                }
+                if (options->on_ready) {
+                    options->on_ready(options->context, options->watch_fd);
+                }
+            } else if (deadline || options->on_ready) {
+                // Nothing to read: check on the child until the deadline
+                pid_t done = wait4(pid, &status, WNOHANG, &result->usage);
+                if (done == pid || (done < 0 && errno != EINTR)) {
+                    reaped = 1;
+                    break;
+                }
+                if (options->on_ready) {
+                    poll(fds, nfds, wait_ms);
+                    options->on_ready(options->context, options->watch_fd);
+                } else {
+                    struct timespec pause = {0, 10 * 1000 * 1000};
+                    nanosleep(&pause, NULL);
+                }
+            } else {
+                while (wait4(pid, &status, 0, &result->usage) < 0 && errno == EINTR) {
+                }
+                reaped = 1;
+                break;
+            }
+
+            if (deadline && now_ms() >= deadline) {
+                if (!terminated) {
+                    kill(target, SIGTERM);
+                    terminated = 1;
+                    result->timed_out = 1;
+                    deadline = now_ms() + PROCESS_KILL_GRACE_MS;
+                } else {
+                    kill(target, SIGKILL);
+                    deadline = 0;
+                }
+            }
+        }
+
+        result->wall_us = now_us() - started;
+        for (int i = 0; i < 2; i++) {
+            free(readers[i].line);
+        }
+
+        // Let the rest of the group (e.g. sub-makes after a signal) finish too
+        if (options->new_group) {
+            struct timespec pause = {0, 10 * 1000 * 1000};
+            for (int waited = 0; kill(-pid, 0) == 0 && waited < PROCESS_KILL_GRACE_MS; waited += 10) {
+                nanosleep(&pause, NULL);
+            }
+        }
+        forward_pid = 0;
+    }
+
+    sigaction(SIGINT, &saved_int, NULL);
+    sigaction(SIGQUIT, &saved_quit, NULL);
+    sigaction(SIGTERM, &saved_term, NULL);
+    sigaction(SIGHUP, &saved_hup, NULL);
+
+    if (spawn_error != 0) {
+        errno = spawn_error;
+        return -1;
+    }
+
+    decode_status(status, result);
+    return 0;
+}
+
+/**
+ * Start a program without waiting for it, to run several at once
+ *
+ * Signal dispositions are left to the caller, and on_line, timeout_ms
+ * and on_ready aren't supported. Piped output is captured into
+ * job->result as process_poll() reads it.
+ *
+ * @return 0 once started, -1 if it could not be (errno is set)
+ */
+int process_start(char *const argv[], const process_options *options, process_job *job) {
+    memset(job, 0, sizeof(*job));
+    job->fds[0] = job->fds[1] = -1;
+    job->capture = options->capture;
+
+    int out_pipe[2] = {-1, -1};
+    int err_pipe[2] = {-1, -1};
+    if ((options->out == PROCESS_PIPE && open_pipe(out_pipe) != 0) ||
+        (options->err == PROCESS_PIPE && open_pipe(err_pipe) != 0)) {
+        int saved = errno;
+        for (int i = 0; i < 2; i++) {
+            if (out_pipe[i] >= 0) close(out_pipe[i]);
+            if (err_pipe[i] >= 0) close(err_pipe[i]);
+        }
+        errno = saved;
+        return -1;
+    }
+
+    char **env = options->env ? merged_environment(options->env) : environ;
+    job->started = now_us();
+    int spawn_error = spawn_child(argv, options, env, out_pipe[1], err_pipe[1], &job->pid);
+    if (env != environ) {
+        free(env);
+    }
+    if (out_pipe[1] >= 0) {
+        close(out_pipe[1]);
+    }
+    if (err_pipe[1] >= 0) {
+        close(err_pipe[1]);
+    }
+    if (spawn_error != 0) {
+        if (out_pipe[0] >= 0) close(out_pipe[0]);
+        if (err_pipe[0] >= 0) close(err_pipe[0]);
+        errno = spawn_error;
+        return -1;
+    }
+    job->result.pid = job->pid;
+    job->fds[0] = out_pipe[0];
+    job->fds[1] = err_pipe[0];
+    return 0;
+}
+
+/**
+ * Read what running jobs wrote and reap those that have exited
+ *
+ * A job is reaped once its piped streams are closed, as process_run()
+ * does; job->finished is then set and job->result is complete.
+ *
+ * @param timeout_ms Longest wait for output or an exit, -1 for no limit
+ * @return Number of jobs that finished during this call
+ */
+int process_poll(process_job *const jobs[], int count, int timeout_ms) {
+    struct pollfd *fds = calloc(count * 2 + 1, sizeof(struct pollfd));
+    int *owner = calloc(count * 2 + 1, sizeof(int));
+    int nfds = 0;
+    int closed = 0;
+    for (int i = 0; i < count; i++) {
+        if (jobs[i]->finished) {
+            continue;
+        }
+        int open_streams = 0;
+        for (int s = 0; s < 2; s++) {
+            if (jobs[i]->fds[s] >= 0) {
+                fds[nfds].fd = jobs[i]->fds[s];
+                fds[nfds].events = POLLIN;
+                owner[nfds++] = i * 2 + s;
+                open_streams++;
+            }
+        }
+        closed += open_streams == 0;
+    }
+
+    // Children without pipes (or past EOF) are checked on every 10ms
+    if (closed && (timeout_ms < 0 || timeout_ms > 10)) {
+        timeout_ms = 10;
+    }
+    int ready = poll(fds, nfds, timeout_ms);
+    for (int i = 0; i < nfds && ready > 0; i++) {
+        if (!fds[i].revents) {
+            continue;
+        }
+        process_job *job = jobs[owner[i] / 2];
+        int s = owner[i] % 2;
+        process_options options = {0};
+        options.capture = job->capture;
+        stream_reader reader = {job->fds[s], s ? STDERR_FILENO : STDOUT_FILENO, NULL, 0, 0,
+                                s ? &job->result.errors : &job->result.output,
+                                s ? &job->result.errors_len : &job->result.output_len};
+        read_stream(&reader, &options, &job->caps[s]);
+        job->fds[s] = reader.fd;
+    }
+    free(fds);
+    free(owner);
+
+    int finished = 0;
+    for (int i = 0; i < count; i++) {
+        process_job *job = jobs[i];
+        if (job->finished || job->fds[0] >= 0 || job->fds[1] >= 0) {
+            continue;
+        }
+        int status;
+        pid_t done = wait4(job->pid, &status, WNOHANG, &job->result.usage);
+        if (done == job->pid) {
+            decode_status(status, &job->result);
+            job->result.wall_us = now_us() - job->started;
+            job->finished = 1;
+            finished++;
+        } else if (done < 0 && errno != EINTR) {
+            job->result.wall_us = now_us() - job->started;
+            job->finished = 1;
+            finished++;
+        }
+    }
+    return finished;
+}
+
+// The status as a shell reports it: the exit code, or 128 + the signal
+int process_status(const process_result *result) {
+    return result->signaled ? 128 + result->signal : result->exit_code;
+}
+
+// Describe how the child ended, e.g. "killed by signal 11 (Segmentation fault)"
+void process_describe(const process_result *result, char *out, size_t size) {
+    if (result->timed_out) {
+        snprintf(out, size, "timed out%s", result->signaled ? " and was killed" : "");
+    } else if (result->signaled) {
+        snprintf(out, size, "killed by signal %d (%s)%s", result->signal, strsignal(result->signal),
+                 result->core_dumped ? ", core dumped" : "");
+    } else {
+        snprintf(out, size, "exited with code %d", result->exit_code);
+    }
+}
+
+void process_result_free(process_result *result) {
+    free(result->output);
+    free(result->errors);
+    result->output = NULL;
+    result->errors = NULL;
+    result->output_len = 0;
+    result->errors_len = 0;
+}
+
+// Format argv for display, quoting arguments a shell would split
+void process_format(char *const argv[], char *out, size_t size) {
+    static const char safe[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-+=/.,:@%";
+    size_t len = 0;
+    for (int i = 0; argv[i] && len + 8 < size; i++) {
+        const char *arg = argv[i];
+        int plain = *arg && strspn(arg, safe) == strlen(arg);
+        if (i > 0) {
+            out[len++] = ' ';
+        }
+        if (!plain) {
+            out[len++] = '\'';
+        }
+        for (const char *p = arg; *p && len + 6 < size; p++) {
+            if (*p == '\'' && !plain) {
+                // Close the quote, add an escaped quote, reopen
+                memcpy(out + len, "'\\''", 4);
+                len += 4;
+            } else {
+                out[len++] = *p;
+            }
+        }
+        if (!plain) {
+            out[len++] = '\'';
+        }
+    }
+    out[len] = '\0';
+}
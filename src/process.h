@@ -0,0 +1,83 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <stddef.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+// How a child's stdout or stderr is connected
+typedef enum {
+    PROCESS_INHERIT,   // jc's own stream
+    PROCESS_DISCARD,   // /dev/null
+    PROCESS_PIPE,      // read by jc: captured and/or passed to on_line
+    PROCESS_MERGE      // stderr only: wherever stdout goes
+} process_stream;
+
+// Called for each line a piped stream produces (the last one may lack '\n')
+typedef void (*process_line_fn)(void *context, int fd, const char *line, size_t len);
+
+// Called while the child runs when watch_fd is readable, and at least every 100ms
+typedef void (*process_ready_fn)(void *context, int fd);
+
+typedef struct {
+    const char *cwd;             // working directory, or NULL for jc's
+    char *const *env;            // NAME=value overrides, NULL-terminated, or NULL
+    process_stream out;
+    process_stream err;
+    int capture;                 // keep piped output in the result
+    process_line_fn on_line;     // stream piped output as it arrives
+    void *context;
+    int timeout_ms;              // SIGTERM (then SIGKILL) after this long; 0 waits forever
+    int new_group;               // own process group: signals go to it, and it's waited for
+    int watch_fd;                // polled alongside the pipes when on_ready is set
+    process_ready_fn on_ready;
+} process_options;
+
+typedef struct {
+    pid_t pid;
+    int exited;                  // exited normally with exit_code
+    int exit_code;
+    int signaled;                // killed by signal
+    int signal;
+    int core_dumped;
+    int timed_out;               // killed because of the timeout
+    long long wall_us;           // from start to exit
+    struct rusage usage;         // the child's resource usage (wait4)
+    char *output;                // captured stdout (and merged stderr)
+    size_t output_len;
+    char *errors;                // captured stderr
+    size_t errors_len;
+} process_result;
+
+// A child started by process_start(), running alongside others
+typedef struct {
+    pid_t pid;
+    int fds[2];                  // piped stdout and stderr, -1 once closed
+    size_t caps[2];              // sizes of the capture buffers
+    int capture;
+    long long started;           // monotonic, us
+    int finished;                // reaped: result is complete
+    process_result result;
+} process_job;
+
+// A growable, NULL-terminated argument vector
+typedef struct {
+    char **argv;
+    int count;
+    int capacity;
+} arg_list;
+
+void args_add(arg_list *list, const char *arg);
+void args_addf(arg_list *list, const char *fmt, ...);
+int args_add_split(arg_list *list, const char *words);
+void args_free(arg_list *list);
+
+int process_run(char *const argv[], const process_options *options, process_result *result);
+int process_start(char *const argv[], const process_options *options, process_job *job);
+int process_poll(process_job *const jobs[], int count, int timeout_ms);
+int process_status(const process_result *result);
+void process_describe(const process_result *result, char *out, size_t size);
+void process_result_free(process_result *result);
+void process_format(char *const argv[], char *out, size_t size);
+
+#endif // PROCESS_H
@@ -0,0 +1,794 @@
+#define _GNU_SOURCE
+
+#include "jc.h"
+#include "utils.h"
+#include "profile.h"
+#include "symbols.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+// Ring buffer pages for perf samples (plus one for the header page)
+#define PROFILE_RING_PAGES 256
+
+// Flame graph geometry, in pixels
+#define FLAME_WIDTH 1200
+#define FLAME_PAD 10
+#define FLAME_FRAME 16
+#define FLAME_TOP 40
+#define FLAME_CHAR 7
+
+void profile_add_map(profile_data *data, pid_t pid, uint64_t time, uint64_t start, uint64_t end,
+                     uint64_t offset, const char *path) {
+    if (data->map_count == data->map_capacity) {
+        data->map_capacity = data->map_capacity ? data->map_capacity * 2 : 64;
+        data->maps = realloc(data->maps, data->map_capacity * sizeof(profile_map));
+    }
+    profile_map *map = &data->maps[data->map_count++];
+    map->pid = pid;
+    map->time = time;
+    map->start = start;
+    map->end = end;
+    map->offset = offset;
+    map->path = strdup(path);
+}
+
+/**
+ * Add the executable mappings from /proc/<pid>/maps text
+ */
+void profile_add_maps(profile_data *data, pid_t pid, uint64_t time, const char *maps) {
+    const char *line = maps;
+    while (line && *line) {
+        const char *next = strchr(line, '\n');
+        unsigned long long start;
+        unsigned long long end;
+        unsigned long long offset;
+        char perms[8];
+        int path_at = 0;
+        if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %n", &start, &end, perms, &offset, &path_at) == 4 &&
+            path_at > 0 && strchr(perms, 'x')) {
+            size_t len = next ? (size_t)(next - line - path_at) : strlen(line + path_at);
+            char path[4096];
+            if (len > 0 && len < sizeof(path) && (line[path_at] == '/' || line[path_at] == '[')) {
+                memcpy(path, line + path_at, len);
+                path[len] = '\0';
+                profile_add_map(data, pid, time, start, end, offset, path);
+            }
+        }
+        line = next ? next + 1 : NULL;
+    }
+}
+
+void profile_add_sample(profile_data *data, pid_t pid, uint64_t time, const uint64_t *frames, int depth) {
+    if (depth <= 0) {
+        return;
+    }
+    if (data->sample_count == data->sample_capacity) {
+        data->sample_capacity = data->sample_capacity ? data->sample_capacity * 2 : 1024;
+        data->samples = realloc(data->samples, data->sample_capacity * sizeof(profile_sample));
+    }
+    while (data->frame_count + depth > data->frame_capacity) {
+        data->frame_capacity = data->frame_capacity ? data->frame_capacity * 2 : 16384;
+        data->frames = realloc(data->frames, data->frame_capacity * sizeof(uint64_t));
+    }
+    profile_sample *sample = &data->samples[data->sample_count++];
+    sample->pid = pid;
+    sample->time = time;
+    sample->depth = depth;
+    sample->first = data->frame_count;
+    memcpy(data->frames + data->frame_count, frames, depth * sizeof(uint64_t));
+    data->frame_count += depth;
+}
+
+// Record an exec (parent 0) or a fork of pid
+void profile_add_task(profile_data *data, pid_t pid, pid_t parent, uint64_t time) {
+    if (data->task_count == data->task_capacity) {
+        data->task_capacity = data->task_capacity ? data->task_capacity * 2 : 16;
+        data->tasks = realloc(data->tasks, data->task_capacity * sizeof(profile_task));
+    }
+    profile_task *task = &data->tasks[data->task_count++];
+    task->pid = pid;
+    task->parent = parent;
+    task->time = time;
+}
+
+void profile_data_free(profile_data *data) {
+    for (int i = 0; i < data->map_count; i++) {
+        free(data->maps[i].path);
+    }
+    free(data->maps);
+    free(data->tasks);
+    free(data->samples);
+    free(data->frames);
+    memset(data, 0, sizeof(*data));
+}
+
+#ifdef __linux__
+
+// PERF_RECORD_MMAP2; sample_id_all puts pid, tid and time after the file name
+struct mmap2_record {
+    struct perf_event_header header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t addr;
+    uint64_t len;
+    uint64_t pgoff;
+    uint32_t maj;
+    uint32_t min;
+    uint64_t ino;
+    uint64_t ino_generation;
+    uint32_t prot;
+    uint32_t flags;
+    char filename[];
+};
+
+// Open the sampling event on one CPU, on cycles if there is a PMU
+static int open_sampler(profile_perf *perf, int cpu, int frequency) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.freq = 1;
+    attr.sample_freq = frequency;
+    attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN;
+    attr.sample_id_all = 1;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.exclude_callchain_kernel = 1;
+    attr.mmap = 1;
+    attr.mmap2 = 1;
+    attr.comm = 1;
+    attr.comm_exec = 1;
+    attr.task = 1;
+    attr.watermark = 1;
+    attr.wakeup_watermark = perf->size / 2;
+
+    if (perf->count == 0 || perf->hardware) {
+        int fd = syscall(SYS_perf_event_open, &attr, 0, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd >= 0) {
+            perf->hardware = 1;
+            return fd;
+        }
+        if (perf->hardware) {
+            return -1;
+        }
+    }
+    // No PMU (most VMs): sample on the CPU clock instead
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_CPU_CLOCK;
+    return syscall(SYS_perf_event_open, &attr, 0, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/**
+ * Start sampling the next program jc runs
+ *
+ * Like the counters of 'jc run --counters', the events are opened disabled
+ * on jc itself, inherited, and enabled when the child execs. The kernel
+ * won't map the ring buffer of an inherited event that follows tasks across
+ * CPUs, so there is one event and buffer per CPU. Samples from the whole
+ * process tree land in them along with the mmap, exec and fork records
+ * needed to symbolize them, each stamped with the time so the buffers can
+ * be read in any order. Callchains are the kernel's frame-pointer walk of
+ * the user stack.
+ *
+ * @return 0 on success, -1 with errno set if perf events are unavailable
+ */
+int profile_perf_open(profile_perf *perf, profile_data *data, int frequency) {
+    memset(perf, 0, sizeof(*perf));
+    perf->data = data;
+
+    long page = sysconf(_SC_PAGESIZE);
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (cpus < 1) {
+        cpus = 1;
+    }
+    perf->size = PROFILE_RING_PAGES * page;
+    perf->fds = malloc(cpus * sizeof(int));
+    perf->buffers = malloc(cpus * sizeof(unsigned char *));
+
+    int error = 0;
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        int fd = open_sampler(perf, cpu, frequency);
+        if (fd < 0) {
+            // Offline CPUs can't be sampled, and nothing will run there
+            error = errno;
+            continue;
+        }
+        void *buffer = mmap(NULL, perf->size + page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (buffer == MAP_FAILED) {
+            error = errno;
+            close(fd);
+            continue;
+        }
+        perf->fds[perf->count] = fd;
+        perf->buffers[perf->count] = buffer;
+        perf->count++;
+    }
+
+    if (perf->count == 0) {
+        profile_perf_close(perf);
+        errno = error ? error : ENODEV;
+        return -1;
+    }
+    return 0;
+}
+
+static void handle_record(profile_data *data, const unsigned char *record) {
+    const struct perf_event_header *header = (const struct perf_event_header *)record;
+    const uint32_t *ids = (const uint32_t *)(record + sizeof(*header));
+    // Other records end with sample_id: pid, tid, time
+    uint64_t time = *(const uint64_t *)(record + header->size - sizeof(uint64_t));
+
+    switch (header->type) {
+    case PERF_RECORD_SAMPLE: {
+        // pid, tid, time, nr, ips[nr]
+        time = *(const uint64_t *)(record + sizeof(*header) + 8);
+        uint64_t nr = *(const uint64_t *)(record + sizeof(*header) + 16);
+        const uint64_t *ips = (const uint64_t *)(record + sizeof(*header) + 24);
+        if (sizeof(*header) + 24 + nr * sizeof(uint64_t) > header->size) {
+            break;
+        }
+        uint64_t frames[PERF_MAX_STACK_DEPTH];
+        int depth = 0;
+        for (uint64_t i = 0; i < nr && depth < PERF_MAX_STACK_DEPTH; i++) {
+            if (ips[i] < PERF_CONTEXT_MAX) {
+                frames[depth++] = ips[i];
+            }
+        }
+        profile_add_sample(data, ids[0], time, frames, depth);
+        break;
+    }
+    case PERF_RECORD_MMAP2: {
+        const struct mmap2_record *mmap = (const struct mmap2_record *)record;
+        profile_add_map(data, mmap->pid, time, mmap->addr, mmap->addr + mmap->len, mmap->pgoff,
+                        mmap->filename);
+        break;
+    }
+    case PERF_RECORD_COMM:
+        if (header->misc & PERF_RECORD_MISC_COMM_EXEC) {
+            profile_add_task(data, ids[0], 0, time);
+        }
+        break;
+    case PERF_RECORD_FORK:
+        // Threads share their process's mappings already
+        if (ids[0] != ids[1]) {
+            profile_add_task(data, ids[0], ids[1], time);
+        }
+        break;
+    case PERF_RECORD_LOST:
+        data->lost += *(const uint64_t *)(record + sizeof(*header) + 8);
+        break;
+    }
+}
+
+// Consume everything in one CPU's ring buffer
+static void drain_buffer(profile_perf *perf, unsigned char *buffer) {
+    struct perf_event_mmap_page *meta = (struct perf_event_mmap_page *)buffer;
+    const unsigned char *ring = buffer + sysconf(_SC_PAGESIZE);
+    uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = meta->data_tail;
+
+    // Records are at most 64K; copy them out so wrapped ones are contiguous
+    static unsigned char record[65536] __attribute__((aligned(8)));
+    while (tail < head) {
+        struct perf_event_header header;
+        for (size_t i = 0; i < sizeof(header); i++) {
+            ((unsigned char *)&header)[i] = ring[(tail + i) % perf->size];
+        }
+        if (header.size < sizeof(header) + sizeof(uint64_t) || tail + header.size > head) {
+            break;
+        }
+        size_t at = tail % perf->size;
+        size_t first = perf->size - at < header.size ? perf->size - at : header.size;
+        memcpy(record, ring + at, first);
+        memcpy(record + first, ring, header.size - first);
+        handle_record(perf->data, record);
+        tail += header.size;
+    }
+    __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Consume every CPU's ring buffer (a process_ready_fn)
+ */
+void profile_perf_drain(void *context, int fd) {
+    profile_perf *perf = context;
+    (void)fd;
+    for (int i = 0; i < perf->count; i++) {
+        drain_buffer(perf, perf->buffers[i]);
+    }
+}
+
+void profile_perf_close(profile_perf *perf) {
+    long page = sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < perf->count; i++) {
+        munmap(perf->buffers[i], perf->size + page);
+        close(perf->fds[i]);
+    }
+    free(perf->fds);
+    free(perf->buffers);
+    perf->fds = NULL;
+    perf->buffers = NULL;
+    perf->count = 0;
+}
+
+#else
+
+int profile_perf_open(profile_perf *perf, profile_data *data, int frequency) {
+    memset(perf, 0, sizeof(*perf));
+    perf->data = data;
+    (void)frequency;
+    errno = ENOSYS;
+    return -1;
+}
+
+void profile_perf_drain(void *context, int fd) {
+    (void)context;
+    (void)fd;
+}
+
+void profile_perf_close(profile_perf *perf) {
+    (void)perf;
+}
+
+#endif
+
+// Parse up to max hex addresses separated by spaces; returns how many
+int profile_parse_frames(const char *text, uint64_t *frames, int max) {
+    int depth = 0;
+    char *end;
+    while (depth < max) {
+        uint64_t address = strtoull(text, &end, 16);
+        if (end == text) {
+            break;
+        }
+        frames[depth++] = address;
+        text = end;
+    }
+    return depth;
+}
+
+/**
+ * Apply one line written by an LD_PRELOAD library
+ *
+ * The records are "E <pid>" (exec), "F <pid> <parent>" (fork),
+ * "M <pid> <line of /proc/pid/maps>" and "S <pid> <hex address>...".
+ *
+ * @return 1 if the line was one of these, 0 otherwise
+ */
+int profile_parse_record(profile_data *data, const char *line, uint64_t time) {
+    char *rest;
+    long pid = strtol(line + 1, &rest, 10);
+    switch (line[0]) {
+    case 'E':
+        profile_add_task(data, pid, 0, time);
+        return 1;
+    case 'F':
+        profile_add_task(data, pid, strtol(rest, NULL, 10), time);
+        return 1;
+    case 'M':
+        profile_add_maps(data, pid, time, rest + strspn(rest, " "));
+        return 1;
+    case 'S': {
+        uint64_t frames[PROFILE_MAX_FRAMES];
+        int depth = profile_parse_frames(rest, frames, PROFILE_MAX_FRAMES);
+        profile_add_sample(data, pid, time, frames, depth);
+        return 1;
+    }
+    }
+    return 0;
+}
+
+/**
+ * Read the samples written by libjc_prof.so
+ *
+ * The file is appended to in order, so line numbers serve as times.
+ *
+ * @return 0 on success, -1 if the file can't be read
+ */
+int profile_load_preload(profile_data *data, const char *path) {
+    char *content = read_file(path);
+    if (!content) {
+        return -1;
+    }
+
+    uint64_t time = 0;
+    char *save = NULL;
+    for (char *line = strtok_r(content, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        profile_parse_record(data, line, ++time);
+    }
+    free(content);
+    return 0;
+}
+
+/**
+ * The mapping of pid containing address at the given time
+ *
+ * Only mappings made since the process last exec'd count; of those, the
+ * latest one made before the time wins, else the first made after it (the
+ * preload sampler writes maps again at exit, for dlopen'd libraries). A
+ * process that forked but hasn't exec'd yet still runs its parent's image.
+ */
+static const profile_map *find_map(const profile_data *data, pid_t pid, uint64_t address, uint64_t time) {
+    for (int hops = 0; hops < 64; hops++) {
+        uint64_t exec_time = 0;
+        uint64_t next_exec = UINT64_MAX;
+        int exec = 0;
+        const profile_task *fork = NULL;
+        for (int i = 0; i < data->task_count; i++) {
+            const profile_task *task = &data->tasks[i];
+            if (task->pid != pid) {
+                continue;
+            }
+            if (task->time > time) {
+                if (task->parent == 0 && task->time < next_exec) {
+                    next_exec = task->time;
+                }
+            } else if (task->parent == 0) {
+                if (!exec || task->time > exec_time) {
+                    exec_time = task->time;
+                }
+                exec = 1;
+            } else if (!fork || task->time > fork->time) {
+                fork = task;
+            }
+        }
+
+        const profile_map *before = NULL;
+        const profile_map *after = NULL;
+        for (int i = 0; i < data->map_count; i++) {
+            const profile_map *map = &data->maps[i];
+            if (map->pid != pid || address < map->start || address >= map->end ||
+                map->time < exec_time || map->time >= next_exec) {
+                continue;
+            }
+            if (map->time <= time) {
+                if (!before || map->time >= before->time) {
+                    before = map;
+                }
+            } else if (!after || map->time < after->time) {
+                after = map;
+            }
+        }
+        if (before || after) {
+            return before ? before : after;
+        }
+        if (exec || !fork) {
+            return NULL;
+        }
+        pid = fork->parent;
+        time = fork->time;
+    }
+    return NULL;
+}
+
+// Symbol tables, loaded once per file
+typedef struct {
+    symbol_file *files;
+    int count;
+} symbol_cache;
+
+static const symbol_file *cached_symbols(symbol_cache *cache, const char *path) {
+    for (int i = 0; i < cache->count; i++) {
+        if (strcmp(cache->files[i].path, path) == 0) {
+            return &cache->files[i];
+        }
+    }
+    cache->files = realloc(cache->files, (cache->count + 1) * sizeof(symbol_file));
+    symbol_file *file = &cache->files[cache->count++];
+    symbols_load(file, path);
+    return file;
+}
+
+// Name a frame: its function, else [library], else [unknown]
+static void frame_name(const profile_data *data, symbol_cache *cache, pid_t pid, uint64_t time,
+                       uint64_t address, char *out, size_t size) {
+    const profile_map *map = find_map(data, pid, address, time);
+    if (!map) {
+        snprintf(out, size, "[unknown]");
+        return;
+    }
+    const char *name = NULL;
+    if (map->path[0] == '/') {
+        name = symbols_lookup(cached_symbols(cache, map->path), address - map->start + map->offset);
+    }
+    if (name) {
+        snprintf(out, size, "%s", name);
+    } else {
+        const char *base = strrchr(map->path, '/');
+        snprintf(out, size, map->path[0] == '[' ? "%s" : "[%s]", base ? base + 1 : map->path);
+    }
+    // ';' separates frames in the folded format
+    for (char *p = out; *p; p++) {
+        if (*p == ';' || *p == ' ') {
+            *p = '_';
+        }
+    }
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Symbolize each sample as a folded call stack, outermost frame first
+ *
+ * Frames after the first are return addresses, so they are looked up one
+ * byte earlier to land inside the calling instruction.
+ *
+ * @return one malloc'd string per sample, in a malloc'd array
+ */
+char **profile_symbolize(const profile_data *data) {
+    symbol_cache cache = {0};
+    char **stacks = malloc((data->sample_count + 1) * sizeof(char *));
+    for (int i = 0; i < data->sample_count; i++) {
+        const profile_sample *sample = &data->samples[i];
+        char *stack = NULL;
+        size_t len = 0;
+        size_t cap = 0;
+        for (int d = sample->depth - 1; d >= 0; d--) {
+            uint64_t address = data->frames[sample->first + d];
+            char name[512];
+            frame_name(data, &cache, sample->pid, sample->time, d > 0 ? address - 1 : address, name, sizeof(name));
+            append_format(&stack, &len, &cap, "%s%s", d == sample->depth - 1 ? "" : ";", name);
+        }
+        stacks[i] = stack;
+    }
+    for (int i = 0; i < cache.count; i++) {
+        symbols_free(&cache.files[i]);
+    }
+    free(cache.files);
+    return stacks;
+}
+
+/**
+ * Symbolize the samples and count identical call stacks
+ */
+void profile_fold(const profile_data *data, folded_set *set) {
+    memset(set, 0, sizeof(*set));
+    if (data->sample_count == 0) {
+        return;
+    }
+
+    char **stacks = profile_symbolize(data);
+    qsort(stacks, data->sample_count, sizeof(char *), compare_strings);
+    set->items = malloc(data->sample_count * sizeof(folded_stack));
+    for (int i = 0; i < data->sample_count; i++) {
+        if (set->count > 0 && strcmp(set->items[set->count - 1].stack, stacks[i]) == 0) {
+            set->items[set->count - 1].count++;
+            free(stacks[i]);
+        } else {
+            set->items[set->count].stack = stacks[i];
+            set->items[set->count].count = 1;
+            set->count++;
+        }
+        set->total++;
+    }
+    free(stacks);
+}
+
+// Write the stacks in Brendan Gregg's folded format ("a;b;c 42")
+int profile_write_folded(const folded_set *set, const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        return -1;
+    }
+    for (int i = 0; i < set->count; i++) {
+        fprintf(out, "%s %ld\n", set->items[i].stack, set->items[i].count);
+    }
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+typedef struct flame_node {
+    char *name;
+    long count;
+    struct flame_node *children;
+    int child_count;
+    int child_capacity;
+} flame_node;
+
+static void flame_insert(flame_node *root, const char *stack, long count) {
+    flame_node *node = root;
+    node->count += count;
+    const char *p = stack;
+    while (*p) {
+        size_t len = strcspn(p, ";");
+        int found = -1;
+        for (int i = 0; i < node->child_count; i++) {
+            if (strlen(node->children[i].name) == len && strncmp(node->children[i].name, p, len) == 0) {
+                found = i;
+                break;
+            }
+        }
+        if (found < 0) {
+            if (node->child_count == node->child_capacity) {
+                node->child_capacity = node->child_capacity ? node->child_capacity * 2 : 4;
+                node->children = realloc(node->children, node->child_capacity * sizeof(flame_node));
+            }
+            found = node->child_count++;
+            memset(&node->children[found], 0, sizeof(flame_node));
+            node->children[found].name = strndup(p, len);
+        }
+        node = &node->children[found];
+        node->count += count;
+        p += len;
+        if (*p == ';') {
+            p++;
+        }
+    }
+}
+
+static int flame_depth(const flame_node *node) {
+    int deepest = 0;
+    for (int i = 0; i < node->child_count; i++) {
+        int depth = flame_depth(&node->children[i]) + 1;
+        if (depth > deepest) {
+            deepest = depth;
+        }
+    }
+    return deepest;
+}
+
+static void flame_free(flame_node *node) {
+    for (int i = 0; i < node->child_count; i++) {
+        flame_free(&node->children[i]);
+    }
+    free(node->children);
+    free(node->name);
+}
+
+static void write_escaped(FILE *out, const char *text, size_t max) {
+    for (size_t i = 0; text[i] && i < max; i++) {
+        switch (text[i]) {
+        case '&': fputs("&amp;", out); break;
+        case '<': fputs("&lt;", out); break;
+        case '>': fputs("&gt;", out); break;
+        case '"': fputs("&quot;", out); break;
+        default: fputc(text[i], out); break;
+        }
+    }
+}
+
+// Warm colors, stable for a given name
+static void flame_color(const char *name, int *r, int *g, int *b) {
+    unsigned long hash = 5381;
+    for (const char *p = name; *p; p++) {
+        hash = hash * 33 + (unsigned char)*p;
+    }
+    *r = 205 + hash % 50;
+    *g = (hash / 50) % 230;
+    *b = (hash / 11500) % 55;
+}
+
+static void flame_render(FILE *out, const flame_node *node, int depth, double x, double scale,
+                         int height, long total, const char *unit) {
+    double width = node->count * scale;
+    if (width < 0.1) {
+        return;
+    }
+    int r, g, b;
+    flame_color(node->name, &r, &g, &b);
+    int y = height - FLAME_PAD - (depth + 1) * FLAME_FRAME;
+
+    fprintf(out, "<g><title>");
+    write_escaped(out, node->name, SIZE_MAX);
+    fprintf(out, " (%ld %s, %.2f%%)</title>", node->count, unit, node->count * 100.0 / total);
+    fprintf(out, "<rect x=\"%.1f\" y=\"%d\" width=\"%.1f\" height=\"%d\" fill=\"rgb(%d,%d,%d)\" rx=\"2\"/>",
+            FLAME_PAD + x, y, width, FLAME_FRAME - 1, r, g, b);
+    size_t fits = (size_t)(width / FLAME_CHAR);
+    if (fits >= 3) {
+        fprintf(out, "<text x=\"%.1f\" y=\"%d\">", FLAME_PAD + x + 3, y + FLAME_FRAME - 4);
+        size_t len = strlen(node->name);
+        write_escaped(out, node->name, len <= fits ? len : fits - 2);
+        fputs(len <= fits ? "" : "..", out);
+        fprintf(out, "</text>");
+    }
+    fprintf(out, "</g>\n");
+
+    for (int i = 0; i < node->child_count; i++) {
+        flame_render(out, &node->children[i], depth + 1, x, scale, height, total, unit);
+        x += node->children[i].count * scale;
+    }
+}
+
+/**
+ * Write a self-contained SVG flame graph of the stacks
+ *
+ * Each box is a function, as wide as the share of samples it was on the
+ * stack for, stacked on its callers; hovering shows the exact counts in
+ * unit ("samples", or "bytes" for a heap profile).
+ */
+int profile_write_flame_graph(const folded_set *set, const char *path, const char *title,
+                              const char *unit) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        return -1;
+    }
+
+    flame_node root = {0};
+    root.name = strdup("all");
+    for (int i = 0; i < set->count; i++) {
+        flame_insert(&root, set->items[i].stack, set->items[i].count);
+    }
+    int height = FLAME_TOP + (flame_depth(&root) + 1) * FLAME_FRAME + 2 * FLAME_PAD;
+    double scale = root.count > 0 ? (FLAME_WIDTH - 2.0 * FLAME_PAD) / root.count : 0;
+
+    fprintf(out, "<?xml version=\"1.0\" standalone=\"no\"?>\n");
+    fprintf(out, "<svg version=\"1.1\" width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\" "
+            "xmlns=\"http://www.w3.org/2000/svg\">\n", FLAME_WIDTH, height, FLAME_WIDTH, height);
+    fprintf(out, "<style>text{font-family:Verdana,sans-serif;font-size:12px;fill:#000;pointer-events:none}"
+            "rect:hover{stroke:#000;stroke-width:0.5}</style>\n");
+    fprintf(out, "<rect width=\"100%%\" height=\"100%%\" fill=\"#f8f8f8\"/>\n");
+    fprintf(out, "<text x=\"%d\" y=\"24\" text-anchor=\"middle\" style=\"font-size:17px\">",
+            FLAME_WIDTH / 2);
+    write_escaped(out, title, SIZE_MAX);
+    fprintf(out, " (%ld %s)</text>\n", set->total, unit);
+    if (root.count > 0) {
+        flame_render(out, &root, 0, 0, scale, height, root.count, unit);
+    }
+    fprintf(out, "</svg>\n");
+    flame_free(&root);
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+typedef struct {
+    const char *name;
+    size_t len;
+    long count;
+} self_count;
+
+static int compare_self(const void *a, const void *b) {
+    long x = ((const self_count *)a)->count;
+    long y = ((const self_count *)b)->count;
+    return (y > x) - (y < x);
+}
+
+// Print the functions most often on top of the stack
+void profile_print_top(const folded_set *set, int limit) {
+    self_count *counts = malloc((set->count + 1) * sizeof(self_count));
+    int distinct = 0;
+    for (int i = 0; i < set->count; i++) {
+        const char *leaf = strrchr(set->items[i].stack, ';');
+        leaf = leaf ? leaf + 1 : set->items[i].stack;
+        size_t len = strlen(leaf);
+        int found = -1;
+        for (int j = 0; j < distinct; j++) {
+            if (counts[j].len == len && strncmp(counts[j].name, leaf, len) == 0) {
+                found = j;
+                break;
+            }
+        }
+        if (found < 0) {
+            found = distinct++;
+            counts[found].name = leaf;
+            counts[found].len = len;
+            counts[found].count = 0;
+        }
+        counts[found].count += set->items[i].count;
+    }
+    qsort(counts, distinct, sizeof(self_count), compare_self);
+
+    printf("%8s %8s  %s\n", "samples", "self", "function");
+    for (int i = 0; i < distinct && i < limit; i++) {
+        printf("%8ld %7.2f%%  %.*s\n", counts[i].count, counts[i].count * 100.0 / set->total,
+               (int)counts[i].len, counts[i].name);
+    }
+    free(counts);
+}
+
+void folded_set_free(folded_set *set) {
+    for (int i = 0; i < set->count; i++) {
+        free(set->items[i].stack);
+    }
+    free(set->items);
+    memset(set, 0, sizeof(*set));
+}
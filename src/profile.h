@@ -0,0 +1,103 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Set in the program's environment for the LD_PRELOAD sampler
+#define PROFILE_FILE_ENV "JC_PROFILE_FILE"
+#define PROFILE_HZ_ENV "JC_PROFILE_HZ"
+
+// Deepest call stack read from a preload library's records
+#define PROFILE_MAX_FRAMES 256
+
+// Records may be read out of order (one ring buffer per CPU), so each
+// carries a time: kernel time for perf, the line number for libjc_prof.so
+
+// An executable mapping of one process
+typedef struct {
+    pid_t pid;
+    uint64_t time;
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;             // file offset of start
+    char *path;
+} profile_map;
+
+// A process starting over with exec (parent 0), or being forked
+typedef struct {
+    pid_t pid;
+    pid_t parent;
+    uint64_t time;
+} profile_task;
+
+// One sample: the interrupted address, then return addresses outward
+typedef struct {
+    pid_t pid;
+    uint64_t time;
+    int depth;
+    size_t first;                // index of the first frame in profile_data.frames
+} profile_sample;
+
+typedef struct {
+    profile_map *maps;
+    int map_count;
+    int map_capacity;
+    profile_task *tasks;
+    int task_count;
+    int task_capacity;
+    profile_sample *samples;
+    int sample_count;
+    int sample_capacity;
+    uint64_t *frames;
+    size_t frame_count;
+    size_t frame_capacity;
+    long long lost;              // samples the kernel dropped
+} profile_data;
+
+// A perf_event_open sampling session: one event and ring buffer per CPU
+typedef struct {
+    int count;
+    int *fds;
+    unsigned char **buffers;
+    size_t size;                 // data bytes per ring buffer
+    int hardware;                // sampling cycles rather than the CPU clock
+    profile_data *data;
+} profile_perf;
+
+// Call stack "outer;...;inner" and how often it was sampled
+typedef struct {
+    char *stack;
+    long count;
+} folded_stack;
+
+typedef struct {
+    folded_stack *items;
+    int count;
+    long total;
+} folded_set;
+
+void profile_add_map(profile_data *data, pid_t pid, uint64_t time, uint64_t start, uint64_t end,
+                     uint64_t offset, const char *path);
+void profile_add_maps(profile_data *data, pid_t pid, uint64_t time, const char *maps);
+void profile_add_sample(profile_data *data, pid_t pid, uint64_t time, const uint64_t *frames, int depth);
+void profile_add_task(profile_data *data, pid_t pid, pid_t parent, uint64_t time);
+void profile_data_free(profile_data *data);
+
+int profile_perf_open(profile_perf *perf, profile_data *data, int frequency);
+void profile_perf_drain(void *perf, int fd);
+void profile_perf_close(profile_perf *perf);
+int profile_parse_frames(const char *text, uint64_t *frames, int max);
+int profile_parse_record(profile_data *data, const char *line, uint64_t time);
+int profile_load_preload(profile_data *data, const char *path);
+
+char **profile_symbolize(const profile_data *data);
+void profile_fold(const profile_data *data, folded_set *set);
+int profile_write_folded(const folded_set *set, const char *path);
+int profile_write_flame_graph(const folded_set *set, const char *path, const char *title,
+                              const char *unit);
+void profile_print_top(const folded_set *set, int limit);
+void folded_set_free(folded_set *set);
+
+#endif // PROFILE_H
@@ -0,0 +1,896 @@
+#define _GNU_SOURCE
+#include "jc.h"
+#include "utils.h"
+#include "build_profile.h"
+#include "makefile_am.h"
+#include "manifest.h"
+#include "process.h"
+#include "runner.h"
+#include "shard.h"
+#include "test_cache.h"
+#include "affected.h"
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// Longest wait for test output before the status line is redrawn
+#define RUNNER_POLL_MS 100
+
+// Set in the environment of a test program built from the jc template,
+// it prints "<suite>\t<tcase>" lines instead of running the tests
+#define LIST_HOOK "JC_TEST_LIST"
+
+// One entry of a directory's TESTS, or one TCase of it
+typedef struct {
+    char *name;
+    char *label;                 // "<dir>/<name>", plus ":<tcase>" for a single case
+    char *log;                   // "<name>.log", or "<name>.<tcase>.log"
+    char path[PATH_MAX * 2];     // absolute, since tests run in their build directory
+    char cwd[PATH_MAX];
+    char srcdir[PATH_MAX + 16];  // "srcdir=<absolute source directory>"
+    char *run_suite;             // "CK_RUN_SUITE=<suite>" for a single case, else NULL
+    char *run_case;              // "CK_RUN_CASE=<tcase>"
+    long long expected_us;       // from the last run
+    int position;                // in TESTS order, to break ties
+    char data_hash[HASH_HEX_SIZE];  // of the directory's data files
+    char key[HASH_HEX_SIZE];     // its result in TEST_CACHE_FILE
+    int cached;                  // passed before with the same key, not run
+    process_job job;
+    int started;
+    int done;
+    const char *verdict;         // PASS, FAIL, SKIP or ERROR
+    char detail[128];            // how it failed
+} runner_test;
+
+typedef struct {
+    runner_test *items;
+    int count;
+    int capacity;
+} runner_suite;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    char **items;
+    int count;
+    int capacity;
+} word_list;
+
+static void words_add(word_list *list, const char *word) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->items = realloc(list->items, list->capacity * sizeof(char *));
+    }
+    list->items[list->count++] = strdup(word);
+}
+
+// Append the words of a Makefile.am variable, references expanded
+static void collect_words(const am_file *am, const char *name, word_list *list) {
+    list->count = am_expand_words(am, name, &list->items, list->count);
+    list->capacity = list->count;
+}
+
+static void words_free(word_list *list) {
+    am_free_words(list->items, list->count);
+    memset(list, 0, sizeof(*list));
+}
+
+/**
+ * Build the check_PROGRAMS of every directory with make
+ *
+ * make only builds what's listed, so the programs of one directory are
+ * built in parallel without running anything.
+ */
+static int build_tests(const char *build_dir, char **dirs, int dir_count, int jobs) {
+    for (int d = 0; d < dir_count; d++) {
+        char am_path[PATH_MAX];
+        join_path(am_path, sizeof(am_path), dirs[d], "Makefile.am");
+        am_file am;
+        if (am_parse(am_path, &am) != 0) {
+            continue;
+        }
+        word_list programs = {0};
+        collect_words(&am, "check_PROGRAMS", &programs);
+
+        arg_list make = {0};
+        char make_dir[PATH_MAX];
+        join_path(make_dir, sizeof(make_dir), build_dir, dirs[d]);
+        args_add(&make, "make");
+        args_add(&make, "-C");
+        args_add(&make, make_dir);
+        args_addf(&make, "-j%d", jobs);
+        for (int i = 0; i < programs.count; i++) {
+            args_add(&make, programs.items[i]);
+        }
+        int listed = programs.count;
+        words_free(&programs);
+        am_free(&am);
+        if (listed == 0) {
+            args_free(&make);
+            continue;
+        }
+
+        process_options options = {0};
+        options.out = PROCESS_PIPE;
+        options.err = PROCESS_MERGE;
+        options.capture = 1;
+        process_result result;
+        int failed = process_run(make.argv, &options, &result) != 0 || process_status(&result) != 0;
+        if (failed) {
+            if (result.output) {
+                fputs(result.output, stderr);
+            }
+            fprintf(stderr, "Error: Building the tests in %s failed\n", make_dir);
+        }
+        process_result_free(&result);
+        args_free(&make);
+        if (failed) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static runner_test *suite_add(runner_suite *suite) {
+    if (suite->count == suite->capacity) {
+        suite->capacity = suite->capacity ? suite->capacity * 2 : 16;
+        suite->items = realloc(suite->items, suite->capacity * sizeof(runner_test));
+    }
+    runner_test *t = &suite->items[suite->count++];
+    memset(t, 0, sizeof(*t));
+    return t;
+}
+
+static void test_free(runner_test *t) {
+    free(t->name);
+    free(t->label);
+    free(t->log);
+    free(t->run_suite);
+    free(t->run_case);
+    process_result_free(&t->job.result);
+}
+
+/**
+ * Hash the data files a directory's tests may read
+ *
+ * These are the check_DATA, dist_check_DATA and EXTRA_DIST of its
+ * Makefile.am, found in the source directory or else the build directory.
+ */
+static void hash_directory_data(const am_file *am, const char *project, const char *build_dir,
+                                const char *dir, char hex[HASH_HEX_SIZE]) {
+    word_list files = {0};
+    collect_words(am, "check_DATA", &files);
+    collect_words(am, "dist_check_DATA", &files);
+    collect_words(am, "EXTRA_DIST", &files);
+    for (int i = 0; i < files.count; i++) {
+        char relative[PATH_MAX];
+        char path[PATH_MAX * 2];
+        join_path(relative, sizeof(relative), dir, files.items[i]);
+        snprintf(path, sizeof(path), "%s/%s", project, relative);
+        if (!file_exists(path) && !directory_exists(path)) {
+            char built[PATH_MAX];
+            join_path(built, sizeof(built), build_dir, relative);
+            snprintf(path, sizeof(path), "%s/%s", project, built);
+        }
+        free(files.items[i]);
+        files.items[i] = strdup(path);
+    }
+    test_cache_hash_data(files.items, files.count, hex);
+    words_free(&files);
+}
+
+static int label_matches(const char *label, const char *program) {
+    size_t len = strlen(program);
+    return strncmp(label, program, len) == 0 && (label[len] == '\0' || label[len] == ':');
+}
+
+// Whether a test program, or every one of its TCases that ran last time, passed
+static int passed_before(const test_cache *cache, const test_times *times, const char *profile,
+                         const char *label) {
+    const char *key = profile ? profile : ".";
+    int ran = 0;
+    for (int i = 0; i < times->count; i++) {
+        const test_time *t = &times->entries[i];
+        if (strcmp(t->profile, key) != 0 || !label_matches(t->label, label)) {
+            continue;
+        }
+        int passed = 0;
+        for (int j = 0; j < cache->count && !passed; j++) {
+            passed = strcmp(cache->entries[j].profile, key) == 0 && strcmp(cache->entries[j].label, t->label) == 0;
+        }
+        if (!passed) {
+            return 0;
+        }
+        ran = 1;
+    }
+    return ran;
+}
+
+/**
+ * Add the TESTS of every directory, each found through the manifest or in the tree
+ *
+ * @param changes When set, only tests that depend on a changed file are added
+ * @param passed Without git, tests that didn't all pass in the last run (times) are added too
+ * @return The number of tests left out because nothing they depend on changed
+ */
+static int collect_tests(runner_suite *suite, const manifest *m, const char *profile, const char *build_dir,
+                         char **dirs, int dir_count, const change_set *changes, const test_cache *passed,
+                         const test_times *times) {
+    int unaffected = 0;
+    char project[PATH_MAX];
+    if (!getcwd(project, sizeof(project))) {
+        snprintf(project, sizeof(project), ".");
+    }
+    for (int d = 0; d < dir_count; d++) {
+        char am_path[PATH_MAX];
+        join_path(am_path, sizeof(am_path), dirs[d], "Makefile.am");
+        am_file am;
+        if (am_parse(am_path, &am) != 0) {
+            continue;
+        }
+        word_list tests = {0};
+        collect_words(&am, "TESTS", &tests);
+        char **words = tests.items;
+        char data_hash[HASH_HEX_SIZE];
+        hash_directory_data(&am, project, build_dir, dirs[d], data_hash);
+        for (int i = 0; i < tests.count; i++) {
+            char label[PATH_MAX];
+            join_path(label, sizeof(label), dirs[d], words[i]);
+            if (changes && !test_affected(changes, build_dir, dirs[d], words[i]) &&
+                (!passed || passed_before(passed, times, profile, label))) {
+                unaffected++;
+                continue;
+            }
+            runner_test *t = suite_add(suite);
+            t->name = strdup(words[i]);
+            t->label = strdup(label);
+            char log[PATH_MAX];
+            snprintf(log, sizeof(log), "%s.log", words[i]);
+            t->log = strdup(log);
+
+            // Programs were built into the build tree; scripts stay in the sources
+            char relative[PATH_MAX];
+            const manifest_entry *entry = manifest_find(m, profile, 1, words[i]);
+            if (entry && strcmp(entry->path, "-") != 0) {
+                snprintf(relative, sizeof(relative), "%s", entry->path);
+            } else {
+                char built[PATH_MAX];
+                join_path(built, sizeof(built), build_dir, label);
+                snprintf(relative, sizeof(relative), "%s", file_exists(built) ? built : label);
+            }
+            char cwd[PATH_MAX];
+            char srcdir[PATH_MAX];
+            join_path(cwd, sizeof(cwd), build_dir, dirs[d]);
+            snprintf(t->path, sizeof(t->path), "%s/%s", project, relative);
+            join_path(t->cwd, sizeof(t->cwd), project, cwd);
+            join_path(srcdir, sizeof(srcdir), project, dirs[d]);
+            snprintf(t->srcdir, sizeof(t->srcdir), "srcdir=%s", srcdir);
+            snprintf(t->data_hash, sizeof(t->data_hash), "%s", data_hash);
+        }
+        words_free(&tests);
+        am_free(&am);
+    }
+    return unaffected;
+}
+
+static void suite_free(runner_suite *suite) {
+    for (int i = 0; i < suite->count; i++) {
+        test_free(&suite->items[i]);
+    }
+    free(suite->items);
+}
+
+// Whether a test program was built from the jc template, which can list its cases
+static int has_list_hook(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || !(st.st_mode & S_IXUSR)) {
+        return 0;
+    }
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    char *image = malloc(st.st_size ? st.st_size : 1);
+    size_t size = fread(image, 1, st.st_size, file);
+    fclose(file);
+    int found = memmem(image, size, LIST_HOOK, strlen(LIST_HOOK)) != NULL;
+    free(image);
+    return found;
+}
+
+// Make a TCase name safe to use in a log file name
+static void log_name(char *output, size_t size, const char *name, const char *suite, const char *tcase) {
+    int len = snprintf(output, size, "%s.%s%s%s", name, suite ? suite : "", suite ? "." : "", tcase);
+    for (int i = strlen(name) + 1; i < len && i < (int)size; i++) {
+        if (!isalnum((unsigned char)output[i]) && output[i] != '-' && output[i] != '.') {
+            output[i] = '_';
+        }
+    }
+    snprintf(output + strlen(output), size - strlen(output), ".log");
+}
+
+// Replace a test by the "<suite>\t<tcase>" lines it listed; returns how many
+static int add_cases(runner_suite *expanded, const runner_test *t, char *listing) {
+    word_list suites = {0};
+    word_list tcases = {0};
+    char *save = NULL;
+    for (char *line = strtok_r(listing, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        char *tab = strchr(line, '\t');
+        if (tab && tab != line && tab[1] != '\0') {
+            *tab = '\0';
+            words_add(&suites, line);
+            words_add(&tcases, tab + 1);
+        }
+    }
+    // The suite is left out of the label when there's only one
+    int several_suites = 0;
+    for (int i = 1; i < suites.count; i++) {
+        several_suites |= strcmp(suites.items[i], suites.items[0]) != 0;
+    }
+
+    for (int i = 0; i < suites.count; i++) {
+        runner_test *u = suite_add(expanded);
+        *u = *t;
+        memset(&u->job, 0, sizeof(u->job));
+        u->name = strdup(t->name);
+        char text[PATH_MAX];
+        if (several_suites) {
+            snprintf(text, sizeof(text), "%s:%s/%s", t->label, suites.items[i], tcases.items[i]);
+        } else {
+            snprintf(text, sizeof(text), "%s:%s", t->label, tcases.items[i]);
+        }
+        u->label = strdup(text);
+        log_name(text, sizeof(text), t->name, several_suites ? suites.items[i] : NULL, tcases.items[i]);
+        u->log = strdup(text);
+        snprintf(text, sizeof(text), "CK_RUN_SUITE=%s", suites.items[i]);
+        u->run_suite = strdup(text);
+        snprintf(text, sizeof(text), "CK_RUN_CASE=%s", tcases.items[i]);
+        u->run_case = strdup(text);
+    }
+    int added = suites.count;
+    words_free(&suites);
+    words_free(&tcases);
+    return added;
+}
+
+/**
+ * Split test programs that can list their TCases into one test per TCase
+ *
+ * Programs generated by 'jc test add' print their suites and TCases when
+ * LIST_HOOK is set; each TCase then runs on its own with CK_RUN_SUITE and
+ * CK_RUN_CASE, so one large program no longer holds up the others. Other
+ * programs and scripts run whole.
+ */
+static void split_cases(runner_suite *suite, int jobs) {
+    process_job *listing = calloc(suite->count, sizeof(process_job));
+    int *listed = calloc(suite->count, sizeof(int));
+    process_job **active = calloc(jobs, sizeof(process_job *));
+    int running = 0;
+
+    for (int next = 0; next < suite->count || running > 0;) {
+        while (running < jobs && next < suite->count) {
+            runner_test *t = &suite->items[next];
+            if (!has_list_hook(t->path)) {
+                next++;
+                continue;
+            }
+            char *const argv[] = {t->path, NULL};
+            char *env[] = {t->srcdir, LIST_HOOK "=1", NULL};
+            process_options options = {0};
+            options.cwd = t->cwd;
+            options.env = env;
+            options.out = PROCESS_PIPE;
+            options.err = PROCESS_DISCARD;
+            options.capture = 1;
+            if (process_start(argv, &options, &listing[next]) == 0) {
+                listed[next] = 1;
+                active[running++] = &listing[next];
+            }
+            next++;
+        }
+        if (running == 0) {
+            break;
+        }
+        process_poll(active, running, RUNNER_POLL_MS);
+        int kept = 0;
+        for (int i = 0; i < running; i++) {
+            if (!active[i]->finished) {
+                active[kept++] = active[i];
+            }
+        }
+        running = kept;
+    }
+
+    runner_suite expanded = {0};
+    for (int i = 0; i < suite->count; i++) {
+        runner_test *t = &suite->items[i];
+        process_result *r = &listing[i].result;
+        if (listed[i] && r->exited && r->exit_code == 0 && r->output &&
+            add_cases(&expanded, t, r->output) > 0) {
+            test_free(t);
+        } else {
+            *suite_add(&expanded) = *t;
+        }
+        process_result_free(r);
+    }
+    free(suite->items);
+    *suite = expanded;
+    free(listing);
+    free(listed);
+    free(active);
+}
+
+// Slowest first, so no long test starts last; unknown ones count as average
+static int compare_expected(const void *a, const void *b) {
+    const runner_test *x = a;
+    const runner_test *y = b;
+    if (x->expected_us != y->expected_us) {
+        return x->expected_us < y->expected_us ? 1 : -1;
+    }
+    return x->position - y->position;
+}
+
+static void plan_order(runner_suite *suite, const test_times *times, const char *profile) {
+    long long known = 0;
+    int known_count = 0;
+    for (int i = 0; i < suite->count; i++) {
+        runner_test *t = &suite->items[i];
+        t->position = i;
+        t->expected_us = test_times_find(times, profile, t->label);
+        if (t->expected_us >= 0) {
+            known += t->expected_us;
+            known_count++;
+        }
+    }
+    for (int i = 0; i < suite->count; i++) {
+        if (suite->items[i].expected_us < 0) {
+            suite->items[i].expected_us = known_count ? known / known_count : 0;
+        }
+    }
+    qsort(suite->items, suite->count, sizeof(runner_test), compare_expected);
+}
+
+static int compare_label(const void *a, const void *b) {
+    const runner_test *x = *(runner_test *const *)a;
+    const runner_test *y = *(runner_test *const *)b;
+    return strcmp(x->label, y->label);
+}
+
+/**
+ * Keep this machine's share of the tests for --shard=index/count
+ *
+ * Every CI machine must compute the same split, so it only depends on what
+ * they all share: the sorted list of test labels and, with --shard-times,
+ * a times file passed explicitly. Without one every test costs the same
+ * and the sorted labels are dealt out in turn. The local .jc/test-times
+ * differs between machines and is never used here.
+ *
+ * @return 0 on success, 1 if the times file can't be read
+ */
+static int keep_shard(runner_suite *suite, const runner_options *options) {
+    test_times times = {0};
+    if (options->shard_times && test_times_load(&times, options->shard_times) != 0) {
+        fprintf(stderr, "Error: Cannot read test times from %s\n", options->shard_times);
+        return 1;
+    }
+
+    runner_test **sorted = malloc(suite->count * sizeof(runner_test *));
+    long long *costs = malloc(suite->count * sizeof(long long));
+    int *assignment = malloc(suite->count * sizeof(int));
+    for (int i = 0; i < suite->count; i++) {
+        sorted[i] = &suite->items[i];
+    }
+    qsort(sorted, suite->count, sizeof(runner_test *), compare_label);
+
+    // Tests missing from the times file count as the average
+    long long known = 0;
+    int known_count = 0;
+    for (int i = 0; i < suite->count; i++) {
+        costs[i] = options->shard_times ? test_times_find(&times, options->profile, sorted[i]->label) : 1;
+        if (costs[i] >= 0) {
+            known += costs[i];
+            known_count++;
+        }
+    }
+    for (int i = 0; i < suite->count; i++) {
+        if (costs[i] < 0) {
+            costs[i] = known_count ? known / known_count : 1;
+        }
+    }
+    shard_assign(costs, suite->count, options->shards, assignment);
+
+    // Drop the other shards' tests, keeping the run order of the rest
+    int *keep = calloc(suite->count, sizeof(int));
+    for (int i = 0; i < suite->count; i++) {
+        keep[sorted[i] - suite->items] = assignment[i] == options->shard - 1;
+    }
+    int kept = 0;
+    for (int i = 0; i < suite->count; i++) {
+        if (keep[i]) {
+            suite->items[kept++] = suite->items[i];
+        } else {
+            test_free(&suite->items[i]);
+        }
+    }
+    suite->count = kept;
+    free(keep);
+    free(sorted);
+    free(costs);
+    free(assignment);
+    test_times_free(&times);
+    return 0;
+}
+
+// Automake's reading of an exit status: 0 passes, 77 skips, 99 is a hard error
+static void classify(runner_test *t) {
+    const process_result *r = &t->job.result;
+    if (r->exited && r->exit_code == 0) {
+        t->verdict = "PASS";
+    } else if (r->exited && r->exit_code == RUNNER_SKIP_STATUS) {
+        t->verdict = "SKIP";
+    } else if (r->exited && r->exit_code == RUNNER_ERROR_STATUS) {
+        t->verdict = "ERROR";
+        process_describe(r, t->detail, sizeof(t->detail));
+    } else {
+        t->verdict = "FAIL";
+        process_describe(r, t->detail, sizeof(t->detail));
+    }
+}
+
+// Report a finished test; failures show the output they buffered
+static void report_test(const runner_test *t) {
+    double seconds = t->job.result.wall_us / 1e6;
+    printf("%s: %s (%.2f s%s%s)\n", t->verdict, t->label, seconds, *t->detail ? ", " : "", t->detail);
+    int failed = strcmp(t->verdict, "FAIL") == 0 || strcmp(t->verdict, "ERROR") == 0;
+    const char *output = t->job.result.output;
+    if (failed && output && *output) {
+        fputs(output, stdout);
+        if (output[strlen(output) - 1] != '\n') {
+            putchar('\n');
+        }
+    }
+}
+
+static int compare_wall_time(const void *a, const void *b) {
+    const runner_test *x = *(runner_test *const *)a;
+    const runner_test *y = *(runner_test *const *)b;
+    if (x->job.result.wall_us != y->job.result.wall_us) {
+        return x->job.result.wall_us < y->job.result.wall_us ? 1 : -1;
+    }
+    return strcmp(x->label, y->label);
+}
+
+/**
+ * Run the TESTS on a pool of workers
+ *
+ * Each test's stdout and stderr go to its own buffer, kept in
+ * <test>.log next to the program as automake does (<test>.<tcase>.log
+ * for a single TCase) and printed when it fails. On a terminal a status line shows the running totals.
+ *
+ * @return The number of tests that failed or hit a hard error
+ */
+static int run_suite(runner_suite *suite, int jobs, double *elapsed) {
+    int live = isatty(STDOUT_FILENO);
+    int running = 0;
+    int finished = 0;
+    int next = 0;
+    int counts[4] = {0};         // passed, failed, skipped, errors
+    for (int i = 0; i < suite->count; i++) {
+        if (suite->items[i].cached) {
+            printf("PASS: %s (cached)\n", suite->items[i].label);
+            finished++;
+            counts[0]++;
+        }
+    }
+    process_job **active = calloc(jobs, sizeof(process_job *));
+    runner_test **owners = calloc(jobs, sizeof(runner_test *));
+    double start = now_seconds();
+
+    struct sigaction handler;
+    struct sigaction saved_int;
+    memset(&handler, 0, sizeof(handler));
+    handler.sa_handler = on_interrupt;
+    sigaction(SIGINT, &handler, &saved_int);
+    interrupted = 0;
+
+    while (finished < suite->count) {
+        while (running < jobs && next < suite->count && !interrupted) {
+            runner_test *t = &suite->items[next++];
+            if (t->cached) {
+                continue;
+            }
+            char *const argv[] = {t->path, NULL};
+            char *env[] = {t->srcdir, t->run_suite, t->run_case, NULL};
+            process_options options = {0};
+            options.cwd = t->cwd;
+            options.env = env;
+            options.out = PROCESS_PIPE;
+            options.err = PROCESS_MERGE;
+            options.capture = 1;
+            t->started = 1;
+            if (process_start(argv, &options, &t->job) != 0) {
+                t->verdict = "ERROR";
+                snprintf(t->detail, sizeof(t->detail), "%s", strerror(errno));
+                t->done = 1;
+                finished++;
+                counts[3]++;
+                if (live) {
+                    printf("\r\033[K");
+                }
+                report_test(t);
+                continue;
+            }
+            for (int slot = 0; slot < jobs; slot++) {
+                if (!active[slot]) {
+                    active[slot] = &t->job;
+                    owners[slot] = t;
+                    break;
+                }
+            }
+            running++;
+        }
+        if (running == 0) {
+            // Interrupted before the rest started, or all of them cached
+            break;
+        }
+
+        process_job *polled[jobs];
+        int polled_count = 0;
+        for (int slot = 0; slot < jobs; slot++) {
+            if (active[slot]) {
+                polled[polled_count++] = active[slot];
+            }
+        }
+        process_poll(polled, polled_count, RUNNER_POLL_MS);
+
+        for (int slot = 0; slot < jobs; slot++) {
+            if (!active[slot] || !active[slot]->finished) {
+                continue;
+            }
+            runner_test *t = owners[slot];
+            active[slot] = NULL;
+            owners[slot] = NULL;
+            running--;
+            finished++;
+            t->done = 1;
+            classify(t);
+            counts[strcmp(t->verdict, "PASS") == 0   ? 0
+                   : strcmp(t->verdict, "FAIL") == 0 ? 1
+                   : strcmp(t->verdict, "SKIP") == 0 ? 2
+                                                     : 3]++;
+            char log_path[PATH_MAX * 2];
+            snprintf(log_path, sizeof(log_path), "%s/%s", t->cwd, t->log);
+            write_file(log_path, t->job.result.output ? t->job.result.output : "");
+            if (live) {
+                printf("\r\033[K");
+            }
+            report_test(t);
+        }
+
+        if (live) {
+            printf("\r\033[K[%d/%d] %d passed, %d failed, %d running", finished, suite->count,
+                   counts[0] + counts[2], counts[1] + counts[3], running);
+        }
+        fflush(stdout);
+    }
+    if (live) {
+        printf("\r\033[K");
+    }
+    sigaction(SIGINT, &saved_int, NULL);
+    free(active);
+    free(owners);
+    *elapsed = now_seconds() - start;
+    return counts[1] + counts[3];
+}
+
+// Final summary: every test that ran, with its wall time, slowest first
+static void print_summary(runner_suite *suite, int jobs, double elapsed) {
+    runner_test **order = malloc(suite->count * sizeof(runner_test *));
+    int shown = 0;
+    int cached = 0;
+    int not_run = 0;
+    int counts[4] = {0};
+    double busy = 0;
+    for (int i = 0; i < suite->count; i++) {
+        runner_test *t = &suite->items[i];
+        if (!t->done) {
+            not_run++;
+            continue;
+        }
+        counts[strcmp(t->verdict, "PASS") == 0   ? 0
+               : strcmp(t->verdict, "FAIL") == 0 ? 1
+               : strcmp(t->verdict, "SKIP") == 0 ? 2
+                                                 : 3]++;
+        if (t->cached) {
+            cached++;
+            continue;
+        }
+        order[shown++] = t;
+        busy += t->job.result.wall_us / 1e6;
+    }
+    qsort(order, shown, sizeof(runner_test *), compare_wall_time);
+
+    if (shown > 0) {
+        printf("\n%-6s %9s  %s\n", "", "wall", "test");
+    }
+    for (int i = 0; i < shown; i++) {
+        printf("%-6s %7.2f s  %s\n", order[i]->verdict, order[i]->job.result.wall_us / 1e6, order[i]->label);
+    }
+    printf("\n%d passed", counts[0]);
+    if (cached > 0) {
+        printf(" (%d cached)", cached);
+    }
+    printf(", %d failed, %d skipped, %d errors", counts[1], counts[2], counts[3]);
+    if (not_run > 0) {
+        printf(", %d not run", not_run);
+    }
+    printf(" in %.2f s (%.2f s of tests, -j%d)\n", elapsed, busy, jobs);
+    free(order);
+}
+
+/**
+ * Build and run the whole test suite, as 'make check' would, in parallel
+ *
+ * The project is brought up to date first, then the check_PROGRAMS of
+ * each directory are built with make -jN, and the TESTS of each directory
+ * run on N workers, split into TCases where the programs allow it and
+ * slowest first by the times of the last run. Tests that passed before
+ * with the same program, libraries, environment and data are reported as
+ * cached instead of being run, unless no_cache is set.
+ *
+ * @return 0 if every test passed or was skipped, 1 otherwise
+ */
+int runner_run(const runner_options *options) {
+    if (ensure_built(options->profile) != 0) {
+        return 1;
+    }
+
+    char build_dir[PATH_MAX];
+    profile_build_dir(options->profile, build_dir, sizeof(build_dir));
+    char **dirs;
+    int dir_count = am_project_dirs(&dirs);
+
+    printf("Building tests...\n");
+    fflush(stdout);
+    if (build_tests(build_dir, dirs, dir_count, options->jobs) != 0) {
+        am_free_words(dirs, dir_count);
+        return 1;
+    }
+    manifest_update(options->profile, build_dir);
+
+    change_set changes = {0};
+    char changes_source[PATH_MAX + 64];
+    if (options->affected &&
+        change_set_load(&changes, options->affected_rev, TEST_TIMES_FILE, changes_source,
+                        sizeof(changes_source)) != 0) {
+        fprintf(stderr, "Error: Can't compare with '%s' (git diff failed)\n", options->affected_rev);
+        am_free_words(dirs, dir_count);
+        return 1;
+    }
+
+    // Modification times can't tell a failed test from one that passed; run it again
+    test_cache passed = {0};
+    test_times last_run = {0};
+    int by_time = options->affected && !changes.from_git;
+    if (by_time) {
+        test_cache_load(&passed, TEST_CACHE_FILE);
+        test_times_load(&last_run, TEST_TIMES_FILE);
+    }
+
+    manifest m;
+    manifest_load(&m, MANIFEST_FILE);
+    runner_suite suite = {0};
+    int unaffected = collect_tests(&suite, &m, options->profile, build_dir, dirs, dir_count,
+                                   options->affected ? &changes : NULL, by_time ? &passed : NULL, &last_run);
+    manifest_free(&m);
+    am_free_words(dirs, dir_count);
+    test_cache_free(&passed);
+    test_times_free(&last_run);
+    if (options->affected) {
+        printf("Affected: %d of %d tests (%s)\n", suite.count, suite.count + unaffected, changes_source);
+        change_set_free(&changes);
+        if (suite.count == 0) {
+            printf("✓ No tests affected\n");
+            return 0;
+        }
+    }
+
+    if (suite.count == 0) {
+        printf("No tests to run (no TESTS in the Makefile.am files)\n");
+        suite_free(&suite);
+        return 0;
+    }
+
+    split_cases(&suite, options->jobs);
+    test_times times;
+    test_times_load(&times, TEST_TIMES_FILE);
+    plan_order(&suite, &times, options->profile);
+    if (options->shards > 0) {
+        int total = suite.count;
+        if (keep_shard(&suite, options) != 0) {
+            test_times_free(&times);
+            suite_free(&suite);
+            return 1;
+        }
+        printf("Shard %d/%d: %d of %d tests\n", options->shard, options->shards, suite.count, total);
+        if (suite.count == 0) {
+            test_times_free(&times);
+            suite_free(&suite);
+            return 0;
+        }
+    }
+
+    // Tests that passed last time with the same inputs aren't run again
+    test_cache cache;
+    test_cache_load(&cache, TEST_CACHE_FILE);
+    int cached = 0;
+    for (int i = 0; i < suite.count; i++) {
+        runner_test *t = &suite.items[i];
+        char *env[] = {t->srcdir, t->run_suite, t->run_case, NULL};
+        test_cache_key(&cache, t->path, env, t->data_hash, t->key);
+        if (!options->no_cache && test_cache_hit(&cache, options->profile, t->label, t->key)) {
+            t->cached = 1;
+            t->done = 1;
+            t->verdict = "PASS";
+            cached++;
+        }
+    }
+
+    int to_run = suite.count - cached;
+    int jobs = options->jobs < to_run ? options->jobs : to_run;
+    printf("Running %d test%s with %d worker%s", to_run, to_run == 1 ? "" : "s", jobs, jobs == 1 ? "" : "s");
+    if (cached > 0) {
+        printf(" (%d cached)", cached);
+    }
+    printf("...\n\n");
+    fflush(stdout);
+
+    double elapsed;
+    int failed = run_suite(&suite, jobs > 0 ? jobs : 1, &elapsed);
+    print_summary(&suite, options->jobs, elapsed);
+    int incomplete = interrupted;
+
+    // Tests cut short by Ctrl-C would skew the next split
+    if (!incomplete) {
+        for (int i = 0; i < suite.count; i++) {
+            runner_test *t = &suite.items[i];
+            if (!t->job.finished) {
+                continue;
+            }
+            test_times_set(&times, options->profile, t->label, t->job.result.wall_us);
+            if (strcmp(t->verdict, "PASS") == 0) {
+                test_cache_store(&cache, options->profile, t->label, t->key);
+            } else {
+                test_cache_forget(&cache, options->profile, t->label);
+            }
+        }
+        create_directory(".jc");
+        test_times_save(&times, TEST_TIMES_FILE);
+        test_cache_save(&cache, TEST_CACHE_FILE);
+    }
+    test_cache_free(&cache);
+    test_times_free(&times);
+    suite_free(&suite);
+    if (incomplete) {
+        fprintf(stderr, "Error: Interrupted\n");
+        return 130;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,22 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+// Automake's exit codes for a skipped test and a hard error
+#define RUNNER_SKIP_STATUS 77
+#define RUNNER_ERROR_STATUS 99
+
+// How 'jc test run' builds and runs the whole test suite
+typedef struct {
+    const char *profile;         // NULL for the in-tree build
+    int jobs;                    // builds and tests at once
+    int shard;                   // with shards, run only this share (1-based)
+    int shards;                  // 0 runs every test
+    const char *shard_times;     // times file to balance the shards by, or NULL
+    int no_cache;                // run tests even if they passed with the same inputs
+    int affected;                // only tests that depend on changed files
+    const char *affected_rev;    // changed since this git revision, NULL for HEAD
+} runner_options;
+
+int runner_run(const runner_options *options);
+
+#endif // RUNNER_H
@@ -0,0 +1,146 @@
+#include "jc.h"
+#include "utils.h"
+#include "shard.h"
+
+static void add_time(test_times *times, const char *profile, const char *label, long long wall_us) {
+    if (times->count == times->capacity) {
+        times->capacity = times->capacity ? times->capacity * 2 : 32;
+        times->entries = realloc(times->entries, times->capacity * sizeof(test_time));
+    }
+    test_time *t = &times->entries[times->count++];
+    t->profile = strdup(profile);
+    t->label = strdup(label);
+    t->wall_us = wall_us;
+}
+
+/**
+ * Read the test times written by test_times_save
+ *
+ * Each line is "<profile> <wall us> <label>"; the label is last because
+ * TCase names may contain spaces.
+ *
+ * @return 0 on success, -1 if the file can't be read
+ */
+int test_times_load(test_times *times, const char *path) {
+    memset(times, 0, sizeof(*times));
+    char *content = read_file(path);
+    if (!content) {
+        return -1;
+    }
+
+    char *save = NULL;
+    for (char *line = strtok_r(content, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        char profile[256];
+        long long wall_us;
+        int offset = 0;
+        if (line[0] == '#' || sscanf(line, "%255s %lld %n", profile, &wall_us, &offset) != 2 ||
+            offset == 0 || line[offset] == '\0') {
+            continue;
+        }
+        add_time(times, profile, line + offset, wall_us);
+    }
+    free(content);
+    return 0;
+}
+
+int test_times_save(const test_times *times, const char *path) {
+    char *content = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    append_format(&content, &len, &cap, "# Written by 'jc test run': <profile> <wall us> <test>\n");
+    for (int i = 0; i < times->count; i++) {
+        const test_time *t = &times->entries[i];
+        append_format(&content, &len, &cap, "%s %lld %s\n", t->profile, t->wall_us, t->label);
+    }
+    int result = write_file(path, content);
+    free(content);
+    return result;
+}
+
+// The last wall time of a test under a profile (NULL in-tree), or -1 if it never ran
+long long test_times_find(const test_times *times, const char *profile, const char *label) {
+    const char *key = profile ? profile : ".";
+    for (int i = 0; i < times->count; i++) {
+        if (strcmp(times->entries[i].profile, key) == 0 && strcmp(times->entries[i].label, label) == 0) {
+            return times->entries[i].wall_us;
+        }
+    }
+    return -1;
+}
+
+void test_times_set(test_times *times, const char *profile, const char *label, long long wall_us) {
+    const char *key = profile ? profile : ".";
+    for (int i = 0; i < times->count; i++) {
+        if (strcmp(times->entries[i].profile, key) == 0 && strcmp(times->entries[i].label, label) == 0) {
+            times->entries[i].wall_us = wall_us;
+            return;
+        }
+    }
+    add_time(times, key, label, wall_us);
+}
+
+void test_times_free(test_times *times) {
+    for (int i = 0; i < times->count; i++) {
+        free(times->entries[i].profile);
+        free(times->entries[i].label);
+    }
+    free(times->entries);
+    memset(times, 0, sizeof(*times));
+}
+
+// Parse "--shard" values of the form "i/n", 1 <= i <= n
+int shard_parse(const char *value, int *index, int *count) {
+    char *end;
+    long i = strtol(value, &end, 10);
+    if (end == value || *end != '/') {
+        return -1;
+    }
+    const char *rest = end + 1;
+    long n = strtol(rest, &end, 10);
+    if (end == rest || *end != '\0' || n < 1 || n > 4096 || i < 1 || i > n) {
+        return -1;
+    }
+    *index = (int)i;
+    *count = (int)n;
+    return 0;
+}
+
+/**
+ * Split tests into shards of about equal total time
+ *
+ * Longest processing time first: each test, slowest first, goes to the
+ * shard with the least time so far. Ties keep the input order, so every
+ * machine given the same tests and times computes the same split.
+ *
+ * @param costs Expected time of each test
+ * @param assignment Receives the shard (0-based) of each test
+ */
+void shard_assign(const long long *costs, int count, int shards, int *assignment) {
+    int *order = malloc(count * sizeof(int));
+    long long *load = calloc(shards, sizeof(long long));
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    // Insertion sort keeps equal costs in input order
+    for (int i = 1; i < count; i++) {
+        int current = order[i];
+        int j = i;
+        while (j > 0 && costs[order[j - 1]] < costs[current]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = current;
+    }
+    for (int i = 0; i < count; i++) {
+        int lightest = 0;
+        for (int s = 1; s < shards; s++) {
+            if (load[s] < load[lightest]) {
+                lightest = s;
+            }
+        }
+        assignment[order[i]] = lightest;
+        load[lightest] += costs[order[i]];
+    }
+    free(order);
+    free(load);
+}
@@ -0,0 +1,29 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+// How long each test took last time, for every build profile
+#define TEST_TIMES_FILE ".jc/test-times"
+
+// One test (or test case) and its last wall time
+typedef struct {
+    char *profile;               // "." for the in-tree build
+    char *label;                 // e.g. "tests/test_utils:Core"
+    long long wall_us;
+} test_time;
+
+typedef struct {
+    test_time *entries;
+    int count;
+    int capacity;
+} test_times;
+
+int test_times_load(test_times *times, const char *path);
+int test_times_save(const test_times *times, const char *path);
+long long test_times_find(const test_times *times, const char *profile, const char *label);
+void test_times_set(test_times *times, const char *profile, const char *label, long long wall_us);
+void test_times_free(test_times *times);
+
+int shard_parse(const char *value, int *index, int *count);
+void shard_assign(const long long *costs, int count, int shards, int *assignment);
+
+#endif // SHARD_H
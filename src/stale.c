@@ -0,0 +1,358 @@
+#include "jc.h"
+#include "utils.h"
+#include "makefile_am.h"
+#include "manifest.h"
+#include "stale.h"
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// Modification times already looked up; most headers appear in every depfile
+typedef struct {
+    char *path;
+    long long mtime;             // ns, -1 if the file is missing
+} mtime_slot;
+
+typedef struct {
+    mtime_slot *slots;
+    size_t capacity;             // a power of two
+    size_t count;
+} mtime_cache;
+
+static long long file_mtime(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+    return (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+static uint64_t hash_path(const char *path) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h = (h ^ *p) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static long long cached_mtime(mtime_cache *cache, const char *path) {
+    if (cache->count * 2 >= cache->capacity) {
+        size_t capacity = cache->capacity ? cache->capacity * 2 : 1024;
+        mtime_slot *slots = calloc(capacity, sizeof(mtime_slot));
+        for (size_t i = 0; i < cache->capacity; i++) {
+            if (!cache->slots[i].path) {
+                continue;
+            }
+            size_t j = hash_path(cache->slots[i].path) & (capacity - 1);
+            while (slots[j].path) {
+                j = (j + 1) & (capacity - 1);
+            }
+            slots[j] = cache->slots[i];
+        }
+        free(cache->slots);
+        cache->slots = slots;
+        cache->capacity = capacity;
+    }
+
+    size_t i = hash_path(path) & (cache->capacity - 1);
+    while (cache->slots[i].path) {
+        if (strcmp(cache->slots[i].path, path) == 0) {
+            return cache->slots[i].mtime;
+        }
+        i = (i + 1) & (cache->capacity - 1);
+    }
+    cache->slots[i].path = strdup(path);
+    cache->slots[i].mtime = file_mtime(path);
+    cache->count++;
+    return cache->slots[i].mtime;
+}
+
+static void mtime_cache_free(mtime_cache *cache) {
+    for (size_t i = 0; i < cache->capacity; i++) {
+        free(cache->slots[i].path);
+    }
+    free(cache->slots);
+}
+
+/**
+ * Read the prerequisites of an automake depfile (.deps/<object>.Po)
+ *
+ * Only the first rule counts: "target.o: dep dep \<newline> dep ...".
+ * Paths are as the compiler wrote them, relative to where it ran.
+ *
+ * @return The number of prerequisites, or -1 if the depfile can't be read
+ *         or has no rule yet ("# dummy" before the first compile)
+ */
+int depfile_read(const char *po_path, char ***prerequisites) {
+    *prerequisites = NULL;
+    char *content = read_file(po_path);
+    if (!content) {
+        return -1;
+    }
+
+    char *p = strchr(content, ':');
+    if (!p || content[0] == '#') {
+        free(content);
+        return -1;
+    }
+    p++;
+    int count = 0;
+    while (*p && *p != '\n') {
+        if (*p == ' ' || *p == '\t' || (*p == '\\' && p[1] == '\n')) {
+            p += *p == '\\' ? 2 : 1;
+            continue;
+        }
+        char *start = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\n' && !(*p == '\\' && p[1] == '\n')) {
+            p++;
+        }
+        *prerequisites = realloc(*prerequisites, (count + 1) * sizeof(char *));
+        (*prerequisites)[count++] = strndup(start, p - start);
+    }
+    free(content);
+    return count;
+}
+
+/**
+ * Compare the prerequisites in one depfile with a program
+ *
+ * @param dir The directory the compiler ran in, which depfile paths are relative to
+ * @param built When the program was linked (ns)
+ * @return 1 if a prerequisite changed or is gone, 0 if not, -1 if the
+ *         depfile has no rule yet
+ */
+static int check_depfile(const char *po_path, const char *dir, long long built, mtime_cache *cache,
+                         char *reason, size_t reason_size) {
+    char **prerequisites;
+    int count = depfile_read(po_path, &prerequisites);
+    if (count < 0) {
+        return -1;
+    }
+
+    int result = 0;
+    for (int i = 0; i < count && result == 0; i++) {
+        char path[PATH_MAX * 2];
+        if (prerequisites[i][0] == '/' || strcmp(dir, ".") == 0) {
+            snprintf(path, sizeof(path), "%s", prerequisites[i]);
+        } else {
+            snprintf(path, sizeof(path), "%s/%s", dir, prerequisites[i]);
+        }
+        long long mtime = cached_mtime(cache, path);
+        if (mtime < 0 || mtime > built) {
+            char shown[PATH_MAX];
+            clean_path(path, shown, sizeof(shown));
+            snprintf(reason, reason_size, "%s %s since the last build", shown,
+                     mtime < 0 ? "was removed" : "changed");
+            result = 1;
+        }
+    }
+    am_free_words(prerequisites, count);
+    return result;
+}
+
+// When the manifest's program was linked (ns), or -1 if it hasn't been
+static long long program_mtime(const manifest *m, const char *profile, const char *name) {
+    const manifest_entry *entry = manifest_find(m, profile, 0, name);
+    if (!entry || strcmp(entry->path, "-") == 0) {
+        return -1;
+    }
+    return file_mtime(entry->path);
+}
+
+// Whether a depfile name starts with "<canonical program name>-"
+static int depfile_of(const char *depfile, char **programs, int count, char *matched, size_t size) {
+    for (int i = 0; i < count; i++) {
+        char canonical[256];
+        am_canonical_name(programs[i], canonical, sizeof(canonical));
+        size_t len = strlen(canonical);
+        if (strncmp(depfile, canonical, len) == 0 && depfile[len] == '-') {
+            snprintf(matched, size, "%s", programs[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Append the program names of a _PROGRAMS value, leaving out make variables
+static int add_programs(char ***list, int count, const char *value) {
+    char **words = NULL;
+    int word_count = value ? am_split_words(value, &words) : 0;
+    for (int i = 0; i < word_count; i++) {
+        if (strchr(words[i], '$')) {
+            free(words[i]);
+            continue;
+        }
+        *list = realloc(*list, (count + 1) * sizeof(char *));
+        (*list)[count++] = words[i];
+    }
+    free(words);
+    return count;
+}
+
+/**
+ * Check one Makefile.am directory of the build against its depfiles
+ *
+ * Each depfile belongs to the program its name starts with (automake
+ * prefixes objects built with per-program flags); otherwise it's compared
+ * with the newest program of the directory, or of the whole build for
+ * directories that only hold libraries. Depfiles of check programs are
+ * skipped, since building doesn't rebuild tests.
+ */
+static int check_directory(const manifest *m, const char *profile, const char *build_dir, const char *subdir,
+                           long long newest, mtime_cache *cache, char *reason, size_t reason_size) {
+    char am_path[PATH_MAX];
+    if (strcmp(subdir, ".") == 0) {
+        snprintf(am_path, sizeof(am_path), "Makefile.am");
+    } else {
+        snprintf(am_path, sizeof(am_path), "%s/Makefile.am", subdir);
+    }
+    am_file am;
+    if (am_parse(am_path, &am) != 0) {
+        return 0;
+    }
+
+    char dir[PATH_MAX];
+    if (strcmp(build_dir, ".") == 0) {
+        snprintf(dir, sizeof(dir), "%s", subdir);
+    } else if (strcmp(subdir, ".") == 0) {
+        snprintf(dir, sizeof(dir), "%s", build_dir);
+    } else {
+        snprintf(dir, sizeof(dir), "%s/%s", build_dir, subdir);
+    }
+
+    // The generated Makefile must be newer than its Makefile.am
+    char makefile[PATH_MAX + 16];
+    snprintf(makefile, sizeof(makefile), "%s/Makefile", dir);
+    if (file_mtime(am_path) > file_mtime(makefile)) {
+        snprintf(reason, reason_size, "%s changed since the last build", am_path);
+        am_free(&am);
+        return 1;
+    }
+
+    char **programs = NULL;
+    char **checks = NULL;
+    int program_count = add_programs(&programs, 0, am_get(&am, "bin_PROGRAMS"));
+    program_count = add_programs(&programs, program_count, am_get(&am, "noinst_PROGRAMS"));
+    int check_count = add_programs(&checks, 0, am_get(&am, "check_PROGRAMS"));
+    int has_libraries = 0;
+    for (int i = 0; i < am.count; i++) {
+        const char *name = am.vars[i].name;
+        size_t len = strlen(name);
+        if (strncmp(name, "check_", 6) != 0 &&
+            ((len > 10 && strcmp(name + len - 10, "_LIBRARIES") == 0) ||
+             (len > 12 && strcmp(name + len - 12, "_LTLIBRARIES") == 0))) {
+            has_libraries = 1;
+        }
+    }
+    am_free(&am);
+
+    int result = 0;
+    long long dir_newest = -1;
+    for (int i = 0; i < program_count && result == 0; i++) {
+        long long mtime = program_mtime(m, profile, programs[i]);
+        if (mtime < 0) {
+            snprintf(reason, reason_size, "%s has not been built", programs[i]);
+            result = 1;
+        } else if (mtime > dir_newest) {
+            dir_newest = mtime;
+        }
+    }
+
+    char deps_dir[PATH_MAX + 16];
+    snprintf(deps_dir, sizeof(deps_dir), "%s/.deps", dir);
+    DIR *d = (result == 0 && (program_count > 0 || has_libraries)) ? opendir(deps_dir) : NULL;
+    int checked = 0;
+    struct dirent *entry;
+    while (d && result == 0 && (entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        char owner[256];
+        if (len < 4 || strcmp(entry->d_name + len - 3, ".Po") != 0 ||
+            depfile_of(entry->d_name, checks, check_count, owner, sizeof(owner))) {
+            continue;
+        }
+        long long built = program_count ? dir_newest : newest;
+        if (depfile_of(entry->d_name, programs, program_count, owner, sizeof(owner))) {
+            built = program_mtime(m, profile, owner);
+        }
+        char po_path[PATH_MAX * 2];
+        snprintf(po_path, sizeof(po_path), "%s/%s", deps_dir, entry->d_name);
+        int status = check_depfile(po_path, dir, built, cache, reason, reason_size);
+        if (status >= 0) {
+            checked = 1;
+            result = status;
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+
+    // The ninja backend keeps dependencies in its own log, so there's
+    // nothing to compare with; the build itself decides then
+    if (result == 0 && program_count > 0 && !checked) {
+        snprintf(reason, reason_size, "no dependency information for %s", dir);
+        result = 1;
+    }
+
+    am_free_words(programs, program_count);
+    am_free_words(checks, check_count);
+    return result;
+}
+
+/**
+ * Decide whether a profile's programs are out of date, without running make
+ *
+ * Programs come from the manifest of the last build. Sources and headers
+ * listed in the depfiles that build left behind must be older than the
+ * program they were linked into, and the build system's inputs older than
+ * what was generated from them.
+ *
+ * @param profile The build profile, NULL for the in-tree build
+ * @param build_dir Where that profile builds ("." in-tree)
+ * @param reason Receives why a build is needed
+ * @return 1 if a build is needed, 0 if the programs are current
+ */
+int stale_check(const char *profile, const char *build_dir, char *reason, size_t reason_size) {
+    manifest m;
+    if (manifest_load(&m, MANIFEST_FILE) != 0 || !manifest_find(&m, profile, 0, NULL)) {
+        snprintf(reason, reason_size, "no build manifest yet");
+        manifest_free(&m);
+        return 1;
+    }
+
+    char config_status[PATH_MAX + 16];
+    snprintf(config_status, sizeof(config_status), "%s/config.status", build_dir);
+    long long configure = file_mtime("configure");
+    if (file_mtime("configure.ac") > configure || configure > file_mtime(config_status)) {
+        snprintf(reason, reason_size, "configure.ac changed since the last build");
+        manifest_free(&m);
+        return 1;
+    }
+
+    // Library objects are compared with the newest program: if even that
+    // one is older, no program has linked them yet
+    long long newest = -1;
+    const char *key = profile ? profile : ".";
+    for (int i = 0; i < m.count; i++) {
+        const manifest_entry *e = &m.entries[i];
+        if (strcmp(e->profile, key) == 0 && strcmp(e->kind, "check") != 0 && strcmp(e->path, "-") != 0) {
+            long long mtime = file_mtime(e->path);
+            newest = mtime > newest ? mtime : newest;
+        }
+    }
+
+    mtime_cache cache = {0};
+    char **dirs;
+    int count = am_project_dirs(&dirs);
+    int result = 0;
+    for (int i = 0; i < count && result == 0; i++) {
+        result = check_directory(&m, profile, build_dir, dirs[i], newest, &cache, reason, reason_size);
+    }
+    am_free_words(dirs, count);
+    mtime_cache_free(&cache);
+    manifest_free(&m);
+    return result;
+}
@@ -0,0 +1,9 @@
+#ifndef STALE_H
+#define STALE_H
+
+#include <stddef.h>
+
+int depfile_read(const char *po_path, char ***prerequisites);
+int stale_check(const char *profile, const char *build_dir, char *reason, size_t reason_size);
+
+#endif // STALE_H
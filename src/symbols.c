@@ -0,0 +1,349 @@
+#include "jc.h"
+#include "utils.h"
+#include "symbols.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <elf.h>
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// Separate debug files installed by -dbg/-debuginfo packages
+#define DEBUG_DIR "/usr/lib/debug/.build-id"
+
+static int compare_symbols(const void *a, const void *b) {
+    const elf_symbol *x = a;
+    const elf_symbol *y = b;
+    if (x->address != y->address) {
+        return x->address < y->address ? -1 : 1;
+    }
+    // Prefer the alias that knows its size
+    return (y->size > 0) - (x->size > 0);
+}
+
+#ifdef __linux__
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+} elf_image;
+
+static int map_file(const char *path, elf_image *image) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    image->data = data;
+    image->size = st.st_size;
+
+    const Elf64_Ehdr *eh = data;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh->e_shoff > image->size || eh->e_shnum > (image->size - eh->e_shoff) / sizeof(Elf64_Shdr) ||
+        eh->e_phoff > image->size || eh->e_phnum > (image->size - eh->e_phoff) / sizeof(Elf64_Phdr)) {
+        munmap(data, image->size);
+        return -1;
+    }
+    return 0;
+}
+
+static const Elf64_Shdr *section(const elf_image *image, int index) {
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)image->data;
+    return (const Elf64_Shdr *)(image->data + eh->e_shoff) + index;
+}
+
+// Add the function symbols of every section of the given type
+static int add_symbols(symbol_file *file, const elf_image *image, uint32_t type) {
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)image->data;
+    int found = 0;
+    for (int i = 0; i < eh->e_shnum; i++) {
+        const Elf64_Shdr *sh = section(image, i);
+        if (sh->sh_type != type || sh->sh_link >= eh->e_shnum || sh->sh_offset > image->size ||
+            sh->sh_size > image->size - sh->sh_offset) {
+            continue;
+        }
+        const Elf64_Shdr *strtab = section(image, sh->sh_link);
+        if (strtab->sh_offset > image->size || strtab->sh_size > image->size - strtab->sh_offset) {
+            continue;
+        }
+        const char *names = (const char *)image->data + strtab->sh_offset;
+        const Elf64_Sym *syms = (const Elf64_Sym *)(image->data + sh->sh_offset);
+        size_t count = sh->sh_size / sizeof(Elf64_Sym);
+        found = 1;
+
+        for (size_t j = 0; j < count; j++) {
+            int kind = ELF64_ST_TYPE(syms[j].st_info);
+            if ((kind != STT_FUNC && kind != STT_GNU_IFUNC) || syms[j].st_shndx == SHN_UNDEF ||
+                syms[j].st_value == 0 || syms[j].st_name >= strtab->sh_size) {
+                continue;
+            }
+            file->symbols = realloc(file->symbols, (file->count + 1) * sizeof(elf_symbol));
+            elf_symbol *symbol = &file->symbols[file->count++];
+            symbol->address = syms[j].st_value;
+            symbol->size = syms[j].st_size;
+            symbol->name = strndup(names + syms[j].st_name, strtab->sh_size - syms[j].st_name);
+        }
+    }
+    return found;
+}
+
+// The GNU build ID note of an ELF file, if it has one
+static const unsigned char *find_build_id(const elf_image *image, uint32_t *length) {
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)image->data;
+    const Elf64_Phdr *ph = (const Elf64_Phdr *)(image->data + eh->e_phoff);
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type != PT_NOTE || ph[i].p_offset > image->size ||
+            ph[i].p_filesz > image->size - ph[i].p_offset) {
+            continue;
+        }
+        const unsigned char *p = image->data + ph[i].p_offset;
+        const unsigned char *end = p + ph[i].p_filesz;
+        while (p + sizeof(Elf64_Nhdr) <= end) {
+            const Elf64_Nhdr *note = (const Elf64_Nhdr *)p;
+            const unsigned char *name = p + sizeof(Elf64_Nhdr);
+            const unsigned char *desc = name + ((note->n_namesz + 3) & ~3u);
+            if (desc + note->n_descsz > end) {
+                break;
+            }
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+                memcmp(name, "GNU", 4) == 0 && note->n_descsz > 1) {
+                *length = note->n_descsz;
+                return desc;
+            }
+            p = desc + ((note->n_descsz + 3) & ~3u);
+        }
+    }
+    return NULL;
+}
+
+// /usr/lib/debug/.build-id/xx/yyyy.debug for the file's GNU build ID
+static int debug_file_path(const elf_image *image, char *output, size_t output_size) {
+    uint32_t length;
+    const unsigned char *id = find_build_id(image, &length);
+    if (!id) {
+        return -1;
+    }
+    size_t len = snprintf(output, output_size, "%s/%02x/", DEBUG_DIR, id[0]);
+    for (uint32_t j = 1; j < length && len + 3 < output_size; j++) {
+        len += snprintf(output + len, output_size - len, "%02x", id[j]);
+    }
+    snprintf(output + len, output_size - len, ".debug");
+    return 0;
+}
+
+/**
+ * Read the GNU build ID of an ELF file as hex
+ *
+ * @return 0 on success, -1 if the file has none or isn't 64-bit ELF
+ */
+int symbols_build_id(const char *path, char *output, size_t output_size) {
+    elf_image image;
+    if (map_file(path, &image) != 0) {
+        return -1;
+    }
+    uint32_t length;
+    const unsigned char *id = find_build_id(&image, &length);
+    size_t len = 0;
+    output[0] = '\0';
+    for (uint32_t i = 0; id && i < length && len + 3 <= output_size; i++) {
+        len += snprintf(output + len, output_size - len, "%02x", id[i]);
+    }
+    munmap((void *)image.data, image.size);
+    return id ? 0 : -1;
+}
+
+/**
+ * Read the libraries an ELF file needs and where it asks for them
+ *
+ * Statically linked programs and non-ELF files have no dynamic section;
+ * they're reported with no libraries.
+ *
+ * @return 0 on success, -1 if the file can't be read as ELF
+ */
+int symbols_dynamic(const char *path, elf_dynamic *dynamic) {
+    memset(dynamic, 0, sizeof(*dynamic));
+    elf_image image;
+    if (map_file(path, &image) != 0) {
+        return -1;
+    }
+
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)image.data;
+    for (int i = 0; i < eh->e_shnum; i++) {
+        const Elf64_Shdr *sh = section(&image, i);
+        if (sh->sh_type != SHT_DYNAMIC || sh->sh_link >= eh->e_shnum || sh->sh_offset > image.size ||
+            sh->sh_size > image.size - sh->sh_offset) {
+            continue;
+        }
+        const Elf64_Shdr *strtab = section(&image, sh->sh_link);
+        if (strtab->sh_offset > image.size || strtab->sh_size > image.size - strtab->sh_offset) {
+            continue;
+        }
+        const char *names = (const char *)image.data + strtab->sh_offset;
+        const Elf64_Dyn *entries = (const Elf64_Dyn *)(image.data + sh->sh_offset);
+        size_t count = sh->sh_size / sizeof(Elf64_Dyn);
+        for (size_t j = 0; j < count && entries[j].d_tag != DT_NULL; j++) {
+            Elf64_Xword offset = entries[j].d_un.d_val;
+            if (offset >= strtab->sh_size) {
+                continue;
+            }
+            const char *name = names + offset;
+            size_t len = strnlen(name, strtab->sh_size - offset);
+            if (entries[j].d_tag == DT_NEEDED) {
+                dynamic->needed = realloc(dynamic->needed, (dynamic->count + 1) * sizeof(char *));
+                dynamic->needed[dynamic->count++] = strndup(name, len);
+            } else if (entries[j].d_tag == DT_RUNPATH ||
+                       (entries[j].d_tag == DT_RPATH && !dynamic->runpath)) {
+                free(dynamic->runpath);
+                dynamic->runpath = strndup(name, len);
+            }
+        }
+        break;
+    }
+    munmap((void *)image.data, image.size);
+    return 0;
+}
+
+/**
+ * Read the function symbols of an ELF file
+ *
+ * .symtab is used when present, otherwise the separate debug file found by
+ * build ID, and .dynsym as the last resort (stripped system libraries).
+ * Only 64-bit ELF is understood.
+ *
+ * @return 0 on success, -1 if the file can't be read as ELF
+ */
+int symbols_load(symbol_file *file, const char *path) {
+    memset(file, 0, sizeof(*file));
+    file->path = strdup(path);
+
+    elf_image image;
+    if (map_file(path, &image) != 0) {
+        return -1;
+    }
+    file->loaded = 1;
+
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)image.data;
+    const Elf64_Phdr *ph = (const Elf64_Phdr *)(image.data + eh->e_phoff);
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_LOAD) {
+            file->segments = realloc(file->segments, (file->segment_count + 1) * sizeof(elf_segment));
+            elf_segment *segment = &file->segments[file->segment_count++];
+            segment->offset = ph[i].p_offset;
+            segment->vaddr = ph[i].p_vaddr;
+            segment->size = ph[i].p_filesz;
+        }
+    }
+
+    if (!add_symbols(file, &image, SHT_SYMTAB)) {
+        char debug_path[PATH_MAX];
+        elf_image debug;
+        if (debug_file_path(&image, debug_path, sizeof(debug_path)) == 0 &&
+            map_file(debug_path, &debug) == 0) {
+            add_symbols(file, &debug, SHT_SYMTAB);
+            munmap((void *)debug.data, debug.size);
+        }
+        add_symbols(file, &image, SHT_DYNSYM);
+    }
+    munmap((void *)image.data, image.size);
+
+    qsort(file->symbols, file->count, sizeof(elf_symbol), compare_symbols);
+    return 0;
+}
+
+#else
+
+int symbols_load(symbol_file *file, const char *path) {
+    memset(file, 0, sizeof(*file));
+    file->path = strdup(path);
+    (void)compare_symbols;
+    return -1;
+}
+
+int symbols_build_id(const char *path, char *output, size_t output_size) {
+    (void)path;
+    (void)output;
+    (void)output_size;
+    return -1;
+}
+
+int symbols_dynamic(const char *path, elf_dynamic *dynamic) {
+    (void)path;
+    memset(dynamic, 0, sizeof(*dynamic));
+    return -1;
+}
+
+#endif
+
+void symbols_dynamic_free(elf_dynamic *dynamic) {
+    for (int i = 0; i < dynamic->count; i++) {
+        free(dynamic->needed[i]);
+    }
+    free(dynamic->needed);
+    free(dynamic->runpath);
+    memset(dynamic, 0, sizeof(*dynamic));
+}
+
+/**
+ * Find the function containing a file offset of a mapped ELF file
+ *
+ * @return The function's name, or NULL when no symbol covers it
+ */
+const char *symbols_lookup(const symbol_file *file, uint64_t offset) {
+    uint64_t address = offset;
+    for (int i = 0; i < file->segment_count; i++) {
+        const elf_segment *segment = &file->segments[i];
+        if (offset >= segment->offset && offset < segment->offset + segment->size) {
+            address = offset - segment->offset + segment->vaddr;
+            break;
+        }
+    }
+
+    int low = 0;
+    int high = file->count - 1;
+    int found = -1;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        if (file->symbols[mid].address <= address) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    // Of several symbols at one address, take the first (sized) one
+    while (found > 0 && file->symbols[found - 1].address == file->symbols[found].address) {
+        found--;
+    }
+    if (found < 0) {
+        return NULL;
+    }
+    const elf_symbol *symbol = &file->symbols[found];
+    if (symbol->size > 0 && address >= symbol->address + symbol->size) {
+        return NULL;
+    }
+    return symbol->name;
+}
+
+void symbols_free(symbol_file *file) {
+    for (int i = 0; i < file->count; i++) {
+        free(file->symbols[i].name);
+    }
+    free(file->symbols);
+    free(file->segments);
+    free(file->path);
+    memset(file, 0, sizeof(*file));
+}
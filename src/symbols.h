@@ -0,0 +1,44 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t address;            // ELF virtual address
+    uint64_t size;               // 0 when the symbol table doesn't say
+    char *name;
+} elf_symbol;
+
+// A PT_LOAD segment, to turn file offsets into virtual addresses
+typedef struct {
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t size;
+} elf_segment;
+
+// The function symbols of one ELF file, sorted by address
+typedef struct {
+    char *path;
+    int loaded;                  // 0 when the file couldn't be read as ELF
+    elf_symbol *symbols;
+    int count;
+    elf_segment *segments;
+    int segment_count;
+} symbol_file;
+
+// What the dynamic section of an ELF file asks the loader for
+typedef struct {
+    char **needed;               // DT_NEEDED library names
+    int count;
+    char *runpath;               // DT_RUNPATH, else DT_RPATH, or NULL
+} elf_dynamic;
+
+int symbols_load(symbol_file *file, const char *path);
+const char *symbols_lookup(const symbol_file *file, uint64_t offset);
+void symbols_free(symbol_file *file);
+int symbols_build_id(const char *path, char *output, size_t output_size);
+int symbols_dynamic(const char *path, elf_dynamic *dynamic);
+void symbols_dynamic_free(elf_dynamic *dynamic);
+
+#endif // SYMBOLS_H
@@ -0,0 +1,398 @@
+#include "jc.h"
+#include "utils.h"
+#include "hash.h"
+#include "symbols.h"
+#include "test_cache.h"
+#include <dirent.h>
+#include <limits.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+extern char **environ;
+
+// Variables of jc's environment that can change a test's result; the rest
+// (PWD, SHLVL, TERM, SSH_*...) differ between shells and would defeat the cache
+static const char *const env_names[] = {"PATH", "LANG", "TZ", "TMPDIR", "HOME"};
+static const char *const env_prefixes[] = {"LD_", "LC_", "CK_", "ASAN_", "UBSAN_", "TSAN_",
+                                           "LSAN_", "MSAN_", "MALLOC_", "GLIBC_"};
+
+static void add_entry(test_cache *cache, const char *profile, const char *label, const char *key) {
+    if (cache->count == cache->capacity) {
+        cache->capacity = cache->capacity ? cache->capacity * 2 : 32;
+        cache->entries = realloc(cache->entries, cache->capacity * sizeof(test_cache_entry));
+    }
+    test_cache_entry *e = &cache->entries[cache->count++];
+    e->profile = strdup(profile);
+    e->label = strdup(label);
+    snprintf(e->key, sizeof(e->key), "%s", key);
+}
+
+/**
+ * Read the cache written by test_cache_save
+ *
+ * Each line is "<profile> <key> <label>", one per test that passed the
+ * last time it ran.
+ *
+ * @return 0 on success, -1 if the file can't be read
+ */
+int test_cache_load(test_cache *cache, const char *path) {
+    memset(cache, 0, sizeof(*cache));
+    char *content = read_file(path);
+    if (!content) {
+        return -1;
+    }
+
+    char *save = NULL;
+    for (char *line = strtok_r(content, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        char profile[256];
+        char key[HASH_HEX_SIZE];
+        int offset = 0;
+        if (line[0] == '#' || sscanf(line, "%255s %64s %n", profile, key, &offset) != 2 || offset == 0 ||
+            line[offset] == '\0') {
+            continue;
+        }
+        add_entry(cache, profile, line + offset, key);
+    }
+    free(content);
+    return 0;
+}
+
+int test_cache_save(const test_cache *cache, const char *path) {
+    char *content = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    append_format(&content, &len, &cap, "# Written by 'jc test run': <profile> <key> <test>\n");
+    for (int i = 0; i < cache->count; i++) {
+        const test_cache_entry *e = &cache->entries[i];
+        append_format(&content, &len, &cap, "%s %s %s\n", e->profile, e->key, e->label);
+    }
+    int result = write_file(path, content);
+    free(content);
+    return result;
+}
+
+static test_cache_entry *find_entry(const test_cache *cache, const char *profile, const char *label) {
+    const char *key = profile ? profile : ".";
+    for (int i = 0; i < cache->count; i++) {
+        if (strcmp(cache->entries[i].profile, key) == 0 && strcmp(cache->entries[i].label, label) == 0) {
+            return &cache->entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Whether a test passed the last time it ran with this key
+int test_cache_hit(const test_cache *cache, const char *profile, const char *label, const char *key) {
+    const test_cache_entry *e = find_entry(cache, profile, label);
+    return e && strcmp(e->key, key) == 0;
+}
+
+void test_cache_store(test_cache *cache, const char *profile, const char *label, const char *key) {
+    test_cache_entry *e = find_entry(cache, profile, label);
+    if (e) {
+        snprintf(e->key, sizeof(e->key), "%s", key);
+    } else {
+        add_entry(cache, profile ? profile : ".", label, key);
+    }
+}
+
+void test_cache_forget(test_cache *cache, const char *profile, const char *label) {
+    test_cache_entry *e = find_entry(cache, profile, label);
+    if (e) {
+        free(e->profile);
+        free(e->label);
+        *e = cache->entries[--cache->count];
+    }
+}
+
+static void add_string(char ***list, int *count, const char *text) {
+    *list = realloc(*list, (*count + 1) * sizeof(char *));
+    (*list)[(*count)++] = strdup(text);
+}
+
+// The directories the loader searches last: ld.so.conf.d entries and the defaults
+static void load_system_dirs(test_cache *cache) {
+    DIR *dir = opendir("/etc/ld.so.conf.d");
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir))) {
+        size_t len = strlen(entry->d_name);
+        if (len < 5 || strcmp(entry->d_name + len - 5, ".conf") != 0) {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "/etc/ld.so.conf.d/%s", entry->d_name);
+        char *content = read_file(path);
+        char *save = NULL;
+        for (char *line = content ? strtok_r(content, "\n", &save) : NULL; line;
+             line = strtok_r(NULL, "\n", &save)) {
+            line[strcspn(line, "# \t")] = '\0';
+            if (line[0] == '/') {
+                add_string(&cache->system_dirs, &cache->system_dir_count, line);
+            }
+        }
+        free(content);
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    const char *defaults[] = {"/lib64", "/usr/lib64", "/lib", "/usr/lib"};
+    for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++) {
+        add_string(&cache->system_dirs, &cache->system_dir_count, defaults[i]);
+    }
+}
+
+// Look for a library in a ':'-separated list of directories
+static int search_path(const char *list, const char *origin, const char *name, char *output, size_t size) {
+    char *copy = strdup(list);
+    char *save = NULL;
+    int found = 0;
+    for (char *dir = strtok_r(copy, ":", &save); dir && !found; dir = strtok_r(NULL, ":", &save)) {
+        if (strncmp(dir, "$ORIGIN", 7) == 0) {
+            snprintf(output, size, "%s%s/%s", origin, dir + 7, name);
+        } else if (strncmp(dir, "${ORIGIN}", 9) == 0) {
+            snprintf(output, size, "%s%s/%s", origin, dir + 9, name);
+        } else {
+            snprintf(output, size, "%s/%s", dir, name);
+        }
+        found = file_exists(output);
+    }
+    free(copy);
+    return found;
+}
+
+/**
+ * Find a DT_NEEDED library the way the loader would
+ *
+ * Searches the object's RUNPATH/RPATH, LD_LIBRARY_PATH, then the system
+ * directories. /etc/ld.so.cache itself isn't read.
+ */
+static int resolve_library(test_cache *cache, const char *object, const char *runpath, const char *name,
+                           char *output, size_t size) {
+    if (strchr(name, '/')) {
+        snprintf(output, size, "%s", name);
+        return file_exists(output);
+    }
+    char origin[PATH_MAX];
+    snprintf(origin, sizeof(origin), "%s", object);
+    char *slash = strrchr(origin, '/');
+    if (slash) {
+        *slash = '\0';
+    } else {
+        snprintf(origin, sizeof(origin), ".");
+    }
+    const char *ld_path = getenv("LD_LIBRARY_PATH");
+    if ((runpath && search_path(runpath, origin, name, output, size)) ||
+        (ld_path && search_path(ld_path, origin, name, output, size))) {
+        return 1;
+    }
+    if (!cache->system_dirs) {
+        load_system_dirs(cache);
+    }
+    for (int i = 0; i < cache->system_dir_count; i++) {
+        snprintf(output, size, "%s/%s", cache->system_dirs[i], name);
+        if (file_exists(output)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A library's identity and dependencies, read once per run
+static test_cache_library *library_info(test_cache *cache, const char *path) {
+    for (int i = 0; i < cache->library_count; i++) {
+        if (strcmp(cache->libraries[i].path, path) == 0) {
+            return &cache->libraries[i];
+        }
+    }
+    cache->libraries = realloc(cache->libraries, (cache->library_count + 1) * sizeof(test_cache_library));
+    test_cache_library *lib = &cache->libraries[cache->library_count++];
+    memset(lib, 0, sizeof(*lib));
+    lib->path = strdup(path);
+
+    char identity[256];
+    struct stat st;
+    if (symbols_build_id(path, identity, sizeof(identity)) != 0) {
+        if (stat(path, &st) == 0) {
+            snprintf(identity, sizeof(identity), "%lld:%lld", (long long)st.st_size,
+                     (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec);
+        } else {
+            snprintf(identity, sizeof(identity), "missing");
+        }
+    }
+    lib->identity = strdup(identity);
+
+    elf_dynamic dynamic;
+    if (symbols_dynamic(path, &dynamic) == 0) {
+        lib->needed = dynamic.needed;
+        lib->needed_count = dynamic.count;
+        lib->runpath = dynamic.runpath;
+    }
+    return lib;
+}
+
+// Hash every library the program loads, breadth first from its DT_NEEDED
+static void hash_libraries(test_cache *cache, hash_ctx *ctx, const char *program) {
+    char **queue = NULL;
+    int count = 0;
+    add_string(&queue, &count, program);
+    for (int q = 0; q < count; q++) {
+        // Copy what's needed: library_info may move the array
+        test_cache_library *info = library_info(cache, queue[q]);
+        int needed_count = info->needed_count;
+        char **needed = info->needed;
+        char *runpath = info->runpath;
+        if (q > 0) {
+            hash_update_string(ctx, queue[q]);
+            hash_update_string(ctx, info->identity);
+        }
+        for (int i = 0; i < needed_count; i++) {
+            char path[PATH_MAX];
+            if (!resolve_library(cache, queue[q], runpath, needed[i], path, sizeof(path))) {
+                hash_update_string(ctx, needed[i]);
+                hash_update_string(ctx, "missing");
+                continue;
+            }
+            int seen = 0;
+            for (int j = 0; j < count && !seen; j++) {
+                seen = strcmp(queue[j], path) == 0;
+            }
+            if (!seen) {
+                add_string(&queue, &count, path);
+            }
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        free(queue[i]);
+    }
+    free(queue);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int env_affects_tests(const char *entry) {
+    size_t name_len = strcspn(entry, "=");
+    for (size_t i = 0; i < sizeof(env_names) / sizeof(env_names[0]); i++) {
+        if (strlen(env_names[i]) == name_len && strncmp(entry, env_names[i], name_len) == 0) {
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < sizeof(env_prefixes) / sizeof(env_prefixes[0]); i++) {
+        if (strncmp(entry, env_prefixes[i], strlen(env_prefixes[i])) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Hash a data file, or every file below a data directory in name order
+static void hash_data(hash_ctx *ctx, const char *path) {
+    struct stat st;
+    hash_update_string(ctx, path);
+    if (stat(path, &st) != 0) {
+        hash_update_string(ctx, "missing");
+    } else if (!S_ISDIR(st.st_mode)) {
+        hash_update_file(ctx, path);
+    } else {
+        DIR *dir = opendir(path);
+        char **names = NULL;
+        int count = 0;
+        struct dirent *entry;
+        while (dir && (entry = readdir(dir))) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+                add_string(&names, &count, entry->d_name);
+            }
+        }
+        if (dir) {
+            closedir(dir);
+        }
+        qsort(names, count, sizeof(char *), compare_strings);
+        for (int i = 0; i < count; i++) {
+            char child[PATH_MAX];
+            snprintf(child, sizeof(child), "%s/%s", path, names[i]);
+            hash_data(ctx, child);
+            free(names[i]);
+        }
+        free(names);
+    }
+}
+
+/**
+ * Compute the key a test's cached result is stored under
+ *
+ * Covers the program (its GNU build ID, or its contents for scripts and
+ * programs without one), every shared library it loads, the variables it
+ * runs with plus those of jc's environment that can change its behavior,
+ * and its data files. The label and profile aren't part of the key;
+ * entries are already looked up by them.
+ *
+ * @param env The variables the test is started with, NULL-terminated
+ * @param data_hash From test_cache_hash_data() for the test's data files
+ */
+void test_cache_key(test_cache *cache, const char *program, char *const env[], const char *data_hash,
+                    char key[HASH_HEX_SIZE]) {
+    hash_ctx ctx;
+    hash_init(&ctx);
+
+    char build_id[256];
+    if (symbols_build_id(program, build_id, sizeof(build_id)) == 0) {
+        hash_update_string(&ctx, build_id);
+    } else {
+        hash_update_file(&ctx, program);
+    }
+    hash_libraries(cache, &ctx, program);
+
+    for (int i = 0; env && env[i]; i++) {
+        hash_update_string(&ctx, env[i]);
+    }
+    char **inherited = NULL;
+    int inherited_count = 0;
+    for (char **e = environ; e && *e; e++) {
+        if (env_affects_tests(*e)) {
+            add_string(&inherited, &inherited_count, *e);
+        }
+    }
+    qsort(inherited, inherited_count, sizeof(char *), compare_strings);
+    for (int i = 0; i < inherited_count; i++) {
+        hash_update_string(&ctx, inherited[i]);
+        free(inherited[i]);
+    }
+    free(inherited);
+
+    hash_update_string(&ctx, data_hash);
+    hash_final(&ctx, key);
+}
+
+// Hash the contents of data files and directories; missing ones count too
+void test_cache_hash_data(char *const paths[], int count, char hex[HASH_HEX_SIZE]) {
+    hash_ctx ctx;
+    hash_init(&ctx);
+    for (int i = 0; i < count; i++) {
+        hash_data(&ctx, paths[i]);
+    }
+    hash_final(&ctx, hex);
+}
+
+void test_cache_free(test_cache *cache) {
+    for (int i = 0; i < cache->count; i++) {
+        free(cache->entries[i].profile);
+        free(cache->entries[i].label);
+    }
+    free(cache->entries);
+    for (int i = 0; i < cache->library_count; i++) {
+        test_cache_library *lib = &cache->libraries[i];
+        elf_dynamic dynamic = {lib->needed, lib->needed_count, lib->runpath};
+        symbols_dynamic_free(&dynamic);
+        free(lib->path);
+        free(lib->identity);
+    }
+    free(cache->libraries);
+    for (int i = 0; i < cache->system_dir_count; i++) {
+        free(cache->system_dirs[i]);
+    }
+    free(cache->system_dirs);
+    memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,44 @@
+#ifndef TEST_CACHE_H
+#define TEST_CACHE_H
+
+#include "hash.h"
+
+// Tests that passed, by a hash of everything their result depends on
+#define TEST_CACHE_FILE ".jc/test-cache"
+
+typedef struct {
+    char *profile;               // "." for the in-tree build
+    char *label;                 // e.g. "tests/test_utils:Core"
+    char key[HASH_HEX_SIZE];
+} test_cache_entry;
+
+// A shared library looked at while computing keys, kept for the next test
+typedef struct {
+    char *path;
+    char *identity;              // build ID, or size and mtime
+    char **needed;
+    int needed_count;
+    char *runpath;
+} test_cache_library;
+
+typedef struct {
+    test_cache_entry *entries;
+    int count;
+    int capacity;
+    test_cache_library *libraries;
+    int library_count;
+    char **system_dirs;          // the loader's default search path
+    int system_dir_count;
+} test_cache;
+
+int test_cache_load(test_cache *cache, const char *path);
+int test_cache_save(const test_cache *cache, const char *path);
+void test_cache_key(test_cache *cache, const char *program, char *const env[], const char *data_hash,
+                    char key[HASH_HEX_SIZE]);
+void test_cache_hash_data(char *const paths[], int count, char hex[HASH_HEX_SIZE]);
+int test_cache_hit(const test_cache *cache, const char *profile, const char *label, const char *key);
+void test_cache_store(test_cache *cache, const char *profile, const char *label, const char *key);
+void test_cache_forget(test_cache *cache, const char *profile, const char *label);
+void test_cache_free(test_cache *cache);
+
+#endif // TEST_CACHE_H
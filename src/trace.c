@@ -0,0 +1,839 @@
+#include "jc.h"
+#include "utils.h"
+#include "trace.h"
+#include "process.h"
+#include "diag.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define TRACE_LOG ".jc/trace.log"
+#define TRACE_JSON ".jc/trace.json"
+#define TRACE_SHELL ".jc/" TRACE_SHELL_NAME
+
+// How many of the slowest translation units the summary lists
+#define TRACE_TOP_TUS 10
+
+enum {
+    JOB_PHASE,
+    JOB_COMPILE,
+    JOB_LINK,
+    JOB_ARCHIVE,
+    JOB_OTHER
+};
+
+static const char *job_kind_names[] = {"phase", "compile", "link", "archive", "other"};
+
+// One timed event from the trace log
+typedef struct {
+    int kind;
+    int status;
+    int slot;
+    long long start;
+    long long end;
+    char name[PATH_MAX];
+    char output[PATH_MAX];
+    char *command;
+    char **inputs;
+    int input_count;
+    long long path_length;
+    int path_prev;
+} trace_job;
+
+// Output path -> producing job, sorted for lookup
+typedef struct {
+    const char *path;
+    int job;
+} output_entry;
+
+// Absolute path of the trace log; empty when tracing is off
+static char trace_log_path[PATH_MAX];
+static char trace_make_vars[PATH_MAX + 32];
+
+long long trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+int trace_active(void) {
+    return trace_log_path[0] != '\0';
+}
+
+/**
+ * Link .jc/jc-trace-shell to this binary so make can use it as SHELL
+ *
+ * Both build tracing and diagnostics capture run recipes through it.
+ *
+ * @return 0 on success, -1 on error
+ */
+int trace_install_shell(void) {
+    if (trace_make_vars[0]) {
+        return 0;
+    }
+
+    char cwd[PATH_MAX];
+    char self[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)) || get_self_path(self, sizeof(self)) != 0) {
+        return -1;
+    }
+
+    create_directory(".jc");
+    unlink(TRACE_SHELL);
+    if (symlink(self, TRACE_SHELL) != 0) {
+        perror("symlink");
+        return -1;
+    }
+    snprintf(trace_make_vars, sizeof(trace_make_vars), "SHELL=%s/%s", cwd, TRACE_SHELL);
+    return 0;
+}
+
+/**
+ * Start tracing a build
+ *
+ * Truncates .jc/trace.log and exports its location to child processes.
+ *
+ * @return 0 on success, -1 on error
+ */
+int trace_begin(void) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)) || trace_install_shell() != 0) {
+        return -1;
+    }
+
+    int written = snprintf(trace_log_path, sizeof(trace_log_path), "%s/%s", cwd, TRACE_LOG);
+    if (written < 0 || (size_t)written >= sizeof(trace_log_path) ||
+        write_file(trace_log_path, "") != 0) {
+        trace_log_path[0] = '\0';
+        return -1;
+    }
+
+    setenv("JC_TRACE_FILE", trace_log_path, 1);
+    return 0;
+}
+
+// Extra make argument that routes every recipe through the trace shell,
+// or "" when neither tracing nor diagnostics capture is on
+const char *trace_make_args(void) {
+    return trace_make_vars;
+}
+
+// Append one line to the trace log in a single write
+static void append_log(const char *path, const char *line) {
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        return;
+    }
+    size_t len = strlen(line);
+    ssize_t written = write(fd, line, len);
+    (void)written;
+    close(fd);
+}
+
+void trace_phase(const char *name, long long start, long long end) {
+    if (!trace_active()) {
+        return;
+    }
+    char line[256];
+    snprintf(line, sizeof(line), "P\t%lld\t%lld\t0\t-\t%s\n", start, end, name);
+    append_log(trace_log_path, line);
+}
+
+// Size of <build_dir>/.ninja_log, so trace_ninja_edges() reads only what ninja adds
+long trace_ninja_offset(const char *build_dir) {
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/.ninja_log", build_dir);
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : 0;
+}
+
+// Split a build.ninja line into words, undoing its "$ ", "$:" and "$$" escapes
+static int ninja_words(const char *line, char ***words) {
+    int count = 0;
+    *words = NULL;
+    char *word = malloc(strlen(line) + 1);
+    size_t len = 0;
+    for (const char *p = line;; p++) {
+        if (*p == '$' && (p[1] == ' ' || p[1] == ':' || p[1] == '$')) {
+            word[len++] = *++p;
+        } else if (*p == ' ' || *p == '\0') {
+            if (len > 0) {
+                word[len] = '\0';
+                *words = realloc(*words, (count + 1) * sizeof(char *));
+                (*words)[count++] = strdup(word);
+                len = 0;
+            }
+            if (*p == '\0') {
+                break;
+            }
+        } else {
+            word[len++] = *p;
+        }
+    }
+    free(word);
+    return count;
+}
+
+/**
+ * Add the edges ninja ran to the trace log
+ *
+ * Ninja runs commands itself rather than through the trace shell, but
+ * .ninja_log records each edge's output and its start and end in ms
+ * since ninja started. The edge's rule and inputs come from build.ninja.
+ *
+ * @param build_dir Directory holding build.ninja and .ninja_log
+ * @param offset trace_ninja_offset() from before ninja ran
+ * @param start trace_now() when ninja was started
+ */
+void trace_ninja_edges(const char *build_dir, long offset, long long start) {
+    if (!trace_active()) {
+        return;
+    }
+
+    char path[PATH_MAX + 16];
+    char cwd[PATH_MAX];
+    char dir[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.ninja_log", build_dir);
+    FILE *log = fopen(path, "r");
+    if (!log) {
+        return;
+    }
+    if (!getcwd(cwd, sizeof(cwd))) {
+        fclose(log);
+        return;
+    }
+    join_path(dir, sizeof(dir), cwd, build_dir);
+    // A smaller log was recompacted; its entries can't be told apart by run
+    fseek(log, 0, SEEK_END);
+    if (ftell(log) < offset) {
+        fclose(log);
+        return;
+    }
+    fseek(log, offset, SEEK_SET);
+
+    snprintf(path, sizeof(path), "%s/build.ninja", build_dir);
+    char *manifest = read_file(path);
+    if (!manifest) {
+        fclose(log);
+        return;
+    }
+
+    // "build <outputs>: <rule> <inputs> | <implicit> || <order-only>"
+    char **statements = NULL;
+    int statement_count = 0;
+    char *save = NULL;
+    for (char *line = strtok_r(manifest, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        if (strncmp(line, "build ", 6) == 0) {
+            statements = realloc(statements, (statement_count + 1) * sizeof(char *));
+            statements[statement_count++] = line + 6;
+        }
+    }
+    int *logged = calloc(statement_count ? statement_count : 1, sizeof(int));
+
+    char *line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, log) > 0) {
+        long long edge_start;
+        long long edge_end;
+        char output[PATH_MAX];
+        if (line[0] == '#' ||
+            sscanf(line, "%lld\t%lld\t%*s\t%4095[^\t\n]", &edge_start, &edge_end, output) != 3) {
+            continue;
+        }
+
+        for (int i = 0; i < statement_count; i++) {
+            char **words;
+            int count = ninja_words(statements[i], &words);
+            int colon = 0;
+            int match = 0;
+            while (colon < count && !has_suffix(words[colon], ":")) {
+                colon++;
+            }
+            if (colon < count) {
+                words[colon][strlen(words[colon]) - 1] = '\0';
+                for (int w = 0; w <= colon && !match; w++) {
+                    match = strcmp(words[w], output) == 0;
+                }
+            }
+            if (match && !logged[i] && colon + 1 < count) {
+                logged[i] = 1;
+                char *record = NULL;
+                size_t len = 0;
+                size_t cap = 0;
+                append_format(&record, &len, &cap, "E\t%lld\t%lld\t0\t%s\t%s %s", start + edge_start * 1000,
+                              start + edge_end * 1000, dir, words[colon + 1], output);
+                for (int w = colon + 2; w < count && strcmp(words[w], "||") != 0; w++) {
+                    if (strcmp(words[w], "|") != 0) {
+                        append_format(&record, &len, &cap, " %s", words[w]);
+                    }
+                }
+                append_format(&record, &len, &cap, "\n");
+                append_log(trace_log_path, record);
+                free(record);
+            }
+            for (int w = 0; w < count; w++) {
+                free(words[w]);
+            }
+            free(words);
+            if (match) {
+                break;
+            }
+        }
+    }
+
+    free(line);
+    free(logged);
+    free(statements);
+    free(manifest);
+    fclose(log);
+}
+
+// Record one recipe run in the trace log
+static void log_job(const char *log, long long start, long long end, int code, const char *recipe) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        snprintf(cwd, sizeof(cwd), ".");
+    }
+
+    size_t size = strlen(recipe) + strlen(cwd) + 96;
+    char *line = malloc(size);
+    if (!line) {
+        return;
+    }
+    int len = snprintf(line, size, "J\t%lld\t%lld\t%d\t%s\t", start, end, code, cwd);
+    // Keep each record on one line
+    for (const char *p = recipe; *p; p++) {
+        line[len++] = (*p == '\n' || *p == '\t' || *p == '\r') ? ' ' : *p;
+    }
+    line[len++] = '\n';
+    line[len] = '\0';
+    append_log(log, line);
+    free(line);
+}
+
+/**
+ * Entry point when make runs jc as SHELL
+ *
+ * Runs the recipe with /bin/sh. Under 'jc build --trace' it logs the
+ * start/end time, exit status, directory and command line; when
+ * diagnostics are captured the recipe's stderr is recorded for
+ * diag_report(). Invocations other than "-c <recipe>" (such as
+ * automake's "$(SHELL) ./config.status") are passed straight to /bin/sh.
+ */
+int trace_shell_main(int argc, char *argv[]) {
+    char **sh_argv = calloc(argc + 1, sizeof(char *));
+    if (!sh_argv) {
+        return 127;
+    }
+    sh_argv[0] = "/bin/sh";
+    for (int i = 1; i < argc; i++) {
+        sh_argv[i] = argv[i];
+    }
+
+    const char *log = getenv("JC_TRACE_FILE");
+    int capture = getenv(DIAG_ENV) != NULL;
+    if ((!log && !capture) || argc < 3 ||
+        (strcmp(argv[1], "-c") != 0 && strcmp(argv[1], "-ec") != 0)) {
+        execv("/bin/sh", sh_argv);
+        perror("/bin/sh");
+        return 127;
+    }
+
+    long long start = trace_now();
+    int code = 127;
+    int failed = 0;
+    if (capture) {
+        code = diag_run_recipe(sh_argv, &failed);
+    } else {
+        process_result result;
+        if (process_run(sh_argv, NULL, &result) == 0) {
+            code = process_status(&result);
+        }
+    }
+    long long end = trace_now();
+    free(sh_argv);
+
+    if (log) {
+        log_job(log, start, end, code, argv[2]);
+    }
+    if (failed) {
+        diag_fail_fast();
+    }
+    return code;
+}
+
+// Collapse "." and ".." segments of an absolute path in place
+static void normalize_path(char *path) {
+    char *segments[PATH_MAX / 2];
+    int count = 0;
+    char copy[PATH_MAX];
+    snprintf(copy, sizeof(copy), "%s", path);
+
+    char *save = NULL;
+    for (char *seg = strtok_r(copy, "/", &save); seg; seg = strtok_r(NULL, "/", &save)) {
+        if (strcmp(seg, ".") == 0) {
+            continue;
+        }
+        if (strcmp(seg, "..") == 0) {
+            if (count > 0) count--;
+            continue;
+        }
+        segments[count++] = seg;
+    }
+
+    char *out = path;
+    *out = '\0';
+    for (int i = 0; i < count; i++) {
+        out += sprintf(out, "/%s", segments[i]);
+    }
+    if (count == 0) {
+        strcpy(path, "/");
+    }
+}
+
+// Strip shell quoting from a recipe word and make it an absolute path
+static void resolve_word(const char *cwd, const char *word, char *output, size_t size) {
+    char clean[PATH_MAX];
+    size_t len = 0;
+    for (const char *p = word; *p && len < sizeof(clean) - 1; p++) {
+        if (*p != '\'' && *p != '"' && *p != '`') {
+            clean[len++] = *p;
+        }
+    }
+    clean[len] = '\0';
+
+    // A path too long to hold is dropped rather than recorded truncated
+    int written = clean[0] == '/' ? snprintf(output, size, "%s", clean)
+                                  : snprintf(output, size, "%s/%s", cwd, clean);
+    if (written < 0 || (size_t)written >= size) {
+        output[0] = '\0';
+        return;
+    }
+    normalize_path(output);
+}
+
+// Show paths relative to the project root when possible
+static const char *relative_to(const char *path, const char *root) {
+    size_t len = strlen(root);
+    if (strncmp(path, root, len) == 0 && path[len] == '/') {
+        return path + len + 1;
+    }
+    return path;
+}
+
+/**
+ * Classify a recipe and extract the file it produces and the build
+ * products it consumes (objects and archives)
+ */
+static void classify_job(trace_job *job, const char *cwd, const char *root) {
+    char *words = strdup(job->command);
+    char *save = NULL;
+    int compile = 0;
+    int archive = 0;
+    int take_output = 0;
+    char source[PATH_MAX] = "";
+    char path[PATH_MAX];
+
+    job->kind = JOB_OTHER;
+    for (char *w = strtok_r(words, " ", &save); w; w = strtok_r(NULL, " ", &save)) {
+        if (take_output) {
+            resolve_word(cwd, w, job->output, sizeof(job->output));
+            take_output = 0;
+            continue;
+        }
+
+        if (strcmp(w, "-o") == 0 && !job->output[0]) {
+            take_output = 1;
+        } else if (strcmp(w, "-c") == 0) {
+            compile = 1;
+        } else if (strcmp(w, "ar") == 0 || has_suffix(w, "-ar") || has_suffix(w, "/ar")) {
+            archive = 1;
+        } else if (has_suffix(w, ".c") || has_suffix(w, ".c'")) {
+            resolve_word(cwd, w, source, sizeof(source));
+        } else if (archive && !job->output[0] && has_suffix(w, ".a")) {
+            resolve_word(cwd, w, job->output, sizeof(job->output));
+        } else if (has_suffix(w, ".o") || has_suffix(w, ".a") || has_suffix(w, ".lo") ||
+                   has_suffix(w, ".la")) {
+            resolve_word(cwd, w, path, sizeof(path));
+            job->inputs = realloc(job->inputs, (job->input_count + 1) * sizeof(char *));
+            job->inputs[job->input_count++] = strdup(path);
+        }
+    }
+    free(words);
+
+    if (compile && job->output[0]) {
+        job->kind = JOB_COMPILE;
+        snprintf(job->name, sizeof(job->name), "%s",
+                 relative_to(source[0] ? source : job->output, root));
+    } else if (archive && job->output[0]) {
+        job->kind = JOB_ARCHIVE;
+        snprintf(job->name, sizeof(job->name), "%s", relative_to(job->output, root));
+    } else if (job->output[0]) {
+        job->kind = JOB_LINK;
+        snprintf(job->name, sizeof(job->name), "%s", relative_to(job->output, root));
+    } else {
+        snprintf(job->name, sizeof(job->name), "%.60s%s", job->command,
+                 strlen(job->command) > 60 ? "..." : "");
+    }
+}
+
+// Classify a ninja edge ("<rule> <output> <inputs>", see trace_ninja_edges())
+static void classify_edge(trace_job *job, const char *cwd, const char *root) {
+    char *words = strdup(job->command);
+    char *save = NULL;
+    char *rule = strtok_r(words, " ", &save);
+    char *output = strtok_r(NULL, " ", &save);
+    char source[PATH_MAX] = "";
+    char path[PATH_MAX];
+
+    job->kind = JOB_OTHER;
+    if (!rule || !output) {
+        snprintf(job->name, sizeof(job->name), "%s", job->command);
+        free(words);
+        return;
+    }
+    resolve_word(cwd, output, job->output, sizeof(job->output));
+    for (char *w = strtok_r(NULL, " ", &save); w; w = strtok_r(NULL, " ", &save)) {
+        resolve_word(cwd, w, path, sizeof(path));
+        if (!source[0]) {
+            snprintf(source, sizeof(source), "%s", path);
+        }
+        job->inputs = realloc(job->inputs, (job->input_count + 1) * sizeof(char *));
+        job->inputs[job->input_count++] = strdup(path);
+    }
+
+    if (strcmp(rule, "cc") == 0 || strcmp(rule, "pch") == 0) {
+        job->kind = JOB_COMPILE;
+    } else if (strcmp(rule, "ar") == 0) {
+        job->kind = JOB_ARCHIVE;
+    } else if (strcmp(rule, "link") == 0) {
+        job->kind = JOB_LINK;
+    }
+    snprintf(job->name, sizeof(job->name), "%s",
+             relative_to(job->kind == JOB_COMPILE && source[0] ? source : job->output, root));
+    free(words);
+}
+
+// Parse the trace log; returns the number of jobs read
+static int load_trace(const char *root, trace_job **jobs_out) {
+    FILE *file = fopen(trace_log_path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    trace_job *jobs = NULL;
+    int count = 0;
+    int capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+
+    while (getline(&line, &line_size, file) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+
+        char *fields[6];
+        char *p = line;
+        int n = 0;
+        for (; n < 5; n++) {
+            fields[n] = p;
+            char *tab = strchr(p, '\t');
+            if (!tab) break;
+            *tab = '\0';
+            p = tab + 1;
+        }
+        if (n < 5) {
+            continue;
+        }
+        fields[5] = p;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            jobs = realloc(jobs, capacity * sizeof(trace_job));
+        }
+        trace_job *job = &jobs[count++];
+        memset(job, 0, sizeof(*job));
+        job->start = atoll(fields[1]);
+        job->end = atoll(fields[2]);
+        job->status = atoi(fields[3]);
+        job->command = strdup(fields[5]);
+        job->path_prev = -1;
+
+        if (fields[0][0] == 'P') {
+            job->kind = JOB_PHASE;
+            snprintf(job->name, sizeof(job->name), "%s", fields[5]);
+        } else if (fields[0][0] == 'E') {
+            classify_edge(job, fields[4], root);
+        } else {
+            classify_job(job, fields[4], root);
+        }
+    }
+
+    free(line);
+    fclose(file);
+    *jobs_out = jobs;
+    return count;
+}
+
+static int compare_outputs(const void *a, const void *b) {
+    return strcmp(((const output_entry *)a)->path, ((const output_entry *)b)->path);
+}
+
+static trace_job *sort_jobs;
+
+static int compare_by_start(const void *a, const void *b) {
+    const trace_job *x = &sort_jobs[*(const int *)a];
+    const trace_job *y = &sort_jobs[*(const int *)b];
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+static int compare_by_end(const void *a, const void *b) {
+    const trace_job *x = &sort_jobs[*(const int *)a];
+    const trace_job *y = &sort_jobs[*(const int *)b];
+    return (x->end > y->end) - (x->end < y->end);
+}
+
+static int compare_by_duration(const void *a, const void *b) {
+    const trace_job *x = &sort_jobs[*(const int *)a];
+    const trace_job *y = &sort_jobs[*(const int *)b];
+    long long dx = x->end - x->start;
+    long long dy = y->end - y->start;
+    return (dx < dy) - (dx > dy);
+}
+
+// Give every make job the lowest free slot, like make's own job slots
+static void assign_slots(trace_job *jobs, int count, int *order) {
+    long long *slot_end = calloc(count ? count : 1, sizeof(long long));
+    int slots = 0;
+
+    for (int i = 0; i < count; i++) {
+        trace_job *job = &jobs[order[i]];
+        if (job->kind == JOB_PHASE) {
+            continue;
+        }
+        int slot = 0;
+        while (slot < slots && slot_end[slot] > job->start) {
+            slot++;
+        }
+        if (slot == slots) {
+            slots++;
+        }
+        slot_end[slot] = job->end;
+        job->slot = slot;
+    }
+
+    free(slot_end);
+}
+
+/**
+ * Longest chain of compile/archive/link jobs, where an edge means one
+ * job consumed a file the other produced
+ *
+ * @return The last job on the critical path, or -1 if there is none
+ */
+static int critical_path(trace_job *jobs, int count, int *order) {
+    output_entry *outputs = malloc((count ? count : 1) * sizeof(output_entry));
+    int output_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].kind >= JOB_COMPILE && jobs[i].kind <= JOB_ARCHIVE) {
+            outputs[output_count].path = jobs[i].output;
+            outputs[output_count].job = i;
+            output_count++;
+        }
+    }
+    qsort(outputs, output_count, sizeof(output_entry), compare_outputs);
+
+    // Producers finish before consumers start, so end-time order is topological
+    sort_jobs = jobs;
+    qsort(order, count, sizeof(int), compare_by_end);
+
+    int last = -1;
+    for (int i = 0; i < count; i++) {
+        trace_job *job = &jobs[order[i]];
+        if (job->kind < JOB_COMPILE || job->kind > JOB_ARCHIVE) {
+            continue;
+        }
+
+        long long best = 0;
+        for (int k = 0; k < job->input_count; k++) {
+            output_entry key = {job->inputs[k], 0};
+            output_entry *found = bsearch(&key, outputs, output_count, sizeof(output_entry),
+                                          compare_outputs);
+            if (!found) {
+                continue;
+            }
+            // Several jobs may write the same file; walk all of them
+            while (found > outputs && strcmp(found[-1].path, key.path) == 0) {
+                found--;
+            }
+            for (; found < outputs + output_count && strcmp(found->path, key.path) == 0; found++) {
+                trace_job *producer = &jobs[found->job];
+                if (producer->end <= job->start && producer->path_length > best) {
+                    best = producer->path_length;
+                    job->path_prev = found->job;
+                }
+            }
+        }
+
+        job->path_length = best + (job->end - job->start);
+        if (last < 0 || job->path_length > jobs[last].path_length) {
+            last = order[i];
+        }
+    }
+
+    free(outputs);
+    return last;
+}
+
+// Write the events in Chrome trace-event format (chrome://tracing, Perfetto)
+static int write_chrome_trace(trace_job *jobs, int count, long long origin) {
+    FILE *out = fopen(TRACE_JSON, "w");
+    if (!out) {
+        return -1;
+    }
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"jc phases\"}},\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"make jobs\"}}");
+
+    for (int i = 0; i < count; i++) {
+        trace_job *job = &jobs[i];
+        fprintf(out, ",\n{\"name\":");
+        json_write_string(out, job->name);
+        fprintf(out, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d",
+                job_kind_names[job->kind], job->start - origin, job->end - job->start,
+                job->kind == JOB_PHASE ? 1 : 2, job->kind == JOB_PHASE ? 0 : job->slot + 1);
+        if (job->kind != JOB_PHASE) {
+            fprintf(out, ",\"args\":{\"status\":%d,\"command\":", job->status);
+            json_write_string(out, job->command);
+            fprintf(out, "}");
+        }
+        fprintf(out, "}");
+    }
+
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    return 0;
+}
+
+/**
+ * Turn the trace log into .jc/trace.json and print a summary of phase
+ * times, the slowest translation units and the critical path
+ *
+ * @param build_phase The phase the jobs ran in ("make" or "ninja")
+ * @return 0 on success, -1 on error
+ */
+int trace_report(const char *build_phase) {
+    if (!trace_active()) {
+        return -1;
+    }
+
+    char root[PATH_MAX];
+    if (!getcwd(root, sizeof(root))) {
+        return -1;
+    }
+
+    trace_job *jobs = NULL;
+    int count = load_trace(root, &jobs);
+    if (count == 0) {
+        free(jobs);
+        return -1;
+    }
+
+    int *order = malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+    }
+
+    sort_jobs = jobs;
+    qsort(order, count, sizeof(int), compare_by_start);
+    long long origin = jobs[order[0]].start;
+    assign_slots(jobs, count, order);
+
+    int last = critical_path(jobs, count, order);
+    write_chrome_trace(jobs, count, origin);
+
+    printf("\nBuild trace\n");
+    printf("----------------------------------------\n");
+
+    long long job_time = 0;
+    int job_count = 0;
+    long long make_time = 0;
+    long long before_make = 0;
+    for (int i = 0; i < count; i++) {
+        long long duration = jobs[i].end - jobs[i].start;
+        if (jobs[i].kind == JOB_PHASE) {
+            if (strcmp(jobs[i].name, build_phase) == 0) {
+                make_time = duration;
+            } else {
+                before_make += duration;
+            }
+        } else if (jobs[i].kind != JOB_OTHER) {
+            job_time += duration;
+            job_count++;
+        }
+    }
+
+    printf("Phases:\n");
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].kind == JOB_PHASE) {
+            printf("  %-12s %8.3f s\n", jobs[i].name, (jobs[i].end - jobs[i].start) / 1e6);
+        }
+    }
+    if (make_time > 0 && job_count > 0) {
+        printf("  %d compile/link jobs, %.3f s of work, average parallelism %.1fx\n",
+               job_count, job_time / 1e6, (double)job_time / make_time);
+    }
+
+    sort_jobs = jobs;
+    qsort(order, count, sizeof(int), compare_by_duration);
+    printf("\nSlowest translation units:\n");
+    int shown = 0;
+    for (int i = 0; i < count && shown < TRACE_TOP_TUS; i++) {
+        trace_job *job = &jobs[order[i]];
+        if (job->kind == JOB_COMPILE) {
+            printf("  %8.3f s  %s\n", (job->end - job->start) / 1e6, job->name);
+            shown++;
+        }
+    }
+    if (shown == 0) {
+        printf("  (no compile jobs ran)\n");
+    }
+
+    if (last >= 0) {
+        printf("\nCritical path (%.3f s):\n", (jobs[last].path_length + before_make) / 1e6);
+        for (int i = 0; i < count; i++) {
+            if (jobs[i].kind == JOB_PHASE && strcmp(jobs[i].name, build_phase) != 0) {
+                printf("  %8.3f s  %-8s %s\n", (jobs[i].end - jobs[i].start) / 1e6, "phase", jobs[i].name);
+            }
+        }
+
+        // The chain is linked backwards from the last job
+        int chain[1024];
+        int length = 0;
+        for (int j = last; j >= 0 && length < 1024; j = jobs[j].path_prev) {
+            chain[length++] = j;
+        }
+        for (int i = length - 1; i >= 0; i--) {
+            trace_job *job = &jobs[chain[i]];
+            printf("  %8.3f s  %-8s %s\n", (job->end - job->start) / 1e6,
+                   job_kind_names[job->kind], job->name);
+        }
+    }
+
+    printf("\nTrace written to %s (open in chrome://tracing or ui.perfetto.dev)\n", TRACE_JSON);
+
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < jobs[i].input_count; k++) {
+            free(jobs[i].inputs[k]);
+        }
+        free(jobs[i].inputs);
+        free(jobs[i].command);
+    }
+    free(jobs);
+    free(order);
+    return 0;
+}
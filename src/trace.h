@@ -0,0 +1,18 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Name jc answers to when make runs it as SHELL (tracing, diagnostics)
+#define TRACE_SHELL_NAME "jc-trace-shell"
+
+int trace_install_shell(void);
+int trace_begin(void);
+int trace_active(void);
+long long trace_now(void);
+void trace_phase(const char *name, long long start, long long end);
+const char *trace_make_args(void);
+long trace_ninja_offset(const char *build_dir);
+void trace_ninja_edges(const char *build_dir, long offset, long long start);
+int trace_report(const char *build_phase);
+int trace_shell_main(int argc, char *argv[]);
+
+#endif // TRACE_H
@@ -0,0 +1,637 @@
+#define _XOPEN_SOURCE 700
+
+#include "unity.h"
+#include "utils.h"
+#include "makefile_am.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define UNITY_DIR ".jc/unity"
+
+// Sorted set of identifiers
+typedef struct {
+    char **names;
+    int count;
+    int capacity;
+} name_set;
+
+// A source file considered for a unity batch
+typedef struct {
+    char word[PATH_MAX];     // as listed in *_SOURCES
+    char path[PATH_MAX * 2]; // absolute path
+    name_set local;          // static functions/objects, typedefs, tags, enumerators
+    name_set global;         // other file-scope names
+    name_set macros;         // #defines still active at the end of the file
+    int batch;               // unity batch number, or 0 for per-file compilation
+} unity_source;
+
+static const char *c_keywords[] = {
+    "_Alignas", "_Atomic", "_Bool", "_Complex", "_Noreturn", "_Static_assert",
+    "_Thread_local", "__attribute__", "__extension__", "__inline", "__inline__",
+    "__restrict", "auto", "bool", "break", "case", "char", "const", "continue",
+    "default", "do", "double", "else", "enum", "extern", "float", "for", "goto",
+    "if", "inline", "int", "long", "register", "restrict", "return", "short",
+    "signed", "sizeof", "static", "struct", "switch", "typedef", "union",
+    "unsigned", "void", "volatile", "while"
+};
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int is_keyword(const char *name) {
+    return bsearch(&name, c_keywords, sizeof(c_keywords) / sizeof(c_keywords[0]),
+                   sizeof(char *), compare_names) != NULL;
+}
+
+static void name_set_add(name_set *set, const char *name) {
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity ? set->capacity * 2 : 16;
+        set->names = realloc(set->names, set->capacity * sizeof(char *));
+    }
+    set->names[set->count++] = strdup(name);
+}
+
+static void name_set_remove(name_set *set, const char *name) {
+    for (int i = 0; i < set->count; i++) {
+        if (strcmp(set->names[i], name) == 0) {
+            free(set->names[i]);
+            set->names[i] = set->names[--set->count];
+            i--;
+        }
+    }
+}
+
+// Sort and drop duplicates so lookups can use bsearch
+static void name_set_finish(name_set *set) {
+    if (set->count == 0) {
+        return;
+    }
+    qsort(set->names, set->count, sizeof(char *), compare_names);
+    int out = 1;
+    for (int i = 1; i < set->count; i++) {
+        if (strcmp(set->names[i], set->names[out - 1]) == 0) {
+            free(set->names[i]);
+        } else {
+            set->names[out++] = set->names[i];
+        }
+    }
+    set->count = out;
+}
+
+static void name_set_free(name_set *set) {
+    for (int i = 0; i < set->count; i++) {
+        free(set->names[i]);
+    }
+    free(set->names);
+}
+
+// First name present in both sets, or NULL
+static const char *name_set_common(const name_set *a, const name_set *b) {
+    for (int i = 0; i < a->count; i++) {
+        if (bsearch(&a->names[i], b->names, b->count, sizeof(char *), compare_names)) {
+            return a->names[i];
+        }
+    }
+    return NULL;
+}
+
+// Name that would be defined twice if both files shared a translation unit
+static const char *unity_conflict(const unity_source *a, const unity_source *b) {
+    const char *name = name_set_common(&a->local, &b->local);
+    if (!name) name = name_set_common(&a->local, &b->global);
+    if (!name) name = name_set_common(&b->local, &a->global);
+    return name;
+}
+
+// Skip a comment, string or character literal starting at p
+static const char *skip_literal(const char *p) {
+    if (p[0] == '/' && p[1] == '/') {
+        while (*p && *p != '\n') p++;
+        return p;
+    }
+    if (p[0] == '/' && p[1] == '*') {
+        const char *end = strstr(p + 2, "*/");
+        return end ? end + 2 : p + strlen(p);
+    }
+    if (*p == '"' || *p == '\'') {
+        char quote = *p++;
+        while (*p && *p != quote && *p != '\n') {
+            if (*p == '\\' && p[1]) p++;
+            p++;
+        }
+        return *p == quote ? p + 1 : p;
+    }
+    return NULL;
+}
+
+// Handle a preprocessor line; returns the position after it
+static const char *scan_directive(const char *p, unity_source *src) {
+    p++;
+    while (*p == ' ' || *p == '\t') p++;
+
+    int define = strncmp(p, "define", 6) == 0 && !isalnum((unsigned char)p[6]);
+    int undef = strncmp(p, "undef", 5) == 0 && !isalnum((unsigned char)p[5]);
+    if (define || undef) {
+        p += define ? 6 : 5;
+        while (*p == ' ' || *p == '\t') p++;
+        char name[128];
+        size_t len = 0;
+        while ((isalnum((unsigned char)*p) || *p == '_') && len < sizeof(name) - 1) {
+            name[len++] = *p++;
+        }
+        name[len] = '\0';
+        if (len > 0) {
+            if (define) {
+                name_set_add(&src->macros, name);
+            } else {
+                name_set_remove(&src->macros, name);
+            }
+        }
+    }
+
+    // Skip to the end of the directive, following continuations
+    while (*p && *p != '\n') {
+        if (*p == '\\' && p[1] == '\n') p++;
+        p++;
+    }
+    return p;
+}
+
+/**
+ * Collect the file-scope names a source defines
+ *
+ * This is a tokenizer, not a parser: it tracks brace and parenthesis depth
+ * and takes the identifier before '(', '=', '[', ',' or ';' at file scope
+ * as a declared name. Misreading a declaration only costs a needless
+ * per-file fallback, never a broken build.
+ */
+static void scan_source(const char *text, unity_source *src) {
+    const char *p = text;
+    int depth = 0;
+    int paren = 0;
+    int line_start = 1;
+
+    // State of the current file-scope declaration
+    int is_local = 0;        // static or typedef
+    int in_init = 0;         // after '=' until ',' or ';'
+    int after_tag_kw = 0;    // 1 after struct/union, 2 after enum
+    int tag_kind = 0;        // after_tag_kw of the tag just read
+    int tag_pending = 0;     // the last token was a tag name
+    int enum_body = 0;       // inside an enum's braces
+    int expect_enumerator = 0;
+    int body_ends_decl = 0;  // the open brace is a function body
+    char tag[128] = "";
+    char pending[128] = "";
+
+#define RECORD(name) name_set_add(is_local ? &src->local : &src->global, (name))
+#define RESET_DECL() (is_local = in_init = after_tag_kw = tag_pending = 0, pending[0] = tag[0] = '\0')
+
+    while (*p) {
+        const char *after = skip_literal(p);
+        if (after) {
+            p = after;
+            continue;
+        }
+
+        char c = *p;
+        if (c == '\n') {
+            line_start = 1;
+            p++;
+            continue;
+        }
+        if (isspace((unsigned char)c)) {
+            p++;
+            continue;
+        }
+        if (c == '#' && line_start) {
+            p = scan_directive(p, src);
+            continue;
+        }
+        line_start = 0;
+
+        if (isalpha((unsigned char)c) || c == '_') {
+            char name[128];
+            size_t len = 0;
+            while (isalnum((unsigned char)*p) || *p == '_') {
+                if (len < sizeof(name) - 1) name[len++] = *p;
+                p++;
+            }
+            name[len] = '\0';
+
+            if (depth == 1 && enum_body && expect_enumerator) {
+                name_set_add(&src->local, name);
+                expect_enumerator = 0;
+                continue;
+            }
+            if (depth > 0) {
+                continue;
+            }
+
+            tag_pending = 0;
+            if (strcmp(name, "static") == 0 || strcmp(name, "typedef") == 0) {
+                is_local = 1;
+            } else if (strcmp(name, "struct") == 0 || strcmp(name, "union") == 0) {
+                after_tag_kw = 1;
+            } else if (strcmp(name, "enum") == 0) {
+                after_tag_kw = 2;
+            } else if (is_keyword(name)) {
+                continue;
+            } else if (after_tag_kw) {
+                snprintf(tag, sizeof(tag), "%s", name);
+                tag_kind = after_tag_kw;
+                after_tag_kw = 0;
+                tag_pending = 1;
+            } else if (paren == 0 && !in_init) {
+                snprintf(pending, sizeof(pending), "%s", name);
+            }
+            continue;
+        }
+
+        if (isdigit((unsigned char)c)) {
+            while (isalnum((unsigned char)*p) || *p == '.' || *p == '_') p++;
+            continue;
+        }
+
+        p++;
+        if (c == '{') {
+            if (depth == 0) {
+                int kind = after_tag_kw ? after_tag_kw : (tag_pending ? tag_kind : 0);
+                enum_body = kind == 2;
+                expect_enumerator = enum_body;
+                // A tag with a body is a definition that can collide
+                if (tag_pending) {
+                    name_set_add(&src->local, tag);
+                }
+                body_ends_decl = !in_init && !kind;
+                after_tag_kw = tag_pending = 0;
+            }
+            depth++;
+            continue;
+        }
+        if (c == '}') {
+            if (depth > 0) depth--;
+            if (depth == 0) {
+                enum_body = 0;
+                if (body_ends_decl) {
+                    RESET_DECL();
+                    body_ends_decl = 0;
+                }
+            }
+            continue;
+        }
+        if (depth > 0) {
+            if (c == ',' && depth == 1 && enum_body) {
+                expect_enumerator = 1;
+            }
+            continue;
+        }
+
+        tag_pending = 0;
+        if (c == '(') {
+            if (paren == 0 && pending[0] && !in_init) {
+                RECORD(pending);
+                pending[0] = '\0';
+            }
+            paren++;
+        } else if (c == ')') {
+            if (paren > 0) paren--;
+        } else if (paren > 0) {
+            continue;
+        } else if (c == '=' || c == '[') {
+            if (pending[0] && !in_init) {
+                RECORD(pending);
+            }
+            pending[0] = '\0';
+            if (c == '=') in_init = 1;
+        } else if (c == ',') {
+            if (pending[0] && !in_init) {
+                RECORD(pending);
+            }
+            pending[0] = '\0';
+            in_init = 0;
+        } else if (c == ';') {
+            if (pending[0] && !in_init) {
+                RECORD(pending);
+            }
+            RESET_DECL();
+        }
+    }
+
+#undef RECORD
+#undef RESET_DECL
+
+    name_set_finish(&src->local);
+    name_set_finish(&src->global);
+    name_set_finish(&src->macros);
+}
+
+/**
+ * Group one target's sources into unity batches
+ *
+ * A source joins the current batch unless it defines a name another
+ * member already defines, in which case it is compiled on its own.
+ *
+ * @return Number of batches
+ */
+static int assign_batches(const char *target, unity_source *sources, int count, int batch_size) {
+    int batch = 1;
+    int in_batch = 0;
+    int first = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (in_batch == batch_size) {
+            batch++;
+            in_batch = 0;
+            first = i;
+        }
+
+        const char *conflict = NULL;
+        int other = -1;
+        for (int j = first; j < i && !conflict; j++) {
+            if (sources[j].batch == batch) {
+                conflict = unity_conflict(&sources[i], &sources[j]);
+                other = j;
+            }
+        }
+
+        if (conflict) {
+            printf("  %s: compiling %s separately ('%s' is also defined in %s)\n",
+                   target, sources[i].word, conflict, sources[other].word);
+            sources[i].batch = 0;
+            continue;
+        }
+        sources[i].batch = batch;
+        in_batch++;
+    }
+
+    // A batch of one file gains nothing
+    int batches = 0;
+    for (int b = 1; b <= batch; b++) {
+        int members = 0;
+        int last = -1;
+        for (int i = 0; i < count; i++) {
+            if (sources[i].batch == b) {
+                members++;
+                last = i;
+            }
+        }
+        if (members == 1) {
+            sources[last].batch = 0;
+        }
+        if (members < 2) {
+            continue;
+        }
+
+        batches++;
+        for (int i = 0; i < count; i++) {
+            if (sources[i].batch == b) {
+                sources[i].batch = batches;
+            }
+        }
+    }
+    return batches;
+}
+
+// Append the objects automake would build for a source compiled on its own
+static void append_fallback_objects(char **mk, size_t *len, size_t *cap,
+                                    const char *target, const char *word) {
+    char base[PATH_MAX];
+    snprintf(base, sizeof(base), "%s", word);
+    char *dot = strrchr(base, '.');
+    if (dot) *dot = '\0';
+
+    char dir[PATH_MAX + 1] = "";
+    const char *name = base;
+    char *slash = strrchr(base, '/');
+    if (slash) {
+        *slash = '\0';
+        snprintf(dir, sizeof(dir), "%s/", base);
+        name = slash + 1;
+    }
+
+    // Automake prefixes objects with the target when it has per-target flags
+    append_format(mk, len, cap, " %s.$(OBJEXT) %s%s.$(OBJEXT) %s-%s.$(OBJEXT) %s%s-%s.$(OBJEXT)",
+           name, dir, name, target, name, dir, target, name);
+}
+
+/**
+ * Generate unity sources for every *_SOURCES list in src/Makefile.am
+ *
+ * Writes .jc/unity/<profile>/<target>/unity_K.c, each #including a batch
+ * of sources, and a make fragment that replaces the target's objects with
+ * the unity objects plus any sources that had to be compiled separately.
+ * The fragment is loaded through MAKEFILES, so src/Makefile.am and the
+ * generated Makefile stay untouched.
+ *
+ * @param build_dir "." or build/<profile>
+ * @param batch_size Sources per unity file, or 0 to spread them over jobs
+ * @param jobs Make job count, used when batch_size is 0
+ * @param make_vars Receives "MAKEFILES=..." for make's environment,
+ *                  or an empty string when no target benefits
+ * @return 0 on success, -1 on error
+ */
+int unity_prepare(const char *build_dir, int batch_size, int jobs, char *make_vars, size_t size) {
+    make_vars[0] = '\0';
+
+    char src_dir[PATH_MAX];
+    char obj_dir[PATH_MAX];
+    char build_src[PATH_MAX];
+    snprintf(build_src, sizeof(build_src), "%s/src", build_dir);
+    if (!realpath("src", src_dir) || !realpath(build_src, obj_dir)) {
+        fprintf(stderr, "Warning: Cannot resolve the source directories, skipping unity build\n");
+        return -1;
+    }
+
+    am_file am;
+    if (am_parse("src/Makefile.am", &am) != 0) {
+        fprintf(stderr, "Warning: Cannot read src/Makefile.am, skipping unity build\n");
+        return -1;
+    }
+
+    const char *profile = strcmp(build_dir, ".") == 0 ? "default" : strrchr(build_dir, '/') + 1;
+    char unity_dir[PATH_MAX];
+    char cwd[PATH_MAX];
+    int written = getcwd(cwd, sizeof(cwd))
+                      ? snprintf(unity_dir, sizeof(unity_dir), "%s/%s/%s", cwd, UNITY_DIR, profile)
+                      : -1;
+    if (written < 0 || (size_t)written >= sizeof(unity_dir)) {
+        am_free(&am);
+        return -1;
+    }
+    create_directory(".jc");
+    create_directory(UNITY_DIR);
+    if (create_directory(unity_dir) != 0) {
+        am_free(&am);
+        return -1;
+    }
+
+    char *mk = NULL;
+    size_t mk_len = 0;
+    size_t mk_cap = 0;
+    int unity_targets = 0;
+    append_format(&mk, &mk_len, &mk_cap, "# Generated by 'jc build --unity'; do not edit\n");
+    append_format(&mk, &mk_len, &mk_cap, "ifeq ($(CURDIR),%s)\n", obj_dir);
+
+    for (int v = 0; v < am.count; v++) {
+        const char *var = am.vars[v].name;
+        if (!has_suffix(var, "_SOURCES") || strncmp(var, "EXTRA_", 6) == 0 ||
+            strncmp(var, "nodist_", 7) == 0 || strncmp(var, "dist_", 5) == 0) {
+            continue;
+        }
+        char target[256];
+        am_target_name(var, "_SOURCES", target, sizeof(target));
+
+        char **words;
+        int word_count = am_split_words(am.vars[v].value, &words);
+        if (word_count <= 0) {
+            continue;
+        }
+
+        // Sources named through make variables can't be batched reliably
+        int has_variables = 0;
+        for (int w = 0; w < word_count; w++) {
+            if (strchr(words[w], '$')) {
+                has_variables = 1;
+            }
+        }
+        if (has_variables) {
+            printf("Unity build: %s: sources use make variables, building per file\n", target);
+            am_free_words(words, word_count);
+            continue;
+        }
+
+        unity_source *sources = calloc(word_count, sizeof(unity_source));
+        int count = 0;
+        for (int w = 0; w < word_count; w++) {
+            unity_source *src = &sources[count];
+            snprintf(src->word, sizeof(src->word), "%s", words[w]);
+            snprintf(src->path, sizeof(src->path), "%s/%s", src_dir, words[w]);
+            if (!has_suffix(words[w], ".c")) {
+                continue;
+            }
+
+            // Generated or missing sources are left to automake
+            char *text = read_file(src->path);
+            if (!text) {
+                continue;
+            }
+            scan_source(text, src);
+            free(text);
+            count++;
+        }
+
+        int per_batch = batch_size;
+        if (per_batch <= 0) {
+            int slots = jobs > 0 ? jobs : 1;
+            per_batch = (count + slots - 1) / slots;
+        }
+        if (per_batch < 2) {
+            per_batch = 2;
+        }
+
+        int batches = count >= 2 ? assign_batches(target, sources, count, per_batch) : 0;
+        if (batches > 0) {
+            char target_dir[PATH_MAX + 256];
+            snprintf(target_dir, sizeof(target_dir), "%s/%s", unity_dir, target);
+            create_directory(target_dir);
+
+            // The object list: unity objects plus every source left out of a batch
+            append_format(&mk, &mk_len, &mk_cap, "override %s_OBJECTS =", target);
+            for (int b = 1; b <= batches; b++) {
+                append_format(&mk, &mk_len, &mk_cap, " %s-unity_%d.o", target, b);
+            }
+            append_format(&mk, &mk_len, &mk_cap, " $(filter");
+            for (int w = 0; w < word_count; w++) {
+                int batched = 0;
+                for (int i = 0; i < count; i++) {
+                    if (sources[i].batch > 0 && strcmp(sources[i].word, words[w]) == 0) {
+                        batched = 1;
+                    }
+                }
+                if (!batched && !has_suffix(words[w], ".h")) {
+                    append_fallback_objects(&mk, &mk_len, &mk_cap, target, words[w]);
+                }
+            }
+            append_format(&mk, &mk_len, &mk_cap, ",$(am_%s_OBJECTS))\n", target);
+
+            int batched_sources = 0;
+            for (int b = 1; b <= batches; b++) {
+                char *unit = NULL;
+                size_t unit_len = 0;
+                size_t unit_cap = 0;
+                append_format(&unit, &unit_len, &unit_cap,
+                       "/* Generated by 'jc build --unity'; do not edit */\n");
+                for (int i = 0; i < count; i++) {
+                    if (sources[i].batch != b) {
+                        continue;
+                    }
+                    batched_sources++;
+                    append_format(&unit, &unit_len, &unit_cap, "#include \"%s\"\n", sources[i].path);
+                    // Keep each file's macros out of the files after it
+                    for (int m = 0; m < sources[i].macros.count; m++) {
+                        append_format(&unit, &unit_len, &unit_cap, "#undef %s\n", sources[i].macros.names[m]);
+                    }
+                }
+
+                char unit_path[PATH_MAX + 288];
+                snprintf(unit_path, sizeof(unit_path), "%s/unity_%d.c", target_dir, b);
+                write_if_changed(unit_path, unit);
+                free(unit);
+
+                // Same flags as automake's per-target compile rule. The fragment is
+                // read before the Makefile, so targets can't use $(OBJEXT) yet.
+                char object[512];
+                snprintf(object, sizeof(object), "%s-unity_%d", target, b);
+                append_format(&mk, &mk_len, &mk_cap,
+                       "%s.o: %s\n"
+                       "\t$(AM_V_CC)$(MKDIR_P) .deps && $(CC) $(DEFS) $(DEFAULT_INCLUDES) $(INCLUDES) "
+                       "$(if $(%s_CPPFLAGS),$(%s_CPPFLAGS),$(AM_CPPFLAGS)) $(CPPFLAGS) "
+                       "$(if $(%s_CFLAGS),$(%s_CFLAGS),$(AM_CFLAGS)) $(CFLAGS) "
+                       "-MT $@ -MD -MP -MF .deps/%s.Tpo -c -o $@ $<\n"
+                       "\t$(AM_V_at)mv -f .deps/%s.Tpo .deps/%s.Po\n"
+                       "-include .deps/%s.Po\n",
+                       object, unit_path, target, target, target, target, object, object, object,
+                       object);
+            }
+
+            printf("Unity build: %s: %d of %d sources in %d unity file%s\n", target,
+                   batched_sources, word_count, batches, batches == 1 ? "" : "s");
+            unity_targets++;
+        }
+
+        for (int i = 0; i < count; i++) {
+            name_set_free(&sources[i].local);
+            name_set_free(&sources[i].global);
+            name_set_free(&sources[i].macros);
+        }
+        free(sources);
+        am_free_words(words, word_count);
+    }
+    am_free(&am);
+
+    append_format(&mk, &mk_len, &mk_cap, "endif\n");
+
+    char mk_path[PATH_MAX + 16];
+    snprintf(mk_path, sizeof(mk_path), "%s/unity.mk", unity_dir);
+    int result = write_if_changed(mk_path, mk);
+    free(mk);
+
+    if (result != 0) {
+        fprintf(stderr, "Warning: Cannot write %s, skipping unity build\n", mk_path);
+        return -1;
+    }
+    if (unity_targets > 0) {
+        snprintf(make_vars, size, "MAKEFILES=%s", mk_path);
+    } else {
+        printf("Unity build: no target has enough sources to batch\n");
+    }
+    return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef UNITY_H
+#define UNITY_H
+
+#include <stddef.h>
+
+int unity_prepare(const char *build_dir, int batch_size, int jobs, char *make_vars, size_t size);
+
+#endif // UNITY_H
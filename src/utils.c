@@ -1,7 +1,12 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "utils.h"
+#include "process.h"
 #include <errno.h>
+#include <stdarg.h>
 #include <limits.h>
 #include <dirent.h>
+#include <fcntl.h>
 
 #ifndef PATH_MAX
 #define PATH_MAX 4096
@@ -31,6 +36,38 @@ int directory_exists(const char *path) {
     return 0;
 }
 
+// Remove a directory and everything below it
+int remove_directory(const char *path) {
+    DIR *d = opendir(path);
+    if (!d) {
+        return 0; // Directory doesn't exist or can't be opened
+    }
+    
+    struct dirent *entry;
+    char filepath[PATH_MAX];
+    
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        
+        snprintf(filepath, sizeof(filepath), "%s/%s", path, entry->d_name);
+        
+        struct stat st;
+        if (stat(filepath, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                remove_directory(filepath);
+            } else {
+                unlink(filepath);
+            }
+        }
+    }
+    
+    closedir(d);
+    rmdir(path);
+    return 0;
+}
+
 int copy_file(const char *src, const char *dst) {
     FILE *source = fopen(src, "r");
     if (!source) {
@@ -98,19 +135,97 @@ char *read_file(const char *path) {
     return content;
 }
 
-int execute_command(const char *cmd) {
-    printf("Executing: %s\n", cmd);
-    int ret = system(cmd);
-    if (ret != 0) {
-        fprintf(stderr, "Command failed with exit code: %d\n", ret);
+// Write a file only when its content changes, so make doesn't rebuild it
+int write_if_changed(const char *path, const char *content) {
+    char *old = read_file(path);
+    int same = old && strcmp(old, content) == 0;
+    free(old);
+    return same ? 0 : write_file(path, content);
+}
+
+// Append printf-style output to a growing string buffer
+void append_format(char **buf, size_t *len, size_t *cap, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int needed = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    if (*len + needed + 1 > *cap) {
+        while (*len + needed + 1 > *cap) {
+            *cap = *cap ? *cap * 2 : 4096;
+        }
+        *buf = realloc(*buf, *cap);
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(*buf + *len, *cap - *len, fmt, ap);
+    va_end(ap);
+    *len += needed;
+}
+
+// Write s as a quoted JSON string
+void json_write_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/**
+ * Run a command in a directory, showing it first
+ *
+ * @param dir Working directory, or NULL for the current one
+ * @param argv Program and arguments (no shell is involved)
+ * @return 0 if it exited with status 0, -1 otherwise
+ */
+int execute_command_in(const char *dir, char *const argv[]) {
+    char display[PATH_MAX * 4];
+    process_format(argv, display, sizeof(display));
+    if (dir) {
+        printf("Executing: cd '%s' && %s\n", dir, display);
+    } else {
+        printf("Executing: %s\n", display);
+    }
+    fflush(stdout);
+
+    process_options options = {0};
+    options.cwd = dir;
+    process_result result;
+    if (process_run(argv, &options, &result) != 0) {
+        fprintf(stderr, "Error: Cannot run %s: %s\n", argv[0], strerror(errno));
+        return -1;
+    }
+    if (!result.exited || result.exit_code != 0) {
+        char how[128];
+        process_describe(&result, how, sizeof(how));
+        fprintf(stderr, "Command failed: %s %s\n", argv[0], how);
         return -1;
     }
     return 0;
 }
 
-int execute_command_quiet(const char *cmd) {
-    int ret = system(cmd);
-    return ret == 0 ? 0 : -1;
+int execute_command(char *const argv[]) {
+    return execute_command_in(NULL, argv);
+}
+
+// Run a command with its output discarded
+int execute_command_quiet(char *const argv[]) {
+    process_options options = {0};
+    options.out = PROCESS_DISCARD;
+    options.err = PROCESS_DISCARD;
+    process_result result;
+    if (process_run(argv, &options, &result) != 0) {
+        return -1;
+    }
+    return result.exited && result.exit_code == 0 ? 0 : -1;
 }
 
 char *get_template_path(const char *template_name) {
@@ -156,6 +271,64 @@ char *get_template_path(const char *template_name) {
     return NULL;
 }
 
+/**
+ * Find a helper library shipped with jc ($JC_LIB_DIR, next to the jc
+ * binary as in the build tree, then <prefix>/lib/jc)
+ *
+ * @return 0 on success, -1 if it isn't found
+ */
+int get_library_path(const char *name, char *output, size_t output_size) {
+    const char *dir = getenv("JC_LIB_DIR");
+    if (dir && *dir) {
+        snprintf(output, output_size, "%s/%s", dir, name);
+        if (file_exists(output)) {
+            return 0;
+        }
+    }
+
+    char self[PATH_MAX];
+    if (get_self_path(self, sizeof(self)) == 0) {
+        char *slash = strrchr(self, '/');
+        if (slash) {
+            *slash = '\0';
+            snprintf(output, output_size, "%s/%s", self, name);
+            if (file_exists(output)) {
+                return 0;
+            }
+            snprintf(output, output_size, "%s/../lib/jc/%s", self, name);
+            if (file_exists(output)) {
+                return 0;
+            }
+        }
+    }
+
+    const char *install_prefixes[] = {"/usr/local", "/usr", NULL};
+    for (int i = 0; install_prefixes[i] != NULL; i++) {
+        snprintf(output, output_size, "%s/lib/jc/%s", install_prefixes[i], name);
+        if (file_exists(output)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Build "LD_PRELOAD=<library>[:<existing>]" for a helper library shipped
+ * with jc, keeping whatever the user already preloads
+ *
+ * @return 0 on success, -1 if the library isn't found
+ */
+int get_preload_env(const char *name, char *output, size_t output_size) {
+    char library[PATH_MAX];
+    if (get_library_path(name, library, sizeof(library)) != 0) {
+        return -1;
+    }
+    const char *existing = getenv("LD_PRELOAD");
+    snprintf(output, output_size, "LD_PRELOAD=%s%s%s", library, existing && *existing ? ":" : "",
+             existing ? existing : "");
+    return 0;
+}
+
 int is_automake_project(void) {
     return file_exists("configure.ac") || file_exists("configure.in");
 }
@@ -187,6 +360,92 @@ int find_executable(const char *dir, char *output, size_t output_size) {
     return -1;
 }
 
+/**
+ * Locate a program on $PATH
+ *
+ * @param name The program name
+ * @param output Buffer receiving the full path of the program
+ * @param output_size Size of the output buffer
+ * @return 0 if found, -1 otherwise
+ */
+int find_in_path(const char *name, char *output, size_t output_size) {
+    const char *path_env = getenv("PATH");
+    if (!path_env) {
+        path_env = "/usr/local/bin:/usr/bin:/bin";
+    }
+
+    const char *dir = path_env;
+    while (*dir) {
+        const char *sep = strchr(dir, ':');
+        size_t len = sep ? (size_t)(sep - dir) : strlen(dir);
+
+        char candidate[PATH_MAX];
+        if (len == 0) {
+            snprintf(candidate, sizeof(candidate), "./%s", name);
+        } else {
+            snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)len, dir, name);
+        }
+
+        struct stat st;
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+            snprintf(output, output_size, "%s", candidate);
+            return 0;
+        }
+
+        if (!sep) {
+            break;
+        }
+        dir = sep + 1;
+    }
+
+    return -1;
+}
+
+/**
+ * Get the absolute path of the running jc binary, so it can be handed to
+ * child processes (e.g. as a compiler wrapper)
+ *
+ * @return 0 on success, -1 on error
+ */
+int get_self_path(char *output, size_t output_size) {
+    ssize_t len = readlink("/proc/self/exe", output, output_size - 1);
+    if (len > 0) {
+        output[len] = '\0';
+        return 0;
+    }
+
+    // No procfs (e.g. macOS): fall back to the first jc on PATH
+    return find_in_path("jc", output, output_size);
+}
+
+/**
+ * Get the user cache directory for jc ($JC_CACHE_DIR, else
+ * $XDG_CACHE_HOME/jc, else ~/.cache/jc), creating it if needed
+ *
+ * @return 0 on success, -1 on error
+ */
+int get_cache_dir(char *output, size_t output_size) {
+    const char *dir = getenv("JC_CACHE_DIR");
+    if (dir && *dir) {
+        snprintf(output, output_size, "%s", dir);
+    } else if ((dir = getenv("XDG_CACHE_HOME")) != NULL && *dir) {
+        snprintf(output, output_size, "%s/jc", dir);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home || !*home) {
+            return -1;
+        }
+        char parent[PATH_MAX];
+        snprintf(parent, sizeof(parent), "%s/.cache", home);
+        if (create_directory(parent) != 0) {
+            return -1;
+        }
+        snprintf(output, output_size, "%s/jc", parent);
+    }
+
+    return create_directory(output);
+}
+
 /**
  * Replace all occurrences of a regex pattern in a string with support for capture groups
  * 
@@ -324,3 +583,339 @@ char *regex_replace(const char *input, const char *pattern, const char *replacem
 
     return output;
 }
+
+/**
+ * Look up a "key = value" setting in a file
+ *
+ * Blank lines and lines starting with '#' are ignored. If a key
+ * appears more than once, the last value wins.
+ *
+ * @param path The settings file
+ * @param key The setting name
+ * @return A newly allocated copy of the value, or NULL if not set
+ *         (Caller is responsible for freeing the returned string)
+ */
+char *read_setting(const char *path, const char *key) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return NULL;
+    }
+
+    char line[1024];
+    char *value = NULL;
+    size_t key_len = strlen(key);
+
+    while (fgets(line, sizeof(line), file)) {
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') {
+            continue;
+        }
+        if (strncmp(p, key, key_len) != 0) {
+            continue;
+        }
+        p += key_len;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != '=') {
+            continue;
+        }
+        p++;
+        while (*p == ' ' || *p == '\t') p++;
+
+        // Trim trailing whitespace and newline
+        char *end = p + strlen(p);
+        while (end > p && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+        *end = '\0';
+
+        free(value);
+        value = malloc(strlen(p) + 1);
+        if (value) {
+            strcpy(value, p);
+        }
+    }
+
+    fclose(file);
+    return value;
+}
+
+/**
+ * Set a "key = value" entry in a settings file, replacing any existing
+ * entry for the key and keeping all other lines. Passing a NULL value
+ * removes the key.
+ *
+ * @return 0 on success, -1 on error
+ */
+int write_setting(const char *path, const char *key, const char *value) {
+    char *content = read_file(path);
+    size_t key_len = strlen(key);
+    size_t size = (content ? strlen(content) : 0) + key_len + (value ? strlen(value) : 0) + 8;
+    char *output = malloc(size);
+    if (!output) {
+        free(content);
+        return -1;
+    }
+
+    char *out = output;
+    const char *line = content;
+    while (line && *line) {
+        const char *line_end = strchr(line, '\n');
+        size_t len = line_end ? (size_t)(line_end - line + 1) : strlen(line);
+
+        const char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        int matches = strncmp(p, key, key_len) == 0;
+        if (matches) {
+            p += key_len;
+            while (*p == ' ' || *p == '\t') p++;
+            matches = (*p == '=');
+        }
+
+        if (!matches) {
+            memcpy(out, line, len);
+            out += len;
+            if (!line_end) {
+                *out++ = '\n';
+            }
+        }
+        line += len;
+    }
+
+    if (value) {
+        out += sprintf(out, "%s = %s\n", key, value);
+    }
+    *out = '\0';
+
+    int ret = write_file(path, output);
+    free(content);
+    free(output);
+    return ret;
+}
+
+// Look up a per-project setting in .jc/config
+char *get_project_setting(const char *key) {
+    return read_setting(".jc/config", key);
+}
+
+// Read the CPU limit from a cgroup v2 cpu.max file ("max 100000" or "<quota> <period>")
+static int read_cpu_max(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+
+    char quota[32];
+    long period = 0;
+    int limit = 0;
+    if (fscanf(f, "%31s %ld", quota, &period) == 2 && strcmp(quota, "max") != 0 && period > 0) {
+        long q = atol(quota);
+        limit = (int)((q + period - 1) / period);
+        if (limit < 1) limit = 1;
+    }
+
+    fclose(f);
+    return limit;
+}
+
+// Find the cgroup v2 CPU quota for this process, or 0 if unlimited
+static int cgroup_cpu_limit(void) {
+    char cgroup[PATH_MAX] = "";
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (f) {
+        char line[PATH_MAX];
+        while (fgets(line, sizeof(line), f)) {
+            // The unified hierarchy is the "0::<path>" entry
+            if (strncmp(line, "0::", 3) == 0) {
+                snprintf(cgroup, sizeof(cgroup), "%s", line + 3);
+                cgroup[strcspn(cgroup, "\n")] = '\0';
+                break;
+            }
+        }
+        fclose(f);
+    }
+
+    // Walk from our own cgroup up to the root; the tightest limit wins
+    int limit = 0;
+    char path[PATH_MAX + 32];
+    while (1) {
+        snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", cgroup);
+        int l = read_cpu_max(path);
+        if (l > 0 && (limit == 0 || l < limit)) {
+            limit = l;
+        }
+
+        char *slash = strrchr(cgroup, '/');
+        if (!slash || cgroup[0] == '\0') {
+            break;
+        }
+        *slash = '\0';
+    }
+
+    return limit;
+}
+
+// Drop "." and "dir/.." components of a path, without looking at the filesystem
+void clean_path(const char *path, char *output, size_t size) {
+    char copy[PATH_MAX];
+    snprintf(copy, sizeof(copy), "%s", path);
+    const char *parts[PATH_MAX / 2];
+    int count = 0;
+    char *save = NULL;
+    for (char *part = strtok_r(copy, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        if (strcmp(part, ".") == 0) {
+            continue;
+        }
+        if (strcmp(part, "..") == 0 && count > 0 && strcmp(parts[count - 1], "..") != 0) {
+            count--;
+            continue;
+        }
+        parts[count++] = part;
+    }
+    size_t len = snprintf(output, size, "%s", path[0] == '/' ? "/" : "");
+    for (int i = 0; i < count && len < size; i++) {
+        len += snprintf(output + len, size - len, "%s%s", i ? "/" : "", parts[i]);
+    }
+    if (len == 0) {
+        snprintf(output, size, ".");
+    }
+}
+
+// Join path onto base (unless path is absolute or base is "."), then clean it
+void join_path(char *output, size_t size, const char *base, const char *path) {
+    char joined[PATH_MAX * 2];
+    if (path[0] == '/' || strcmp(base, ".") == 0) {
+        snprintf(joined, sizeof(joined), "%s", path);
+    } else {
+        snprintf(joined, sizeof(joined), "%s/%s", base, path);
+    }
+    clean_path(joined, output, size);
+}
+
+int has_suffix(const char *s, const char *suffix) {
+    size_t len = strlen(s);
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+
+// Parse a job count; "auto" and empty mean auto-detect (returns 0)
+int parse_jobs(const char *value) {
+    if (!value || *value == '\0' || strcmp(value, "auto") == 0) {
+        return 0;
+    }
+
+    char *end;
+    long jobs = strtol(value, &end, 10);
+    if (*end != '\0' || jobs < 1 || jobs > 4096) {
+        return -1;
+    }
+    return (int)jobs;
+}
+
+/**
+ * Pick a parallel job count for make
+ *
+ * Starts from the number of online CPUs, caps it at the cgroup v2
+ * cpu.max quota, then backs off by the current 1-minute load average
+ * (never below half the available CPUs).
+ *
+ * @return The number of jobs to run, at least 1
+ */
+int detect_job_count(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        cpus = 1;
+    }
+
+    int limit = cgroup_cpu_limit();
+    if (limit > 0 && limit < cpus) {
+        cpus = limit;
+    }
+
+    int jobs = (int)cpus;
+    FILE *f = fopen("/proc/loadavg", "r");
+    if (f) {
+        double load = 0;
+        if (fscanf(f, "%lf", &load) == 1 && load >= 1.0) {
+            int floor_jobs = (jobs + 1) / 2;
+            jobs -= (int)load;
+            if (jobs < floor_jobs) {
+                jobs = floor_jobs;
+            }
+        }
+        fclose(f);
+    }
+
+    return jobs < 1 ? 1 : jobs;
+}
+
+// Whether the jobserver named by a --jobserver-auth/--jobserver-fds value can be used
+static int jobserver_usable(const char *auth) {
+    if (strncmp(auth, "fifo:", 5) == 0) {
+        char path[PATH_MAX];
+        size_t len = strcspn(auth + 5, " ");
+        if (len == 0 || len >= sizeof(path)) {
+            return 0;
+        }
+        memcpy(path, auth + 5, len);
+        path[len] = '\0';
+        int fd = open(path, O_RDWR | O_NONBLOCK);
+        if (fd < 0) {
+            return 0;
+        }
+        close(fd);
+        return 1;
+    }
+
+    int read_fd;
+    int write_fd;
+    if (sscanf(auth, "%d,%d", &read_fd, &write_fd) != 2 || read_fd < 0 || write_fd < 0) {
+        return 0;
+    }
+    return fcntl(read_fd, F_GETFD) != -1 && fcntl(write_fd, F_GETFD) != -1;
+}
+
+/**
+ * Check whether we are running under a parent make that already
+ * provides a jobserver (or an explicit -j), in which case the child
+ * make must not be given its own -j.
+ *
+ * A parent only hands its jobserver to recipes marked $(MAKE) or '+';
+ * otherwise MAKEFLAGS still names it but the descriptors are closed, and
+ * the child would fall back to -j1, so the jobserver must be reachable.
+ */
+int makeflags_has_jobserver(void) {
+    const char *flags = getenv("MAKEFLAGS");
+    if (!flags) {
+        return 0;
+    }
+
+    // The last jobserver option is the one make uses
+    const char *auth = NULL;
+    const char *options[] = {"--jobserver-auth=", "--jobserver-fds="};
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        for (const char *p = strstr(flags, options[i]); p; p = strstr(p + 1, options[i])) {
+            if (!auth || p > auth) {
+                auth = p + strlen(options[i]);
+            }
+        }
+    }
+    if (auth) {
+        return jobserver_usable(auth);
+    }
+
+    // Single-letter flags are grouped in the first word (e.g. "sj" or "-j4");
+    // without a jobserver option that means an unlimited -j
+    const char *p = flags;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '-') p++;
+    while (*p && *p != ' ' && *p != '-') {
+        if (*p == 'j') {
+            return 1;
+        }
+        p++;
+    }
+
+    return 0;
+}
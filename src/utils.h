@@ -12,14 +12,33 @@
 int create_directory(const char *path);
 int file_exists(const char *path);
 int directory_exists(const char *path);
+int remove_directory(const char *path);
 int copy_file(const char *src, const char *dst);
 int write_file(const char *path, const char *content);
 char *read_file(const char *path);
-int execute_command(const char *cmd);
-int execute_command_quiet(const char *cmd);
+int write_if_changed(const char *path, const char *content);
+void append_format(char **buf, size_t *len, size_t *cap, const char *fmt, ...);
+void json_write_string(FILE *out, const char *s);
+int execute_command(char *const argv[]);
+int execute_command_in(const char *dir, char *const argv[]);
+int execute_command_quiet(char *const argv[]);
 char *get_template_path(const char *template_name);
+int get_library_path(const char *name, char *output, size_t output_size);
+int get_preload_env(const char *name, char *output, size_t output_size);
 int is_automake_project(void);
 int find_executable(const char *dir, char *output, size_t output_size);
+int find_in_path(const char *name, char *output, size_t output_size);
+int get_self_path(char *output, size_t output_size);
+int get_cache_dir(char *output, size_t output_size);
 char *regex_replace(const char *input, const char *pattern, const char *replacement);
+char *read_setting(const char *path, const char *key);
+int write_setting(const char *path, const char *key, const char *value);
+char *get_project_setting(const char *key);
+void clean_path(const char *path, char *output, size_t size);
+void join_path(char *output, size_t size, const char *base, const char *path);
+int has_suffix(const char *s, const char *suffix);
+int parse_jobs(const char *value);
+int detect_job_count(void);
+int makeflags_has_jobserver(void);
 
 #endif // UTILS_H
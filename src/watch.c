@@ -0,0 +1,461 @@
+#include "jc.h"
+#include "utils.h"
+#include "watch.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+// Quiet time after the last change before rebuilding, in milliseconds
+#define DEFAULT_DEBOUNCE_MS 150
+
+// Grace period between SIGTERM and SIGKILL for the previous run
+#define STOP_TIMEOUT_MS 2000
+
+static void print_watch_usage(void) {
+    printf("Usage: jc build --watch [options] [-- <program arguments>]\n\n");
+    printf("Builds, then rebuilds whenever a source, header or build file changes.\n\n");
+    printf("Options:\n");
+    printf("  --run              Run the program after each successful build\n");
+    printf("  --test             Run the tests after each successful build\n");
+    printf("  --debounce=<ms>    Wait this long after the last change (default: %d)\n",
+           DEFAULT_DEBOUNCE_MS);
+    printf("  Other 'jc build' options (--profile, -j, --backend, ...) are passed on.\n\n");
+    printf("A run or test that is still going when the next change arrives is stopped.\n\n");
+    printf("Examples:\n");
+    printf("  jc build --watch\n");
+    printf("  jc build --watch --run -- input.txt\n");
+    printf("  jc build --watch --profile=debug --test\n\n");
+}
+
+#ifdef __linux__
+
+// Events that mean a file's content or a directory's entries changed
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE)
+
+// Directories watched recursively; the top level is watched on its own
+static const char *const watch_roots[] = {"src", "include", "tests", "m4", NULL};
+
+// Generated directories below the watched ones
+static const char *const ignored_dirs[] = {"build", "pch", ".deps", ".libs", NULL};
+
+// Inotify watch descriptors and the directories they belong to
+typedef struct {
+    int fd;
+    int *wds;
+    char **paths;
+    int count;
+} watch_set;
+
+// What changed during one burst of events
+typedef struct {
+    int files;
+    int build_system;
+    char first[PATH_MAX];
+} change_summary;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+// Process group of the run or test started after the last build
+static pid_t runner = 0;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void add_watch(watch_set *ws, const char *path, int recursive) {
+    int wd = inotify_add_watch(ws->fd, path, WATCH_EVENTS | IN_ONLYDIR);
+    if (wd < 0) {
+        return;
+    }
+    ws->wds = realloc(ws->wds, (ws->count + 1) * sizeof(int));
+    ws->paths = realloc(ws->paths, (ws->count + 1) * sizeof(char *));
+    ws->wds[ws->count] = wd;
+    ws->paths[ws->count] = strdup(path);
+    ws->count++;
+
+    if (!recursive) {
+        return;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        int ignored = 0;
+        for (int i = 0; ignored_dirs[i]; i++) {
+            if (strcmp(entry->d_name, ignored_dirs[i]) == 0) {
+                ignored = 1;
+            }
+        }
+
+        char child[PATH_MAX];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (!ignored && directory_exists(child)) {
+            add_watch(ws, child, 1);
+        }
+    }
+    closedir(dir);
+}
+
+static const char *watched_path(const watch_set *ws, int wd) {
+    for (int i = 0; i < ws->count; i++) {
+        if (ws->wds[i] == wd) {
+            return ws->paths[i];
+        }
+    }
+    return NULL;
+}
+
+static void free_watch_set(watch_set *ws) {
+    for (int i = 0; i < ws->count; i++) {
+        free(ws->paths[i]);
+    }
+    free(ws->wds);
+    free(ws->paths);
+    close(ws->fd);
+}
+
+/**
+ * Whether a changed file is an input of the build
+ *
+ * Build output (objects, programs, config.h, Makefile.in) lands in the
+ * same directories for in-tree builds and must not trigger a rebuild.
+ *
+ * @param build_system Set when the file needs autogen/configure to rerun
+ */
+static int is_build_input(const char *dir, const char *name, int *build_system) {
+    static const char *const source_suffixes[] = {".c", ".h", ".inc", ".def", NULL};
+
+    if (strcmp(name, "configure.ac") == 0 || strcmp(name, "Makefile.am") == 0) {
+        *build_system = 1;
+        return 1;
+    }
+    // Only configure.ac and the top Makefile.am matter at the top level
+    if (strcmp(dir, ".") == 0) {
+        return 0;
+    }
+
+    size_t len = strlen(name);
+    if (len > 3 && strcmp(name + len - 3, ".m4") == 0) {
+        *build_system = 1;
+        return 1;
+    }
+    for (int i = 0; source_suffixes[i]; i++) {
+        size_t suffix_len = strlen(source_suffixes[i]);
+        if (len > suffix_len && strcmp(name + len - suffix_len, source_suffixes[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Read the pending events into the summary
+ *
+ * @param timeout_ms How long to wait for the first event; -1 waits forever
+ * @return 1 if events were read, 0 on timeout, -1 when interrupted
+ */
+static int read_events(watch_set *ws, int timeout_ms, change_summary *summary) {
+    struct pollfd pfd = {ws->fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready < 0) {
+        return errno == EINTR ? -1 : 0;
+    }
+    if (ready == 0) {
+        return 0;
+    }
+
+    char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(ws->fd, buffer, sizeof(buffer));
+    if (len <= 0) {
+        return 0;
+    }
+
+    for (char *p = buffer; p < buffer + len;) {
+        struct inotify_event *event = (struct inotify_event *)p;
+        p += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            // Events were lost; rebuild to be safe
+            summary->files++;
+            summary->build_system = 1;
+            continue;
+        }
+
+        const char *dir = watched_path(ws, event->wd);
+        if (!dir || event->len == 0) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, event->name);
+        if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+            // New directories are watched from now on
+            if (strcmp(dir, ".") != 0 && event->name[0] != '.') {
+                add_watch(ws, path, 1);
+            }
+            continue;
+        }
+
+        // A new file is counted when it is written; editors save some files twice
+        if ((event->mask & IN_CREATE) || strcmp(path + (strncmp(path, "./", 2) == 0 ? 2 : 0), summary->first) == 0) {
+            continue;
+        }
+        if (is_build_input(dir, event->name, &summary->build_system)) {
+            if (summary->files++ == 0) {
+                snprintf(summary->first, sizeof(summary->first), "%s",
+                         strncmp(path, "./", 2) == 0 ? path + 2 : path);
+            }
+        }
+    }
+    return 1;
+}
+
+// Stop the previous run if it is still going, with all of its children
+static void stop_runner(void) {
+    if (runner <= 0) {
+        return;
+    }
+
+    if (waitpid(runner, NULL, WNOHANG) == 0) {
+        printf("Stopping the previous run (pid %d)\n", (int)runner);
+        kill(-runner, SIGTERM);
+        struct timespec pause = {0, 50 * 1000 * 1000};
+        int waited = 0;
+        while (waitpid(runner, NULL, WNOHANG) == 0 && waited < STOP_TIMEOUT_MS) {
+            nanosleep(&pause, NULL);
+            waited += 50;
+        }
+        if (waited >= STOP_TIMEOUT_MS) {
+            kill(-runner, SIGKILL);
+            waitpid(runner, NULL, 0);
+        }
+    }
+    runner = 0;
+}
+
+// Run 'jc build' with the forwarded options in a child process
+static int run_build(int argc, char *argv[]) {
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        exit(cmd_build(argc, argv));
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return 1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+// Start 'jc run' or 'jc test run' in its own process group
+static void start_runner(int argc, char *argv[], int test) {
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        exit(test ? cmd_test(argc, argv) : cmd_run(argc, argv));
+    }
+    setpgid(pid, pid);
+    runner = pid;
+}
+
+/**
+ * Build, then rebuild on every change until interrupted
+ *
+ * Each build is a normal 'jc build', which already reruns autogen and
+ * configure only when configure.ac or a Makefile.am changed and leaves
+ * the rest to make or ninja.
+ */
+int watch_build(int argc, char *argv[]) {
+    int run = 0;
+    int test = 0;
+    int debounce_ms = DEFAULT_DEBOUNCE_MS;
+    char profile_option[256] = "";
+
+    // build: "build" + forwarded options; runner: "run"/"test run" + profile + program arguments
+    char **build_argv = calloc(argc + 1, sizeof(char *));
+    char **runner_argv = calloc(argc + 4, sizeof(char *));
+    int build_argc = 0;
+    int runner_argc = 0;
+    build_argv[build_argc++] = "build";
+
+    int program_args = argc;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--") == 0) {
+            program_args = i + 1;
+            break;
+        } else if (strcmp(arg, "--watch") == 0) {
+            continue;
+        } else if (strcmp(arg, "--run") == 0) {
+            run = 1;
+        } else if (strcmp(arg, "--test") == 0) {
+            test = 1;
+        } else if (strncmp(arg, "--debounce=", 11) == 0) {
+            char *end;
+            long value = strtol(arg + 11, &end, 10);
+            if (*end || value < 0 || value > 60000) {
+                fprintf(stderr, "Error: Invalid debounce time '%s'\n", arg + 11);
+                free(build_argv);
+                free(runner_argv);
+                return 1;
+            }
+            debounce_ms = (int)value;
+        } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            print_watch_usage();
+            free(build_argv);
+            free(runner_argv);
+            return 0;
+        } else {
+            build_argv[build_argc++] = argv[i];
+            // The run or test uses the same build profile
+            if (strncmp(arg, "--profile=", 10) == 0) {
+                snprintf(profile_option, sizeof(profile_option), "%s", arg);
+            } else if (strcmp(arg, "--profile") == 0 && i + 1 < argc) {
+                build_argv[build_argc++] = argv[++i];
+                snprintf(profile_option, sizeof(profile_option), "--profile=%s", argv[i]);
+            }
+        }
+    }
+
+    if (run && test) {
+        fprintf(stderr, "Error: Use either --run or --test\n");
+        free(build_argv);
+        free(runner_argv);
+        return 1;
+    }
+    if (test) {
+        runner_argv[runner_argc++] = "test";
+        runner_argv[runner_argc++] = "run";
+    } else {
+        runner_argv[runner_argc++] = "run";
+    }
+    if (*profile_option) {
+        runner_argv[runner_argc++] = profile_option;
+    }
+    for (int i = program_args; i < argc && run; i++) {
+        runner_argv[runner_argc++] = argv[i];
+    }
+
+    if (!is_automake_project()) {
+        fprintf(stderr, "Error: Not in an automake project directory\n");
+        free(build_argv);
+        free(runner_argv);
+        return 1;
+    }
+
+    watch_set ws = {0};
+    ws.fd = inotify_init1(IN_CLOEXEC);
+    if (ws.fd < 0) {
+        perror("inotify_init1");
+        free(build_argv);
+        free(runner_argv);
+        return 1;
+    }
+    add_watch(&ws, ".", 0);
+    for (int i = 0; watch_roots[i]; i++) {
+        if (directory_exists(watch_roots[i])) {
+            add_watch(&ws, watch_roots[i], 1);
+        }
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!stop_requested) {
+        if (run_build(build_argc, build_argv) == 0) {
+            if (run || test) {
+                start_runner(runner_argc, runner_argv, test);
+            }
+        } else if (!stop_requested) {
+            printf("\nBuild failed\n");
+        }
+
+        printf("\n==> Watching for changes (Ctrl-C to stop)\n");
+        fflush(stdout);
+
+        // Wait for a change, then for the burst of writes to settle
+        change_summary summary = {0};
+        while (!stop_requested && summary.files == 0) {
+            if (read_events(&ws, -1, &summary) < 0 && stop_requested) {
+                break;
+            }
+        }
+        while (!stop_requested && read_events(&ws, debounce_ms, &summary) > 0) {
+        }
+        if (stop_requested) {
+            break;
+        }
+
+        printf("\n==> %s changed", summary.first[0] ? summary.first : "The build");
+        if (summary.files > 1) {
+            printf(" (and %d more)", summary.files - 1);
+        }
+        printf("%s\n", summary.build_system ? "; regenerating the build system" : "; rebuilding");
+        stop_runner();
+        printf("\n");
+    }
+
+    stop_runner();
+    free_watch_set(&ws);
+    free(build_argv);
+    free(runner_argv);
+    printf("\nStopped watching\n");
+    return 0;
+}
+
+#else
+
+int watch_build(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_watch_usage();
+            return 0;
+        }
+    }
+    fprintf(stderr, "Error: 'jc build --watch' needs inotify, which is only available on Linux\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+int watch_build(int argc, char *argv[]);
+
+#endif // WATCH_H
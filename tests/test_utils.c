@@ -4,7 +4,25 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include "jc.h"
 #include "utils.h"
+#include "hash.h"
+#include "compile_args.h"
+#include "makefile_am.h"
+#include "process.h"
+#include "diag.h"
+#include "bench.h"
+#include "profile.h"
+#include "heap.h"
+#include "manifest.h"
+#include "symbols.h"
+#include "stale.h"
+#include "shard.h"
+#include "test_cache.h"
+#include "affected.h"
+#include <math.h>
+#include <inttypes.h>
+#include <fcntl.h>
 
 // Global test directory for fixture
 static char test_dir[256];
@@ -101,11 +119,134 @@ END_TEST
 
 // Test: Execute command quiet
 START_TEST(test_execute_command_quiet) {
+    char *const ok[] = {"true", NULL};
+    char *const fail[] = {"false", NULL};
+    char *const missing[] = {"jc-no-such-program", NULL};
+
     // Test successful command
-    ck_assert_int_eq(execute_command_quiet("true"), 0);
+    ck_assert_int_eq(execute_command_quiet(ok), 0);
 
     // Test failing command
-    ck_assert_int_ne(execute_command_quiet("false"), 0);
+    ck_assert_int_ne(execute_command_quiet(fail), 0);
+    ck_assert_int_ne(execute_command_quiet(missing), 0);
+}
+END_TEST
+
+// Test: Process layer (argument splitting, capture, exact status, timeout)
+START_TEST(test_process) {
+    arg_list args = {0};
+    ck_assert_int_eq(args_add_split(&args, "--prefix='/opt/my dir' CFLAGS=\"-O2 -g\" a\\ b"), 3);
+    ck_assert_str_eq(args.argv[0], "--prefix=/opt/my dir");
+    ck_assert_str_eq(args.argv[1], "CFLAGS=-O2 -g");
+    ck_assert_str_eq(args.argv[2], "a b");
+    ck_assert_ptr_null(args.argv[3]);
+    ck_assert_int_eq(args_add_split(&args, "'unterminated"), -1);
+    args_free(&args);
+
+    char formatted[256];
+    char *const quoted[] = {"echo", "it's", "plain", NULL};
+    process_format(quoted, formatted, sizeof(formatted));
+    ck_assert_str_eq(formatted, "echo 'it'\\''s' plain");
+
+    process_options options = {0};
+    options.out = PROCESS_PIPE;
+    options.capture = 1;
+    process_result result;
+    char *const echo[] = {"sh", "-c", "echo out; echo err >&2; exit 3", NULL};
+    options.err = PROCESS_MERGE;
+    ck_assert_int_eq(process_run(echo, &options, &result), 0);
+    ck_assert_int_eq(result.exited, 1);
+    ck_assert_int_eq(result.exit_code, 3);
+    ck_assert_str_eq(result.output, "out\nerr\n");
+    process_result_free(&result);
+
+    char *const crash[] = {"sh", "-c", "kill -SEGV $$", NULL};
+    ck_assert_int_eq(process_run(crash, NULL, &result), 0);
+    ck_assert_int_eq(result.signaled, 1);
+    ck_assert_int_eq(result.signal, 11);
+    ck_assert_int_eq(process_status(&result), 139);
+
+    process_options timed = {0};
+    timed.timeout_ms = 100;
+    char *const slow[] = {"sleep", "10", NULL};
+    ck_assert_int_eq(process_run(slow, &timed, &result), 0);
+    ck_assert_int_eq(result.timed_out, 1);
+    ck_assert_int_eq(result.signaled, 1);
+}
+END_TEST
+
+// Test: Jobs run side by side, each with its own output
+START_TEST(test_process_jobs) {
+    process_options options = {0};
+    options.out = PROCESS_PIPE;
+    options.err = PROCESS_MERGE;
+    options.capture = 1;
+    char *const slow[] = {"sh", "-c", "echo slow; sleep 0.2; echo done", NULL};
+    char *const fast[] = {"sh", "-c", "echo fast >&2; exit 77", NULL};
+    process_job a;
+    process_job b;
+    ck_assert_int_eq(process_start(slow, &options, &a), 0);
+    ck_assert_int_eq(process_start(fast, &options, &b), 0);
+
+    process_job *const jobs[] = {&a, &b};
+    int finished = 0;
+    while (finished < 2) {
+        finished += process_poll(jobs, 2, 1000);
+    }
+    ck_assert_str_eq(a.result.output, "slow\ndone\n");
+    ck_assert_int_eq(a.result.exit_code, 0);
+    ck_assert_str_eq(b.result.output, "fast\n");
+    ck_assert_int_eq(b.result.exit_code, 77);
+    ck_assert(b.result.wall_us < a.result.wall_us);
+    process_result_free(&a.result);
+    process_result_free(&b.result);
+}
+END_TEST
+
+// Test: Compiler output is split into diagnostics and deduplicated
+START_TEST(test_diag_parse) {
+    const char *first =
+        "In file included from ../src/a.c:1:\n"
+        "../src/util.h:3:12: warning: 'x' defined but not used [-Wunused-variable]\n"
+        "    3 | static int x;\n"
+        "      |            ^\n"
+        "../src/a.c: In function 'main':\n"
+        "../src/a.c:5:5: error: 'y' undeclared (first use in this function)\n"
+        "../src/a.c:5:5: note: each undeclared identifier is reported only once\n";
+    const char *second =
+        "In file included from b.c:2:\n"
+        "util.h:3:12: warning: 'x' defined but not used [-Wunused-variable]\n"
+        "cc1: all warnings being treated as errors\n";
+
+    // Locations are resolved against the real tree
+    char src[512], build[512], header[512];
+    snprintf(src, sizeof(src), "%s/src", test_dir);
+    snprintf(build, sizeof(build), "%s/build", test_dir);
+    snprintf(header, sizeof(header), "%s/util.h", src);
+    mkdir(src, 0755);
+    mkdir(build, 0755);
+    write_file(header, "static int x;\n");
+    snprintf(header, sizeof(header), "%s/a.c", src);
+    write_file(header, "#include \"util.h\"\n");
+    char root[512];
+    ck_assert_ptr_nonnull(realpath(test_dir, root));
+
+    diag_set set = {0};
+    diag_parse(&set, first, strlen(first), build, root);
+    diag_parse(&set, second, strlen(second), src, root);
+
+    ck_assert_int_eq(set.count, 3);
+    ck_assert_int_eq(set.items[0].severity, DIAG_WARNING);
+    ck_assert_int_eq(set.items[0].line, 3);
+    ck_assert_int_eq(set.items[0].column, 12);
+    ck_assert_int_eq(set.items[0].count, 2);
+    ck_assert_str_eq(set.items[0].file, "src/util.h");
+    ck_assert_ptr_nonnull(strstr(set.items[0].text, "In file included from src/a.c:1:"));
+    ck_assert_int_eq(set.items[1].severity, DIAG_ERROR);
+    ck_assert_ptr_nonnull(strstr(set.items[1].text, "note: each undeclared"));
+    ck_assert_int_eq(set.items[2].severity, DIAG_OUTPUT);
+    ck_assert_str_eq(set.items[2].text, "cc1: all warnings being treated as errors\n");
+    diag_set_free(&set);
 }
 END_TEST
 
@@ -255,6 +396,788 @@ START_TEST(test_regex_replace_edge_cases) {
 }
 END_TEST
 
+// Test: Project settings from .jc/config
+START_TEST(test_get_project_setting) {
+    char cwd[1024];
+    getcwd(cwd, sizeof(cwd));
+    chdir(test_dir);
+
+    // No config file yet
+    ck_assert_ptr_null(get_project_setting("jobs"));
+
+    create_directory(".jc");
+    write_file(".jc/config",
+               "# project defaults\n"
+               "jobs = 6\n"
+               "jobserver=off\n"
+               "  name =  spaced value  \n");
+
+    char *value = get_project_setting("jobs");
+    ck_assert_ptr_nonnull(value);
+    ck_assert_str_eq(value, "6");
+    free(value);
+
+    // Prefix of another key must not match
+    ck_assert_ptr_null(get_project_setting("job"));
+
+    value = get_project_setting("name");
+    ck_assert_ptr_nonnull(value);
+    ck_assert_str_eq(value, "spaced value");
+    free(value);
+
+    chdir(cwd);
+}
+END_TEST
+
+// Test: Writing settings keeps other entries and replaces existing keys
+START_TEST(test_write_setting) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/state", test_dir);
+
+    ck_assert_int_eq(write_setting(path, "autogen", "abc"), 0);
+    ck_assert_int_eq(write_setting(path, "am:src/Makefile.am", "123"), 0);
+    ck_assert_int_eq(write_setting(path, "autogen", "def"), 0);
+
+    char *value = read_setting(path, "autogen");
+    ck_assert_ptr_nonnull(value);
+    ck_assert_str_eq(value, "def");
+    free(value);
+
+    value = read_setting(path, "am:src/Makefile.am");
+    ck_assert_ptr_nonnull(value);
+    ck_assert_str_eq(value, "123");
+    free(value);
+
+    // NULL removes the key
+    ck_assert_int_eq(write_setting(path, "autogen", NULL), 0);
+    ck_assert_ptr_null(read_setting(path, "autogen"));
+}
+END_TEST
+
+// Test: Makefile.am variable parsing
+START_TEST(test_am_parse) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/Makefile.am", test_dir);
+    write_file(path,
+               "# Programs\n"
+               "bin_PROGRAMS = demo\n"
+               "demo_SOURCES = main.c \\\n"
+               "    util.c  # helpers\n"
+               "demo_SOURCES += extra.c\n"
+               "noinst_LIBRARIES = libdemo.a\n"
+               "all-local:\n"
+               "\t@echo CFLAGS = ignored\n");
+
+    am_file am;
+    ck_assert_int_eq(am_parse(path, &am), 0);
+    ck_assert_str_eq(am_get(&am, "bin_PROGRAMS"), "demo");
+    ck_assert_ptr_null(am_get(&am, "CFLAGS"));
+
+    char **words;
+    int count = am_split_words(am_get(&am, "demo_SOURCES"), &words);
+    ck_assert_int_eq(count, 3);
+    ck_assert_str_eq(words[1], "util.c");
+    am_free_words(words, count);
+
+    ck_assert_int_eq(am_has_word(am_get(&am, "demo_SOURCES"), "util.c"), 1);
+    ck_assert_int_eq(am_has_word(am_get(&am, "demo_SOURCES"), "til.c"), 0);
+
+    char target[64];
+    am_target_name("libfoo_a_SOURCES", "_SOURCES", target, sizeof(target));
+    ck_assert_str_eq(target, "libfoo_a");
+
+    char library[64];
+    ck_assert_int_eq(am_convenience_library(&am, library, sizeof(library)), 0);
+    ck_assert_str_eq(library, "libdemo.a");
+    am_free(&am);
+
+    write_file(path, "bin_PROGRAMS = demo\n");
+    ck_assert_int_eq(am_parse(path, &am), 0);
+    ck_assert_int_eq(am_convenience_library(&am, library, sizeof(library)), -1);
+    am_free(&am);
+}
+END_TEST
+
+// Test: SHA-256 digests
+START_TEST(test_hash) {
+    char hex[HASH_HEX_SIZE];
+    hash_ctx ctx;
+
+    hash_init(&ctx);
+    hash_final(&ctx, hex);
+    ck_assert_str_eq(hex, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+
+    hash_init(&ctx);
+    hash_update(&ctx, "abc", 3);
+    hash_final(&ctx, hex);
+    ck_assert_str_eq(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+    // Multi-block input fed in uneven pieces
+    const char *msg = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    hash_init(&ctx);
+    hash_update(&ctx, msg, 5);
+    hash_update(&ctx, msg + 5, strlen(msg) - 5);
+    hash_final(&ctx, hex);
+    ck_assert_str_eq(hex, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/hashme", test_dir);
+    write_file(path, "abc");
+    ck_assert_int_eq(hash_file(path, hex), 0);
+    ck_assert_str_eq(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    ck_assert_int_eq(hash_file("/nonexistent/file", hex), -1);
+}
+END_TEST
+
+// Test: Compiler command-line parsing and cache key arguments
+static void compile_key(int argc, char *argv[], char hex[HASH_HEX_SIZE]) {
+    hash_ctx ctx;
+    hash_init(&ctx);
+    compile_args_hash(&ctx, argc, argv);
+    hash_final(&ctx, hex);
+}
+
+START_TEST(test_compile_args) {
+    compile_args args;
+
+    char *separate[] = {"cc", "-O2", "-MD", "-MF", "dep/foo.Tpo", "-c", "-o", "foo.o", "foo.c"};
+    parse_compile_args(9, separate, &args);
+    ck_assert(args.cacheable);
+    ck_assert(args.compile_only);
+    ck_assert(args.wants_deps);
+    ck_assert_str_eq(args.source, "foo.c");
+    ck_assert_str_eq(args.output, "foo.o");
+    ck_assert_str_eq(args.depfile, "dep/foo.Tpo");
+    ck_assert_str_eq(args.preprocess_argv[args.preprocess_argc - 1], "foo.c");
+    for (int i = 0; i < args.preprocess_argc; i++) {
+        ck_assert_str_ne(args.preprocess_argv[i], "-o");
+        ck_assert_str_ne(args.preprocess_argv[i], "foo.o");
+    }
+    free(args.preprocess_argv);
+
+    char *joined[] = {"cc", "-MMD", "-MFdep/foo.Tpo", "-c", "foo.c"};
+    parse_compile_args(5, joined, &args);
+    ck_assert(args.cacheable);
+    ck_assert_str_eq(args.depfile, "dep/foo.Tpo");
+    ck_assert_ptr_null(args.output);
+    free(args.preprocess_argv);
+
+    char *two_sources[] = {"cc", "-c", "a.c", "b.c"};
+    parse_compile_args(4, two_sources, &args);
+    ck_assert(!args.cacheable);
+    free(args.preprocess_argv);
+
+    char *link[] = {"cc", "-o", "prog", "foo.c"};
+    parse_compile_args(4, link, &args);
+    ck_assert(!args.compile_only);
+    ck_assert(!args.cacheable);
+    free(args.preprocess_argv);
+
+    char *preprocess[] = {"cc", "-E", "-c", "foo.c"};
+    parse_compile_args(4, preprocess, &args);
+    ck_assert(!args.cacheable);
+    free(args.preprocess_argv);
+
+    // The depfile location, however spelled, doesn't change the key
+    char key1[HASH_HEX_SIZE], key2[HASH_HEX_SIZE], key3[HASH_HEX_SIZE];
+    char *dep_a[] = {"cc", "-MD", "-MF", "a.Tpo", "-c", "foo.c"};
+    char *dep_b[] = {"cc", "-MD", "-MFb.Tpo", "-c", "foo.c"};
+    char *dep_none[] = {"cc", "-MD", "-c", "foo.c"};
+    compile_key(6, dep_a, key1);
+    compile_key(5, dep_b, key2);
+    compile_key(4, dep_none, key3);
+    ck_assert_str_eq(key1, key2);
+    ck_assert_str_eq(key1, key3);
+
+    char *optimized[] = {"cc", "-O2", "-c", "foo.c"};
+    compile_key(4, optimized, key2);
+    ck_assert_str_ne(key1, key2);
+
+    // The directory only matters when debug info records it
+    char *plain[] = {"cc", "-O2", "-c", "foo.c"};
+    char *debug[] = {"cc", "-g", "-O2", "-c", "foo.c"};
+    char plain_here[HASH_HEX_SIZE], debug_here[HASH_HEX_SIZE];
+    char original[512];
+    ck_assert_ptr_nonnull(getcwd(original, sizeof(original)));
+    compile_key(4, plain, plain_here);
+    compile_key(5, debug, debug_here);
+    ck_assert_int_eq(chdir(test_dir), 0);
+    compile_key(4, plain, key1);
+    compile_key(5, debug, key2);
+    ck_assert_int_eq(chdir(original), 0);
+    ck_assert_str_eq(plain_here, key1);
+    ck_assert_str_ne(debug_here, key2);
+}
+END_TEST
+
+// Test: Benchmark statistics and the Mann-Whitney U test
+START_TEST(test_bench_stats) {
+    double samples[] = {7, 3, 100, 1, 9, 5, 2, 8, 4, 6};
+    bench_stats stats;
+    bench_compute(samples, 10, &stats);
+    ck_assert_int_eq(stats.count, 10);
+    ck_assert(fabs(stats.mean - 14.5) < 1e-9);
+    ck_assert(fabs(stats.median - 5.5) < 1e-9);
+    ck_assert(fabs(stats.min - 1) < 1e-9);
+    ck_assert(fabs(stats.max - 100) < 1e-9);
+    ck_assert(fabs(stats.p95 - 59.05) < 1e-9);
+    ck_assert_int_eq(stats.severe_outliers, 1);
+    ck_assert_int_eq(stats.mild_outliers, 0);
+
+    double even[] = {2, 4, 4, 4, 5, 5, 7, 9};
+    bench_compute(even, 8, &stats);
+    ck_assert(fabs(stats.mean - 5) < 1e-9);
+    ck_assert(fabs(stats.stddev - sqrt(32.0 / 7)) < 1e-9);
+
+    bench_compute(samples, 1, &stats);
+    ck_assert(fabs(stats.p99 - 7) < 1e-9);
+    ck_assert(stats.stddev == 0);
+
+    // Completely separated series differ; identical ones don't
+    double low[] = {1, 2, 3, 4, 5};
+    double high[] = {6, 7, 8, 9, 10};
+    double p = bench_mann_whitney(low, 5, high, 5);
+    ck_assert(fabs(p - 0.01219) < 1e-4);
+    ck_assert(fabs(bench_mann_whitney(high, 5, low, 5) - p) < 1e-12);
+    ck_assert(bench_mann_whitney(low, 5, low, 5) > 0.99);
+    ck_assert(bench_mann_whitney(even, 8, even, 8) > 0.99);
+
+    ck_assert_int_eq(bench_valid_name("before"), 1);
+    ck_assert_int_eq(bench_valid_name("v1.2-rc_3"), 1);
+    ck_assert_int_eq(bench_valid_name(""), 0);
+    ck_assert_int_eq(bench_valid_name(".hidden"), 0);
+    ck_assert_int_eq(bench_valid_name(".."), 0);
+    ck_assert_int_eq(bench_valid_name("../../escape"), 0);
+    ck_assert_int_eq(bench_valid_name("a/b"), 0);
+    ck_assert(bench_mann_whitney(low, 5, high, 0) == 1.0);
+}
+END_TEST
+
+// Functions for test_profile to find by address
+__attribute__((noinline)) void profile_test_leaf(void) {
+    __asm__ volatile("");
+}
+
+__attribute__((noinline)) void profile_test_caller(void) {
+    profile_test_leaf();
+}
+
+// Test: Symbolizing, folding and drawing samples
+START_TEST(test_profile) {
+    // /proc files report no size, so read_file() can't be used here
+    static char maps[1 << 16];
+    FILE *file = fopen("/proc/self/maps", "r");
+    ck_assert_ptr_nonnull(file);
+    maps[fread(maps, 1, sizeof(maps) - 1, file)] = '\0';
+    fclose(file);
+    profile_data data = {0};
+    pid_t pid = getpid();
+    profile_add_maps(&data, pid, 1, maps);
+    ck_assert_int_gt(data.map_count, 0);
+
+    // Inner frame first; return addresses point just past the call
+    uint64_t frames[] = {(uint64_t)(uintptr_t)profile_test_leaf,
+                         (uint64_t)(uintptr_t)profile_test_caller + 1};
+    profile_add_sample(&data, pid, 2, frames, 2);
+    profile_add_sample(&data, pid, 3, frames, 2);
+    // A forked child that hasn't exec'd runs its parent's image
+    profile_add_task(&data, pid + 100000, pid, 4);
+    profile_add_sample(&data, pid + 100000, 5, frames, 1);
+    // After an exec the old mappings no longer apply
+    profile_add_task(&data, pid, 0, 6);
+    profile_add_sample(&data, pid, 7, frames, 1);
+
+    folded_set set;
+    profile_fold(&data, &set);
+    profile_data_free(&data);
+    ck_assert_int_eq(set.total, 4);
+    ck_assert_int_eq(set.count, 3);
+    int found_stack = 0;
+    int found_leaf = 0;
+    int found_unknown = 0;
+    for (int i = 0; i < set.count; i++) {
+        if (strcmp(set.items[i].stack, "profile_test_caller;profile_test_leaf") == 0) {
+            found_stack = set.items[i].count == 2;
+        } else if (strcmp(set.items[i].stack, "profile_test_leaf") == 0) {
+            found_leaf = set.items[i].count == 1;
+        } else if (strcmp(set.items[i].stack, "[unknown]") == 0) {
+            found_unknown = set.items[i].count == 1;
+        }
+    }
+    ck_assert(found_stack && found_leaf && found_unknown);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/profile.svg", test_dir);
+    ck_assert_int_eq(profile_write_flame_graph(&set, path, "test", "samples"), 0);
+    char *svg = read_file(path);
+    ck_assert_ptr_nonnull(svg);
+    ck_assert_ptr_nonnull(strstr(svg, "<svg"));
+    ck_assert_ptr_nonnull(strstr(svg, "profile_test_leaf"));
+    free(svg);
+    folded_set_free(&set);
+}
+END_TEST
+
+// Test: Reading heap samples and totalling them by site
+START_TEST(test_heap) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/heap.samples", test_dir);
+    FILE *out = fopen(path, "w");
+    ck_assert_ptr_nonnull(out);
+    FILE *maps = fopen("/proc/self/maps", "r");
+    ck_assert_ptr_nonnull(maps);
+    char line[4096];
+    fprintf(out, "E 42\n");
+    while (fgets(line, sizeof(line), maps)) {
+        fprintf(out, "M 42 %s", line);
+    }
+    fclose(maps);
+    // A 1 MB block that leaks and a small one freed at once
+    uint64_t leaf = (uint64_t)(uintptr_t)profile_test_leaf;
+    uint64_t caller = (uint64_t)(uintptr_t)profile_test_caller + 1;
+    fprintf(out, "A 42 1048576 1 %" PRIx64 " %" PRIx64 "\n", leaf, caller);
+    fprintf(out, "A 42 64 2 %" PRIx64 "\n", caller - 1);
+    fprintf(out, "D 42 2 500\n");
+    fprintf(out, "T 42 10 2000000 9 1500000 1048576 0 524288\n");
+    fclose(out);
+
+    heap_profile heap = {0};
+    heap.rate = 1;
+    ck_assert_int_eq(heap_load(&heap, path), 0);
+    ck_assert_int_eq(heap.rate, 524288);
+    ck_assert_int_eq(heap.data.sample_count, 2);
+    ck_assert_int_eq(heap.process_count, 1);
+    ck_assert(heap.processes[0].peak == 1500000);
+    ck_assert_int_eq(heap.samples[0].freed, 0);
+    ck_assert_int_eq(heap.samples[1].freed, 1);
+
+    heap_site_set sites;
+    folded_set stacks;
+    heap_sites(&heap, &sites, &stacks);
+    ck_assert_int_eq(sites.count, 2);
+    ck_assert_int_eq(stacks.count, 2);
+    int checked = 0;
+    for (int i = 0; i < sites.count; i++) {
+        const heap_site *site = &sites.items[i];
+        if (strcmp(site->name, "profile_test_leaf < profile_test_caller") == 0) {
+            // Sampled with probability 1 - e^-2: it stands for 1.16 blocks
+            ck_assert(fabs(site->count - 1 / (1 - exp(-2.0))) < 1e-9);
+            ck_assert(site->leaked_count == site->count && site->churn_count == 0);
+            checked++;
+        } else if (strcmp(site->name, "profile_test_caller") == 0) {
+            ck_assert(site->churn_count > 8000 && site->leaked_count == 0);
+            checked++;
+        }
+    }
+    ck_assert_int_eq(checked, 2);
+    heap_sites_free(&sites);
+    folded_set_free(&stacks);
+    heap_free(&heap);
+}
+END_TEST
+
+// Test: Build manifest records declared programs and where they were built
+START_TEST(test_manifest) {
+    char cwd[1024];
+    getcwd(cwd, sizeof(cwd));
+    chdir(test_dir);
+
+    write_file("Makefile.am", "SUBDIRS = src tests\n");
+    create_directory("src");
+    write_file("src/Makefile.am", "bin_PROGRAMS = one two\n");
+    create_directory("tests");
+    write_file("tests/Makefile.am", "if ENABLE_TESTS\ncheck_PROGRAMS = test_a\nendif\n");
+    create_directory("build");
+    create_directory("build/debug");
+    create_directory("build/debug/src");
+    ck_assert_int_eq(copy_file("/proc/self/exe", "build/debug/src/one"), 0);
+
+    ck_assert_int_eq(manifest_update("debug", "build/debug"), 0);
+    ck_assert_int_eq(manifest_update(NULL, "."), 0);
+
+    manifest m;
+    ck_assert_int_eq(manifest_load(&m, MANIFEST_FILE), 0);
+    ck_assert_int_eq(m.count, 6);
+
+    // The first declared program, with its build ID
+    const manifest_entry *e = manifest_find(&m, "debug", 0, NULL);
+    ck_assert_ptr_nonnull(e);
+    ck_assert_str_eq(e->name, "one");
+    ck_assert_str_eq(e->path, "build/debug/src/one");
+    ck_assert(e->mtime > 0);
+    char build_id[128];
+    if (symbols_build_id("/proc/self/exe", build_id, sizeof(build_id)) == 0) {
+        ck_assert_str_eq(e->build_id, build_id);
+    }
+
+    // Declared but not built, test programs only as tests, per profile
+    e = manifest_find(&m, "debug", 0, "two");
+    ck_assert_ptr_nonnull(e);
+    ck_assert_str_eq(e->path, "-");
+    ck_assert_ptr_null(manifest_find(&m, "debug", 0, "test_a"));
+    e = manifest_find(&m, "debug", 1, "test_a");
+    ck_assert_ptr_nonnull(e);
+    ck_assert_str_eq(e->kind, "check");
+    e = manifest_find(&m, NULL, 0, "one");
+    ck_assert_ptr_nonnull(e);
+    ck_assert_str_eq(e->profile, ".");
+    ck_assert_str_eq(e->path, "-");
+
+    // A rescan replaces only that profile's entries; the moved copy is newer
+    create_directory("build/debug/src/build");
+    ck_assert_int_eq(copy_file("/proc/self/exe", "build/debug/src/build/one"), 0);
+    struct timespec times[2] = {{0, UTIME_NOW}, {1, 0}};
+    utimensat(AT_FDCWD, "build/debug/src/one", times, 0);
+    manifest_scan(&m, "debug", "build/debug");
+    ck_assert_int_eq(m.count, 6);
+    ck_assert_str_eq(manifest_find(&m, "debug", 0, "one")->path, "build/debug/src/build/one");
+    ck_assert_str_eq(manifest_find(&m, NULL, 0, "one")->path, "-");
+    manifest_free(&m);
+
+    chdir(cwd);
+}
+END_TEST
+
+// Set a file's modification time to a whole number of seconds
+static void set_mtime(const char *path, time_t seconds) {
+    struct timespec times[2] = {{seconds, 0}, {seconds, 0}};
+    utimensat(AT_FDCWD, path, times, 0);
+}
+
+// Test: Staleness from the depfiles of the last build
+START_TEST(test_stale_check) {
+    char cwd[1024];
+    getcwd(cwd, sizeof(cwd));
+    chdir(test_dir);
+
+    char reason[1024];
+    ck_assert_int_eq(stale_check(NULL, ".", reason, sizeof(reason)), 1);
+
+    // An in-tree build of src/demo, with a test whose sources are newer
+    write_file("configure.ac", "AC_INIT([demo], [1.0])\n");
+    write_file("configure", "");
+    write_file("config.status", "");
+    write_file("Makefile.am", "SUBDIRS = src tests\n");
+    write_file("Makefile", "");
+    create_directory("src");
+    create_directory("src/.deps");
+    create_directory("src/build");
+    write_file("src/Makefile.am", "bin_PROGRAMS = demo\ndemo_SOURCES = main.c\ndemo_CFLAGS = -Wall\n");
+    write_file("src/Makefile", "");
+    write_file("src/main.c", "");
+    write_file("src/util.h", "");
+    write_file("src/.deps/demo-main.Po", "demo-main.o: main.c util.h \\\n ../src/util.h\n\nutil.h:\n");
+    write_file("src/.deps/other.Po", "# dummy\n");
+    write_file("src/build/demo", "");
+    create_directory("tests");
+    create_directory("tests/.deps");
+    write_file("tests/Makefile.am", "check_PROGRAMS = test_demo\ntest_demo_CFLAGS = -g\n");
+    write_file("tests/Makefile", "");
+    write_file("tests/test_demo.c", "");
+    write_file("tests/.deps/test_demo-test_demo.Po", "test_demo-test_demo.o: test_demo.c\n");
+    const char *files[] = {"configure.ac", "configure", "config.status", "Makefile.am", "Makefile",
+                           "src/Makefile.am", "src/Makefile", "src/main.c", "src/util.h",
+                           "src/build/demo", "tests/Makefile.am", "tests/Makefile"};
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        set_mtime(files[i], 1000 + i);
+    }
+    set_mtime("tests/test_demo.c", 5000);
+
+    // No manifest yet, then current
+    ck_assert_int_eq(stale_check(NULL, ".", reason, sizeof(reason)), 1);
+    ck_assert_int_eq(manifest_update(NULL, "."), 0);
+    ck_assert_int_eq(stale_check(NULL, ".", reason, sizeof(reason)), 0);
+
+    // A header edited after linking
+    set_mtime("src/util.h", 3000);
+    ck_assert_int_eq(stale_check(NULL, ".", reason, sizeof(reason)), 1);
+    ck_assert_str_eq(reason, "src/util.h changed since the last build");
+    set_mtime("src/util.h", 1000);
+
+    // A Makefile.am newer than its Makefile
+    set_mtime("src/Makefile.am", 3000);
+    ck_assert_int_eq(stale_check(NULL, ".", reason, sizeof(reason)), 1);
+    ck_assert_str_eq(reason, "src/Makefile.am changed since the last build");
+    set_mtime("src/Makefile.am", 1000);
+
+    // A prerequisite that's gone
+    unlink("src/util.h");
+    ck_assert_int_eq(stale_check(NULL, ".", reason, sizeof(reason)), 1);
+    ck_assert_str_eq(reason, "src/util.h was removed since the last build");
+    write_file("src/util.h", "");
+    set_mtime("src/util.h", 1000);
+    ck_assert_int_eq(stale_check(NULL, ".", reason, sizeof(reason)), 0);
+
+    // The program itself is gone
+    unlink("src/build/demo");
+    ck_assert_int_eq(stale_check(NULL, ".", reason, sizeof(reason)), 1);
+
+    chdir(cwd);
+}
+END_TEST
+
+// Test: Job count detection and MAKEFLAGS jobserver handling
+START_TEST(test_job_count) {
+    ck_assert_int_ge(detect_job_count(), 1);
+
+    unsetenv("MAKEFLAGS");
+    ck_assert_int_eq(makeflags_has_jobserver(), 0);
+
+    setenv("MAKEFLAGS", " -- CC=gcc", 1);
+    ck_assert_int_eq(makeflags_has_jobserver(), 0);
+
+    setenv("MAKEFLAGS", "s -- CC=gcc", 1);
+    ck_assert_int_eq(makeflags_has_jobserver(), 0);
+
+    // An explicit unlimited -j, also after leading blanks
+    setenv("MAKEFLAGS", " -j -- CC=gcc", 1);
+    ck_assert_int_eq(makeflags_has_jobserver(), 1);
+
+    setenv("MAKEFLAGS", "sj", 1);
+    ck_assert_int_eq(makeflags_has_jobserver(), 1);
+
+    // A jobserver counts only when its descriptors or fifo are usable
+    int fds[2];
+    char flags[128];
+    ck_assert_int_eq(pipe(fds), 0);
+    snprintf(flags, sizeof(flags), "sj --jobserver-fds=%d,%d", fds[0], fds[1]);
+    setenv("MAKEFLAGS", flags, 1);
+    ck_assert_int_eq(makeflags_has_jobserver(), 1);
+    snprintf(flags, sizeof(flags), " -j8 --jobserver-auth=%d,%d", fds[0], fds[1]);
+    setenv("MAKEFLAGS", flags, 1);
+    ck_assert_int_eq(makeflags_has_jobserver(), 1);
+    close(fds[0]);
+    close(fds[1]);
+    ck_assert_int_eq(makeflags_has_jobserver(), 0);
+
+    char fifo[128];
+    snprintf(fifo, sizeof(fifo), "/tmp/jc_test_fifo_%ld", (long)getpid());
+    snprintf(flags, sizeof(flags), " -j8 --jobserver-auth=fifo:%s", fifo);
+    setenv("MAKEFLAGS", flags, 1);
+    ck_assert_int_eq(makeflags_has_jobserver(), 0);
+    ck_assert_int_eq(mkfifo(fifo, 0600), 0);
+    ck_assert_int_eq(makeflags_has_jobserver(), 1);
+    unlink(fifo);
+
+    unsetenv("MAKEFLAGS");
+}
+END_TEST
+
+// Test: Shards are balanced by the times of the last run
+START_TEST(test_shard) {
+    int index;
+    int count;
+    ck_assert_int_eq(shard_parse("2/4", &index, &count), 0);
+    ck_assert_int_eq(index, 2);
+    ck_assert_int_eq(count, 4);
+    ck_assert_int_eq(shard_parse("0/4", &index, &count), -1);
+    ck_assert_int_eq(shard_parse("5/4", &index, &count), -1);
+    ck_assert_int_eq(shard_parse("1/", &index, &count), -1);
+    ck_assert_int_eq(shard_parse("1", &index, &count), -1);
+
+    // 10 + 2 + 2 + 2 + 2 + 2 splits as 10 | 2 2 2 2 2 rather than by count
+    long long costs[] = {2, 10, 2, 2, 2, 2};
+    int assignment[6];
+    shard_assign(costs, 6, 2, assignment);
+    ck_assert_int_eq(assignment[1], 0);
+    for (int i = 0; i < 6; i++) {
+        ck_assert_int_eq(assignment[i], i == 1 ? 0 : 1);
+    }
+
+    // Without times every test costs the same and they are dealt out in turn
+    long long equal[] = {1, 1, 1, 1, 1};
+    int dealt[5];
+    shard_assign(equal, 5, 2, dealt);
+    for (int i = 0; i < 5; i++) {
+        ck_assert_int_eq(dealt[i], i % 2);
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/test-times", test_dir);
+    test_times times = {0};
+    test_times_set(&times, NULL, "tests/test_a:Core", 1500);
+    test_times_set(&times, "asan", "tests/test_a:Slow cases", 90000);
+    test_times_set(&times, NULL, "tests/test_a:Core", 1200);
+    ck_assert_int_eq(times.count, 2);
+    ck_assert_int_eq(test_times_save(&times, path), 0);
+    test_times_free(&times);
+
+    ck_assert_int_eq(test_times_load(&times, path), 0);
+    ck_assert_int_eq(test_times_find(&times, NULL, "tests/test_a:Core"), 1200);
+    ck_assert_int_eq(test_times_find(&times, "asan", "tests/test_a:Slow cases"), 90000);
+    ck_assert_int_eq(test_times_find(&times, "asan", "tests/test_a:Core"), -1);
+    test_times_free(&times);
+}
+END_TEST
+
+// Test: Cached test results are keyed by program, libraries, environment and data
+START_TEST(test_test_cache) {
+    char cwd[1024];
+    getcwd(cwd, sizeof(cwd));
+    chdir(test_dir);
+
+    elf_dynamic dynamic;
+    ck_assert_int_eq(symbols_dynamic("/proc/self/exe", &dynamic), 0);
+    int has_libc = 0;
+    for (int i = 0; i < dynamic.count; i++) {
+        has_libc |= strncmp(dynamic.needed[i], "libc.so", 7) == 0;
+    }
+    ck_assert(has_libc || dynamic.count == 0);
+    symbols_dynamic_free(&dynamic);
+
+    write_file("check.sh", "#!/bin/sh\ncmp input.txt expected.txt\n");
+    write_file("input.txt", "one\n");
+    char *data[] = {"input.txt", "missing.txt"};
+    char data_hash[HASH_HEX_SIZE];
+    char changed_hash[HASH_HEX_SIZE];
+    test_cache_hash_data(data, 2, data_hash);
+    write_file("input.txt", "two\n");
+    test_cache_hash_data(data, 2, changed_hash);
+    ck_assert_str_ne(data_hash, changed_hash);
+
+    test_cache cache = {0};
+    char *env[] = {"srcdir=/src", NULL};
+    char *case_env[] = {"srcdir=/src", "CK_RUN_CASE=Core", NULL};
+    char key[HASH_HEX_SIZE];
+    char other[HASH_HEX_SIZE];
+    test_cache_key(&cache, "check.sh", env, data_hash, key);
+    test_cache_key(&cache, "check.sh", env, data_hash, other);
+    ck_assert_str_eq(key, other);
+    test_cache_key(&cache, "check.sh", case_env, data_hash, other);
+    ck_assert_str_ne(key, other);
+    test_cache_key(&cache, "check.sh", env, changed_hash, other);
+    ck_assert_str_ne(key, other);
+    setenv("LD_BIND_NOW", "1", 1);
+    test_cache_key(&cache, "check.sh", env, data_hash, other);
+    unsetenv("LD_BIND_NOW");
+    ck_assert_str_ne(key, other);
+    test_cache_key(&cache, "/proc/self/exe", env, data_hash, other);
+    ck_assert_str_ne(key, other);
+
+    test_cache_store(&cache, NULL, "tests/check.sh", key);
+    test_cache_store(&cache, "asan", "tests/check.sh", other);
+    create_directory(".jc");
+    ck_assert_int_eq(test_cache_save(&cache, TEST_CACHE_FILE), 0);
+    test_cache_free(&cache);
+
+    ck_assert_int_eq(test_cache_load(&cache, TEST_CACHE_FILE), 0);
+    ck_assert(test_cache_hit(&cache, NULL, "tests/check.sh", key));
+    ck_assert(!test_cache_hit(&cache, NULL, "tests/check.sh", other));
+    ck_assert(test_cache_hit(&cache, "asan", "tests/check.sh", other));
+    test_cache_forget(&cache, NULL, "tests/check.sh");
+    ck_assert(!test_cache_hit(&cache, NULL, "tests/check.sh", key));
+    ck_assert_int_eq(cache.count, 1);
+    test_cache_free(&cache);
+
+    chdir(cwd);
+}
+END_TEST
+
+static int has_dependency(char **deps, int count, const char *path) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(deps[i], path) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+START_TEST(test_affected_tests) {
+    char cwd[1024];
+    getcwd(cwd, sizeof(cwd));
+    chdir(test_dir);
+
+    create_directory("src");
+    create_directory("src/.deps");
+    create_directory("tests");
+    create_directory("tests/.deps");
+    write_file("src/Makefile.am", "noinst_LIBRARIES = libutil.a\nlibutil_a_SOURCES = util.c util.h\n");
+    write_file("src/.deps/util.Po", "util.o: util.c util.h /usr/include/stdio.h\n");
+    write_file("tests/Makefile.am",
+               "check_PROGRAMS = test_math\n"
+               "test_math_SOURCES = test_math.c ../src/math.c\n"
+               "test_math_LDADD = $(top_builddir)/src/libutil.a\n"
+               "EXTRA_DIST = data.txt\n"
+               "TESTS = $(check_PROGRAMS) run.sh\n");
+    write_file("tests/.deps/test_math.Po", "test_math.o: test_math.c ../src/math.h \\\n ../src/util.h\n");
+    write_file("tests/.deps/math.Po", "math.o: ../src/math.c ../src/math.h\n");
+
+    char **deps;
+    int count;
+    ck_assert_int_eq(test_dependencies(".", "tests", "test_math", &deps, &count), 0);
+    const char *expected[] = {"tests/Makefile.am", "configure.ac", "tests/data.txt", "tests/test_math.c",
+                              "src/math.c", "src/math.h", "src/util.c", "src/util.h"};
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        ck_assert_msg(has_dependency(deps, count, expected[i]), "missing %s", expected[i]);
+    }
+    ck_assert(!has_dependency(deps, count, "/usr/include/stdio.h"));
+    am_free_words(deps, count);
+
+    ck_assert_int_eq(test_dependencies(".", "tests", "run.sh", &deps, &count), 0);
+    ck_assert(has_dependency(deps, count, "tests/run.sh"));
+    ck_assert(!has_dependency(deps, count, "src/math.c"));
+    am_free_words(deps, count);
+
+    char *files[] = {"src/util.h"};
+    change_set changes = {files, 1, 1, 0};
+    ck_assert(test_affected(&changes, ".", "tests", "test_math"));
+    ck_assert(!test_affected(&changes, ".", "tests", "run.sh"));
+
+    // Without git: everything before the first run, nothing modified since
+    write_file("tests/run.sh", "#!/bin/sh\n");
+    change_set by_time = {NULL, 0, 0, -1};
+    ck_assert(test_affected(&by_time, ".", "tests", "run.sh"));
+    by_time.since = 4000000000LL * 1000000000LL;
+    ck_assert(!test_affected(&by_time, ".", "tests", "run.sh"));
+
+    // A program built without depfiles can't be ruled out
+    remove("tests/.deps/math.Po");
+    ck_assert_int_eq(test_dependencies(".", "tests", "test_math", &deps, &count), -1);
+    am_free_words(deps, count);
+    ck_assert(test_affected(&changes, ".", "tests", "test_math") == 1);
+
+    chdir(cwd);
+}
+END_TEST
+
+// Test: 'jc add pch' also precompiles for the convenience library
+START_TEST(test_add_pch_library) {
+    char cwd[1024];
+    ck_assert_ptr_nonnull(getcwd(cwd, sizeof(cwd)));
+    ck_assert_int_eq(chdir(test_dir), 0);
+
+    write_file("configure.ac", "AC_INIT([demo], [1.0])\n");
+    create_directory("src");
+    write_file("src/common.h", "#include <stdio.h>\n");
+    write_file("src/Makefile.am",
+               "bin_PROGRAMS = demo\n"
+               "noinst_LIBRARIES = libdemo.a\n"
+               "libdemo_a_SOURCES = util.c\n"
+               "libdemo_a_CFLAGS = $(demo_CFLAGS)\n"
+               "demo_SOURCES = main.c\n"
+               "demo_LDADD = libdemo.a\n"
+               "demo_CFLAGS = -Wall\n");
+
+    char *argv[] = {"add", "pch", "common.h", NULL};
+    ck_assert_int_eq(cmd_add(3, argv), 0);
+    char *content = read_file("src/Makefile.am");
+    ck_assert_ptr_nonnull(content);
+    ck_assert_ptr_nonnull(strstr(content, "demo_CPPFLAGS = -include pch/$(PCH_HEADER)"));
+    ck_assert_ptr_nonnull(strstr(content, "libdemo_a_CPPFLAGS = $(demo_CPPFLAGS)\n"));
+    ck_assert_ptr_nonnull(strstr(content, "$(libdemo_a_OBJECTS): pch/$(PCH_HEADER) pch/$(PCH_HEADER).gch\n"));
+
+    // Running it again leaves the file as it was
+    ck_assert_int_eq(cmd_add(3, argv), 0);
+    char *again = read_file("src/Makefile.am");
+    ck_assert_ptr_nonnull(again);
+    ck_assert_str_eq(content, again);
+    free(again);
+    free(content);
+
+    chdir(cwd);
+}
+END_TEST
+
 // Create test suite
 Suite *utils_suite(void) {
     Suite *s;
@@ -272,6 +1195,22 @@ Suite *utils_suite(void) {
     tcase_add_test(tc_core, test_copy_file);
     tcase_add_test(tc_core, test_directory_exists);
     tcase_add_test(tc_core, test_execute_command_quiet);
+    tcase_add_test(tc_core, test_process);
+    tcase_add_test(tc_core, test_process_jobs);
+    tcase_add_test(tc_core, test_diag_parse);
+    tcase_add_test(tc_core, test_get_project_setting);
+    tcase_add_test(tc_core, test_write_setting);
+    tcase_add_test(tc_core, test_hash);
+    tcase_add_test(tc_core, test_compile_args);
+    tcase_add_test(tc_core, test_am_parse);
+    tcase_add_test(tc_core, test_profile);
+    tcase_add_test(tc_core, test_heap);
+    tcase_add_test(tc_core, test_manifest);
+    tcase_add_test(tc_core, test_stale_check);
+    tcase_add_test(tc_core, test_shard);
+    tcase_add_test(tc_core, test_test_cache);
+    tcase_add_test(tc_core, test_affected_tests);
+    tcase_add_test(tc_core, test_add_pch_library);
     suite_add_tcase(s, tc_core);
 
     // Standalone test case without fixture
@@ -280,6 +1219,8 @@ Suite *utils_suite(void) {
     tcase_add_test(tc_standalone, test_regex_replace_basic);
     tcase_add_test(tc_standalone, test_regex_replace_capture_groups);
     tcase_add_test(tc_standalone, test_regex_replace_edge_cases);
+    tcase_add_test(tc_standalone, test_job_count);
+    tcase_add_test(tc_standalone, test_bench_stats);
     suite_add_tcase(s, tc_standalone);
 
     return s;